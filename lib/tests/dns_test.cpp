@@ -20,6 +20,10 @@
 #include "ziti/ziti_dns.h"
 #include "ziti/model_collections.h"
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
 static int mock_add_route(netif_handle tun, const char *dest) {
     return 0;
 }
@@ -85,4 +89,116 @@ TEST_CASE("recycle ip", "[dns]") {
     // last ip is not broadcast ip
     ip = static_cast<const ip_addr_t *>(model_map_getl(ips, pool_size-1));
     CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.64.0.254"));
-}
\ No newline at end of file
+}
+TEST_CASE("ipv6 range", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    ziti_dns_setup(tnlr, "100.65.0.2", "100.65.0.1/24");
+
+    CHECK(ziti_dns_set_ipv6_range("fd00:5a17::/120") == -1);
+    CHECK(ziti_dns_set_ipv6_range("not an address/96") == -1);
+    REQUIRE(ziti_dns_set_ipv6_range("fd00:5a17::/96") == 0);
+
+    // reserved tun ip gets a matching IPv6 address
+    ip_addr_t tun_ip;
+    ipaddr_aton("100.65.0.1", &tun_ip);
+    const ip_addr_t *tun_ip6 = ziti_dns_ipv6_addr(&tun_ip);
+    REQUIRE(tun_ip6 != nullptr);
+    CHECK_THAT(ipaddr_ntoa(tun_ip6), Catch::Equals("fd00:5a17::1"));
+
+    ziti_address za;
+    ziti_address_from_string(&za, "v6.host.test");
+    const ip_addr_t *ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.65.0.3"));
+
+    const ip_addr_t *ip6 = ziti_dns_ipv6_addr(ip);
+    REQUIRE(ip6 != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip6), Catch::Equals("fd00:5a17::3"));
+
+    CHECK_THAT(ziti_dns_reverse_lookup("fd00:5a17::3"), Catch::Equals("v6.host.test"));
+    CHECK_THAT(ziti_dns_reverse_lookup("100.65.0.3"), Catch::Equals("v6.host.test"));
+    CHECK(ziti_dns_reverse_lookup("fd00:5a17::4") == nullptr);
+    CHECK(ziti_dns_reverse_lookup("fd00:5a18::3") == nullptr);
+}
+
+TEST_CASE("restore mappings from state file", "[dns]") {
+    netif_driver_t mock_netif = {};
+    mock_netif.add_route = mock_add_route;
+    tunneler_sdk_options tnlr_opts = {
+            .netif_driver = &mock_netif,
+            .ziti_dial = ziti_sdk_c_dial,
+            .ziti_close = ziti_sdk_c_close,
+            .ziti_close_write = ziti_sdk_c_close_write,
+            .ziti_write = ziti_sdk_c_write,
+            .ziti_host = ziti_sdk_c_host
+    };
+    tunneler_context tnlr = ziti_tunneler_init(&tnlr_opts, uv_default_loop());
+    ziti_dns_setup(tnlr, "100.67.0.2", "100.67.0.1/24");
+
+    // the flush timer never runs on this loop, only its handle is closed
+    uv_loop_t state_loop;
+    uv_loop_init(&state_loop);
+    const char *state_file = "dns_state_test.txt";
+    {
+        std::ofstream out(state_file);
+        out << "100.67.0.50 persisted.host.test\n"
+            << "100.67.0.51 old.name.test\n"
+            << "100.67.0.51 renamed.host.test\n" // later record wins
+            << "100.99.0.9 out.of.range.test\n"
+            << "garbage\n";
+    }
+    REQUIRE(ziti_dns_set_state_file(&state_loop, state_file) == 0);
+
+    ziti_address za;
+    const ip_addr_t *ip;
+
+    ziti_address_from_string(&za, "persisted.host.test");
+    ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.67.0.50"));
+
+    ziti_address_from_string(&za, "renamed.host.test");
+    ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.67.0.51"));
+
+    // names without a restored address get new ones
+    ziti_address_from_string(&za, "old.name.test");
+    ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.67.0.3"));
+
+    ziti_address_from_string(&za, "out.of.range.test");
+    ip = ziti_dns_register_hostname(&za, new ziti_service);
+    REQUIRE(ip != nullptr);
+    CHECK_THAT(ipaddr_ntoa(ip), Catch::Equals("100.67.0.4"));
+
+    auto read_state = [&]() {
+        std::ifstream in(state_file);
+        std::stringstream content;
+        content << in.rdbuf();
+        return content.str();
+    };
+    // new mappings are buffered, and written when the flush timer fires or the state file is let go
+    CHECK_THAT(read_state(), !Catch::Contains("old.name.test"));
+    REQUIRE(ziti_dns_set_state_file(&state_loop, nullptr) == 0);
+    uv_run(&state_loop, UV_RUN_DEFAULT);
+    CHECK(uv_loop_close(&state_loop) == 0);
+
+    std::string content = read_state();
+    CHECK_THAT(content, Catch::Contains("100.67.0.3 old.name.test\n"));
+    CHECK_THAT(content, Catch::Contains("100.67.0.4 out.of.range.test\n"));
+    CHECK_THAT(content, !Catch::Contains("garbage"));
+
+    std::remove(state_file);
+}
@@ -0,0 +1,233 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <ziti/ziti_log.h>
+
+#include "admission.h"
+
+struct waiter_s {
+    admission_cb cb;
+    void *ctx;
+    uint64_t since;
+    STAILQ_ENTRY(waiter_s) _next;
+};
+
+struct admission_s {
+    uv_loop_t *loop;
+    char *label;
+    hosted_service_limits limits;
+
+    int conns;
+    int pending;
+    double tokens;
+    uint64_t refilled_at;
+
+    STAILQ_HEAD(, waiter_s) queue;
+    int queued;
+    uv_timer_t timer;
+
+    uint64_t admitted;
+    uint64_t rejected;
+    uint64_t timed_out;
+};
+
+static void refill(admission *adm, uint64_t now) {
+    if (adm->limits.rate <= 0) {
+        return;
+    }
+    adm->tokens += (double) (now - adm->refilled_at) * adm->limits.rate / 1000.0;
+    if (adm->tokens > adm->limits.burst) {
+        adm->tokens = adm->limits.burst;
+    }
+    adm->refilled_at = now;
+}
+
+static bool has_slot(const admission *adm) {
+    const hosted_service_limits *l = &adm->limits;
+    return (l->max_pending <= 0 || adm->pending < l->max_pending) &&
+           (l->max_conns <= 0 || adm->pending + adm->conns < l->max_conns) &&
+           (l->rate <= 0 || adm->tokens >= 1.0);
+}
+
+static void take_slot(admission *adm) {
+    adm->pending++;
+    adm->admitted++;
+    if (adm->limits.rate > 0) {
+        adm->tokens -= 1.0;
+    }
+}
+
+static void on_admission_timer(uv_timer_t *t);
+
+/** wake up when the oldest waiter times out, or when the next token is due if that is what it waits for */
+static void schedule(admission *adm, uint64_t now) {
+    struct waiter_s *w = STAILQ_FIRST(&adm->queue);
+    if (w == NULL) {
+        uv_timer_stop(&adm->timer);
+        return;
+    }
+
+    uint64_t deadline = w->since + adm->limits.queue_timeout;
+    uint64_t delay = deadline > now ? deadline - now : 0;
+    if (adm->limits.rate > 0 && adm->tokens < 1.0) {
+        uint64_t token_due = (uint64_t) ((1.0 - adm->tokens) * 1000.0 / adm->limits.rate) + 1;
+        if (token_due < delay) delay = token_due;
+    }
+    uv_timer_start(&adm->timer, on_admission_timer, delay, 0);
+}
+
+static void dispatch(admission *adm) {
+    uint64_t now = uv_now(adm->loop);
+    refill(adm, now);
+
+    struct waiter_s *w;
+    while ((w = STAILQ_FIRST(&adm->queue)) != NULL) {
+        bool expired = now - w->since >= (uint64_t) adm->limits.queue_timeout;
+        if (!expired && !has_slot(adm)) {
+            break;
+        }
+        STAILQ_REMOVE_HEAD(&adm->queue, _next);
+        adm->queued--;
+        if (expired) {
+            adm->timed_out++;
+            ZITI_LOG(DEBUG, "hosted_service[%s] client waited %llums for a slot, giving up", adm->label,
+                     (unsigned long long) (now - w->since));
+        } else {
+            take_slot(adm);
+        }
+        // callbacks may request or release slots
+        w->cb(w->ctx, !expired);
+        free(w);
+    }
+
+    schedule(adm, now);
+}
+
+static void on_admission_timer(uv_timer_t *t) {
+    dispatch(t->data);
+}
+
+admission *admission_new(uv_loop_t *loop, const char *label, const hosted_service_limits *limits) {
+    admission *adm = calloc(1, sizeof(admission));
+    adm->loop = loop;
+    adm->label = strdup(label);
+    adm->limits = *limits;
+    if (adm->limits.rate > 0 && adm->limits.burst <= 0) {
+        adm->limits.burst = adm->limits.rate;
+    }
+    if (adm->limits.queue_timeout <= 0) {
+        adm->limits.queue_timeout = ADMISSION_QUEUE_TIMEOUT;
+    }
+    adm->tokens = adm->limits.burst;
+    adm->refilled_at = uv_now(loop);
+    STAILQ_INIT(&adm->queue);
+
+    uv_timer_init(loop, &adm->timer);
+    adm->timer.data = adm;
+    return adm;
+}
+
+static void on_admission_close(uv_handle_t *h) {
+    admission *adm = h->data;
+    free(adm->label);
+    free(adm);
+}
+
+void admission_free(admission *adm) {
+    if (adm == NULL) {
+        return;
+    }
+    while (!STAILQ_EMPTY(&adm->queue)) {
+        struct waiter_s *w = STAILQ_FIRST(&adm->queue);
+        STAILQ_REMOVE_HEAD(&adm->queue, _next);
+        adm->queued--;
+        w->cb(w->ctx, false);
+        free(w);
+    }
+    uv_close((uv_handle_t *) &adm->timer, on_admission_close);
+}
+
+admission_result admission_request(admission *adm, admission_cb cb, void *ctx) {
+    refill(adm, uv_now(adm->loop));
+    // clients that are already waiting go first
+    if (STAILQ_EMPTY(&adm->queue) && has_slot(adm)) {
+        take_slot(adm);
+        return admission_admitted;
+    }
+
+    if (adm->queued >= adm->limits.queue_size) {
+        adm->rejected++;
+        ZITI_LOG(DEBUG, "hosted_service[%s] no slot for client (conns=%d pending=%d queued=%d), rejecting",
+                 adm->label, adm->conns, adm->pending, adm->queued);
+        return admission_rejected;
+    }
+
+    struct waiter_s *w = calloc(1, sizeof(*w));
+    w->cb = cb;
+    w->ctx = ctx;
+    w->since = uv_now(adm->loop);
+    STAILQ_INSERT_TAIL(&adm->queue, w, _next);
+    adm->queued++;
+    if (adm->queued == 1) {
+        schedule(adm, w->since);
+    }
+    return admission_queued;
+}
+
+void admission_cancel(admission *adm, void *ctx) {
+    struct waiter_s *w = STAILQ_FIRST(&adm->queue);
+    while (w != NULL) {
+        struct waiter_s *next = STAILQ_NEXT(w, _next);
+        if (w->ctx == ctx) {
+            STAILQ_REMOVE(&adm->queue, w, waiter_s, _next);
+            adm->queued--;
+            free(w);
+        }
+        w = next;
+    }
+}
+
+void admission_connected(admission *adm) {
+    adm->pending--;
+    adm->conns++;
+    // a pending slot opened up
+    if (!STAILQ_EMPTY(&adm->queue)) {
+        dispatch(adm);
+    }
+}
+
+void admission_release(admission *adm, bool connected) {
+    if (connected) {
+        adm->conns--;
+    } else {
+        adm->pending--;
+    }
+    if (!STAILQ_EMPTY(&adm->queue)) {
+        dispatch(adm);
+    }
+}
+
+void admission_get_stats(const admission *adm, admission_stats *stats) {
+    stats->conns = adm->conns;
+    stats->pending = adm->pending;
+    stats->queued = adm->queued;
+    stats->admitted = adm->admitted;
+    stats->rejected = adm->rejected;
+    stats->timed_out = adm->timed_out;
+}
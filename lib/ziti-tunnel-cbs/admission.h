@@ -0,0 +1,80 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_ADMISSION_H
+#define ZITI_TUNNELER_SDK_ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+#include <ziti/ziti_tunnel_cbs.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** how long a queued client waits for a slot if the limits do not say (ms) */
+#define ADMISSION_QUEUE_TIMEOUT 2000
+
+typedef enum {
+    admission_admitted,
+    admission_queued,
+    admission_rejected,
+} admission_result;
+
+/** called for a queued client when it gets a slot, or with `admitted` false when it waited too long */
+typedef void (*admission_cb)(void *ctx, bool admitted);
+
+/**
+ * admission control for the clients of a hosted service. an admitted client holds a slot from the time
+ * it starts connecting to the server until its connection is gone. clients that find no free slot (or no
+ * token, if the rate is limited) wait in a queue, or are rejected when the queue is full.
+ */
+typedef struct admission_s admission;
+
+typedef struct admission_stats_s {
+    int conns;          // clients connected to the server
+    int pending;        // clients connecting to the server
+    int queued;         // clients waiting for a slot
+    uint64_t admitted;
+    uint64_t rejected;  // queue was full
+    uint64_t timed_out; // waited too long in the queue
+} admission_stats;
+
+admission *admission_new(uv_loop_t *loop, const char *label, const hosted_service_limits *limits);
+
+/** queued clients are called back with `admitted` false. the admission is released once its timer is closed */
+void admission_free(admission *adm);
+
+/** ask for a slot on behalf of `ctx`. `cb` is only called if the client is queued */
+admission_result admission_request(admission *adm, admission_cb cb, void *ctx);
+
+/** `ctx` no longer waits for a slot */
+void admission_cancel(admission *adm, void *ctx);
+
+/** the client holding a slot is connected to the server */
+void admission_connected(admission *adm);
+
+/** the client holding a slot is gone */
+void admission_release(admission *adm, bool connected);
+
+void admission_get_stats(const admission *adm, admission_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_ADMISSION_H
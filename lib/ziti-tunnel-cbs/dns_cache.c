@@ -0,0 +1,374 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_cache.h"
+
+// lowercase qname in wire format + qtype + qclass + flags
+#define MAX_KEY_LEN (255 + 5)
+
+// key flags, query bits that change the answer
+#define KEY_CD 0x01 // checking disabled
+#define KEY_DO 0x02 // EDNS DNSSEC OK
+
+#define NS_T_SOA 6
+#define NS_T_OPT 41
+
+#define DNS_HEADER_LEN 12
+#define GET_U16(p) ((uint16_t)((p)[0] << 8 | (p)[1]))
+#define GET_U32(p) ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | (uint32_t)(p)[2] << 8 | (uint32_t)(p)[3])
+#define SET_U32(p,v) do{ (p)[0] = ((v) >> 24) & 0xff; (p)[1] = ((v) >> 16) & 0xff; \
+(p)[2] = ((v) >> 8) & 0xff; (p)[3] = (v) & 0xff; } while(0)
+
+struct dns_cache_entry_s {
+    TAILQ_ENTRY(dns_cache_entry_s) _lru;
+    uint8_t *key;
+    size_t key_len;
+    uint64_t stored;
+    uint64_t expires;
+    size_t size;
+    size_t resp_len;
+    uint8_t resp[]; // response followed by key
+};
+
+typedef void (*rr_visitor)(const uint8_t *msg, size_t len, int section, uint16_t type,
+                           size_t ttl_off, size_t rdata_off, uint16_t rdlen, void *ctx);
+
+static long skip_name(const uint8_t *msg, size_t len, size_t off) {
+    while (off < len) {
+        uint8_t c = msg[off];
+        if (c == 0) {
+            return (long)off + 1;
+        }
+        if ((c & 0xC0) == 0xC0) {
+            return off + 1 < len ? (long)off + 2 : -1;
+        }
+        if ((c & 0xC0) != 0) {
+            return -1;
+        }
+        off += c + 1;
+    }
+    return -1;
+}
+
+static int walk_rrs(const uint8_t *msg, size_t len, size_t off, rr_visitor visit, void *ctx);
+
+static void scan_opt(const uint8_t *msg, size_t len, int section, uint16_t type,
+                     size_t ttl_off, size_t rdata_off, uint16_t rdlen, void *ctx) {
+    uint8_t *flags = ctx;
+    // OPT TTL field: extended RCODE, version, flags
+    if (section == 2 && type == NS_T_OPT && (msg[ttl_off + 2] & 0x80) != 0) {
+        *flags |= KEY_DO;
+    }
+}
+
+/**
+ * build the cache key from the (single) question of `msg` and the CD and DO bits, which answers repeat.
+ * returns offset past the question or -1
+ */
+static long question_key(const uint8_t *msg, size_t len, uint8_t key[MAX_KEY_LEN], size_t *key_len) {
+    if (len < DNS_HEADER_LEN || GET_U16(msg + 4) != 1) {
+        return -1;
+    }
+
+    size_t off = DNS_HEADER_LEN;
+    size_t k = 0;
+    while (off < len && msg[off] != 0) {
+        uint8_t label_len = msg[off];
+        // questions are never compressed
+        if ((label_len & 0xC0) != 0 || off + 1 + label_len > len || k + 1 + label_len > MAX_KEY_LEN - 6) {
+            return -1;
+        }
+        key[k++] = label_len;
+        for (int i = 1; i <= label_len; i++) {
+            uint8_t c = msg[off + i];
+            key[k++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        }
+        off += 1 + label_len;
+    }
+    if (off + 5 > len) {
+        return -1;
+    }
+    key[k++] = 0;
+    memcpy(key + k, msg + off + 1, 4); // qtype, qclass
+    k += 4;
+
+    uint8_t flags = (msg[3] & 0x10) != 0 ? KEY_CD : 0;
+    walk_rrs(msg, len, off + 5, scan_opt, &flags);
+    key[k++] = flags;
+    *key_len = k;
+    return (long)off + 5;
+}
+
+static int walk_rrs(const uint8_t *msg, size_t len, size_t off, rr_visitor visit, void *ctx) {
+    for (int section = 0; section < 3; section++) {
+        uint16_t count = GET_U16(msg + 6 + 2 * section);
+        for (uint16_t i = 0; i < count; i++) {
+            long p = skip_name(msg, len, off);
+            if (p < 0 || (size_t)p + 10 > len) {
+                return -1;
+            }
+            uint16_t type = GET_U16(msg + p);
+            uint16_t rdlen = GET_U16(msg + p + 8);
+            size_t rdata = (size_t)p + 10;
+            if (rdata + rdlen > len) {
+                return -1;
+            }
+            visit(msg, len, section, type, (size_t)p + 4, rdata, rdlen, ctx);
+            off = rdata + rdlen;
+        }
+    }
+    return 0;
+}
+
+struct ttl_scan_s {
+    uint32_t min_ttl;
+    bool has_soa;
+    uint32_t neg_ttl;
+};
+
+static void scan_ttl(const uint8_t *msg, size_t len, int section, uint16_t type,
+                     size_t ttl_off, size_t rdata_off, uint16_t rdlen, void *ctx) {
+    struct ttl_scan_s *scan = ctx;
+    if (type == NS_T_OPT) {
+        return; // TTL field carries EDNS flags
+    }
+    uint32_t ttl = GET_U32(msg + ttl_off);
+    if (ttl < scan->min_ttl) {
+        scan->min_ttl = ttl;
+    }
+
+    // authority SOA of a negative response: cache for min(SOA TTL, SOA MINIMUM)
+    if (section == 1 && type == NS_T_SOA) {
+        long p = skip_name(msg, len, rdata_off); // MNAME
+        if (p > 0) p = skip_name(msg, len, (size_t)p); // RNAME
+        if (p > 0 && (size_t)p + 20 <= rdata_off + rdlen) {
+            uint32_t minimum = GET_U32(msg + p + 16);
+            scan->neg_ttl = minimum < ttl ? minimum : ttl;
+            scan->has_soa = true;
+        }
+    }
+}
+
+static void age_ttl(const uint8_t *msg, size_t len, int section, uint16_t type,
+                    size_t ttl_off, size_t rdata_off, uint16_t rdlen, void *ctx) {
+    if (type == NS_T_OPT) {
+        return;
+    }
+    uint32_t elapsed = *(uint32_t *) ctx;
+    uint8_t *p = (uint8_t *) msg + ttl_off;
+    uint32_t ttl = GET_U32(p);
+    ttl = ttl > elapsed ? ttl - elapsed : 0;
+    SET_U32(p, ttl);
+}
+
+static void remove_entry(dns_cache *cache, struct dns_cache_entry_s *e) {
+    model_map_remove_key(&cache->entries, e->key, e->key_len);
+    TAILQ_REMOVE(&cache->lru, e, _lru);
+    cache->bytes -= e->size;
+    free(e);
+}
+
+static void evict(dns_cache *cache, size_t needed) {
+    while (!TAILQ_EMPTY(&cache->lru) && cache->bytes + needed > cache->limit) {
+        remove_entry(cache, TAILQ_LAST(&cache->lru, dns_cache_lru_s));
+        cache->stats.evicted++;
+    }
+}
+
+void dns_cache_init(dns_cache *cache, size_t limit) {
+    memset(cache, 0, sizeof(*cache));
+    TAILQ_INIT(&cache->lru);
+    cache->limit = limit;
+}
+
+void dns_cache_set_limit(dns_cache *cache, size_t limit) {
+    cache->limit = limit;
+    evict(cache, 0);
+}
+
+size_t dns_cache_lookup(dns_cache *cache, const uint8_t *query, size_t query_len, uint64_t now_ms,
+                        uint8_t *resp, size_t resp_size) {
+    uint8_t key[MAX_KEY_LEN];
+    size_t key_len;
+    if (cache->limit == 0 || question_key(query, query_len, key, &key_len) < 0) {
+        return 0;
+    }
+
+    struct dns_cache_entry_s *e = model_map_get_key(&cache->entries, key, key_len);
+    if (e != NULL && now_ms >= e->expires) {
+        remove_entry(cache, e);
+        cache->stats.expired++;
+        e = NULL;
+    }
+    if (e == NULL || e->resp_len > resp_size) {
+        cache->stats.misses++;
+        return 0;
+    }
+
+    memcpy(resp, e->resp, e->resp_len);
+    // answer with the client's transaction ID and RD flag
+    resp[0] = query[0];
+    resp[1] = query[1];
+    resp[2] = (resp[2] & ~0x01) | (query[2] & 0x01);
+
+    uint32_t elapsed = (uint32_t)((now_ms - e->stored) / 1000);
+    long off = question_key(resp, e->resp_len, key, &key_len);
+    walk_rrs(resp, e->resp_len, (size_t)off, age_ttl, &elapsed);
+
+    TAILQ_REMOVE(&cache->lru, e, _lru);
+    TAILQ_INSERT_HEAD(&cache->lru, e, _lru);
+    cache->stats.hits++;
+    return e->resp_len;
+}
+
+int dns_cache_store(dns_cache *cache, const uint8_t *resp, size_t resp_len, uint64_t now_ms) {
+    if (cache->limit == 0 || resp_len < DNS_HEADER_LEN) {
+        return -1;
+    }
+
+    bool is_response = (resp[2] & 0x80) != 0;
+    bool truncated = (resp[2] & 0x02) != 0;
+    uint8_t opcode = (resp[2] >> 3) & 0xf;
+    uint8_t rcode = resp[3] & 0xf;
+    if (!is_response || truncated || opcode != 0 || (rcode != 0 && rcode != 3)) {
+        return -1;
+    }
+
+    uint8_t key[MAX_KEY_LEN];
+    size_t key_len;
+    long off = question_key(resp, resp_len, key, &key_len);
+    if (off < 0) {
+        return -1;
+    }
+
+    struct ttl_scan_s scan = { .min_ttl = UINT32_MAX };
+    if (walk_rrs(resp, resp_len, (size_t)off, scan_ttl, &scan) != 0) {
+        return -1;
+    }
+
+    uint32_t ttl;
+    if (rcode == 3 || GET_U16(resp + 6) == 0) {
+        // negative response without SOA must not be cached (RFC 2308, section 5)
+        if (!scan.has_soa) return -1;
+        ttl = scan.neg_ttl;
+    } else {
+        ttl = scan.min_ttl;
+    }
+    if (ttl == 0 || ttl == UINT32_MAX) {
+        return -1;
+    }
+    if (ttl > DNS_CACHE_MAX_TTL) {
+        ttl = DNS_CACHE_MAX_TTL;
+    }
+
+    size_t size = sizeof(struct dns_cache_entry_s) + resp_len + key_len;
+    if (size > cache->limit) {
+        return -1;
+    }
+
+    struct dns_cache_entry_s *old = model_map_get_key(&cache->entries, key, key_len);
+    if (old) {
+        remove_entry(cache, old);
+    }
+    evict(cache, size);
+
+    struct dns_cache_entry_s *e = malloc(size);
+    e->key = e->resp + resp_len;
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->stored = now_ms;
+    e->expires = now_ms + (uint64_t)ttl * 1000;
+    e->size = size;
+    e->resp_len = resp_len;
+    memcpy(e->resp, resp, resp_len);
+
+    model_map_set_key(&cache->entries, e->key, e->key_len, e);
+    TAILQ_INSERT_HEAD(&cache->lru, e, _lru);
+    cache->bytes += size;
+    cache->stats.stored++;
+    return 0;
+}
+
+void dns_cache_get_stats(const dns_cache *cache, dns_cache_stats *stats) {
+    *stats = cache->stats;
+    stats->entries = model_map_size((model_map *) &cache->entries);
+    stats->bytes = cache->bytes;
+    stats->limit = cache->limit;
+}
+
+void dns_cache_clear(dns_cache *cache) {
+    model_map_clear(&cache->entries, NULL);
+    while (!TAILQ_EMPTY(&cache->lru)) {
+        struct dns_cache_entry_s *e = TAILQ_FIRST(&cache->lru);
+        TAILQ_REMOVE(&cache->lru, e, _lru);
+        free(e);
+    }
+    cache->bytes = 0;
+}
+
+/** true if wire format name `name` is `suffix` or ends with it at a label boundary */
+static bool name_has_suffix(const uint8_t *name, size_t name_len, const uint8_t *suffix, size_t suffix_len) {
+    size_t off = 0;
+    while (off < name_len) {
+        if (name_len - off == suffix_len && memcmp(name + off, suffix, suffix_len) == 0) {
+            return true;
+        }
+        if (name[off] == 0) {
+            break;
+        }
+        off += name[off] + 1;
+    }
+    return false;
+}
+
+size_t dns_cache_remove_domain(dns_cache *cache, const char *domain) {
+    // lowercase wire format of `domain`, as in cache keys
+    uint8_t suffix[MAX_KEY_LEN];
+    size_t k = 0;
+    const char *label = domain;
+    while (*label != '\0') {
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot ? (size_t)(dot - label) : strlen(label);
+        if (label_len == 0 || label_len > 63 || k + 1 + label_len > MAX_KEY_LEN - 6) {
+            return 0;
+        }
+        suffix[k++] = (uint8_t) label_len;
+        for (size_t i = 0; i < label_len; i++) {
+            char c = label[i];
+            suffix[k++] = (uint8_t) ((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+        }
+        label += label_len;
+        if (*label == '.') label++;
+    }
+    suffix[k++] = 0;
+
+    size_t removed = 0;
+    struct dns_cache_entry_s *e = TAILQ_FIRST(&cache->lru);
+    while (e != NULL) {
+        struct dns_cache_entry_s *next = TAILQ_NEXT(e, _lru);
+        // key is the qname followed by qtype, qclass and flags
+        if (name_has_suffix(e->key, e->key_len - 5, suffix, k)) {
+            remove_entry(cache, e);
+            removed++;
+        }
+        e = next;
+    }
+    return removed;
+}
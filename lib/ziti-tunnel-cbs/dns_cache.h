@@ -0,0 +1,83 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_CACHE_H
+#define ZITI_TUNNELER_SDK_DNS_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
+#include <ziti/model_support.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** longest TTL that is honored for cached responses (seconds) */
+#define DNS_CACHE_MAX_TTL 86400
+
+typedef struct dns_cache_stats_s {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t stored;
+    uint64_t evicted;
+    uint64_t expired;
+    size_t entries;
+    size_t bytes;
+    size_t limit;
+} dns_cache_stats;
+
+/**
+ * cache of wire format DNS responses keyed on (qname, qtype, qclass) of the question.
+ * positive responses live for the smallest TTL of their records, NXDOMAIN/NODATA responses for the
+ * SOA minimum (RFC 2308). the cache never holds more than `limit` bytes; least recently used entries
+ * are evicted first. a limit of 0 disables the cache.
+ */
+typedef struct dns_cache_s {
+    size_t limit;
+    size_t bytes;
+    model_map entries; // map[question -> struct dns_cache_entry_s]
+    TAILQ_HEAD(dns_cache_lru_s, dns_cache_entry_s) lru;
+    dns_cache_stats stats;
+} dns_cache;
+
+void dns_cache_init(dns_cache *cache, size_t limit);
+
+/** change the memory limit, evicting entries as needed */
+void dns_cache_set_limit(dns_cache *cache, size_t limit);
+
+/**
+ * look up the response for `query`. on hit the cached response is copied to `resp` with the ID of `query`
+ * and TTLs reduced by the time spent in the cache. returns the response length, or 0 on miss.
+ */
+size_t dns_cache_lookup(dns_cache *cache, const uint8_t *query, size_t query_len, uint64_t now_ms,
+                        uint8_t *resp, size_t resp_size);
+
+/** store an upstream response. returns 0 if the response was cached, -1 if it is not cacheable */
+int dns_cache_store(dns_cache *cache, const uint8_t *resp, size_t resp_len, uint64_t now_ms);
+
+void dns_cache_get_stats(const dns_cache *cache, dns_cache_stats *stats);
+
+void dns_cache_clear(dns_cache *cache);
+
+/** remove responses for `domain` and all names below it. returns the number of removed entries */
+size_t dns_cache_remove_domain(dns_cache *cache, const char *domain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_CACHE_H
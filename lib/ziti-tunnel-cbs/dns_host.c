@@ -15,8 +15,10 @@
  */
 #include <ziti/ziti.h>
 #include <ziti/ziti_log.h>
+#include <uv.h>
 #include "ziti_hosting.h"
 #include "dns_host.h"
+#include "dns_host_queue.h"
 
 #ifndef PACKETSZ
 # ifdef NS_PACKETSZ
@@ -27,11 +29,39 @@
 #endif // PACKETSZ
 
 
+// per-attempt timeout (seconds) and attempts for the system resolver
+#define DNS_HOST_RES_RETRANS 2
+#define DNS_HOST_RES_RETRY 2
+
+// wire format queries are passed to the system resolver as is, which is not available on windows
+#if !_WIN32
+#define DNS_HOST_WIRE 1
+#define DNS_HOST_WIRE_ANS_SIZE (PACKETSZ * 8)
+#endif
+
 typedef struct dns_host_conn_s {
-    resolver_t resolver;
     allowed_hostnames_t allowed_domains;
+    bool wire; // peer sends wire format queries as well as JSON
+    dns_host_queue_owner queries;
 } dns_host_conn_t;
 
+typedef struct dns_host_query_s {
+    dns_host_job job;
+    dns_host_conn_t *dns;
+    ziti_connection conn;
+    dns_message msg;
+
+    // wire format query, header and question section length, and answer
+    uint8_t *wire;
+    size_t wire_len;
+    size_t wire_q_len;
+    uint8_t *ans;
+    int ans_len;
+} dns_host_query_t;
+
+// shared by all resolver connections. created with the loop of the first one
+static dns_host_queue *workers;
+
 
 typedef int (*rr_fmt)(const ns_msg *, const ns_rr*, dns_answer *ans, size_t max);
 static int fmt_srv(const ns_msg *, const ns_rr*, dns_answer *ans, size_t max);
@@ -51,23 +81,25 @@ void dns_host_init() {
     uv_once(&init, do_init);
 }
 
+static void free_dns_host_conn(dns_host_conn_t *dns) {
+    while(!LIST_EMPTY(&dns->allowed_domains)) {
+        struct allowed_hostname_s *ad = LIST_FIRST(&dns->allowed_domains);
+        LIST_REMOVE(ad, _next);
+        free(ad->domain_name);
+        free(ad);
+    }
+    free(dns);
+}
+
 static void on_close(ziti_connection conn) {
     dns_host_conn_t *dns = ziti_conn_data(conn);
     if (dns) {
-        res_nclose(&dns->resolver);
-        while(!LIST_EMPTY(&dns->allowed_domains)) {
-            struct allowed_hostname_s *ad = LIST_FIRST(&dns->allowed_domains);
-            LIST_REMOVE(ad, _next);
-            free(ad->domain_name);
-            free(ad);
+        ziti_conn_set_data(conn, NULL);
+        dns->queries.closed = true;
+        // queries still in the pool release the connection state when they finish
+        if (dns->queries.jobs == 0) {
+            free_dns_host_conn(dns);
         }
-        free(dns);
-    }
-}
-
-static void on_conn_complete(ziti_connection conn, int status) {
-    if (status != ZITI_OK) {
-        ziti_close(conn, on_close);
     }
 }
 
@@ -79,6 +111,20 @@ static void on_write(ziti_connection conn, ssize_t status, void *ctx) {
     }
 }
 
+static void on_conn_complete(ziti_connection conn, int status) {
+    if (status != ZITI_OK) {
+        ziti_close(conn, on_close);
+        return;
+    }
+
+    dns_host_conn_t *dns = ziti_conn_data(conn);
+    if (dns && dns->wire) {
+        // peer keeps sending JSON until it gets this
+        char *hello = strdup(DNS_WIRE_HELLO);
+        ziti_write(conn, (uint8_t *) hello, strlen(hello), on_write, hello);
+    }
+}
+
 static bool is_allowed(const char *name, const dns_host_conn_t *dns) {
     struct allowed_hostname_s *ad;
     LIST_FOREACH(ad, &dns->allowed_domains, _next) {
@@ -241,48 +287,239 @@ static int fmt_txt(const ns_msg *msg, const ns_rr* rr, dns_answer *ans, size_t m
 
 #endif
 
+static void send_dns_resp(ziti_connection conn, dns_message *msg) {
+    size_t msg_len = 0;
+    char *json = dns_message_to_json(msg, 0, &msg_len);
+    if (json) {
+        ziti_write(conn, (uint8_t *)json, msg_len, on_write, json);
+    }
+}
+
+/** runs on a pool thread. each query gets its own resolver state, `res_state` is not safe to share */
+static void run_query(dns_host_job *job) {
+    dns_host_query_t *query = (dns_host_query_t *) job;
+    resolver_t resolver;
+    memset(&resolver, 0, sizeof(resolver));
+    if (res_ninit(&resolver) != 0) {
+        query->msg.status = ns_r_servfail;
+        return;
+    }
+#if !_WIN32
+    resolver.retrans = DNS_HOST_RES_RETRANS;
+    resolver.retry = DNS_HOST_RES_RETRY;
+#endif
+#if DNS_HOST_WIRE
+    if (query->wire) {
+        query->ans = malloc(DNS_HOST_WIRE_ANS_SIZE);
+        query->ans_len = res_nsend(&resolver, query->wire, (int) query->wire_len,
+                                   query->ans, DNS_HOST_WIRE_ANS_SIZE);
+        if (query->ans_len < 0) {
+            free(query->ans);
+            query->ans = NULL;
+        }
+        res_nclose(&resolver);
+        return;
+    }
+#endif
+    do_query(query->msg.question[0], &query->msg, &resolver);
+    res_nclose(&resolver);
+}
+
+#if DNS_HOST_WIRE
+/** response to a wire format query with no answers, made from the query's header and question */
+static void send_wire_error(ziti_connection conn, const uint8_t *q, size_t q_len, int rcode) {
+    uint8_t *resp = malloc(q_len);
+    memcpy(resp, q, q_len);
+    resp[2] |= 0x80; // QR
+    resp[3] = (uint8_t) (0x80 | (rcode & 0xf)); // RA
+    if (q_len == NS_HFIXEDSZ) {
+        memset(resp + 4, 0, 2); // the question is not repeated
+    }
+    memset(resp + 6, 0, 6); // no answer, authority or additional records
+    ziti_write(conn, resp, q_len, on_write, resp);
+}
+
+static void send_wire_resp(dns_host_query_t *query) {
+    if (query->ans == NULL) {
+        send_wire_error(query->conn, query->wire, query->wire_q_len, ns_r_servfail);
+        return;
+    }
+    ziti_write(query->conn, query->ans, query->ans_len, on_write, query->ans);
+    query->ans = NULL;
+}
+#endif
+
+/** called when the query ran, or could not be run */
+static void complete_query(dns_host_job *job, int status) {
+    dns_host_query_t *query = (dns_host_query_t *) job;
+    dns_host_conn_t *dns = query->dns;
+    if (status != 0) {
+        query->msg.status = ns_r_servfail;
+    }
+
+    if (dns->queries.closed) {
+        if (dns->queries.jobs == 0) {
+            free_dns_host_conn(dns);
+        }
+    } else if (query->wire) {
+#if DNS_HOST_WIRE
+        send_wire_resp(query);
+#endif
+    } else {
+        send_dns_resp(query->conn, &query->msg);
+    }
+    free_dns_message(&query->msg);
+    free(query->wire);
+    free(query->ans);
+    free(query);
+}
+
+static bool can_queue(const dns_host_conn_t *dns) {
+    return dns_host_queue_can_add(workers, &dns->queries);
+}
+
+/** resolved off the loop, response is sent when the query completes */
+static void queue_query(dns_host_conn_t *dns, dns_host_query_t *query) {
+    dns_host_queue_add(workers, &query->job, &dns->queries, run_query, complete_query);
+}
+
+#if DNS_HOST_WIRE
+int dns_wire_check_query(const uint8_t *msg, size_t len, ns_rr *q, size_t *q_len) {
+    if (len < NS_HFIXEDSZ) {
+        return -1;
+    }
+    *q_len = NS_HFIXEDSZ;
+
+    // the header is checked before the message is parsed, parsing fails on records that are not there
+    if (msg[2] & 0x80) { // QR
+        return ns_r_refused;
+    }
+    if (((msg[2] >> 3) & 0xf) != ns_o_query) {
+        return ns_r_notimpl;
+    }
+    if (ns_get16(msg + 4) != 1 || ns_get16(msg + 6) != 0 || ns_get16(msg + 8) != 0) {
+        return ns_r_refused;
+    }
+
+    ns_msg q_msg;
+    if (ns_initparse(msg, (int) len, &q_msg) != 0) {
+        return ns_r_formerr;
+    }
+
+    int qd_len;
+    if (ns_parserr(&q_msg, ns_s_qd, 0, q) != 0 ||
+        (qd_len = ns_skiprr(msg + NS_HFIXEDSZ, msg + len, ns_s_qd, 1)) < 0) {
+        return ns_r_formerr;
+    }
+    *q_len += qd_len;
+
+    if (ns_rr_class(*q) != ns_c_in) {
+        return ns_r_notimpl;
+    }
+    return ns_r_noerror;
+}
+
+static void on_wire_req(ziti_connection conn, dns_host_conn_t *dns, const uint8_t *data, size_t len) {
+    ns_rr q;
+    size_t q_len;
+    int rcode = dns_wire_check_query(data, len, &q, &q_len);
+    if (rcode < 0) {
+        ZITI_LOG(WARN, "invalid wire format resolve request");
+        return;
+    }
+    if (rcode != ns_r_noerror) {
+        ZITI_LOG(DEBUG, "rejecting wire format resolve request with rcode %d", rcode);
+        send_wire_error(conn, data, q_len, rcode);
+        return;
+    }
+
+    const char *name = ns_rr_name(q);
+    ZITI_LOG(DEBUG, "resolve_req: %s type=%d", name, ns_rr_type(q));
+    if (!is_allowed(name, dns)) {
+        send_wire_error(conn, data, q_len, ns_r_refused);
+    } else if (!can_queue(dns)) {
+        ZITI_LOG(WARN, "too many queries in flight, failing query for %s", name);
+        send_wire_error(conn, data, q_len, ns_r_servfail);
+    } else {
+        dns_host_query_t *query = calloc(1, sizeof(dns_host_query_t));
+        query->dns = dns;
+        query->conn = conn;
+        query->wire = malloc(len);
+        memcpy(query->wire, data, len);
+        query->wire_len = len;
+        query->wire_q_len = q_len;
+        queue_query(dns, query);
+    }
+}
+#endif
+
 static ssize_t on_dns_req(ziti_connection conn, const uint8_t *data, ssize_t datalen) {
     if (datalen < 0) {
         ziti_close(conn, on_close);
         return 0;
     }
     dns_host_conn_t *dns = ziti_conn_data(conn);
+    if (dns == NULL) {
+        return datalen;
+    }
+
+#if DNS_HOST_WIRE
+    // JSON messages are still accepted, the peer sends them until it receives DNS_WIRE_HELLO
+    if (dns->wire && datalen > 0 && data[0] != '{') {
+        on_wire_req(conn, dns, data, datalen);
+        return datalen;
+    }
+#endif
 
     ZITI_LOG(DEBUG, "resolve_req: %.*s", (int)datalen, data);
     dns_message msg = {0};
-    parse_dns_message(&msg, (const char*) data, datalen);
+    if (parse_dns_message(&msg, (const char*) data, datalen) < 0 ||
+        msg.question == NULL || msg.question[0] == NULL || msg.question[0]->name == NULL) {
+        ZITI_LOG(WARN, "invalid resolve request");
+        free_dns_message(&msg);
+        return datalen;
+    }
     dns_question *q = msg.question[0];
 
-    if (is_allowed(q->name, dns)) {
-        do_query(q, &msg, &dns->resolver);
-    } else {
+    if (!is_allowed(q->name, dns)) {
         msg.status = ns_r_refused;
+    } else if (!can_queue(dns)) {
+        ZITI_LOG(WARN, "too many queries in flight, failing query for %s", q->name);
+        msg.status = ns_r_servfail;
+    } else {
+        dns_host_query_t *query = calloc(1, sizeof(dns_host_query_t));
+        query->dns = dns;
+        query->conn = conn;
+        query->msg = msg;
+        queue_query(dns, query);
+        return datalen;
     }
 
-    size_t msg_len = 0;
-    char *json = dns_message_to_json(&msg, 0, &msg_len);
-    ziti_write(conn, (uint8_t *)json, msg_len, on_write, json);
+    send_dns_resp(conn, &msg);
     free_dns_message(&msg);
     return datalen;
 }
 
-void accept_resolver_conn(ziti_connection conn, allowed_hostnames_t *allowed) {
+void accept_resolver_conn(ziti_connection conn, uv_loop_t *loop, allowed_hostnames_t *allowed, const char *format) {
     uv_once(&init, do_init);
+    if (workers == NULL) {
+        workers = dns_host_queue_new(loop, DNS_HOST_MAX_WORKERS, DNS_HOST_MAX_QUEUED, DNS_HOST_MAX_CONN_QUERIES,
+                                     DNS_HOST_QUEUE_TIMEOUT);
+    }
     dns_host_conn_t *dns = calloc(1, sizeof(dns_host_conn_t));
-    if (res_ninit(&dns->resolver) == 0) {
-        ziti_conn_set_data(conn, dns);
-        struct allowed_hostname_s *ah;
-        LIST_FOREACH(ah, allowed, _next) {
-            if (ah->domain_name[0] == '*' && ah->domain_name[1] == '.') {
-                struct allowed_hostname_s *allowed_domain = calloc(1, sizeof(struct allowed_hostname_s));
-                allowed_domain->domain_name = strdup(ah->domain_name + 2); // skip *.
-                LIST_INSERT_HEAD(&dns->allowed_domains, allowed_domain, _next);
-            }
+#if DNS_HOST_WIRE
+    dns->wire = format != NULL && strcmp(format, DNS_FORMAT_WIRE) == 0;
+#endif
+    ziti_conn_set_data(conn, dns);
+    struct allowed_hostname_s *ah;
+    LIST_FOREACH(ah, allowed, _next) {
+        if (ah->domain_name[0] == '*' && ah->domain_name[1] == '.') {
+            struct allowed_hostname_s *allowed_domain = calloc(1, sizeof(struct allowed_hostname_s));
+            allowed_domain->domain_name = strdup(ah->domain_name + 2); // skip *.
+            LIST_INSERT_HEAD(&dns->allowed_domains, allowed_domain, _next);
         }
-        ziti_accept(conn, on_conn_complete, on_dns_req);
-    } else {
-        ziti_close(conn, on_close);
     }
+    ziti_accept(conn, on_conn_complete, on_dns_req);
 }
 
 
@@ -33,6 +33,7 @@
 #define ns_t_txt DNS_TYPE_TEXT
 
 #define ns_r_refused DNS_RCODE_REFUSED
+#define ns_r_servfail DNS_RCODE_SERVFAIL
 
 typedef struct {
     int no_use;
@@ -46,6 +47,7 @@ typedef struct __res_state resolver_t;
 #     define res_ninit(c) res_init()
 #     define res_nclose(c) do{}while(0)
 #     define res_nquery(res, name, c, t, resp, sz) res_query(name, c, t, resp, sz)
+#     define res_nsend(res, msg, len, resp, sz) res_send(msg, len, resp, sz)
 #endif
 
 #endif
@@ -77,6 +79,21 @@ XX(comment, model_string, none, comment, __VA_ARGS__)
 extern "C" {
 #endif
 
+// resolver connections carry JSON dns_message objects, unless the dialer asks for `dns_format: wire` in app_data
+// and the hosting side confirms with DNS_WIRE_HELLO. after that either side may send raw DNS messages,
+// a message that starts with '{' is JSON. responses use the format of the query.
+#define DNS_FORMAT_WIRE "wire"
+#define DNS_WIRE_HELLO "{\"comment\":\"" DNS_FORMAT_WIRE "\"}"
+
+// queries are resolved on the uv thread pool. at most this many pool threads are used for queries at any time
+#define DNS_HOST_MAX_WORKERS 2
+// queries waiting for a worker, across all resolver connections
+#define DNS_HOST_MAX_QUEUED 256
+// queries in flight (queued or resolving) per resolver connection
+#define DNS_HOST_MAX_CONN_QUERIES 32
+// queries that could not be started within this time (ms) are failed
+#define DNS_HOST_QUEUE_TIMEOUT 5000
+
 #define DNS_FLAG_QR(f) (((f) & 0x8000U) != 0)
 #define DNS_FLAG_RD(f) (((f) & 0x0100U) != 0)
 
@@ -92,6 +109,16 @@ void do_query(const dns_question *q, dns_message *resp, resolver_t *resolver);
 
 int parse_dns_req(dns_message *msg, const unsigned char* buf, size_t buflen);
 
+#if !_WIN32
+/**
+ * check that a wire format message is a plain query for one IN class question: QR clear, opcode QUERY,
+ * no answer or authority records. `*q` is set to the question and `*q_len` to the length of the header and
+ * question section. returns ns_r_noerror, or the rcode to answer the message with (`*q_len` covers
+ * what the answer can repeat of it). returns -1 if the message is too short to answer.
+ */
+int dns_wire_check_query(const uint8_t *msg, size_t len, ns_rr *q, size_t *q_len);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,184 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <ziti/ziti_log.h>
+
+#include "dns_host_queue.h"
+
+struct dns_host_queue_s {
+    uv_loop_t *loop;
+    int max_running;
+    size_t max_queued;
+    int max_owner_jobs;
+    uint64_t timeout;
+
+    STAILQ_HEAD(, dns_host_job_s) queue;
+    size_t queued;
+    int running;
+    uv_timer_t timer;
+    bool closing;
+    bool timer_closed;
+
+    uint64_t timed_out;
+};
+
+static void finish_job(dns_host_job *job, int status) {
+    job->owner->jobs--;
+    job->done(job, status);
+}
+
+static void release_queue(dns_host_queue *q) {
+    if (q->timer_closed && q->running == 0) {
+        free(q);
+    }
+}
+
+static void on_queue_timer(uv_timer_t *t);
+
+/** wake up when the oldest queued job times out */
+static void schedule(dns_host_queue *q) {
+    dns_host_job *job = STAILQ_FIRST(&q->queue);
+    if (job == NULL || q->closing) {
+        uv_timer_stop(&q->timer);
+        return;
+    }
+    uint64_t now = uv_now(q->loop);
+    uint64_t deadline = job->queued_at + q->timeout;
+    uv_timer_start(&q->timer, on_queue_timer, deadline > now ? deadline - now : 0, 0);
+}
+
+/** fail the jobs at the head of the queue that waited too long */
+static void expire(dns_host_queue *q) {
+    uint64_t now = uv_now(q->loop);
+    dns_host_job *job;
+    while ((job = STAILQ_FIRST(&q->queue)) != NULL && now - job->queued_at >= q->timeout) {
+        STAILQ_REMOVE_HEAD(&q->queue, _next);
+        q->queued--;
+        q->timed_out++;
+        ZITI_LOG(WARN, "query[%p] timed out waiting for a resolver", job);
+        finish_job(job, UV_ETIMEDOUT);
+    }
+}
+
+static void on_job_run(uv_work_t *work) {
+    dns_host_job *job = work->data;
+    job->run(job);
+}
+
+static void dispatch(dns_host_queue *q);
+
+static void on_job_done(uv_work_t *work, int status) {
+    dns_host_job *job = work->data;
+    dns_host_queue *q = job->queue;
+    q->running--;
+    finish_job(job, status);
+    if (q->closing) {
+        release_queue(q);
+        return;
+    }
+    dispatch(q);
+}
+
+static void dispatch(dns_host_queue *q) {
+    expire(q);
+    dns_host_job *job;
+    while (q->running < q->max_running && (job = STAILQ_FIRST(&q->queue)) != NULL) {
+        STAILQ_REMOVE_HEAD(&q->queue, _next);
+        q->queued--;
+
+        if (job->owner->closed) {
+            finish_job(job, UV_ECANCELED);
+            continue;
+        }
+
+        job->work.data = job;
+        int rc = uv_queue_work(q->loop, &job->work, on_job_run, on_job_done);
+        if (rc != 0) {
+            ZITI_LOG(WARN, "failed to start query[%p]: %s", job, uv_strerror(rc));
+            finish_job(job, rc);
+            continue;
+        }
+        q->running++;
+    }
+    schedule(q);
+}
+
+static void on_queue_timer(uv_timer_t *t) {
+    dns_host_queue *q = t->data;
+    expire(q);
+    schedule(q);
+}
+
+dns_host_queue *dns_host_queue_new(uv_loop_t *loop, int max_running, size_t max_queued, int max_owner_jobs,
+                                   uint64_t timeout) {
+    dns_host_queue *q = calloc(1, sizeof(dns_host_queue));
+    q->loop = loop;
+    q->max_running = max_running;
+    q->max_queued = max_queued;
+    q->max_owner_jobs = max_owner_jobs;
+    q->timeout = timeout;
+    STAILQ_INIT(&q->queue);
+
+    uv_timer_init(loop, &q->timer);
+    q->timer.data = q;
+    // queued queries alone do not keep the loop going
+    uv_unref((uv_handle_t *) &q->timer);
+    return q;
+}
+
+static void on_queue_timer_close(uv_handle_t *h) {
+    dns_host_queue *q = h->data;
+    q->timer_closed = true;
+    release_queue(q);
+}
+
+void dns_host_queue_free(dns_host_queue *q) {
+    if (q == NULL) {
+        return;
+    }
+    q->closing = true;
+    while (!STAILQ_EMPTY(&q->queue)) {
+        dns_host_job *job = STAILQ_FIRST(&q->queue);
+        STAILQ_REMOVE_HEAD(&q->queue, _next);
+        q->queued--;
+        finish_job(job, UV_ECANCELED);
+    }
+    uv_close((uv_handle_t *) &q->timer, on_queue_timer_close);
+}
+
+bool dns_host_queue_can_add(const dns_host_queue *q, const dns_host_queue_owner *owner) {
+    return !q->closing && owner->jobs < q->max_owner_jobs && q->queued < q->max_queued;
+}
+
+void dns_host_queue_add(dns_host_queue *q, dns_host_job *job, dns_host_queue_owner *owner,
+                        dns_host_job_run run, dns_host_job_done done) {
+    job->queue = q;
+    job->owner = owner;
+    job->run = run;
+    job->done = done;
+    job->queued_at = uv_now(q->loop);
+    owner->jobs++;
+    STAILQ_INSERT_TAIL(&q->queue, job, _next);
+    q->queued++;
+    dispatch(q);
+}
+
+void dns_host_queue_get_stats(const dns_host_queue *q, dns_host_queue_stats *stats) {
+    stats->queued = q->queued;
+    stats->running = q->running;
+    stats->timed_out = q->timed_out;
+}
@@ -0,0 +1,89 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_HOST_QUEUE_H
+#define ZITI_TUNNELER_SDK_DNS_HOST_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * runs the queries of hosted resolver connections on the uv thread pool, which is shared with getaddrinfo and
+ * file system requests. at most `max_running` queries use pool threads at any time, the rest wait in a queue of
+ * `max_queued`. each connection has at most `max_owner_jobs` queries queued or running. a query that waits longer
+ * than `timeout` ms is failed from a timer, so it does not linger until a pool thread frees up.
+ */
+typedef struct dns_host_queue_s dns_host_queue;
+
+/** the queries of one resolver connection */
+typedef struct dns_host_queue_owner_s {
+    int jobs;    // queued or running
+    bool closed; // queries that did not start yet are not run
+} dns_host_queue_owner;
+
+typedef struct dns_host_job_s dns_host_job;
+
+/** runs on a pool thread */
+typedef void (*dns_host_job_run)(dns_host_job *job);
+
+/**
+ * called on the loop with 0 when the job ran, UV_ETIMEDOUT when it waited too long, UV_ECANCELED when its owner
+ * was closed (or the queue freed) before it started, or the error that kept it from starting
+ */
+typedef void (*dns_host_job_done)(dns_host_job *job, int status);
+
+struct dns_host_job_s {
+    uv_work_t work;
+    dns_host_queue *queue;
+    dns_host_queue_owner *owner;
+    dns_host_job_run run;
+    dns_host_job_done done;
+    uint64_t queued_at;
+    STAILQ_ENTRY(dns_host_job_s) _next;
+};
+
+typedef struct dns_host_queue_stats_s {
+    size_t queued;
+    int running;
+    uint64_t timed_out;
+} dns_host_queue_stats;
+
+dns_host_queue *dns_host_queue_new(uv_loop_t *loop, int max_running, size_t max_queued, int max_owner_jobs,
+                                   uint64_t timeout);
+
+/** queued jobs are done with UV_ECANCELED. the queue is released once running jobs are done */
+void dns_host_queue_free(dns_host_queue *q);
+
+/** false if `owner` or the queue has no room for another job */
+bool dns_host_queue_can_add(const dns_host_queue *q, const dns_host_queue_owner *owner);
+
+/** queue `job` for `owner`. check dns_host_queue_can_add() first */
+void dns_host_queue_add(dns_host_queue *q, dns_host_job *job, dns_host_queue_owner *owner,
+                        dns_host_job_run run, dns_host_job_done done);
+
+void dns_host_queue_get_stats(const dns_host_queue *q, dns_host_queue_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_HOST_QUEUE_H
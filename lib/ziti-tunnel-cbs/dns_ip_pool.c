@@ -0,0 +1,148 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "dns_ip_pool.h"
+
+#define WORD_BITS 64
+#define FULL_WORD UINT64_MAX
+
+/** index of the lowest clear bit. `w` must not be FULL_WORD */
+static inline uint32_t lowest_clear(uint64_t w) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, ~w);
+    return (uint32_t) idx;
+#else
+    return (uint32_t) __builtin_ctzll(~w);
+#endif
+}
+
+static inline uint64_t bits_below(uint32_t n) {
+    return n == 0 ? 0 : (FULL_WORD >> (WORD_BITS - n));
+}
+
+int dns_ip_pool_init(dns_ip_pool *pool, uint32_t size) {
+    memset(pool, 0, sizeof(*pool));
+    pool->nwords = (uint32_t)(((uint64_t) size + WORD_BITS - 1) / WORD_BITS);
+    uint32_t nsummary = (pool->nwords + WORD_BITS - 1) / WORD_BITS;
+
+    pool->bits = calloc(pool->nwords ? pool->nwords : 1, sizeof(uint64_t));
+    pool->summary = calloc(nsummary ? nsummary : 1, sizeof(uint64_t));
+    if (pool->bits == NULL || pool->summary == NULL) {
+        dns_ip_pool_free(pool);
+        return -1;
+    }
+    pool->size = size;
+    pool->available = size;
+
+    // offsets past the end of the pool are permanently taken
+    if (size % WORD_BITS) {
+        pool->bits[pool->nwords - 1] = ~bits_below(size % WORD_BITS);
+    }
+    if (pool->nwords % WORD_BITS) {
+        pool->summary[nsummary - 1] = ~bits_below(pool->nwords % WORD_BITS);
+    }
+    return 0;
+}
+
+void dns_ip_pool_free(dns_ip_pool *pool) {
+    free(pool->bits);
+    free(pool->summary);
+    memset(pool, 0, sizeof(*pool));
+}
+
+bool dns_ip_pool_is_taken(const dns_ip_pool *pool, uint32_t offset) {
+    if (offset >= pool->size) {
+        return true;
+    }
+    return (pool->bits[offset / WORD_BITS] >> (offset % WORD_BITS)) & 1;
+}
+
+bool dns_ip_pool_reserve(dns_ip_pool *pool, uint32_t offset) {
+    if (dns_ip_pool_is_taken(pool, offset)) {
+        return false;
+    }
+    uint32_t w = offset / WORD_BITS;
+    pool->bits[w] |= (uint64_t) 1 << (offset % WORD_BITS);
+    if (pool->bits[w] == FULL_WORD) {
+        pool->summary[w / WORD_BITS] |= (uint64_t) 1 << (w % WORD_BITS);
+    }
+    pool->available--;
+    return true;
+}
+
+void dns_ip_pool_release(dns_ip_pool *pool, uint32_t offset) {
+    if (offset >= pool->size || !dns_ip_pool_is_taken(pool, offset)) {
+        return;
+    }
+    uint32_t w = offset / WORD_BITS;
+    pool->bits[w] &= ~((uint64_t) 1 << (offset % WORD_BITS));
+    pool->summary[w / WORD_BITS] &= ~((uint64_t) 1 << (w % WORD_BITS));
+    pool->available++;
+}
+
+/** find the first free offset at or after `start` without wrapping around */
+static uint32_t find_free(const dns_ip_pool *pool, uint32_t start) {
+    if (start >= pool->size) {
+        return DNS_IP_POOL_NONE;
+    }
+
+    uint32_t w = start / WORD_BITS;
+    uint64_t word = pool->bits[w] | bits_below(start % WORD_BITS);
+    if (word != FULL_WORD) {
+        return w * WORD_BITS + lowest_clear(word);
+    }
+
+    // find the next word with a free offset
+    uint32_t next = w + 1;
+    uint32_t nsummary = (pool->nwords + WORD_BITS - 1) / WORD_BITS;
+    for (uint32_t s = next / WORD_BITS; s < nsummary; s++) {
+        uint64_t sword = pool->summary[s];
+        if (s == next / WORD_BITS) {
+            sword |= bits_below(next % WORD_BITS);
+        }
+        if (sword != FULL_WORD) {
+            uint32_t fw = s * WORD_BITS + lowest_clear(sword);
+            return fw * WORD_BITS + lowest_clear(pool->bits[fw]);
+        }
+    }
+    return DNS_IP_POOL_NONE;
+}
+
+uint32_t dns_ip_pool_alloc(dns_ip_pool *pool) {
+    if (pool->available == 0) {
+        return DNS_IP_POOL_NONE;
+    }
+
+    uint32_t offset = find_free(pool, pool->cursor);
+    if (offset == DNS_IP_POOL_NONE) {
+        offset = find_free(pool, 0);
+    }
+    if (offset == DNS_IP_POOL_NONE) {
+        return DNS_IP_POOL_NONE;
+    }
+
+    dns_ip_pool_reserve(pool, offset);
+    pool->cursor = offset + 1 < pool->size ? offset + 1 : 0;
+    return offset;
+}
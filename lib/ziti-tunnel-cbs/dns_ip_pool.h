@@ -0,0 +1,64 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_IP_POOL_H
+#define ZITI_TUNNELER_SDK_DNS_IP_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DNS_IP_POOL_NONE UINT32_MAX
+
+/**
+ * allocator for host offsets [0, size) of the DNS address range.
+ * one bit per offset, plus a summary bit per 64 offsets that is set when all of them are taken, so
+ * finding a free offset reads a couple of words regardless of how full the pool is.
+ * offsets are handed out in round-robin order, so a released address is not reused before the rest
+ * of the pool has been cycled through.
+ */
+typedef struct dns_ip_pool_s {
+    uint32_t size;
+    uint32_t available;
+    uint32_t cursor;  // next offset to consider
+    uint32_t nwords;
+    uint64_t *bits;    // 1 = offset is taken
+    uint64_t *summary; // 1 = bits[i] is full
+} dns_ip_pool;
+
+/** initialize pool with `size` free offsets. returns 0 on success, -1 if memory could not be allocated */
+int dns_ip_pool_init(dns_ip_pool *pool, uint32_t size);
+
+void dns_ip_pool_free(dns_ip_pool *pool);
+
+/** mark `offset` as taken. returns false if it was already taken or is out of range */
+bool dns_ip_pool_reserve(dns_ip_pool *pool, uint32_t offset);
+
+/** take the next free offset, or return DNS_IP_POOL_NONE if the pool is exhausted */
+uint32_t dns_ip_pool_alloc(dns_ip_pool *pool);
+
+void dns_ip_pool_release(dns_ip_pool *pool, uint32_t offset);
+
+bool dns_ip_pool_is_taken(const dns_ip_pool *pool, uint32_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_IP_POOL_H
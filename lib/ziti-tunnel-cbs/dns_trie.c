@@ -0,0 +1,161 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_trie.h"
+
+#define MAX_LABELS 128
+#define MAX_LABEL_LEN 64
+
+struct label_s {
+    const char *start;
+    size_t len;
+};
+
+/** split a domain name into labels, last label first. returns the number of labels, or -1 if the name is invalid */
+static int split_labels(const char *name, struct label_s labels[MAX_LABELS]) {
+    int n = 0;
+    const char *end = name + strlen(name);
+    while (end > name) {
+        const char *p = end;
+        while (p > name && *(p - 1) != '.') p--;
+        if (n == MAX_LABELS || end - p >= MAX_LABEL_LEN) {
+            return -1;
+        }
+        labels[n].start = p;
+        labels[n].len = end - p;
+        n++;
+        end = p > name ? p - 1 : p;
+    }
+    return n;
+}
+
+static dns_trie *child(dns_trie *node, const struct label_s *l, bool create) {
+    char label[MAX_LABEL_LEN];
+    memcpy(label, l->start, l->len);
+    label[l->len] = '\0';
+
+    dns_trie *c = model_map_get(&node->children, label);
+    if (c == NULL && create) {
+        c = calloc(1, sizeof(dns_trie));
+        model_map_set(&node->children, label, c);
+    }
+    return c;
+}
+
+/** fill `path` with the nodes along `name`, root first. returns the number of nodes found */
+static int walk(dns_trie *trie, const char *name, bool create, dns_trie *path[MAX_LABELS + 1], int *num_labels) {
+    struct label_s labels[MAX_LABELS];
+    int n = split_labels(name, labels);
+    if (num_labels) *num_labels = n;
+    if (n < 0) {
+        return 0;
+    }
+
+    int depth = 0;
+    path[depth++] = trie;
+    for (int i = 0; i < n; i++) {
+        dns_trie *c = child(path[depth - 1], &labels[i], create);
+        if (c == NULL) break;
+        path[depth++] = c;
+    }
+    return depth;
+}
+
+void *dns_trie_set(dns_trie *trie, const char *domain, void *value) {
+    dns_trie *path[MAX_LABELS + 1];
+    int n;
+    int depth = walk(trie, domain, true, path, &n);
+    if (n < 0 || depth != n + 1) {
+        return NULL;
+    }
+
+    void *old = path[depth - 1]->value;
+    path[depth - 1]->value = value;
+    return old;
+}
+
+void *dns_trie_get(dns_trie *trie, const char *domain) {
+    dns_trie *path[MAX_LABELS + 1];
+    int n;
+    int depth = walk(trie, domain, false, path, &n);
+    if (n < 0 || depth != n + 1) {
+        return NULL;
+    }
+    return path[depth - 1]->value;
+}
+
+void *dns_trie_remove(dns_trie *trie, const char *domain) {
+    struct label_s labels[MAX_LABELS];
+    dns_trie *path[MAX_LABELS + 1];
+    int n;
+    int depth = walk(trie, domain, false, path, &n);
+    if (n < 0 || depth != n + 1) {
+        return NULL;
+    }
+    split_labels(domain, labels);
+
+    void *old = path[depth - 1]->value;
+    path[depth - 1]->value = NULL;
+
+    // prune nodes that no longer lead to a value
+    for (int i = depth - 1; i > 0; i--) {
+        dns_trie *node = path[i];
+        if (node->value != NULL || model_map_size(&node->children) > 0) {
+            break;
+        }
+        char label[MAX_LABEL_LEN];
+        memcpy(label, labels[i - 1].start, labels[i - 1].len);
+        label[labels[i - 1].len] = '\0';
+        model_map_remove(&path[i - 1]->children, label);
+        free(node);
+    }
+    return old;
+}
+
+void *dns_trie_find_match(dns_trie *trie, const char *hostname, bool (*visit)(void *value, void *ctx), void *ctx) {
+    dns_trie *path[MAX_LABELS + 1];
+    int depth = walk(trie, hostname, false, path, NULL);
+
+    // the root node represents the empty domain, which never matches
+    for (int i = depth - 1; i > 0; i--) {
+        void *value = path[i]->value;
+        if (value != NULL && (visit == NULL || visit(value, ctx))) {
+            return value;
+        }
+    }
+    return NULL;
+}
+
+void *dns_trie_match(dns_trie *trie, const char *hostname) {
+    return dns_trie_find_match(trie, hostname, NULL, NULL);
+}
+
+void dns_trie_clear(dns_trie *trie, void (*free_fn)(void *)) {
+    model_map_iter it = model_map_iterator(&trie->children);
+    while (it != NULL) {
+        dns_trie *c = model_map_it_value(it);
+        dns_trie_clear(c, free_fn);
+        free(c);
+        it = model_map_it_remove(it);
+    }
+    if (trie->value && free_fn) {
+        free_fn(trie->value);
+    }
+    trie->value = NULL;
+}
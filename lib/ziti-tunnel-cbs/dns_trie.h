@@ -0,0 +1,60 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_TRIE_H
+#define ZITI_TUNNELER_SDK_DNS_TRIE_H
+
+#include <stdbool.h>
+#include <ziti/model_support.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * trie of domain names keyed by reversed labels ("www.example.com" is stored as com -> example -> www).
+ * a zero-initialized dns_trie is empty. domain names are expected to be lowercase without a trailing dot.
+ */
+typedef struct dns_trie_s {
+    model_map children; // map[label -> struct dns_trie_s]
+    void *value;
+} dns_trie;
+
+/** set the value for a domain. returns the previous value, if any */
+void *dns_trie_set(dns_trie *trie, const char *domain, void *value);
+
+/** remove the value for a domain. returns the removed value, if any */
+void *dns_trie_remove(dns_trie *trie, const char *domain);
+
+/** return the value for a domain (exact match) */
+void *dns_trie_get(dns_trie *trie, const char *domain);
+
+/** return the value of the most specific domain that is `hostname` or one of its parent domains */
+void *dns_trie_match(dns_trie *trie, const char *hostname);
+
+/**
+ * call `visit` for each value whose domain is `hostname` or one of its parent domains, from the most
+ * to the least specific domain, until `visit` returns true. returns the value that stopped the walk.
+ */
+void *dns_trie_find_match(dns_trie *trie, const char *hostname, bool (*visit)(void *value, void *ctx), void *ctx);
+
+void dns_trie_clear(dns_trie *trie, void (*free_fn)(void *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_TRIE_H
@@ -0,0 +1,536 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ziti/model_support.h>
+#include <ziti/ziti_log.h>
+
+#include "dns_upstream.h"
+
+#define DNS_HEADER_LEN 12
+#define DNS_ID(p) ((uint8_t)(p)[0] << 8 | (uint8_t)(p)[1])
+#define DNS_TC(p) (((p)[2] & 0x02) != 0)
+
+// largest udp datagram, answers may be bigger than the size the query advertised
+#define DNS_UDP_MAX (64 * 1024)
+
+#ifndef IN6ADDR_V4MAPPED
+#define IN6ADDR_V4MAPPED(v4) \
+	{{{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
+	    0x00, 0x00, 0xff, 0xff, v4[0], v4[1], v4[2], v4[3] }}}
+#endif
+
+struct dns_upstream_s {
+    uv_loop_t *loop;
+    uint64_t query_timeout;
+    uv_udp_t udp;
+    bool is_ipv4;
+    uint8_t *recv_buf;
+
+    int num_servers;
+    struct sockaddr_in6 addr[DNS_UPSTREAM_MAX];
+    struct server_rtt_s {
+        uint32_t srtt; // smoothed round trip time (ms)
+        uint32_t rttvar;
+        bool measured;
+    } rtt[DNS_UPSTREAM_MAX];
+
+    LIST_HEAD(, dns_upstream_query_s) queries;
+    model_map by_xid; // map[xid -> dns_upstream_query]
+    uv_timer_t timer;
+    int open_handles; // released when both are closed
+};
+
+/** a truncated answer asked again over tcp, from the server that sent it */
+struct dns_upstream_tcp_s {
+    uv_tcp_t tcp;
+    uv_connect_t connect;
+    uv_write_t write;
+    dns_upstream_query *q; // cleared once the query is gone
+    uint8_t prefix[2];
+    uint8_t *truncated; // udp answer, returned if the tcp one does not come
+    size_t truncated_len;
+    uint8_t *buf; // length prefixed answer
+    size_t len;
+};
+
+static uint64_t server_timeout(const dns_upstream *up, int idx) {
+    const struct server_rtt_s *u = &up->rtt[idx];
+    if (!u->measured) {
+        return DNS_UPSTREAM_INITIAL_TIMEOUT;
+    }
+    uint64_t rto = u->srtt + (4 * u->rttvar > 10 ? 4 * u->rttvar : 10);
+    if (rto < DNS_UPSTREAM_MIN_TIMEOUT) return DNS_UPSTREAM_MIN_TIMEOUT;
+    if (rto > DNS_UPSTREAM_MAX_TIMEOUT) return DNS_UPSTREAM_MAX_TIMEOUT;
+    return rto;
+}
+
+static void server_rtt_sample(dns_upstream *up, int idx, uint64_t rtt) {
+    struct server_rtt_s *u = &up->rtt[idx];
+    if (rtt > DNS_UPSTREAM_MAX_TIMEOUT) {
+        rtt = DNS_UPSTREAM_MAX_TIMEOUT;
+    }
+    if (!u->measured) {
+        u->srtt = (uint32_t) rtt;
+        u->rttvar = (uint32_t) rtt / 2;
+        u->measured = true;
+    } else {
+        uint32_t delta = u->srtt > rtt ? u->srtt - (uint32_t) rtt : (uint32_t) rtt - u->srtt;
+        u->rttvar = (3 * u->rttvar + delta) / 4;
+        u->srtt = (7 * u->srtt + (uint32_t) rtt) / 8;
+    }
+    ZITI_LOG(TRACE, "upstream[%d] rtt=%" PRIu64 "ms srtt=%ums rttvar=%ums", idx, rtt, u->srtt, u->rttvar);
+}
+
+static void server_timed_out(dns_upstream *up, int idx) {
+    struct server_rtt_s *u = &up->rtt[idx];
+    uint32_t srtt = u->srtt > DNS_UPSTREAM_INITIAL_TIMEOUT ? u->srtt : DNS_UPSTREAM_INITIAL_TIMEOUT;
+    u->srtt = 2 * srtt < DNS_UPSTREAM_MAX_TIMEOUT ? 2 * srtt : DNS_UPSTREAM_MAX_TIMEOUT;
+    u->measured = true;
+}
+
+static int server_index(const dns_upstream *up, const struct sockaddr *addr) {
+    for (int i = 0; addr && i < up->num_servers; i++) {
+        const struct sockaddr_in6 *s = &up->addr[i];
+        if (addr->sa_family != s->sin6_family) continue;
+
+        if (addr->sa_family == AF_INET6) {
+            const struct sockaddr_in6 *a = (const struct sockaddr_in6 *) addr;
+            if (a->sin6_port == s->sin6_port && memcmp(&a->sin6_addr, &s->sin6_addr, sizeof(a->sin6_addr)) == 0) {
+                return i;
+            }
+        } else if (addr->sa_family == AF_INET) {
+            const struct sockaddr_in *a = (const struct sockaddr_in *) addr;
+            const struct sockaddr_in *s4 = (const struct sockaddr_in *) s;
+            if (a->sin_port == s4->sin_port && a->sin_addr.s_addr == s4->sin_addr.s_addr) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+/** the untried server with the lowest expected response time */
+static int next_server(const dns_upstream *up, const dns_upstream_query *q) {
+    int best = -1;
+    uint64_t best_timeout = 0;
+    for (int i = 0; i < up->num_servers; i++) {
+        if (q->tried & (1U << i)) continue;
+        uint64_t timeout = server_timeout(up, i);
+        if (best == -1 || timeout < best_timeout) {
+            best = i;
+            best_timeout = timeout;
+        }
+    }
+    return best;
+}
+
+/** send the query to the next server. it is tried for its retransmission timeout, but not past the deadline */
+static int send_next(dns_upstream *up, dns_upstream_query *q) {
+    int rc = UV_ENOENT;
+    int idx;
+    while ((idx = next_server(up, q)) >= 0) {
+        q->tried |= 1U << idx;
+        uv_buf_t buf = uv_buf_init((char *) q->msg, (unsigned int) q->len);
+        rc = uv_udp_try_send(&up->udp, &buf, 1, (struct sockaddr *) &up->addr[idx]);
+        if (rc > 0) {
+            uint64_t now = uv_now(up->loop);
+            q->server = idx;
+            q->sent[idx] = now;
+            q->retry_at = now + server_timeout(up, idx);
+            if (q->retry_at > q->deadline) {
+                q->retry_at = q->deadline;
+            }
+            return 0;
+        }
+        ZITI_LOG(WARN, "failed to query[%04x] upstream DNS server[%d]: %d(%s)", q->xid, idx, rc, uv_strerror(rc));
+    }
+    return rc;
+}
+
+static void on_timer(uv_timer_t *t);
+
+/** wake up when the next query is due for another server, or for failing */
+static void schedule(dns_upstream *up) {
+    dns_upstream_query *q;
+    uint64_t next = UINT64_MAX;
+    LIST_FOREACH(q, &up->queries, _next) {
+        if (q->retry_at < next) {
+            next = q->retry_at;
+        }
+    }
+    if (next == UINT64_MAX) {
+        uv_timer_stop(&up->timer);
+        return;
+    }
+    uint64_t now = uv_now(up->loop);
+    uv_timer_start(&up->timer, on_timer, next > now ? next - now : 0, 0);
+}
+
+static void on_tcp_close(uv_handle_t *h) {
+    struct dns_upstream_tcp_s *t = h->data;
+    free(t->truncated);
+    free(t->buf);
+    free(t);
+}
+
+static void forget(dns_upstream_query *q) {
+    dns_upstream *up = q->up;
+    LIST_REMOVE(q, _next);
+    model_map_remove_key(&up->by_xid, &q->xid, sizeof(q->xid));
+    if (q->tcp) {
+        q->tcp->q = NULL;
+        uv_close((uv_handle_t *) &q->tcp->tcp, on_tcp_close);
+        q->tcp = NULL;
+    }
+    q->up = NULL;
+}
+
+/** the answer must be for the question that was asked */
+static bool answer_matches(const dns_upstream_query *q, const uint8_t *data, size_t len) {
+    return len >= DNS_HEADER_LEN + q->section_len && DNS_ID(data) == q->xid &&
+           memcmp(data + DNS_HEADER_LEN, q->msg + DNS_HEADER_LEN, q->section_len) == 0;
+}
+
+/** complete a query retried over tcp, with the tcp answer or else the truncated one */
+static void tcp_done(struct dns_upstream_tcp_s *t, int status) {
+    dns_upstream_query *q = t->q;
+    dns_upstream *up = q->up;
+    const uint8_t *answer = t->truncated;
+    size_t len = t->truncated_len;
+    if (status == 0) {
+        answer = t->buf + 2;
+        len = t->len - 2;
+    } else {
+        ZITI_LOG(WARN, "query[%04x] to upstream DNS server[%d] over tcp failed: %d(%s), answer stays truncated",
+                 q->xid, q->server, status, uv_strerror(status));
+    }
+    forget(q); // closes the connection, its buffers are released later
+    schedule(up);
+    q->cb(q, 0, answer, len);
+}
+
+static void on_tcp_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *b) {
+    struct dns_upstream_tcp_s *t = h->data;
+    if (t->buf == NULL) {
+        t->buf = malloc(2 + DNS_UPSTREAM_TCP_MAX);
+    }
+    b->base = (char *) t->buf + t->len;
+    b->len = 2 + DNS_UPSTREAM_TCP_MAX - t->len;
+}
+
+static void on_tcp_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    struct dns_upstream_tcp_s *t = s->data;
+    if (t->q == NULL || nread == 0) {
+        return;
+    }
+    if (nread < 0) {
+        tcp_done(t, (int) nread);
+        return;
+    }
+    t->len += nread;
+    if (t->len < 2) {
+        return;
+    }
+    size_t msg_len = t->buf[0] << 8 | t->buf[1];
+    if (t->len < 2 + msg_len) {
+        return;
+    }
+    t->len = 2 + msg_len;
+    if (!answer_matches(t->q, t->buf + 2, msg_len)) {
+        ZITI_LOG(DEBUG, "upstream tcp response[%04x]: question does not match the query", t->q->xid);
+        tcp_done(t, UV_EPROTO);
+        return;
+    }
+    tcp_done(t, 0);
+}
+
+static void on_tcp_write(uv_write_t *w, int status) {
+    struct dns_upstream_tcp_s *t = w->data;
+    if (status != 0 && t->q != NULL) {
+        tcp_done(t, status);
+    }
+}
+
+static void on_tcp_connect(uv_connect_t *c, int status) {
+    struct dns_upstream_tcp_s *t = c->data;
+    if (t->q == NULL) {
+        return;
+    }
+    if (status == 0) {
+        t->prefix[0] = (t->q->len >> 8) & 0xff;
+        t->prefix[1] = t->q->len & 0xff;
+        uv_buf_t bufs[] = {
+                uv_buf_init((char *) t->prefix, sizeof(t->prefix)),
+                uv_buf_init((char *) t->q->msg, (unsigned int) t->q->len),
+        };
+        status = uv_write(&t->write, (uv_stream_t *) &t->tcp, bufs, 2, on_tcp_write);
+    }
+    if (status == 0) {
+        status = uv_read_start((uv_stream_t *) &t->tcp, on_tcp_alloc, on_tcp_read);
+    }
+    if (status != 0) {
+        tcp_done(t, status);
+    }
+}
+
+/** ask server `idx` again over tcp. the query then waits for that answer until its deadline */
+static int tcp_retry(dns_upstream *up, dns_upstream_query *q, int idx, const uint8_t *answer, size_t len) {
+    struct dns_upstream_tcp_s *t = calloc(1, sizeof(*t));
+    t->q = q;
+    uv_tcp_init(up->loop, &t->tcp);
+    t->tcp.data = t;
+    t->connect.data = t;
+    t->write.data = t;
+    int rc = uv_tcp_connect(&t->connect, &t->tcp, (const struct sockaddr *) &up->addr[idx], on_tcp_connect);
+    if (rc != 0) {
+        ZITI_LOG(WARN, "failed to connect to upstream DNS server[%d] over tcp: %d(%s)", idx, rc, uv_strerror(rc));
+        uv_close((uv_handle_t *) &t->tcp, on_tcp_close);
+        return rc;
+    }
+    t->truncated = malloc(len);
+    memcpy(t->truncated, answer, len);
+    t->truncated_len = len;
+
+    ZITI_LOG(DEBUG, "answer to query[%04x] is truncated, asking upstream DNS server[%d] over tcp", q->xid, idx);
+    q->tcp = t;
+    q->server = idx;
+    // other udp answers would be truncated as well
+    model_map_remove_key(&up->by_xid, &q->xid, sizeof(q->xid));
+    q->retry_at = q->deadline;
+    schedule(up);
+    return 0;
+}
+
+static dns_upstream_query *first_due(dns_upstream *up, uint64_t now) {
+    dns_upstream_query *q;
+    LIST_FOREACH(q, &up->queries, _next) {
+        if (q->retry_at <= now) {
+            return q;
+        }
+    }
+    return NULL;
+}
+
+static void on_timer(uv_timer_t *t) {
+    dns_upstream *up = t->data;
+    uint64_t now = uv_now(up->loop);
+    dns_upstream_query *q;
+    while ((q = first_due(up, now)) != NULL) {
+        if (q->tcp != NULL) {
+            tcp_done(q->tcp, UV_ETIMEDOUT);
+            continue;
+        }
+        if (now >= q->deadline) {
+            ZITI_LOG(WARN, "query[%04x] failed: no response from upstream DNS servers", q->xid);
+            forget(q);
+            q->cb(q, UV_ETIMEDOUT, NULL, 0);
+            continue;
+        }
+
+        ZITI_LOG(DEBUG, "query[%04x] to upstream DNS server[%d] timed out", q->xid, q->server);
+        server_timed_out(up, q->server);
+        if (send_next(up, q) != 0) {
+            // no other server to try, keep waiting for the ones that were asked
+            q->retry_at = q->deadline;
+        }
+    }
+    schedule(up);
+}
+
+static void on_recv_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *b) {
+    dns_upstream *up = h->data;
+    b->base = (char *) up->recv_buf;
+    b->len = DNS_UDP_MAX;
+}
+
+static void on_recv(uv_udp_t *h, ssize_t rc, const uv_buf_t *buf, const struct sockaddr *addr, unsigned flags) {
+    dns_upstream *up = h->data;
+    if (rc < DNS_HEADER_LEN) {
+        return;
+    }
+    const uint8_t *data = (const uint8_t *) buf->base;
+    uint16_t xid = DNS_ID(data);
+    dns_upstream_query *q = model_map_get_key(&up->by_xid, &xid, sizeof(xid));
+    if (q == NULL) {
+        return;
+    }
+    if (!answer_matches(q, data, (size_t) rc)) {
+        ZITI_LOG(DEBUG, "dropping upstream response[%04x]: question does not match the query", xid);
+        return;
+    }
+
+    ZITI_LOG(TRACE, "upstream sent response to query[%04x] (rc=%zd)", xid, rc);
+    int idx = server_index(up, addr);
+    if (idx >= 0 && (q->tried & (1U << idx))) {
+        server_rtt_sample(up, idx, uv_now(up->loop) - q->sent[idx]);
+    }
+    if (q->tcp_fallback && DNS_TC(data) && idx >= 0 && tcp_retry(up, q, idx, data, (size_t) rc) == 0) {
+        return;
+    }
+    forget(q);
+    schedule(up);
+    q->cb(q, 0, data, (size_t) rc);
+}
+
+static void on_handle_close(uv_handle_t *h) {
+    dns_upstream *up = h->data;
+    if (--up->open_handles == 0) {
+        free(up->recv_buf);
+        free(up);
+    }
+}
+
+dns_upstream *dns_upstream_new(uv_loop_t *loop, uint64_t query_timeout) {
+    dns_upstream *up = calloc(1, sizeof(dns_upstream));
+    up->loop = loop;
+    up->query_timeout = query_timeout;
+    LIST_INIT(&up->queries);
+    up->recv_buf = malloc(DNS_UDP_MAX);
+
+    uv_udp_init(loop, &up->udp);
+    up->udp.data = up;
+    up->open_handles = 1;
+    int r = uv_udp_bind(&up->udp, (const struct sockaddr *) &(struct sockaddr_in6){
+            .sin6_family = AF_INET6,
+            .sin6_addr = in6addr_any,
+    }, 0);
+    if (r != 0) {
+        ZITI_LOG(WARN, "failed to bind upstream socket to IPv6 address: %s", uv_strerror(r));
+        r = uv_udp_bind(&up->udp, (const struct sockaddr *) &(struct sockaddr_in){
+                .sin_family = AF_INET,
+                .sin_addr.s_addr = INADDR_ANY,
+        }, 0);
+        if (r != 0) {
+            ZITI_LOG(WARN, "failed to bind upstream socket to IPv4 address: %s", uv_strerror(r));
+        }
+        up->is_ipv4 = true;
+    }
+    if (r == 0) {
+        r = uv_udp_recv_start(&up->udp, on_recv_alloc, on_recv);
+    }
+    if (r != 0) {
+        ZITI_LOG(ERROR, "failed to open upstream DNS socket: %d(%s)", r, uv_strerror(r));
+        uv_close((uv_handle_t *) &up->udp, on_handle_close);
+        return NULL;
+    }
+    // the socket alone does not keep the loop going, queries in flight do (see schedule)
+    uv_unref((uv_handle_t *) &up->udp);
+
+    uv_timer_init(loop, &up->timer);
+    up->timer.data = up;
+    up->open_handles++;
+    return up;
+}
+
+void dns_upstream_free(dns_upstream *up) {
+    if (up == NULL) {
+        return;
+    }
+    while (!LIST_EMPTY(&up->queries)) {
+        forget(LIST_FIRST(&up->queries));
+    }
+    uv_close((uv_handle_t *) &up->udp, on_handle_close);
+    uv_close((uv_handle_t *) &up->timer, on_handle_close);
+}
+
+void dns_upstream_clear_servers(dns_upstream *up) {
+    up->num_servers = 0;
+    memset(up->rtt, 0, sizeof(up->rtt));
+}
+
+int dns_upstream_add_server(dns_upstream *up, const char *host, uint16_t port) {
+    if (up->num_servers == DNS_UPSTREAM_MAX) {
+        return UV_ENOSPC;
+    }
+
+    union {
+        struct in_addr addr;
+        uint8_t a[4];
+    } ipv4;
+    struct sockaddr_in6 *addr = &up->addr[up->num_servers];
+    memset(addr, 0, sizeof(*addr));
+
+    if (up->is_ipv4) {
+        if (uv_inet_pton(AF_INET, host, &ipv4) != 0) {
+            ZITI_LOG(WARN, "cannot set non-IPv4 upstream on IPv4 only socket");
+            return UV_EAFNOSUPPORT;
+        }
+        struct sockaddr_in *addr4 = (struct sockaddr_in *) addr;
+        addr4->sin_family = AF_INET;
+        addr4->sin_addr = ipv4.addr;
+        addr4->sin_port = htons(port);
+    } else {
+        // set IPv6 upstream address, mapping IPv4 target to IPv6 space (if needed)
+        addr->sin6_family = AF_INET6;
+        addr->sin6_port = htons(port);
+        if (uv_inet_pton(AF_INET6, host, &addr->sin6_addr) != 0) {
+            if (uv_inet_pton(AF_INET, host, &ipv4) == 0) {
+                addr->sin6_addr = (struct in6_addr) IN6ADDR_V4MAPPED(ipv4.a);
+            } else {
+                ZITI_LOG(WARN, "upstream address[%s] is not IP format", host);
+                char port_str[6];
+                snprintf(port_str, sizeof(port_str), "%hu", port);
+                uv_getaddrinfo_t req = {0};
+                if (uv_getaddrinfo(up->loop, &req, NULL, host, port_str, NULL) == 0) {
+                    memcpy(addr, req.addrinfo->ai_addr, req.addrinfo->ai_addrlen);
+                    uv_freeaddrinfo(req.addrinfo);
+                }
+            }
+        }
+    }
+    up->rtt[up->num_servers] = (struct server_rtt_s) {0};
+    up->num_servers++;
+    ZITI_LOG(INFO, "DNS upstream[%d] is set to %s:%hu", up->num_servers, host, port);
+    return 0;
+}
+
+int dns_upstream_server_count(const dns_upstream *up) {
+    return up->num_servers;
+}
+
+int dns_upstream_send(dns_upstream *up, dns_upstream_query *q, const uint8_t *msg, size_t len, size_t section_len,
+                      uint16_t xid, bool tcp_fallback, dns_upstream_cb cb) {
+    memset(q, 0, sizeof(*q));
+    q->tcp_fallback = tcp_fallback;
+    q->msg = msg;
+    q->len = len;
+    q->section_len = section_len;
+    q->xid = xid;
+    q->cb = cb;
+    q->deadline = uv_now(up->loop) + up->query_timeout;
+
+    int rc = send_next(up, q);
+    if (rc != 0) {
+        return rc;
+    }
+    q->up = up;
+    LIST_INSERT_HEAD(&up->queries, q, _next);
+    model_map_set_key(&up->by_xid, &q->xid, sizeof(q->xid), q);
+    schedule(up);
+    return 0;
+}
+
+void dns_upstream_cancel(dns_upstream_query *q) {
+    dns_upstream *up = q->up;
+    if (up != NULL) {
+        forget(q);
+        schedule(up);
+    }
+}
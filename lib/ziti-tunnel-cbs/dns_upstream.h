@@ -0,0 +1,103 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DNS_UPSTREAM_H
+#define ZITI_TUNNELER_SDK_DNS_UPSTREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DNS_UPSTREAM_MAX 5
+
+/** per-attempt timeouts (ms): before a server's round trip was measured, and the bounds of the measured ones */
+#define DNS_UPSTREAM_INITIAL_TIMEOUT 500
+#define DNS_UPSTREAM_MIN_TIMEOUT 100
+#define DNS_UPSTREAM_MAX_TIMEOUT 2000
+
+/** a query fails if no server answered it within this long (ms) */
+#define DNS_UPSTREAM_QUERY_TIMEOUT 5000
+
+/** largest DNS message over tcp, which frames messages with a 2-byte length */
+#define DNS_UPSTREAM_TCP_MAX 65535
+
+/**
+ * forwards queries to upstream DNS servers over one udp socket. a query is sent to the server expected to answer
+ * first. if that server does not answer within its retransmission timeout (RFC 6298 style, from measured round
+ * trips) the query is sent to the next server as well. servers that were asked are not given up on: the first
+ * answer from any of them completes the query, which only fails once the query timeout passed without one.
+ * queries sent with `tcp_fallback` are asked again over tcp when the answer is truncated (TC), the truncated
+ * answer is returned if that fails.
+ */
+typedef struct dns_upstream_s dns_upstream;
+
+typedef struct dns_upstream_query_s dns_upstream_query;
+
+/** called once, with 0 and the answer or with UV_ETIMEDOUT. the answer is only valid during the call */
+typedef void (*dns_upstream_cb)(dns_upstream_query *q, int status, const uint8_t *answer, size_t len);
+
+struct dns_upstream_query_s {
+    dns_upstream *up; // set while the query is in flight
+    const uint8_t *msg; // kept by the caller until the query completes or is cancelled
+    size_t len;
+    size_t section_len; // question section, which answers must repeat
+    uint16_t xid;
+    dns_upstream_cb cb;
+
+    int server; // most recently queried server
+    uint8_t tried; // bitmask of queried servers
+    uint64_t sent[DNS_UPSTREAM_MAX];
+    uint64_t retry_at; // when the next server is tried
+    uint64_t deadline;
+    bool tcp_fallback;
+    struct dns_upstream_tcp_s *tcp; // retry of a truncated answer
+    LIST_ENTRY(dns_upstream_query_s) _next;
+};
+
+/** returns NULL if the socket could not be opened. queries fail after `query_timeout` ms */
+dns_upstream *dns_upstream_new(uv_loop_t *loop, uint64_t query_timeout);
+
+/** queries in flight are dropped without their callbacks */
+void dns_upstream_free(dns_upstream *up);
+
+void dns_upstream_clear_servers(dns_upstream *up);
+
+/** `host` is an IP address, or a name that is resolved right away. returns 0 or an uv error */
+int dns_upstream_add_server(dns_upstream *up, const char *host, uint16_t port);
+
+int dns_upstream_server_count(const dns_upstream *up);
+
+/**
+ * forward query `msg`, which carries `xid` as its ID, and call `cb` with the answer. with `tcp_fallback`, answers
+ * up to DNS_UPSTREAM_TCP_MAX bytes are fetched over tcp instead of returning truncated ones (for tcp clients).
+ * returns 0, or an uv error if no server could be sent the query (`cb` is not called then)
+ */
+int dns_upstream_send(dns_upstream *up, dns_upstream_query *q, const uint8_t *msg, size_t len, size_t section_len,
+                      uint16_t xid, bool tcp_fallback, dns_upstream_cb cb);
+
+/** forget a query in flight, its callback is not called */
+void dns_upstream_cancel(dns_upstream_query *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DNS_UPSTREAM_H
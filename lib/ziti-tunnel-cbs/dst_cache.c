@@ -0,0 +1,433 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <ziti/ziti_log.h>
+
+#if !_WIN32
+#include <arpa/inet.h>
+#endif
+
+#include "dst_cache.h"
+
+struct dst_waiter_s {
+    dst_resolve_cb cb;
+    void *ctx;
+    LIST_ENTRY(dst_waiter_s) _next;
+};
+
+struct dst_cache_entry_s {
+    dst_cache *cache; // NULL once the cache is freed
+    char *key;
+    char *host;
+    char *port;
+    struct addrinfo hints;
+
+    int status;
+    dst_addr **addrs;
+    int n_addrs;
+    unsigned next; // where the next selection starts
+    int family;    // family of the last successful connection race, AF_UNSPEC if none
+    uint64_t expires;
+    uint64_t resolved_at; // time of the last successful lookup
+
+    uv_getaddrinfo_t req;
+    bool resolving;
+    bool notifying; // waiters are being called, the entry must stay
+    LIST_HEAD(, dst_waiter_s) waiters;
+    TAILQ_ENTRY(dst_cache_entry_s) _lru;
+};
+
+static void addr_unref(dst_addr *a) {
+    if (--a->refs == 0) {
+        free(a);
+    }
+}
+
+static socklen_t addr_len(const struct sockaddr *sa) {
+    return sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+static bool same_addr(const dst_addr *a, const struct sockaddr *sa) {
+    return a->addr.ss_family == sa->sa_family && memcmp(&a->addr, sa, addr_len(sa)) == 0;
+}
+
+static dst_addr *new_addr(const struct sockaddr *sa) {
+    dst_addr *a = calloc(1, sizeof(*a));
+    memcpy(&a->addr, sa, addr_len(sa));
+    a->refs = 1;
+
+    char ip[INET6_ADDRSTRLEN] = "?";
+    int port = 0;
+    if (sa->sa_family == AF_INET) {
+        uv_ip4_name((const struct sockaddr_in *) sa, ip, sizeof(ip));
+        port = ntohs(((const struct sockaddr_in *) sa)->sin_port);
+    } else if (sa->sa_family == AF_INET6) {
+        uv_ip6_name((const struct sockaddr_in6 *) sa, ip, sizeof(ip));
+        port = ntohs(((const struct sockaddr_in6 *) sa)->sin6_port);
+    }
+    snprintf(a->name, sizeof(a->name), "%s:%d", ip, port);
+    return a;
+}
+
+static void drop_addrs(struct dst_cache_entry_s *e) {
+    for (int i = 0; i < e->n_addrs; i++) {
+        if (e->addrs[i]) addr_unref(e->addrs[i]);
+    }
+    free(e->addrs);
+    e->addrs = NULL;
+    e->n_addrs = 0;
+}
+
+/** replace the addresses of `e`, keeping the state of those that are still there */
+static void set_addrs(struct dst_cache_entry_s *e, const struct addrinfo *res) {
+    int n = 0;
+    for (const struct addrinfo *r = res; r != NULL; r = r->ai_next) n++;
+
+    dst_addr **addrs = calloc(n > 0 ? n : 1, sizeof(dst_addr *));
+    int count = 0;
+    for (const struct addrinfo *r = res; r != NULL; r = r->ai_next) {
+        if (r->ai_addr == NULL || (r->ai_family != AF_INET && r->ai_family != AF_INET6)) continue;
+
+        bool dup = false;
+        for (int i = 0; i < count && !dup; i++) {
+            dup = same_addr(addrs[i], r->ai_addr);
+        }
+        if (dup) continue;
+
+        dst_addr *a = NULL;
+        for (int i = 0; i < e->n_addrs && a == NULL; i++) {
+            if (e->addrs[i] && same_addr(e->addrs[i], r->ai_addr)) {
+                a = e->addrs[i];
+                e->addrs[i] = NULL;
+            }
+        }
+        addrs[count++] = a ? a : new_addr(r->ai_addr);
+    }
+
+    drop_addrs(e);
+    e->addrs = addrs;
+    e->n_addrs = count;
+    if (e->next >= (unsigned) count) e->next = 0;
+}
+
+static void free_entry(struct dst_cache_entry_s *e) {
+    while (!LIST_EMPTY(&e->waiters)) {
+        struct dst_waiter_s *w = LIST_FIRST(&e->waiters);
+        LIST_REMOVE(w, _next);
+        free(w);
+    }
+    drop_addrs(e);
+    free(e->key);
+    free(e->host);
+    free(e->port);
+    free(e);
+}
+
+void dst_cache_init(dst_cache *cache, uv_loop_t *loop) {
+    memset(cache, 0, sizeof(*cache));
+    cache->loop = loop;
+    TAILQ_INIT(&cache->lru);
+}
+
+void dst_cache_free(dst_cache *cache) {
+    model_map_iter it = model_map_iterator(&cache->entries);
+    while (it != NULL) {
+        struct dst_cache_entry_s *e = model_map_it_value(it);
+        it = model_map_it_remove(it);
+        TAILQ_REMOVE(&cache->lru, e, _lru);
+        if (e->resolving) {
+            // freed when the lookup completes
+            e->cache = NULL;
+        } else {
+            free_entry(e);
+        }
+    }
+}
+
+static void remove_entry(dst_cache *cache, struct dst_cache_entry_s *e) {
+    model_map_remove(&cache->entries, e->key);
+    TAILQ_REMOVE(&cache->lru, e, _lru);
+    free_entry(e);
+}
+
+/** make room for a new entry, starting with the least recently used. entries with lookups in flight stay */
+static void evict_one(dst_cache *cache) {
+    struct dst_cache_entry_s *e;
+    TAILQ_FOREACH(e, &cache->lru, _lru) {
+        if (!e->resolving && !e->notifying) {
+            remove_entry(cache, e);
+            return;
+        }
+    }
+}
+
+static void on_resolved(uv_getaddrinfo_t *req, int status, struct addrinfo *res) {
+    struct dst_cache_entry_s *e = req->data;
+    e->resolving = false;
+
+    if (e->cache == NULL) {
+        if (status == 0) uv_freeaddrinfo(res);
+        while (!LIST_EMPTY(&e->waiters)) {
+            struct dst_waiter_s *w = LIST_FIRST(&e->waiters);
+            LIST_REMOVE(w, _next);
+            w->cb(w->ctx, UV_ECANCELED, NULL);
+            free(w);
+        }
+        free_entry(e);
+        return;
+    }
+
+    uint64_t now = uv_now(e->cache->loop);
+    if (status == 0) {
+        set_addrs(e, res);
+        uv_freeaddrinfo(res);
+        e->status = e->n_addrs > 0 ? 0 : UV_EAI_NONAME;
+        e->expires = now + DST_CACHE_TTL;
+        e->resolved_at = now;
+    } else if (e->n_addrs > 0 && now - e->resolved_at < DST_CACHE_MAX_STALE) {
+        // keep using the last good addresses, try again later
+        ZITI_LOG(DEBUG, "refresh of %s failed: %s, using previous result", e->key, uv_strerror(status));
+        e->expires = now + DST_CACHE_NEG_TTL;
+    } else {
+        drop_addrs(e);
+        e->status = status;
+        e->expires = now + DST_CACHE_NEG_TTL;
+    }
+
+    // waiters may resolve other destinations from the callback
+    e->notifying = true;
+    while (!LIST_EMPTY(&e->waiters)) {
+        struct dst_waiter_s *w = LIST_FIRST(&e->waiters);
+        LIST_REMOVE(w, _next);
+        w->cb(w->ctx, e->n_addrs > 0 ? 0 : e->status, e);
+        free(w);
+    }
+    e->notifying = false;
+}
+
+static int start_lookup(struct dst_cache_entry_s *e) {
+    e->req.data = e;
+    int rc = uv_getaddrinfo(e->cache->loop, &e->req, on_resolved, e->host, e->port, &e->hints);
+    if (rc == 0) {
+        e->resolving = true;
+    }
+    return rc;
+}
+
+static void make_key(char *key, size_t len, const char *host, const char *port, const struct addrinfo *hints) {
+    snprintf(key, len, "%d:%d:%d:%s:%s", hints->ai_family, hints->ai_socktype, hints->ai_protocol, host, port);
+}
+
+void dst_cache_hints(struct addrinfo *hints, const char *host, int protocol) {
+    struct in6_addr ip;
+    memset(hints, 0, sizeof(*hints));
+    hints->ai_protocol = protocol;
+    hints->ai_socktype = protocol == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
+    hints->ai_flags = AI_NUMERICSERV;
+    if (uv_inet_pton(AF_INET, host, &ip) == 0 || uv_inet_pton(AF_INET6, host, &ip) == 0) {
+        hints->ai_flags |= AI_NUMERICHOST;
+    }
+}
+
+int dst_cache_resolve(dst_cache *cache, const char *host, const char *port, const struct addrinfo *hints,
+                      dst_resolve_cb cb, void *ctx) {
+    char key[512];
+    make_key(key, sizeof(key), host, port, hints);
+
+    uint64_t now = uv_now(cache->loop);
+    struct dst_cache_entry_s *e = model_map_get(&cache->entries, key);
+    if (e == NULL) {
+        if (model_map_size(&cache->entries) >= DST_CACHE_MAX_ENTRIES) {
+            evict_one(cache);
+        }
+        e = calloc(1, sizeof(*e));
+        e->cache = cache;
+        e->key = strdup(key);
+        e->host = strdup(host);
+        e->port = strdup(port);
+        e->hints = *hints;
+        LIST_INIT(&e->waiters);
+        model_map_set(&cache->entries, key, e);
+    } else {
+        TAILQ_REMOVE(&cache->lru, e, _lru);
+    }
+    TAILQ_INSERT_TAIL(&cache->lru, e, _lru);
+
+    bool fresh = e->expires > now && (e->n_addrs > 0 || e->status != 0);
+    bool stale_ok = e->n_addrs > 0 && now - e->resolved_at < DST_CACHE_MAX_STALE;
+
+    if (fresh || stale_ok) {
+        if (!e->resolving && (!fresh || e->expires - now < DST_CACHE_REFRESH_AHEAD)) {
+            int rc = start_lookup(e);
+            if (rc != 0) {
+                ZITI_LOG(DEBUG, "background refresh of %s failed to start: %s", key, uv_strerror(rc));
+            }
+        }
+        cb(ctx, e->n_addrs > 0 ? 0 : e->status, e);
+        return 0;
+    }
+
+    if (!e->resolving) {
+        int rc = start_lookup(e);
+        if (rc != 0) {
+            if (LIST_EMPTY(&e->waiters) && e->n_addrs == 0 && e->status == 0) {
+                remove_entry(cache, e);
+            }
+            return rc;
+        }
+    }
+
+    struct dst_waiter_s *w = calloc(1, sizeof(*w));
+    w->cb = cb;
+    w->ctx = ctx;
+    LIST_INSERT_HEAD(&e->waiters, w, _next);
+    return 0;
+}
+
+void dst_cache_cancel(dst_cache *cache, void *ctx) {
+    const char *key;
+    struct dst_cache_entry_s *e;
+    MODEL_MAP_FOREACH(key, e, &cache->entries) {
+        struct dst_waiter_s *w = LIST_FIRST(&e->waiters);
+        while (w != NULL) {
+            struct dst_waiter_s *next = LIST_NEXT(w, _next);
+            if (w->ctx == ctx) {
+                LIST_REMOVE(w, _next);
+                free(w);
+            }
+            w = next;
+        }
+    }
+}
+
+static bool is_skipped(const dst_addr *a, const struct sockaddr_storage *skip, int n_skip) {
+    for (int i = 0; i < n_skip; i++) {
+        if (same_addr(a, (const struct sockaddr *) &skip[i])) return true;
+    }
+    return false;
+}
+
+dst_addr *dst_entry_select(dst_entry *dst, dst_lb_policy policy, int family,
+                           const struct sockaddr_storage *skip, int n_skip) {
+    uint64_t now = uv_now(dst->cache->loop);
+    dst_addr *pick = NULL;
+    int pick_idx = 0;
+
+    // the second pass takes addresses that are down, better than not trying at all
+    for (int pass = 0; pass < 2 && pick == NULL; pass++) {
+        for (int i = 0; i < dst->n_addrs; i++) {
+            int idx = (int) ((dst->next + i) % dst->n_addrs);
+            dst_addr *a = dst->addrs[idx];
+            if ((family != AF_UNSPEC && a->addr.ss_family != family) || is_skipped(a, skip, n_skip) ||
+                (pass == 0 && a->down_until > now)) {
+                continue;
+            }
+            // least connections breaks ties in round-robin order
+            if (pick == NULL || (policy == dst_lb_least_conn && a->active < pick->active)) {
+                pick = a;
+                pick_idx = idx;
+                if (policy == dst_lb_round_robin) break;
+            }
+        }
+    }
+
+    if (pick == NULL) {
+        return NULL;
+    }
+    dst->next = pick_idx + 1;
+    pick->active++;
+    pick->refs++;
+    return pick;
+}
+
+int dst_entry_family(const dst_entry *dst) {
+    return dst->family != AF_UNSPEC ? dst->family : AF_INET6;
+}
+
+void dst_cache_set_family(dst_cache *cache, const char *host, const char *port, const struct addrinfo *hints,
+                          int family) {
+    char key[512];
+    make_key(key, sizeof(key), host, port, hints);
+    struct dst_cache_entry_s *e = model_map_get(&cache->entries, key);
+    if (e != NULL) {
+        e->family = family;
+    }
+}
+
+void dst_addr_report(dst_addr *addr, int status, uint64_t now) {
+    if (status == UV_ECANCELED) {
+        return;
+    }
+    addr->connects++;
+    if (status == 0) {
+        if (addr->failed_in_row >= DST_ADDR_MAX_FAILURES) {
+            ZITI_LOG(INFO, "%s is reachable again", addr->name);
+        }
+        addr->failed_in_row = 0;
+        addr->down_until = 0;
+        return;
+    }
+
+    addr->failures++;
+    addr->failed_in_row++;
+    if (addr->failed_in_row >= DST_ADDR_MAX_FAILURES) {
+        int extra = addr->failed_in_row - DST_ADDR_MAX_FAILURES;
+        uint64_t hold = DST_ADDR_MAX_DOWN_TIME;
+        if (extra < 16 && ((uint64_t) DST_ADDR_DOWN_TIME << extra) < hold) {
+            hold = (uint64_t) DST_ADDR_DOWN_TIME << extra;
+        }
+        addr->down_until = now + hold;
+        ZITI_LOG(WARN, "%s failed %d connects in a row, skipping it for %llums", addr->name, addr->failed_in_row,
+                 (unsigned long long) hold);
+    }
+}
+
+void dst_addr_release(dst_addr *addr) {
+    if (addr == NULL) {
+        return;
+    }
+    addr->active--;
+    addr_unref(addr);
+}
+
+void dst_addr_park(dst_addr *addr) {
+    addr->active--;
+}
+
+void dst_addr_unpark(dst_addr *addr) {
+    addr->active++;
+}
+
+void dst_addr_drop(dst_addr *addr) {
+    if (addr == NULL) {
+        return;
+    }
+    addr_unref(addr);
+}
+
+void dst_cache_foreach_addr(dst_cache *cache, dst_addr_visitor fn, void *ctx) {
+    const char *key;
+    struct dst_cache_entry_s *e;
+    MODEL_MAP_FOREACH(key, e, &cache->entries) {
+        for (int i = 0; i < e->n_addrs; i++) {
+            fn(ctx, e->host, e->port, e->addrs[i]);
+        }
+    }
+}
@@ -0,0 +1,146 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_DST_CACHE_H
+#define ZITI_TUNNELER_SDK_DST_CACHE_H
+
+#include <stdint.h>
+#include <sys/queue.h>
+#include <uv.h>
+#include <ziti/model_support.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** how long resolved addresses are used before they are looked up again (ms) */
+#define DST_CACHE_TTL 30000
+/** how long a failed lookup is remembered (ms) */
+#define DST_CACHE_NEG_TTL 5000
+/** a hit this close to expiry starts a lookup in the background (ms) */
+#define DST_CACHE_REFRESH_AHEAD 5000
+/** expired addresses are still used while a lookup is in flight, up to this long after the last successful one (ms) */
+#define DST_CACHE_MAX_STALE 300000
+/** destinations kept per cache. the least recently used is dropped to make room */
+#define DST_CACHE_MAX_ENTRIES 256
+
+/** connects that fail in a row before an address is taken out of rotation */
+#define DST_ADDR_MAX_FAILURES 3
+/** how long an address stays out of rotation. doubles with every further failure (ms) */
+#define DST_ADDR_DOWN_TIME 5000
+#define DST_ADDR_MAX_DOWN_TIME 120000
+
+/** how connections are spread over the addresses of a destination */
+typedef enum {
+    dst_lb_round_robin,
+    dst_lb_least_conn,
+} dst_lb_policy;
+
+/**
+ * one resolved address of a destination and the connections made to it. the state of an address is kept
+ * when the destination is resolved again and the address is still in the result.
+ */
+typedef struct dst_addr_s {
+    struct sockaddr_storage addr;
+    char name[INET6_ADDRSTRLEN + 8]; // <ip>:<port>
+    int active;          // connections using the address
+    uint64_t connects;   // connects that completed or failed
+    uint64_t failures;   // connects that failed
+    int failed_in_row;
+    uint64_t down_until; // skipped until then, unless all addresses are down
+    int refs;
+} dst_addr;
+
+typedef struct dst_cache_entry_s dst_entry;
+
+/**
+ * called with the destination, or status < 0 if it could not be resolved.
+ * `dst` is owned by the cache and is only valid during the callback.
+ */
+typedef void (*dst_resolve_cb)(void *ctx, int status, dst_entry *dst);
+
+typedef void (*dst_addr_visitor)(void *ctx, const char *host, const char *port, const dst_addr *addr);
+
+/**
+ * results of getaddrinfo for hosted service destinations, keyed on (host, port, protocol).
+ * getaddrinfo does not report TTLs, so entries live for DST_CACHE_TTL. callers that ask for an entry that
+ * is being looked up wait for the lookup in flight instead of starting another one.
+ */
+typedef struct dst_cache_s {
+    uv_loop_t *loop;
+    model_map entries; // map[key -> struct dst_cache_entry_s]
+    TAILQ_HEAD(dst_lru_s, dst_cache_entry_s) lru; // entries, least recently used first
+} dst_cache;
+
+void dst_cache_init(dst_cache *cache, uv_loop_t *loop);
+
+/** drop all entries. waiters of lookups in flight are called with UV_ECANCELED when the lookup completes */
+void dst_cache_free(dst_cache *cache);
+
+/**
+ * lookup hints for `host` with `protocol` (IPPROTO_TCP or IPPROTO_UDP). everyone resolving a destination
+ * must use these, as the hints of the first lookup are kept for the cache entry.
+ */
+void dst_cache_hints(struct addrinfo *hints, const char *host, int protocol);
+
+/**
+ * resolve `host`:`port`. `cb` is called before this returns if the cache has a usable result,
+ * otherwise when the lookup completes. returns 0, or a uv error if the lookup could not be started.
+ */
+int dst_cache_resolve(dst_cache *cache, const char *host, const char *port, const struct addrinfo *hints,
+                      dst_resolve_cb cb, void *ctx);
+
+/** stop waiting for lookups on behalf of `ctx` */
+void dst_cache_cancel(dst_cache *cache, void *ctx);
+
+/**
+ * pick an address of `dst` in `family` (or any family with AF_UNSPEC) for a new connection, leaving out the
+ * `n_skip` addresses in `skip`. addresses that are down are only picked when no other address is left.
+ * returns NULL if every address was skipped. the address must be released with dst_addr_release.
+ */
+dst_addr *dst_entry_select(dst_entry *dst, dst_lb_policy policy, int family,
+                           const struct sockaddr_storage *skip, int n_skip);
+
+/** the address family to try first: the one that connected last, or IPv6 (RFC 8305) */
+int dst_entry_family(const dst_entry *dst);
+
+/** remember the address family that won a connection race to `host`:`port` */
+void dst_cache_set_family(dst_cache *cache, const char *host, const char *port, const struct addrinfo *hints,
+                          int family);
+
+/** record the outcome of a connection to `addr` */
+void dst_addr_report(dst_addr *addr, int status, uint64_t now);
+
+/** the connection to `addr` is gone */
+void dst_addr_release(dst_addr *addr);
+
+/** the connection to `addr` is held open but not used by a client, it no longer counts as active */
+void dst_addr_park(dst_addr *addr);
+
+/** a parked connection to `addr` is handed to a client, it counts as active again */
+void dst_addr_unpark(dst_addr *addr);
+
+/** the parked connection to `addr` is gone */
+void dst_addr_drop(dst_addr *addr);
+
+/** call `fn` for each resolved address in the cache */
+void dst_cache_foreach_addr(dst_cache *cache, dst_addr_visitor fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_DST_CACHE_H
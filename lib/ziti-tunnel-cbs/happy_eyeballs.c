@@ -0,0 +1,238 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ziti/ziti_log.h>
+
+#if _WIN32
+#define sock_close(s) closesocket(s)
+#define sock_error() WSAGetLastError()
+#define SOCK_IN_PROGRESS(e) ((e) == WSAEWOULDBLOCK)
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#define sock_close(s) close(s)
+#define sock_error() errno
+#define SOCK_IN_PROGRESS(e) ((e) == EINPROGRESS)
+#endif
+
+#include "happy_eyeballs.h"
+
+#define INVALID_SOCK ((uv_os_sock_t) -1)
+
+struct he_attempt_s {
+    he_race *race;
+    dst_addr *addr;
+    uv_os_sock_t sock;
+    uv_poll_t poll;
+    bool polling; // poll handle is initialized and not closed yet
+};
+
+struct he_race_s {
+    uv_loop_t *loop;
+    struct he_attempt_s attempts[2];
+    int n_attempts;
+    int started;
+    int failed;
+    uv_timer_t timer;
+    int open_handles; // the race is freed when all are closed
+    bool done;
+    he_race_cb cb;
+    void *ctx;
+};
+
+static void start_attempt(he_race *race);
+
+static int set_nonblocking(uv_os_sock_t s) {
+#if _WIN32
+    u_long on = 1;
+    return ioctlsocket(s, FIONBIO, &on) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(s, F_GETFL);
+    return flags < 0 ? -1 : fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+static void handle_closed(he_race *race) {
+    if (--race->open_handles == 0) {
+        free(race);
+    }
+}
+
+static void on_timer_close(uv_handle_t *h) {
+    handle_closed(h->data);
+}
+
+static void on_attempt_close(uv_handle_t *h) {
+    struct he_attempt_s *a = h->data;
+    if (a->sock != INVALID_SOCK) {
+        sock_close(a->sock);
+        a->sock = INVALID_SOCK;
+    }
+    handle_closed(a->race);
+}
+
+/** stop the attempt. its socket is closed unless it was taken */
+static void end_attempt(struct he_attempt_s *a) {
+    if (a->polling) {
+        a->polling = false;
+        uv_poll_stop(&a->poll);
+        uv_close((uv_handle_t *) &a->poll, on_attempt_close);
+    } else if (a->sock != INVALID_SOCK) {
+        sock_close(a->sock);
+        a->sock = INVALID_SOCK;
+    }
+    dst_addr_release(a->addr);
+    a->addr = NULL;
+}
+
+static void finish(he_race *race, struct he_attempt_s *winner, int status) {
+    uv_os_sock_t sock = INVALID_SOCK;
+    dst_addr *addr = NULL;
+    if (winner) {
+        sock = winner->sock;
+        winner->sock = INVALID_SOCK;
+        addr = winner->addr;
+        winner->addr = NULL;
+    }
+
+    race->done = true;
+    for (int i = 0; i < race->n_attempts; i++) {
+        end_attempt(&race->attempts[i]);
+    }
+    uv_close((uv_handle_t *) &race->timer, on_timer_close);
+    race->cb(race->ctx, status, sock, addr);
+}
+
+static void attempt_failed(struct he_attempt_s *a, int err) {
+    he_race *race = a->race;
+    ZITI_LOG(DEBUG, "connect to %s failed: %s", a->addr->name, uv_strerror(err));
+    dst_addr_report(a->addr, err, uv_now(race->loop));
+    end_attempt(a);
+    race->failed++;
+
+    if (race->started < race->n_attempts) {
+        // no reason to wait for the delay
+        uv_timer_stop(&race->timer);
+        start_attempt(race);
+    } else if (race->failed == race->n_attempts) {
+        finish(race, NULL, err);
+    }
+}
+
+static void on_attempt_event(uv_poll_t *p, int status, int events) {
+    struct he_attempt_s *a = p->data;
+    he_race *race = a->race;
+
+    // libuv reports a socket error as UV_EBADF, the socket knows what actually went wrong
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(a->sock, SOL_SOCKET, SO_ERROR, (char *) &err, &err_len) != 0) {
+        err = uv_translate_sys_error(sock_error());
+    } else if (err != 0) {
+        err = uv_translate_sys_error(err);
+    } else if (status < 0) {
+        err = status;
+    }
+
+    if (err != 0) {
+        attempt_failed(a, err);
+        return;
+    }
+
+    dst_addr_report(a->addr, 0, uv_now(race->loop));
+    if (race->started - race->failed > 1) {
+        ZITI_LOG(DEBUG, "connected to %s first", a->addr->name);
+    }
+    finish(race, a, 0);
+}
+
+static void start_attempt(he_race *race) {
+    struct he_attempt_s *a = &race->attempts[race->started++];
+    const struct sockaddr *sa = (const struct sockaddr *) &a->addr->addr;
+    socklen_t sa_len = sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+    a->sock = socket(sa->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (a->sock == INVALID_SOCK) {
+        attempt_failed(a, uv_translate_sys_error(sock_error()));
+        return;
+    }
+    // a connect that completes right away is reported by the poll as well
+    if (set_nonblocking(a->sock) != 0 ||
+        (connect(a->sock, sa, sa_len) != 0 && !SOCK_IN_PROGRESS(sock_error()))) {
+        attempt_failed(a, uv_translate_sys_error(sock_error()));
+        return;
+    }
+
+    int rc = uv_poll_init_socket(race->loop, &a->poll, a->sock);
+    if (rc != 0) {
+        attempt_failed(a, rc);
+        return;
+    }
+    a->poll.data = a;
+    a->polling = true;
+    race->open_handles++;
+    uv_poll_start(&a->poll, UV_WRITABLE, on_attempt_event);
+}
+
+static void on_attempt_delay(uv_timer_t *t) {
+    he_race *race = t->data;
+    ZITI_LOG(DEBUG, "%s did not connect within %dms, trying %s as well", race->attempts[0].addr->name,
+             HE_CONNECTION_ATTEMPT_DELAY, race->attempts[1].addr->name);
+    start_attempt(race);
+}
+
+he_race *he_race_start(uv_loop_t *loop, dst_addr *first, dst_addr *second, he_race_cb cb, void *ctx) {
+    he_race *race = calloc(1, sizeof(he_race));
+    race->loop = loop;
+    race->cb = cb;
+    race->ctx = ctx;
+    race->attempts[0].addr = first;
+    race->attempts[1].addr = second;
+    race->n_attempts = second ? 2 : 1;
+    for (int i = 0; i < 2; i++) {
+        race->attempts[i].race = race;
+        race->attempts[i].sock = INVALID_SOCK;
+    }
+
+    uv_timer_init(loop, &race->timer);
+    race->timer.data = race;
+    race->open_handles = 1;
+
+    start_attempt(race);
+    if (race->done) {
+        return NULL;
+    }
+    if (race->started < race->n_attempts) {
+        uv_timer_start(&race->timer, on_attempt_delay, HE_CONNECTION_ATTEMPT_DELAY, 0);
+    }
+    return race;
+}
+
+void he_race_cancel(he_race *race) {
+    if (race == NULL || race->done) {
+        return;
+    }
+    race->done = true;
+    for (int i = 0; i < race->n_attempts; i++) {
+        end_attempt(&race->attempts[i]);
+    }
+    uv_close((uv_handle_t *) &race->timer, on_timer_close);
+}
@@ -0,0 +1,56 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_HAPPY_EYEBALLS_H
+#define ZITI_TUNNELER_SDK_HAPPY_EYEBALLS_H
+
+#include <uv.h>
+#include "dst_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** how long the first connect may take before the second address is tried too, RFC 8305 section 5 (ms) */
+#define HE_CONNECTION_ATTEMPT_DELAY 250
+
+/**
+ * TCP connect that races two server addresses, usually one IPv6 and one IPv4 (RFC 8305).
+ * the second address is tried when the first fails, or has not connected after HE_CONNECTION_ATTEMPT_DELAY.
+ * the first connection to be established wins and the other attempt is abandoned.
+ */
+typedef struct he_race_s he_race;
+
+/**
+ * called once with the connected socket and its address, or status < 0 if both attempts failed.
+ * on success the callee owns `sock` and the reference to `addr`.
+ */
+typedef void (*he_race_cb)(void *ctx, int status, uv_os_sock_t sock, dst_addr *addr);
+
+/**
+ * start connecting to `first`, and later to `second` if it is not NULL. the race owns both address references.
+ * if no attempt could be started, `cb` is called before this returns and NULL is returned.
+ */
+he_race *he_race_start(uv_loop_t *loop, dst_addr *first, dst_addr *second, he_race_cb cb, void *ctx);
+
+/** abandon the race. `cb` is not called */
+void he_race_cancel(he_race *race);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_HAPPY_EYEBALLS_H
@@ -0,0 +1,57 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "hosted_metrics.h"
+
+static int bucket_of(uint64_t us) {
+    int b = 0;
+    while (us != 0 && b < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void latency_record(latency_histogram *h, uint64_t us) {
+    h->count++;
+    h->sum += us;
+    if (us > h->max) {
+        h->max = us;
+    }
+    h->buckets[bucket_of(us)]++;
+}
+
+uint64_t latency_percentile(const latency_histogram *h, double pct) {
+    if (h->count == 0) {
+        return 0;
+    }
+    // nearest rank
+    double exact = pct * (double) h->count / 100.0;
+    uint64_t rank = (uint64_t) exact;
+    if ((double) rank < exact) rank++;
+    if (rank < 1) rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            uint64_t bound = b == 0 ? 0 : (UINT64_C(1) << b) - 1;
+            return bound < h->max ? bound : h->max;
+        }
+    }
+    return h->max;
+}
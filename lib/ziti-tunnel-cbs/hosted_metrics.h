@@ -0,0 +1,60 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_HOSTED_METRICS_H
+#define ZITI_TUNNELER_SDK_HOSTED_METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * latency buckets (microseconds). bucket `i` counts samples of `i` significant bits, i.e. below 2^i us.
+ * the last bucket takes everything from 2^(LATENCY_BUCKETS-2) us (~8s) up.
+ */
+#define LATENCY_BUCKETS 25
+
+/** fixed size histogram, recording a sample is a handful of shifts and adds */
+typedef struct latency_histogram_s {
+    uint64_t count;
+    uint64_t sum; // us
+    uint64_t max; // us
+    uint64_t buckets[LATENCY_BUCKETS];
+} latency_histogram;
+
+/** counters of a hosted service, kept for as long as the service is hosted */
+typedef struct hosted_metrics_s {
+    uint64_t connections;      // clients that came in
+    uint64_t active;           // clients connected to the server now
+    uint64_t connect_failures; // clients that started connecting to the server but never got there
+    uint64_t bytes_to_server;  // only counted for clients the tunneler bridges itself
+    uint64_t bytes_to_client;
+    latency_histogram connect;    // from starting to connect to the server until connected
+    latency_histogram first_byte; // from the client coming in until the first server data was relayed to it
+} hosted_metrics;
+
+void latency_record(latency_histogram *h, uint64_t us);
+
+/** upper bound (us) of the bucket that holds the `pct` percentile, capped at the largest sample. 0 if empty */
+uint64_t latency_percentile(const latency_histogram *h, double pct);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_HOSTED_METRICS_H
@@ -37,12 +37,58 @@ int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_
 
 int ziti_dns_set_upstream(uv_loop_t *l, tunnel_upstream_dns_array upstreams);
 
+/**
+ * answer AAAA queries for ziti hostnames with addresses from `ipv6_cidr` (prefix length up to 96).
+ * each hostname's IPv6 address carries the host bits of its IPv4 address.
+ */
+int ziti_dns_set_ipv6_range(const char *ipv6_cidr);
+
+/**
+ * keep hostname to IP mappings in `path`, and give hostnames the addresses they had in the previous run.
+ * new mappings are written to the file in batches, from a timer on `loop`.
+ * call after ziti_dns_setup and before services are registered. a NULL `path` stops keeping mappings, and writes
+ * the ones that are still buffered.
+ */
+int ziti_dns_set_state_file(uv_loop_t *loop, const char *path);
+
+/** return the IPv6 address assigned along with `addr`, or NULL */
+const ip_addr_t *ziti_dns_ipv6_addr(const ip_addr_t *addr);
+
+typedef struct ziti_dns_cache_stats_s {
+    uint64_t hits;
+    uint64_t misses;
+    size_t entries;
+    size_t bytes;
+    size_t limit;
+} ziti_dns_cache_stats;
+
+/** default memory limit (in bytes) of the DNS response caches */
+#define ZITI_DNS_DEFAULT_CACHE_LIMIT 262144
+
+/** set the memory limit (in bytes) shared by the upstream and wildcard proxy response caches. 0 disables caching */
+void ziti_dns_set_cache_limit(size_t limit);
+
+void ziti_dns_get_cache_stats(ziti_dns_cache_stats *stats);
+
 const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *intercept);
 
 const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr);
 
+/**
+ * call `visit` for each intercept with a wildcard domain that covers the hostname assigned to `addr`, from the most
+ * to the least specific domain. ziti_dns_setup registers this with the tunneler to match wildcard intercepts.
+ */
+void ziti_dns_match_intercept_domains(const ip_addr_t *addr, intercept_domain_visitor visit, void *ctx);
+
 const char *ziti_dns_reverse_lookup(const char *ip_addr);
 
+/**
+ * track connections to addresses assigned by ziti DNS.
+ * addresses of wildcard matches are reclaimed for new names only when they have no connections.
+ */
+void ziti_dns_conn_start(const ip_addr_t *addr);
+void ziti_dns_conn_end(const ip_addr_t *addr);
+
 void ziti_dns_deregister_intercept(void *intercept);
 
 #ifdef __cplusplus
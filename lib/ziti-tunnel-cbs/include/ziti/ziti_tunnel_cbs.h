@@ -44,7 +44,8 @@ XX(dst_port, model_string, none, dst_port, __VA_ARGS__)\
 XX(src_protocol, model_string, none, src_protocol, __VA_ARGS__)\
 XX(src_ip, model_string, none, src_ip, __VA_ARGS__)\
 XX(src_port, model_string, none, src_port, __VA_ARGS__)\
-XX(source_addr, model_string, none, source_addr, __VA_ARGS__)
+XX(source_addr, model_string, none, source_addr, __VA_ARGS__)\
+XX(dns_format, model_string, none, dns_format, __VA_ARGS__)
 
 DECLARE_ENUM(TunnelConnectionType, TUNNELER_CONN_TYPE_ENUM)
 
@@ -73,7 +74,9 @@ XX(StatusChange, __VA_ARGS__)   \
 XX(AddIdentity, __VA_ARGS__)    \
 XX(Enroll, __VA_ARGS__)         \
 XX(ExternalAuth, __VA_ARGS__)   \
-XX(SetUpstreamDNS, __VA_ARGS__)
+XX(SetUpstreamDNS, __VA_ARGS__) \
+XX(GetHostedBackends, __VA_ARGS__) \
+XX(GetHostedMetrics, __VA_ARGS__)
 
 DECLARE_ENUM(TunnelCommand, TUNNEL_COMMANDS)
 
@@ -187,6 +190,50 @@ XX(ext_auth_url, model_string, none, url, __VA_ARGS__)
 XX(host, model_string, none, host, __VA_ARGS__) \
 XX(port, model_number, none, port, __VA_ARGS__)
 
+#define TNL_HOSTED_BACKEND(XX, ...) \
+XX(service, model_string, none, Service, __VA_ARGS__) \
+XX(destination, model_string, none, Destination, __VA_ARGS__) \
+XX(address, model_string, none, Address, __VA_ARGS__) \
+XX(active, model_number, none, ActiveConnections, __VA_ARGS__) \
+XX(connects, model_number, none, Connects, __VA_ARGS__) \
+XX(failures, model_number, none, ConnectFailures, __VA_ARGS__) \
+XX(down, model_bool, none, Down, __VA_ARGS__)
+
+#define TNL_HOSTED_SERVICE(XX, ...) \
+XX(service, model_string, none, Service, __VA_ARGS__) \
+XX(active, model_number, none, ActiveConnections, __VA_ARGS__) \
+XX(pending, model_number, none, PendingConnects, __VA_ARGS__) \
+XX(queued, model_number, none, QueueDepth, __VA_ARGS__) \
+XX(admitted, model_number, none, Admitted, __VA_ARGS__) \
+XX(rejected, model_number, none, Rejected, __VA_ARGS__) \
+XX(timed_out, model_number, none, TimedOut, __VA_ARGS__)
+
+#define TNL_HOSTED_BACKENDS(XX, ...) \
+XX(services, tunnel_hosted_service, array, Services, __VA_ARGS__) \
+XX(backends, tunnel_hosted_backend, array, Backends, __VA_ARGS__)
+
+// latencies are in microseconds
+#define TNL_LATENCY(XX, ...) \
+XX(count, model_number, none, Count, __VA_ARGS__) \
+XX(mean, model_number, none, Mean, __VA_ARGS__) \
+XX(p50, model_number, none, P50, __VA_ARGS__) \
+XX(p90, model_number, none, P90, __VA_ARGS__) \
+XX(p99, model_number, none, P99, __VA_ARGS__) \
+XX(max, model_number, none, Max, __VA_ARGS__)
+
+#define TNL_HOSTED_SERVICE_METRICS(XX, ...) \
+XX(service, model_string, none, Service, __VA_ARGS__) \
+XX(connections, model_number, none, Connections, __VA_ARGS__) \
+XX(active, model_number, none, ActiveConnections, __VA_ARGS__) \
+XX(connect_failures, model_number, none, ConnectFailures, __VA_ARGS__) \
+XX(bytes_to_server, model_number, none, BytesToServer, __VA_ARGS__) \
+XX(bytes_to_client, model_number, none, BytesToClient, __VA_ARGS__) \
+XX(connect_latency, tunnel_latency, ptr, ConnectLatency, __VA_ARGS__) \
+XX(first_byte_latency, tunnel_latency, ptr, FirstByteLatency, __VA_ARGS__)
+
+#define TNL_HOSTED_METRICS(XX, ...) \
+XX(services, tunnel_hosted_service_metrics, array, Services, __VA_ARGS__)
+
 #define TNL_ENROLL(XX, ...) \
 XX(name, model_string, none, name, __VA_ARGS__) \
 XX(jwt, model_string, none, jwt, __VA_ARGS__) \
@@ -219,6 +266,12 @@ DECLARE_MODEL(tunnel_status_change, TUNNEL_STATUS_CHANGE)
 DECLARE_MODEL(tunnel_add_identity, TUNNEL_ADD_IDENTITY)
 DECLARE_MODEL(tunnel_upstream_dns, TUNNEL_UPSTREAM_DNS)
 DECLARE_MODEL(tunnel_enroll, TNL_ENROLL)
+DECLARE_MODEL(tunnel_hosted_backend, TNL_HOSTED_BACKEND)
+DECLARE_MODEL(tunnel_hosted_service, TNL_HOSTED_SERVICE)
+DECLARE_MODEL(tunnel_hosted_backends, TNL_HOSTED_BACKENDS)
+DECLARE_MODEL(tunnel_latency, TNL_LATENCY)
+DECLARE_MODEL(tunnel_hosted_service_metrics, TNL_HOSTED_SERVICE_METRICS)
+DECLARE_MODEL(tunnel_hosted_metrics, TNL_HOSTED_METRICS)
 
 DECLARE_MODEL(tunnel_ext_auth, TUNNEL_EXT_AUTH)
 
@@ -303,6 +356,8 @@ typedef struct ziti_io_ctx_s {
     bool ziti_eof;
     bool tnlr_eof;
     uint64_t pending_wbytes;
+    bool dns_conn; // dns_addr was assigned by ziti DNS
+    ip_addr_t dns_addr;
 } ziti_io_context;
 
 
@@ -334,6 +389,67 @@ int ziti_sdk_c_close_write(void *io_ctx);
 
 host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service_name, cfg_type_e cfgtype, const void *cfg);
 
+/**
+ * keep `size` TCP connections to the server of hosted service `service_name` established ahead of
+ * incoming clients. only applies to services that connect to a fixed address and port. 0 disables.
+ * takes effect when the service is (re)hosted.
+ */
+void ziti_sdk_c_set_warm_pool(const char *service_name, int size);
+
+/**
+ * choose how connections of hosted service `service_name` are spread over the addresses its server
+ * resolves to: "round-robin" (the default) or "least-conn". returns -1 if `policy` is not known.
+ * takes effect when the service is (re)hosted.
+ */
+int ziti_sdk_c_set_lb_policy(const char *service_name, const char *policy);
+
+/**
+ * mark hosted udp service `service_name` as one-way: its server never replies (e.g. syslog). the clients of a
+ * one-way service are relayed through `sockets` sockets per server address instead of a socket per client.
+ * datagrams the server sends back cannot be matched to a client and are dropped. 0 clears the mark.
+ * takes effect when the service is (re)hosted.
+ */
+void ziti_sdk_c_set_udp_one_way(const char *service_name, int sockets);
+
+/** settings of the tunneler's own tcp bridge. 0 uses the default */
+typedef struct hosted_tcp_bridge_opts_s {
+    int read_size;  // bytes read from the server at once
+    int max_queued; // bytes queued toward either side before the other side is held back
+} hosted_tcp_bridge_opts;
+
+/**
+ * move the data of hosted tcp service `service_name` with the tunneler's own bridge, which counts bytes
+ * and stalls per connection, instead of the sdk's. NULL goes back to the sdk's bridge.
+ * takes effect when the service is (re)hosted.
+ */
+void ziti_sdk_c_set_tcp_bridge(const char *service_name, const hosted_tcp_bridge_opts *opts);
+
+/** limits for the clients of a hosted service. 0 means no limit */
+typedef struct hosted_service_limits_s {
+    int max_conns;     // clients using the server at once, including those still connecting
+    int max_pending;   // clients connecting to the server at once
+    int rate;          // new clients per second
+    int burst;         // clients admitted at once while under `rate`. defaults to `rate`
+    int queue_size;    // clients that may wait for a slot, others are rejected right away
+    int queue_timeout; // how long a client may wait for a slot (ms)
+} hosted_service_limits;
+
+/**
+ * limit the clients of hosted service `service_name`. NULL removes the limits.
+ * takes effect when the service is (re)hosted.
+ */
+void ziti_sdk_c_set_service_limits(const char *service_name, const hosted_service_limits *limits);
+
+/** admission counters of all hosted services, and connection counts of their server addresses */
+void ziti_sdk_c_get_hosted_backends(tunnel_hosted_backends *backends);
+
+/**
+ * connection and byte counters, server connect and first byte latencies of all hosted services.
+ * bytes and first byte latency are only seen for clients the tunneler relays itself: udp clients,
+ * and tcp clients of services set up with ziti_sdk_c_set_tcp_bridge().
+ */
+void ziti_sdk_c_get_hosted_metrics(tunnel_hosted_metrics *metrics);
+
 /** passed to ziti-sdk via ziti_options.service_cb */
 tunneled_service_t *ziti_sdk_c_on_service(ziti_context ziti_ctx, ziti_service *service, int status, void *tnlr_ctx);
 
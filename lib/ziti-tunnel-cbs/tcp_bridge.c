@@ -0,0 +1,344 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <ziti/ziti_log.h>
+
+#include "tcp_bridge.h"
+
+typedef struct tcp_buf_s {
+    tcp_bridge *bridge;
+    uv_write_t req;
+    size_t len;
+    size_t cap;
+    STAILQ_ENTRY(tcp_buf_s) _next;
+    char data[];
+} tcp_buf;
+
+#define buf_of(p) ((tcp_buf *) ((char *) (p) - offsetof(tcp_buf, data)))
+
+struct tcp_bridge_pool_s {
+    uv_loop_t *loop;
+    size_t read_size;
+    size_t max_queued;
+    tcp_bridge_client_ops ops;
+    STAILQ_HEAD(, tcp_buf_s) free_bufs;
+    int n_free;
+    int refs; // owner and bridges
+};
+
+struct tcp_bridge_s {
+    tcp_bridge_pool *pool;
+    ziti_connection clt;
+    uv_tcp_t *server;
+    tcp_bridge_done_cb done_cb;
+    void *ctx;
+    uv_alloc_cb alloc_cb;
+    uv_read_cb read_cb;
+
+    size_t to_client_queued; // ziti writes not completed yet
+    int in_flight;           // writes and shutdown the bridge waits for before it can be released
+    bool client_stalled;
+    bool server_stalled;
+    bool server_eof;
+    bool client_eof;
+    bool shutdown_done;
+    bool done;
+    bool closed;
+    uint64_t server_stall_since;
+    uint64_t client_stall_since;
+    tcp_bridge_stats stats;
+};
+
+static tcp_buf *pool_get(tcp_bridge_pool *pool, size_t len) {
+    tcp_buf *tb = STAILQ_FIRST(&pool->free_bufs);
+    if (len <= pool->read_size && tb != NULL) {
+        STAILQ_REMOVE_HEAD(&pool->free_bufs, _next);
+        pool->n_free--;
+    } else {
+        size_t cap = len > pool->read_size ? len : pool->read_size;
+        tb = malloc(sizeof(tcp_buf) + cap);
+        tb->cap = cap;
+    }
+    tb->len = len;
+    tb->req.data = tb;
+    return tb;
+}
+
+static void pool_put(tcp_bridge_pool *pool, tcp_buf *tb) {
+    if (tb->cap == pool->read_size && pool->n_free < TCP_BRIDGE_POOL_SIZE) {
+        STAILQ_INSERT_HEAD(&pool->free_bufs, tb, _next);
+        pool->n_free++;
+    } else {
+        free(tb);
+    }
+}
+
+static void pool_unref(tcp_bridge_pool *pool) {
+    if (--pool->refs > 0) {
+        return;
+    }
+    while (!STAILQ_EMPTY(&pool->free_bufs)) {
+        tcp_buf *tb = STAILQ_FIRST(&pool->free_bufs);
+        STAILQ_REMOVE_HEAD(&pool->free_bufs, _next);
+        free(tb);
+    }
+    free(pool);
+}
+
+static void bridge_release(tcp_bridge *b) {
+    if (b->closed && b->in_flight == 0) {
+        pool_unref(b->pool);
+        free(b);
+    }
+}
+
+static void finish(tcp_bridge *b, const char *err) {
+    if (b->done || b->closed) {
+        return;
+    }
+    b->done = true;
+    b->done_cb(b->ctx, err);
+}
+
+static void check_done(tcp_bridge *b) {
+    if (b->server_eof && b->client_eof && b->shutdown_done) {
+        finish(b, NULL);
+    }
+}
+
+static void pause_reading(tcp_bridge *b) {
+    uv_read_stop((uv_stream_t *) b->server);
+    b->client_stalled = true;
+    b->stats.client_stalls++;
+    b->client_stall_since = uv_now(b->pool->loop);
+}
+
+static void resume_reading(tcp_bridge *b) {
+    b->client_stalled = false;
+    b->stats.client_stall_ms += uv_now(b->pool->loop) - b->client_stall_since;
+    int rc = uv_read_start((uv_stream_t *) b->server, b->alloc_cb, b->read_cb);
+    if (rc != 0) {
+        finish(b, uv_strerror(rc));
+    }
+}
+
+static void pause_client(tcp_bridge *b) {
+    b->server_stalled = true;
+    b->stats.server_stalls++;
+    b->server_stall_since = uv_now(b->pool->loop);
+}
+
+static void resume_client(tcp_bridge *b) {
+    b->server_stalled = false;
+    b->stats.server_stall_ms += uv_now(b->pool->loop) - b->server_stall_since;
+    b->pool->ops.resume(b->clt);
+}
+
+static void on_client_write(ziti_connection clt, ssize_t status, void *ctx) {
+    tcp_buf *tb = ctx;
+    tcp_bridge *b = tb->bridge;
+    b->to_client_queued -= tb->len;
+    b->in_flight--;
+    if (status >= 0) {
+        b->stats.to_client += tb->len;
+    }
+    pool_put(b->pool, tb);
+
+    if (status < 0) {
+        finish(b, ziti_errorstr((int) status));
+    } else if (b->client_stalled && !b->done && !b->closed &&
+               b->to_client_queued <= b->pool->max_queued / 2) {
+        resume_reading(b);
+    }
+    bridge_release(b);
+}
+
+static void on_server_write(uv_write_t *req, int status) {
+    tcp_buf *tb = req->data;
+    tcp_bridge *b = tb->bridge;
+    if (status == 0) {
+        b->stats.to_server += tb->len;
+    }
+    pool_put(b->pool, tb);
+
+    if (status < 0 && status != UV_ECANCELED) {
+        finish(b, uv_strerror(status));
+    } else if (b->server_stalled && !b->done && !b->closed &&
+               uv_stream_get_write_queue_size((uv_stream_t *) b->server) <= b->pool->max_queued / 2) {
+        // client data may come in right away. this write keeps the bridge around until it is handled
+        resume_client(b);
+    }
+    b->in_flight--;
+    bridge_release(b);
+}
+
+static void on_server_shutdown(uv_shutdown_t *req, int status) {
+    tcp_bridge *b = req->data;
+    free(req);
+    b->in_flight--;
+    b->shutdown_done = true;
+    if (status < 0 && status != UV_ECANCELED) {
+        finish(b, uv_strerror(status));
+    } else {
+        check_done(b);
+    }
+    bridge_release(b);
+}
+
+tcp_bridge_pool *tcp_bridge_pool_new(uv_loop_t *loop, int read_size, int max_queued, const tcp_bridge_client_ops *ops) {
+    tcp_bridge_pool *pool = calloc(1, sizeof(tcp_bridge_pool));
+    pool->loop = loop;
+    pool->ops = *ops;
+    pool->read_size = read_size > 0 ? (size_t) read_size : TCP_BRIDGE_READ_SIZE;
+    pool->max_queued = max_queued > 0 ? (size_t) max_queued : TCP_BRIDGE_MAX_QUEUED;
+    STAILQ_INIT(&pool->free_bufs);
+    pool->refs = 1;
+    return pool;
+}
+
+void tcp_bridge_pool_free(tcp_bridge_pool *pool) {
+    if (pool != NULL) {
+        pool_unref(pool);
+    }
+}
+
+tcp_bridge *tcp_bridge_new(tcp_bridge_pool *pool, ziti_connection clt, uv_tcp_t *server,
+                           tcp_bridge_done_cb done_cb, void *ctx) {
+    tcp_bridge *b = calloc(1, sizeof(tcp_bridge));
+    b->pool = pool;
+    b->clt = clt;
+    b->server = server;
+    b->done_cb = done_cb;
+    b->ctx = ctx;
+    pool->refs++;
+    return b;
+}
+
+int tcp_bridge_start(tcp_bridge *b, uv_alloc_cb alloc_cb, uv_read_cb read_cb) {
+    b->alloc_cb = alloc_cb;
+    b->read_cb = read_cb;
+    return uv_read_start((uv_stream_t *) b->server, alloc_cb, read_cb);
+}
+
+void tcp_bridge_alloc(tcp_bridge *b, uv_buf_t *buf) {
+    tcp_buf *tb = pool_get(b->pool, b->pool->read_size);
+    buf->base = tb->data;
+    buf->len = tb->cap;
+}
+
+void tcp_bridge_read(tcp_bridge *b, ssize_t nread, const uv_buf_t *buf) {
+    tcp_buf *tb = buf->base ? buf_of(buf->base) : NULL;
+    if (nread > 0 && !b->done && !b->closed) {
+        tb->len = (size_t) nread;
+        tb->bridge = b;
+        b->to_client_queued += tb->len;
+        b->in_flight++;
+        int rc = b->pool->ops.write(b->clt, (uint8_t *) tb->data, tb->len, on_client_write, tb);
+        if (rc != ZITI_OK) {
+            b->to_client_queued -= tb->len;
+            b->in_flight--;
+            pool_put(b->pool, tb);
+            finish(b, ziti_errorstr(rc));
+            return;
+        }
+        if (b->to_client_queued >= b->pool->max_queued) {
+            pause_reading(b);
+        }
+        return;
+    }
+
+    if (tb != NULL) {
+        pool_put(b->pool, tb);
+    }
+    if (nread == UV_EOF) {
+        uv_read_stop((uv_stream_t *) b->server);
+        b->server_eof = true;
+        b->pool->ops.close_write(b->clt);
+        check_done(b);
+    } else if (nread < 0) {
+        finish(b, uv_strerror((int) nread));
+    }
+}
+
+ssize_t tcp_bridge_write(tcp_bridge *b, const uint8_t *data, ssize_t len) {
+    if (b->done || b->closed) {
+        return len > 0 ? len : 0;
+    }
+
+    if (len == ZITI_EOF) {
+        b->client_eof = true;
+        uv_shutdown_t *req = calloc(1, sizeof(uv_shutdown_t));
+        req->data = b;
+        int rc = uv_shutdown(req, (uv_stream_t *) b->server, on_server_shutdown);
+        if (rc != 0) {
+            free(req);
+            finish(b, uv_strerror(rc));
+            return 0;
+        }
+        b->in_flight++;
+        return 0;
+    }
+    if (len < 0) {
+        finish(b, ziti_errorstr((int) len));
+        return 0;
+    }
+
+    // the sdk keeps what is not taken. on_server_write() asks for it again once the server caught up
+    if (b->server_stalled) {
+        return 0;
+    }
+    if (uv_stream_get_write_queue_size((uv_stream_t *) b->server) >= b->pool->max_queued) {
+        pause_client(b);
+        return 0;
+    }
+
+    tcp_buf *tb = pool_get(b->pool, (size_t) len);
+    memcpy(tb->data, data, (size_t) len);
+    tb->bridge = b;
+    uv_buf_t buf = uv_buf_init(tb->data, (unsigned int) len);
+    int rc = uv_write(&tb->req, (uv_stream_t *) b->server, &buf, 1, on_server_write);
+    if (rc != 0) {
+        pool_put(b->pool, tb);
+        finish(b, uv_strerror(rc));
+        return len;
+    }
+    b->in_flight++;
+    return len;
+}
+
+void tcp_bridge_get_stats(const tcp_bridge *b, tcp_bridge_stats *stats) {
+    *stats = b->stats;
+    uint64_t now = uv_now(b->pool->loop);
+    if (b->server_stalled) {
+        stats->server_stall_ms += now - b->server_stall_since;
+    }
+    if (b->client_stalled) {
+        stats->client_stall_ms += now - b->client_stall_since;
+    }
+}
+
+void tcp_bridge_free(tcp_bridge *b) {
+    if (b == NULL) {
+        return;
+    }
+    b->closed = true;
+    bridge_release(b);
+}
@@ -0,0 +1,101 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_TCP_BRIDGE_H
+#define ZITI_TUNNELER_SDK_TCP_BRIDGE_H
+
+#include <stdint.h>
+#include <uv.h>
+#include <ziti/ziti.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** bytes read from the server at once, if the service does not say */
+#define TCP_BRIDGE_READ_SIZE (16 * 1024)
+/** bytes queued toward either side before the other side is held back, if the service does not say */
+#define TCP_BRIDGE_MAX_QUEUED (256 * 1024)
+/** free read buffers a pool keeps for reuse */
+#define TCP_BRIDGE_POOL_SIZE 64
+
+/**
+ * moves the data of a hosted tcp client between its ziti connection and its server connection.
+ * data read from the server is written to ziti from pooled buffers without copying. a side that has
+ * `max_queued` bytes waiting to be written holds back the other side: reading from the server is paused
+ * while ziti writes are outstanding, and data from ziti is refused while the server's write queue is full.
+ * either side is let go again once its queue is down to half of `max_queued`.
+ */
+typedef struct tcp_bridge_s tcp_bridge;
+
+/** buffers and settings shared by the bridges of a hosted service */
+typedef struct tcp_bridge_pool_s tcp_bridge_pool;
+
+typedef struct tcp_bridge_stats_s {
+    uint64_t to_server;       // bytes written to the server
+    uint64_t to_client;       // bytes written to the client
+    uint64_t server_stalls;   // times the client was held back because the server did not keep up
+    uint64_t server_stall_ms;
+    uint64_t client_stalls;   // times reading the server paused because the client did not keep up
+    uint64_t client_stall_ms;
+} tcp_bridge_stats;
+
+/** called once when both sides are done sending, or with `err` when the bridge failed. the owner closes both */
+typedef void (*tcp_bridge_done_cb)(void *ctx, const char *err);
+
+/** how bridges reach their ziti connections */
+typedef struct tcp_bridge_client_ops_s {
+    int (*write)(ziti_connection clt, uint8_t *data, size_t len, ziti_write_cb cb, void *ctx);
+    int (*close_write)(ziti_connection clt);
+    /** have the sdk offer the data that tcp_bridge_write() refused again. it may do so right away */
+    void (*resume)(ziti_connection clt);
+} tcp_bridge_client_ops;
+
+/** 0 for `read_size` or `max_queued` uses the default */
+tcp_bridge_pool *tcp_bridge_pool_new(uv_loop_t *loop, int read_size, int max_queued, const tcp_bridge_client_ops *ops);
+
+/** the pool is released when its last bridge is gone */
+void tcp_bridge_pool_free(tcp_bridge_pool *pool);
+
+tcp_bridge *tcp_bridge_new(tcp_bridge_pool *pool, ziti_connection clt, uv_tcp_t *server,
+                           tcp_bridge_done_cb done_cb, void *ctx);
+
+/**
+ * start reading the server with `alloc_cb` and `read_cb`, which hand over to tcp_bridge_alloc()
+ * and tcp_bridge_read(). (the server handle's data pointer belongs to its owner)
+ */
+int tcp_bridge_start(tcp_bridge *b, uv_alloc_cb alloc_cb, uv_read_cb read_cb);
+
+void tcp_bridge_alloc(tcp_bridge *b, uv_buf_t *buf);
+
+void tcp_bridge_read(tcp_bridge *b, ssize_t nread, const uv_buf_t *buf);
+
+/**
+ * data (or EOF/error) from the client. returns how much was taken, 0 while the server is behind.
+ * refused data is asked for again with the `resume` op
+ */
+ssize_t tcp_bridge_write(tcp_bridge *b, const uint8_t *data, ssize_t len);
+
+void tcp_bridge_get_stats(const tcp_bridge *b, tcp_bridge_stats *stats);
+
+/** the bridge is released once no write is in flight */
+void tcp_bridge_free(tcp_bridge *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_TCP_BRIDGE_H
@@ -15,7 +15,14 @@
  */
 
 #include "catch2/catch.hpp"
+#include <vector>
+#include <uv.h>
 #include "../dns_host.h"
+#include "../dns_host_queue.h"
+#include "../dns_trie.h"
+#include "../dns_cache.h"
+#include "../dns_ip_pool.h"
+#include "../dns_upstream.h"
 
 TEST_CASE("resolve", "[dns]") {
     dns_host_init();
@@ -96,6 +103,78 @@ TEST_CASE("dns wire parse", "[dns]") {
     free_dns_message(&req);
 }
 
+#if !_WIN32
+TEST_CASE("dns wire query check", "[dns]") {
+    // yahoo.com A IN, with an OPT record
+    uint8_t b[] = {
+  0x53, 0x6b, 0x01, 0x20, 0x00, 0x01, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x01, 0x05, 0x79, 0x61, 0x68,
+  0x6f, 0x6f, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+  0x01, 0x00, 0x01, 0x00, 0x00, 0x29, 0x10, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x0a,
+  0x00, 0x08, 0x28, 0x27, 0x1d, 0x17, 0x27, 0x50,
+  0xa0, 0x4e
+};
+    const size_t question_end = 27;
+    ns_rr q;
+    size_t q_len = 0;
+
+    SECTION("plain query") {
+        CHECK(dns_wire_check_query(b, sizeof(b), &q, &q_len) == ns_r_noerror);
+        CHECK(q_len == question_end);
+        CHECK_THAT(ns_rr_name(q), Catch::Matches("yahoo.com"));
+        CHECK(ns_rr_type(q) == ns_t_a);
+    }
+
+    SECTION("too short to answer") {
+        CHECK(dns_wire_check_query(b, NS_HFIXEDSZ - 1, &q, &q_len) == -1);
+    }
+
+    SECTION("truncated question") {
+        CHECK(dns_wire_check_query(b, 20, &q, &q_len) == ns_r_formerr);
+        CHECK(q_len == NS_HFIXEDSZ);
+    }
+
+    SECTION("response") {
+        b[2] |= 0x80;
+        CHECK(dns_wire_check_query(b, sizeof(b), &q, &q_len) == ns_r_refused);
+    }
+
+    SECTION("opcodes other than QUERY") {
+        for (int opcode : {ns_o_iquery, ns_o_status, ns_o_notify, ns_o_update}) {
+            b[2] = (uint8_t) ((b[2] & 0x87) | (opcode << 3));
+            CHECK(dns_wire_check_query(b, sizeof(b), &q, &q_len) == ns_r_notimpl);
+        }
+    }
+
+    SECTION("no question") {
+        b[5] = 0;
+        CHECK(dns_wire_check_query(b, NS_HFIXEDSZ, &q, &q_len) == ns_r_refused);
+        CHECK(q_len == NS_HFIXEDSZ);
+    }
+
+    SECTION("two questions") {
+        b[5] = 2;
+        CHECK(dns_wire_check_query(b, sizeof(b), &q, &q_len) == ns_r_refused);
+    }
+
+    SECTION("answer or authority records") {
+        b[7] = 1;
+        CHECK(dns_wire_check_query(b, sizeof(b), &q, &q_len) == ns_r_refused);
+        b[7] = 0;
+        b[9] = 1;
+        CHECK(dns_wire_check_query(b, sizeof(b), &q, &q_len) == ns_r_refused);
+    }
+
+    SECTION("class other than IN") {
+        b[26] = ns_c_chaos;
+        CHECK(dns_wire_check_query(b, sizeof(b), &q, &q_len) == ns_r_notimpl);
+        // the answer repeats the question
+        CHECK(q_len == question_end);
+    }
+}
+#endif
+
 TEST_CASE("dns parse MX", "[dns]") {
     uint8_t b[] = {
   0xbd, 0x2d, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
@@ -120,3 +199,533 @@ TEST_CASE("dns parse MX", "[dns]") {
     free_dns_message(&req);
 
 }
+
+static bool skip_value(void *value, void *ctx) {
+    return value != ctx;
+}
+
+TEST_CASE("dns trie match", "[dns]") {
+    dns_trie trie = {};
+    char example[] = "example";
+    char foo[] = "foo";
+
+    dns_trie_set(&trie, "example.com", example);
+    dns_trie_set(&trie, "foo.example.com", foo);
+
+    // most specific domain wins
+    CHECK(dns_trie_match(&trie, "x.foo.example.com") == foo);
+    CHECK(dns_trie_match(&trie, "foo.example.com") == foo);
+    CHECK(dns_trie_match(&trie, "bar.example.com") == example);
+    CHECK(dns_trie_match(&trie, "example.com") == example);
+
+    // matches only on label boundaries
+    CHECK(dns_trie_match(&trie, "com") == nullptr);
+    CHECK(dns_trie_match(&trie, "myexample.com") == nullptr);
+    CHECK(dns_trie_get(&trie, "x.example.com") == nullptr);
+
+    // the walk continues to less specific domains until the visitor accepts one
+    CHECK(dns_trie_find_match(&trie, "x.foo.example.com", skip_value, example) == example);
+
+    CHECK(dns_trie_remove(&trie, "example.com") == example);
+    CHECK(dns_trie_match(&trie, "bar.example.com") == nullptr);
+    CHECK(dns_trie_match(&trie, "x.foo.example.com") == foo);
+
+    CHECK(dns_trie_remove(&trie, "foo.example.com") == foo);
+    CHECK(model_map_size(&trie.children) == 0);
+
+    dns_trie_clear(&trie, nullptr);
+}
+
+TEST_CASE("dns cache", "[dns]") {
+    // id[1234] query for Example.COM A IN
+    const uint8_t query[] = {
+            0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+            7, 'E', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'C', 'O', 'M', 0, 0, 1, 0, 1,
+    };
+    // upstream answer with a different id, 1.2.3.4 TTL=100, EDNS OPT record
+    const uint8_t answer[] = {
+            0xab, 0xcd, 0x81, 0x80, 0, 1, 0, 1, 0, 0, 0, 1,
+            7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1,
+            0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 100, 0, 4, 1, 2, 3, 4,
+            0, 0, 41, 0x10, 0, 0, 0, 0, 0, 0, 0,
+    };
+    // NXDOMAIN for bad.com with SOA TTL=900, MINIMUM=30
+    const uint8_t nxdomain[] = {
+            0xab, 0xce, 0x81, 0x83, 0, 1, 0, 0, 0, 1, 0, 0,
+            3, 'b', 'a', 'd', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1,
+            0xc0, 16, 0, 6, 0, 1, 0, 0, 3, 0x84, 0, 28,
+            1, 'a', 0xc0, 16, 1, 'b', 0xc0, 16, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0, 4, 0, 0, 0, 30,
+    };
+    const uint8_t nx_query[] = {
+            0x55, 0x66, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0,
+            3, 'B', 'A', 'D', 3, 'c', 'o', 'm', 0, 0, 1, 0, 1,
+    };
+
+    dns_cache cache;
+    dns_cache_init(&cache, 4096);
+    uint8_t resp[512];
+
+    CHECK(dns_cache_lookup(&cache, query, sizeof(query), 0, resp, sizeof(resp)) == 0);
+    REQUIRE(dns_cache_store(&cache, answer, sizeof(answer), 1000) == 0);
+
+    // hit 30s later: client's id, TTL aged, OPT record untouched
+    REQUIRE(dns_cache_lookup(&cache, query, sizeof(query), 31000, resp, sizeof(resp)) == sizeof(answer));
+    CHECK(resp[0] == 0x12);
+    CHECK(resp[1] == 0x34);
+    CHECK(resp[38] == 70);
+    CHECK(resp[sizeof(answer) - 8] == 0x10);
+
+    // DNSSEC OK and checking disabled queries get answers of their own
+    std::vector<uint8_t> do_query(query, query + sizeof(query));
+    do_query[11] = 1;
+    do_query.insert(do_query.end(), {0, 0, 41, 0x10, 0, 0, 0, 0x80, 0, 0, 0});
+    std::vector<uint8_t> cd_query(query, query + sizeof(query));
+    cd_query[3] |= 0x10;
+    CHECK(dns_cache_lookup(&cache, do_query.data(), do_query.size(), 31000, resp, sizeof(resp)) == 0);
+    CHECK(dns_cache_lookup(&cache, cd_query.data(), cd_query.size(), 31000, resp, sizeof(resp)) == 0);
+
+    std::vector<uint8_t> do_answer(answer, answer + sizeof(answer));
+    do_answer[sizeof(answer) - 4] = 0x80;
+    REQUIRE(dns_cache_store(&cache, do_answer.data(), do_answer.size(), 31000) == 0);
+    CHECK(dns_cache_lookup(&cache, do_query.data(), do_query.size(), 31000, resp, sizeof(resp)) == sizeof(answer));
+    CHECK(dns_cache_lookup(&cache, cd_query.data(), cd_query.size(), 31000, resp, sizeof(resp)) == 0);
+    CHECK(dns_cache_lookup(&cache, query, sizeof(query), 31000, resp, sizeof(resp)) == sizeof(answer));
+    CHECK(resp[sizeof(answer) - 4] == 0);
+
+    // expired
+    CHECK(dns_cache_lookup(&cache, query, sizeof(query), 101000, resp, sizeof(resp)) == 0);
+
+    // negative answers live for the SOA minimum
+    REQUIRE(dns_cache_store(&cache, nxdomain, sizeof(nxdomain), 0) == 0);
+    CHECK(dns_cache_lookup(&cache, nx_query, sizeof(nx_query), 29000, resp, sizeof(resp)) == sizeof(nxdomain));
+    CHECK(dns_cache_lookup(&cache, nx_query, sizeof(nx_query), 30000, resp, sizeof(resp)) == 0);
+
+    // SERVFAIL is not cached
+    uint8_t servfail[sizeof(nxdomain)];
+    memcpy(servfail, nxdomain, sizeof(servfail));
+    servfail[3] = 0x82;
+    CHECK(dns_cache_store(&cache, servfail, sizeof(servfail), 0) == -1);
+
+    dns_cache_stats stats;
+    dns_cache_get_stats(&cache, &stats);
+    CHECK(stats.hits == 4);
+    CHECK(stats.misses == 6);
+    CHECK(stats.expired == 2);
+
+    // memory limit is enforced by evicting least recently used entries
+    dns_cache_set_limit(&cache, 1000);
+    uint8_t other[sizeof(answer)];
+    memcpy(other, answer, sizeof(other));
+    for (char c = 'a'; c <= 'j'; c++) {
+        other[13] = (uint8_t) c;
+        dns_cache_store(&cache, other, sizeof(other), 0);
+    }
+    dns_cache_get_stats(&cache, &stats);
+    CHECK(stats.bytes <= 1000);
+    CHECK(stats.evicted > 0);
+    uint8_t last_query[sizeof(query)];
+    memcpy(last_query, query, sizeof(query));
+    last_query[13] = 'j';
+    CHECK(dns_cache_lookup(&cache, last_query, sizeof(last_query), 1000, resp, sizeof(resp)) == sizeof(answer));
+
+    dns_cache_clear(&cache);
+}
+
+// wire format response with one answer record of `type` for `name`
+static std::vector<uint8_t> cache_resp(const char *name, uint16_t type) {
+    std::vector<uint8_t> msg = { 0xab, 0xcd, 0x81, 0x80, 0, 1, 0, 1, 0, 0, 0, 0 };
+    for (const char *l = name; *l;) {
+        size_t len = strcspn(l, ".");
+        msg.push_back((uint8_t) len);
+        msg.insert(msg.end(), l, l + len);
+        l += len;
+        if (*l == '.') l++;
+    }
+    msg.insert(msg.end(), { 0, (uint8_t) (type >> 8), (uint8_t) type, 0, 1 });
+    msg.insert(msg.end(), { 0xc0, 12, (uint8_t) (type >> 8), (uint8_t) type, 0, 1, 0, 0, 0, 100, 0, 4, 't', 'e', 's', 't' });
+    return msg;
+}
+
+TEST_CASE("dns cache domain removal", "[dns]") {
+    dns_cache cache;
+    dns_cache_init(&cache, 8192);
+    uint8_t resp[512];
+
+    // proxied MX/SRV/TXT answers of a wildcard domain
+    const char *in_domain[] = { "mail.Example.com", "_sip._tcp.example.com", "example.com" };
+    const char *other[] = { "notexample.com", "example.com.org", "com" };
+    const uint16_t types[] = { 15, 33, 16 };
+    for (int i = 0; i < 3; i++) {
+        auto r = cache_resp(in_domain[i], types[i]);
+        REQUIRE(dns_cache_store(&cache, r.data(), r.size(), 0) == 0);
+        r = cache_resp(other[i], types[i]);
+        REQUIRE(dns_cache_store(&cache, r.data(), r.size(), 0) == 0);
+    }
+
+    // a query for the cached name is answered from the cache
+    auto q = cache_resp("MAIL.example.com", 15);
+    q.resize(q.size() - 16);
+    q[2] = 0x01; q[3] = 0; q[7] = 0;
+    CHECK(dns_cache_lookup(&cache, q.data(), q.size(), 1000, resp, sizeof(resp)) == q.size() + 16);
+
+    // removing the domain only drops names at or below it
+    CHECK(dns_cache_remove_domain(&cache, "EXAMPLE.com") == 3);
+    CHECK(dns_cache_lookup(&cache, q.data(), q.size(), 1000, resp, sizeof(resp)) == 0);
+    dns_cache_stats stats;
+    dns_cache_get_stats(&cache, &stats);
+    CHECK(stats.entries == 3);
+    for (int i = 0; i < 3; i++) {
+        auto r = cache_resp(other[i], types[i]);
+        r.resize(r.size() - 16);
+        r[2] = 0x01; r[3] = 0; r[7] = 0;
+        CHECK(dns_cache_lookup(&cache, r.data(), r.size(), 1000, resp, sizeof(resp)) == r.size() + 16);
+    }
+
+    CHECK(dns_cache_remove_domain(&cache, "example.net") == 0);
+    dns_cache_clear(&cache);
+}
+
+TEST_CASE("dns ip pool", "[dns]") {
+    dns_ip_pool pool;
+    REQUIRE(dns_ip_pool_init(&pool, 200) == 0);
+    CHECK(dns_ip_pool_reserve(&pool, 0));
+    CHECK(dns_ip_pool_reserve(&pool, 2));
+    CHECK_FALSE(dns_ip_pool_reserve(&pool, 2));
+    CHECK_FALSE(dns_ip_pool_reserve(&pool, 200));
+
+    // offsets are handed out in order, skipping reserved ones
+    CHECK(dns_ip_pool_alloc(&pool) == 1);
+    CHECK(dns_ip_pool_alloc(&pool) == 3);
+    for (uint32_t i = 4; i < 200; i++) {
+        REQUIRE(dns_ip_pool_alloc(&pool) == i);
+    }
+    CHECK(dns_ip_pool_alloc(&pool) == DNS_IP_POOL_NONE);
+
+    // released offsets are reused after wrapping around
+    dns_ip_pool_release(&pool, 150);
+    dns_ip_pool_release(&pool, 70);
+    CHECK_FALSE(dns_ip_pool_is_taken(&pool, 70));
+    CHECK(dns_ip_pool_alloc(&pool) == 70);
+    CHECK(dns_ip_pool_alloc(&pool) == 150);
+    CHECK(dns_ip_pool_alloc(&pool) == DNS_IP_POOL_NONE);
+
+    dns_ip_pool_free(&pool);
+}
+
+struct test_job_s {
+    dns_host_job job;
+    bool done;
+    int status;
+};
+
+static uv_sem_t job_gate;
+
+TEST_CASE("dns host queue", "[dns]") {
+    uv_loop_t *loop = uv_loop_new();
+    uv_sem_init(&job_gate, 0);
+    dns_host_queue *q = dns_host_queue_new(loop, DNS_HOST_MAX_WORKERS, DNS_HOST_MAX_QUEUED, DNS_HOST_MAX_CONN_QUERIES,
+                                           200);
+
+    std::vector<test_job_s> jobs(DNS_HOST_MAX_WORKERS + DNS_HOST_MAX_QUEUED);
+    size_t n = 0;
+    // jobs block their pool thread until the test lets them go
+    auto run = [](dns_host_job *) { uv_sem_wait(&job_gate); };
+    auto done = [](dns_host_job *job, int status) {
+        auto j = (test_job_s *) job;
+        j->done = true;
+        j->status = status;
+    };
+
+    // one connection gets DNS_HOST_MAX_CONN_QUERIES queries in flight
+    dns_host_queue_owner first = {};
+    while (dns_host_queue_can_add(q, &first)) {
+        dns_host_queue_add(q, &jobs[n++].job, &first, run, done);
+    }
+    CHECK(n == DNS_HOST_MAX_CONN_QUERIES);
+    CHECK(first.jobs == DNS_HOST_MAX_CONN_QUERIES);
+    dns_host_queue_stats stats;
+    dns_host_queue_get_stats(q, &stats);
+    CHECK(stats.running == DNS_HOST_MAX_WORKERS);
+    CHECK(stats.queued == DNS_HOST_MAX_CONN_QUERIES - DNS_HOST_MAX_WORKERS);
+
+    // all connections together queue up to DNS_HOST_MAX_QUEUED
+    dns_host_queue_owner others[DNS_HOST_MAX_QUEUED / DNS_HOST_MAX_CONN_QUERIES + 1] = {};
+    for (auto &o: others) {
+        while (dns_host_queue_can_add(q, &o)) {
+            dns_host_queue_add(q, &jobs[n++].job, &o, run, done);
+        }
+    }
+    dns_host_queue_get_stats(q, &stats);
+    CHECK(stats.queued == DNS_HOST_MAX_QUEUED);
+    CHECK(n == DNS_HOST_MAX_WORKERS + DNS_HOST_MAX_QUEUED);
+    dns_host_queue_owner late = {};
+    CHECK_FALSE(dns_host_queue_can_add(q, &late));
+
+    // queued jobs time out while the running ones still hold the pool threads
+    uv_timer_t timer;
+    uv_timer_init(loop, &timer);
+    uv_timer_start(&timer, [](uv_timer_t *t) { uv_stop(t->loop); }, 1000, 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    dns_host_queue_get_stats(q, &stats);
+    CHECK(stats.queued == 0);
+    CHECK(stats.timed_out == DNS_HOST_MAX_QUEUED);
+    for (size_t i = 0; i < n; i++) {
+        if (i < DNS_HOST_MAX_WORKERS) {
+            CHECK_FALSE(jobs[i].done);
+        } else {
+            CHECK(jobs[i].done);
+            CHECK(jobs[i].status == UV_ETIMEDOUT);
+        }
+    }
+    CHECK(first.jobs == DNS_HOST_MAX_WORKERS);
+    CHECK(dns_host_queue_can_add(q, &late));
+
+    for (int i = 0; i < DNS_HOST_MAX_WORKERS; i++) {
+        uv_sem_post(&job_gate);
+    }
+    uv_timer_start(&timer, [](uv_timer_t *t) { uv_stop(t->loop); }, 1000, 0);
+    while (first.jobs > 0 && uv_run(loop, UV_RUN_ONCE)) {
+    }
+    CHECK(jobs[0].done);
+    CHECK(jobs[0].status == 0);
+    CHECK(jobs[1].done);
+    CHECK(jobs[1].status == 0);
+
+    dns_host_queue_free(q);
+    uv_close((uv_handle_t *) &timer, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+    uv_sem_destroy(&job_gate);
+}
+
+/** an upstream server that answers at once, or holds answers until the test sends them */
+struct test_upstream_s {
+    uv_udp_t udp;
+    struct sockaddr_in addr;
+    bool hold;
+    bool truncate; // udp answers are truncated
+    int received;
+    std::vector<std::pair<std::vector<uint8_t>, struct sockaddr_storage>> held;
+
+    void answer(const std::vector<uint8_t> &msg, const struct sockaddr *to) {
+        std::vector<uint8_t> resp = msg;
+        resp[2] |= 0x80; // QR
+        if (truncate) {
+            resp[2] |= 0x02; // TC
+        }
+        uv_buf_t b = uv_buf_init((char *) resp.data(), (unsigned int) resp.size());
+        uv_udp_try_send(&udp, &b, 1, to);
+    }
+
+    void answer_held() {
+        for (auto &h: held) {
+            answer(h.first, (struct sockaddr *) &h.second);
+        }
+        held.clear();
+    }
+};
+
+static void test_upstream_start(uv_loop_t *loop, test_upstream_s *srv) {
+    uv_ip4_addr("127.0.0.1", 0, &srv->addr);
+    uv_udp_init(loop, &srv->udp);
+    srv->udp.data = srv;
+    REQUIRE(uv_udp_bind(&srv->udp, (struct sockaddr *) &srv->addr, 0) == 0);
+    int len = sizeof(srv->addr);
+    uv_udp_getsockname(&srv->udp, (struct sockaddr *) &srv->addr, &len);
+    uv_udp_recv_start(&srv->udp, [](uv_handle_t *, size_t, uv_buf_t *b) {
+        static char buf[4096];
+        *b = uv_buf_init(buf, sizeof(buf));
+    }, [](uv_udp_t *h, ssize_t nread, const uv_buf_t *b, const struct sockaddr *from, unsigned) {
+        auto s = (test_upstream_s *) h->data;
+        if (nread <= 0) return;
+        s->received++;
+        std::vector<uint8_t> msg(b->base, b->base + nread);
+        if (s->hold) {
+            struct sockaddr_storage to = {};
+            memcpy(&to, from, from->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+            s->held.emplace_back(msg, to);
+        } else {
+            s->answer(msg, from);
+        }
+    });
+}
+
+/** tcp side of the upstream server, it answers with `size` bytes */
+struct test_upstream_tcp_s {
+    uv_tcp_t srv;
+    size_t size;
+    int connections;
+};
+
+static void test_upstream_tcp_start(uv_loop_t *loop, test_upstream_tcp_s *tcp, const struct sockaddr_in *addr) {
+    uv_tcp_init(loop, &tcp->srv);
+    tcp->srv.data = tcp;
+    REQUIRE(uv_tcp_bind(&tcp->srv, (const struct sockaddr *) addr, 0) == 0);
+    REQUIRE(uv_listen((uv_stream_t *) &tcp->srv, 5, [](uv_stream_t *s, int status) {
+        auto tcp = (test_upstream_tcp_s *) s->data;
+        auto clt = new uv_tcp_t;
+        uv_tcp_init(s->loop, clt);
+        clt->data = tcp;
+        uv_accept(s, (uv_stream_t *) clt);
+        tcp->connections++;
+        uv_read_start((uv_stream_t *) clt, [](uv_handle_t *, size_t, uv_buf_t *b) {
+            static char buf[1024];
+            *b = uv_buf_init(buf, sizeof(buf));
+        }, [](uv_stream_t *s, ssize_t nread, const uv_buf_t *b) {
+            auto tcp = (test_upstream_tcp_s *) s->data;
+            if (nread < 0) {
+                uv_close((uv_handle_t *) s, [](uv_handle_t *h) { delete (uv_tcp_t *) h; });
+                return;
+            }
+            // the query arrives in one read on loopback
+            if (nread < 2) return;
+            std::vector<uint8_t> resp(b->base + 2, b->base + nread);
+            resp[2] |= 0x80; // QR
+            resp.resize(tcp->size);
+            auto frame = new std::vector<uint8_t>{(uint8_t) (resp.size() >> 8), (uint8_t) resp.size()};
+            frame->insert(frame->end(), resp.begin(), resp.end());
+            auto w = new uv_write_t;
+            w->data = frame;
+            uv_buf_t out = uv_buf_init((char *) frame->data(), (unsigned int) frame->size());
+            uv_write(w, s, &out, 1, [](uv_write_t *w, int) {
+                delete (std::vector<uint8_t> *) w->data;
+                delete w;
+            });
+        });
+    }) == 0);
+}
+
+struct test_upstream_query_s {
+    dns_upstream_query q;
+    std::vector<uint8_t> msg;
+    bool done;
+    int status;
+    size_t len;
+    bool truncated;
+};
+
+static void test_upstream_query(dns_upstream *up, test_upstream_query_s *tq, uint16_t xid,
+                                bool tcp_fallback = false) {
+    // A test. IN
+    tq->msg = {(uint8_t) (xid >> 8), (uint8_t) xid, 0x01, 0, 0, 1, 0, 0, 0, 0, 0, 0,
+               4, 't', 'e', 's', 't', 0, 0, 1, 0, 1};
+    tq->done = false;
+    REQUIRE(dns_upstream_send(up, &tq->q, tq->msg.data(), tq->msg.size(), tq->msg.size() - 12, xid, tcp_fallback,
+                              [](dns_upstream_query *q, int status, const uint8_t *answer, size_t len) {
+        auto tq = (test_upstream_query_s *) q;
+        tq->done = true;
+        tq->status = status;
+        tq->len = len;
+        tq->truncated = answer != nullptr && (answer[2] & 0x02) != 0;
+    }) == 0);
+}
+
+/** run the loop until `done`, for at most `ms` */
+template<typename F>
+static void run_loop_until(uv_loop_t *loop, uint64_t ms, F done) {
+    uv_timer_t t;
+    uv_timer_init(loop, &t);
+    uv_timer_start(&t, [](uv_timer_t *t) { uv_stop(t->loop); }, ms, 0);
+    while (!done() && uv_is_active((uv_handle_t *) &t)) {
+        uv_run(loop, UV_RUN_ONCE);
+    }
+    uv_close((uv_handle_t *) &t, nullptr);
+    uv_run(loop, UV_RUN_NOWAIT);
+}
+
+TEST_CASE("dns upstream", "[dns]") {
+    uv_loop_t *loop = uv_loop_new();
+    test_upstream_s srv = {};
+    test_upstream_start(loop, &srv);
+
+    const uint64_t query_timeout = 1000;
+    dns_upstream *up = dns_upstream_new(loop, query_timeout);
+    REQUIRE(up != nullptr);
+    REQUIRE(dns_upstream_add_server(up, "127.0.0.1", ntohs(srv.addr.sin_port)) == 0);
+
+    // quick answers bring the retransmission timeout down to its minimum
+    test_upstream_query_s tq;
+    for (uint16_t xid = 1; xid <= 5; xid++) {
+        test_upstream_query(up, &tq, xid);
+        run_loop_until(loop, 1000, [&] { return tq.done; });
+        REQUIRE(tq.done);
+        CHECK(tq.status == 0);
+        CHECK(tq.len == tq.msg.size());
+    }
+
+    SECTION("an answer slower than the retransmission timeout is delivered") {
+        srv.hold = true;
+        uint64_t start = uv_now(loop);
+        test_upstream_query(up, &tq, 100);
+        run_loop_until(loop, 3 * DNS_UPSTREAM_MIN_TIMEOUT, [] { return false; });
+        CHECK_FALSE(tq.done);
+
+        srv.answer_held();
+        run_loop_until(loop, 1000, [&] { return tq.done; });
+        REQUIRE(tq.done);
+        CHECK(tq.status == 0);
+        CHECK(uv_now(loop) - start < query_timeout);
+    }
+
+    SECTION("a query without answer fails at the query timeout") {
+        srv.hold = true;
+        uint64_t start = uv_now(loop);
+        test_upstream_query(up, &tq, 100);
+        run_loop_until(loop, 2 * query_timeout, [&] { return tq.done; });
+        REQUIRE(tq.done);
+        CHECK(tq.status == UV_ETIMEDOUT);
+        CHECK(uv_now(loop) - start >= query_timeout);
+        // the only server was not asked again
+        CHECK(srv.received == 6);
+    }
+
+    SECTION("cancelled queries are not completed") {
+        srv.hold = true;
+        test_upstream_query(up, &tq, 100);
+        dns_upstream_cancel(&tq.q);
+        run_loop_until(loop, 3 * DNS_UPSTREAM_MIN_TIMEOUT, [] { return false; });
+        srv.answer_held();
+        run_loop_until(loop, 3 * DNS_UPSTREAM_MIN_TIMEOUT, [] { return false; });
+        CHECK_FALSE(tq.done);
+    }
+
+    SECTION("truncated answers are asked for over tcp") {
+        srv.truncate = true;
+        test_upstream_tcp_s tcp = {};
+        tcp.size = 20000;
+        test_upstream_tcp_start(loop, &tcp, &srv.addr);
+
+        test_upstream_query(up, &tq, 100, true);
+        run_loop_until(loop, 1000, [&] { return tq.done; });
+        REQUIRE(tq.done);
+        CHECK(tq.status == 0);
+        CHECK(tq.len == tcp.size);
+        CHECK_FALSE(tq.truncated);
+        CHECK(tcp.connections == 1);
+
+        // without tcp fallback the truncated answer is returned
+        test_upstream_query(up, &tq, 101);
+        run_loop_until(loop, 1000, [&] { return tq.done; });
+        REQUIRE(tq.done);
+        CHECK(tq.truncated);
+        CHECK(tcp.connections == 1);
+
+        uv_close((uv_handle_t *) &tcp.srv, nullptr);
+        run_loop_until(loop, 10, [] { return false; });
+    }
+
+    SECTION("truncated answer is returned if tcp fails") {
+        srv.truncate = true;
+        test_upstream_query(up, &tq, 100, true);
+        run_loop_until(loop, 1000, [&] { return tq.done; });
+        REQUIRE(tq.done);
+        CHECK(tq.status == 0);
+        CHECK(tq.truncated);
+        CHECK(tq.len == tq.msg.size());
+    }
+
+    dns_upstream_free(up);
+    uv_close((uv_handle_t *) &srv.udp, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
@@ -0,0 +1,954 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include "catch2/catch.hpp"
+#include "../dst_cache.h"
+#include "../admission.h"
+#include "../udp_bridge.h"
+#include "../hosted_metrics.h"
+#include "../warm_pool.h"
+#include "../happy_eyeballs.h"
+#include "../tcp_bridge.h"
+
+TEST_CASE("destination cache", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+    dst_cache cache;
+    dst_cache_init(&cache, loop);
+
+    struct result_s {
+        int calls;
+        int status;
+    } first = {0}, second = {0}, bad = {0};
+    auto cb = [](void *ctx, int status, dst_entry *dst) {
+        auto r = (result_s *) ctx;
+        r->calls++;
+        r->status = status;
+        if (status == 0) {
+            REQUIRE(dst != nullptr);
+        }
+    };
+
+    struct addrinfo hints = {0};
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    // first lookup completes on the loop
+    REQUIRE(dst_cache_resolve(&cache, "127.0.0.1", "443", &hints, cb, &first) == 0);
+    CHECK(first.calls == 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    CHECK(first.calls == 1);
+    CHECK(first.status == 0);
+
+    // then it is answered from the cache
+    REQUIRE(dst_cache_resolve(&cache, "127.0.0.1", "443", &hints, cb, &second) == 0);
+    CHECK(second.calls == 1);
+    CHECK(second.status == 0);
+
+    // failures are remembered too
+    REQUIRE(dst_cache_resolve(&cache, "not-an-ip", "443", &hints, cb, &bad) == 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    CHECK(bad.calls == 1);
+    CHECK(bad.status < 0);
+    REQUIRE(dst_cache_resolve(&cache, "not-an-ip", "443", &hints, cb, &bad) == 0);
+    CHECK(bad.calls == 2);
+    CHECK(bad.status < 0);
+
+    // lookups for IP destinations are numeric, whoever starts them
+    struct addrinfo ip_hints, name_hints;
+    dst_cache_hints(&ip_hints, "127.0.0.1", IPPROTO_TCP);
+    CHECK(memcmp(&ip_hints, &hints, sizeof(hints)) == 0);
+    dst_cache_hints(&ip_hints, "::1", IPPROTO_TCP);
+    CHECK(ip_hints.ai_flags == (AI_NUMERICHOST | AI_NUMERICSERV));
+    dst_cache_hints(&name_hints, "localhost", IPPROTO_UDP);
+    CHECK(name_hints.ai_flags == AI_NUMERICSERV);
+    CHECK(name_hints.ai_socktype == SOCK_DGRAM);
+
+    dst_cache_free(&cache);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+
+TEST_CASE("destination cache eviction", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+    dst_cache cache;
+    dst_cache_init(&cache, loop);
+
+    struct addrinfo hints = {0};
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    int calls = 0;
+    auto cb = [](void *ctx, int status, dst_entry *dst) { (*(int *) ctx)++; };
+    auto host = [](int i) {
+        return "127.0." + std::to_string(i / 250) + "." + std::to_string(i % 250 + 1);
+    };
+
+    for (int i = 0; i < DST_CACHE_MAX_ENTRIES; i++) {
+        REQUIRE(dst_cache_resolve(&cache, host(i).c_str(), "443", &hints, cb, &calls) == 0);
+    }
+    uv_run(loop, UV_RUN_DEFAULT);
+    REQUIRE(calls == DST_CACHE_MAX_ENTRIES);
+
+    // using the oldest entry makes the second oldest the one to go
+    calls = 0;
+    REQUIRE(dst_cache_resolve(&cache, host(0).c_str(), "443", &hints, cb, &calls) == 0);
+    CHECK(calls == 1);
+    REQUIRE(dst_cache_resolve(&cache, host(DST_CACHE_MAX_ENTRIES).c_str(), "443", &hints, cb, &calls) == 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    CHECK(calls == 2);
+
+    calls = 0;
+    REQUIRE(dst_cache_resolve(&cache, host(0).c_str(), "443", &hints, cb, &calls) == 0);
+    CHECK(calls == 1); // answered from the cache
+    REQUIRE(dst_cache_resolve(&cache, host(1).c_str(), "443", &hints, cb, &calls) == 0);
+    CHECK(calls == 1); // looked up again
+    uv_run(loop, UV_RUN_DEFAULT);
+    CHECK(calls == 2);
+
+    dst_cache_free(&cache);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+
+TEST_CASE("destination address selection", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+    dst_cache cache;
+    dst_cache_init(&cache, loop);
+
+    struct addrinfo hints = {0};
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    auto pick = [](void *ctx, int status, dst_entry *dst) {
+        REQUIRE(status == 0);
+        *(dst_addr **) ctx = dst_entry_select(dst, dst_lb_least_conn, AF_UNSPEC, nullptr, 0);
+    };
+    auto pick_untried = [](void *ctx, int status, dst_entry *dst) {
+        auto a = (dst_addr **) ctx;
+        *a = dst_entry_select(dst, dst_lb_round_robin, AF_UNSPEC, &(*a)->addr, 1);
+    };
+
+    dst_addr *a = nullptr;
+    REQUIRE(dst_cache_resolve(&cache, "127.0.0.1", "443", &hints, pick, &a) == 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    REQUIRE(a != nullptr);
+    CHECK(std::string(a->name) == "127.0.0.1:443");
+    CHECK(a->active == 1);
+
+    // the only address is still picked when it is down
+    for (int i = 0; i < DST_ADDR_MAX_FAILURES; i++) {
+        dst_addr_report(a, UV_ECONNREFUSED, uv_now(loop));
+    }
+    CHECK(a->down_until > uv_now(loop));
+    dst_addr *b = nullptr;
+    REQUIRE(dst_cache_resolve(&cache, "127.0.0.1", "443", &hints, pick, &b) == 0);
+    CHECK(b == a);
+    CHECK(a->active == 2);
+    CHECK(a->connects == DST_ADDR_MAX_FAILURES);
+    CHECK(a->failures == DST_ADDR_MAX_FAILURES);
+
+    // but not when it was tried already
+    dst_addr *c = a;
+    REQUIRE(dst_cache_resolve(&cache, "127.0.0.1", "443", &hints, pick_untried, &c) == 0);
+    CHECK(c == nullptr);
+
+    dst_addr_report(a, 0, uv_now(loop));
+    CHECK(a->down_until == 0);
+    dst_addr_release(b);
+
+    // IPv6 is tried first until another family wins a connect
+    struct family_s {
+        int preferred;
+        dst_addr *v6;
+    } fam = {0};
+    auto by_family = [](void *ctx, int status, dst_entry *dst) {
+        auto f = (family_s *) ctx;
+        f->preferred = dst_entry_family(dst);
+        f->v6 = dst_entry_select(dst, dst_lb_round_robin, AF_INET6, nullptr, 0);
+    };
+    REQUIRE(dst_cache_resolve(&cache, "127.0.0.1", "443", &hints, by_family, &fam) == 0);
+    CHECK(fam.preferred == AF_INET6);
+    CHECK(fam.v6 == nullptr);
+    dst_cache_set_family(&cache, "127.0.0.1", "443", &hints, AF_INET);
+    REQUIRE(dst_cache_resolve(&cache, "127.0.0.1", "443", &hints, by_family, &fam) == 0);
+    CHECK(fam.preferred == AF_INET);
+
+    // counts stay readable while the address is in use
+    int seen = 0;
+    dst_cache_foreach_addr(&cache, [](void *ctx, const char *host, const char *port, const dst_addr *addr) {
+        (*(int *) ctx)++;
+        CHECK(addr->active == 1);
+    }, &seen);
+    CHECK(seen == 1);
+
+    dst_cache_free(&cache);
+    CHECK(a->active == 1);
+    dst_addr_release(a);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+
+// loopback server that keeps the connections it accepts, and may greet them.
+// a stalled server never accepts and has its backlog filled, so connects to it stall
+struct tcp_server_s {
+    uv_tcp_t listener;
+    uv_tcp_t *conns[16];
+    int accepted;
+    const char *greeting;
+    bool stalled;
+    int filled;
+    uv_tcp_t fillers[5];
+    uv_connect_t filler_reqs[5];
+    struct sockaddr_in addr;
+    char port[8];
+};
+
+static void tcp_server_fill(tcp_server_s *srv) {
+    int i = srv->filled++;
+    uv_tcp_init(srv->listener.loop, &srv->fillers[i]);
+    uv_tcp_connect(&srv->filler_reqs[i], &srv->fillers[i], (struct sockaddr *) &srv->addr,
+                   [](uv_connect_t *, int) {});
+}
+
+static void tcp_server_start(uv_loop_t *loop, tcp_server_s *srv) {
+    uv_ip4_addr("127.0.0.1", 0, &srv->addr);
+    uv_tcp_init(loop, &srv->listener);
+    srv->listener.data = srv;
+    REQUIRE(uv_tcp_bind(&srv->listener, (struct sockaddr *) &srv->addr, 0) == 0);
+    int len = sizeof(srv->addr);
+    uv_tcp_getsockname(&srv->listener, (struct sockaddr *) &srv->addr, &len);
+    snprintf(srv->port, sizeof(srv->port), "%d", ntohs(srv->addr.sin_port));
+    REQUIRE(uv_listen((uv_stream_t *) &srv->listener, srv->stalled ? 0 : 16, [](uv_stream_t *l, int status) {
+        auto srv = (tcp_server_s *) l->data;
+        if (srv->stalled) {
+            // libuv took a connection off the backlog and stops accepting, take its place
+            tcp_server_fill(srv);
+            return;
+        }
+        auto c = (uv_tcp_t *) calloc(1, sizeof(uv_tcp_t));
+        uv_tcp_init(l->loop, c);
+        REQUIRE(uv_accept(l, (uv_stream_t *) c) == 0);
+        REQUIRE(srv->accepted < 16);
+        srv->conns[srv->accepted++] = c;
+        if (srv->greeting) {
+            uv_buf_t b = uv_buf_init((char *) srv->greeting, strlen(srv->greeting));
+            uv_try_write((uv_stream_t *) c, &b, 1);
+        }
+    }) == 0);
+    if (srv->stalled) {
+        while (srv->filled < 4) {
+            tcp_server_fill(srv);
+        }
+        while (srv->filled < 5) {
+            uv_run(loop, UV_RUN_ONCE);
+        }
+    }
+}
+
+static void tcp_server_drop(tcp_server_s *srv) {
+    for (int i = 0; i < srv->accepted; i++) {
+        if (srv->conns[i] && !uv_is_closing((uv_handle_t *) srv->conns[i])) {
+            uv_close((uv_handle_t *) srv->conns[i], [](uv_handle_t *h) { free(h); });
+        }
+        srv->conns[i] = nullptr;
+    }
+}
+
+static void tcp_server_stop(tcp_server_s *srv) {
+    tcp_server_drop(srv);
+    for (int i = 0; i < srv->filled; i++) {
+        uv_close((uv_handle_t *) &srv->fillers[i], nullptr);
+    }
+    uv_close((uv_handle_t *) &srv->listener, nullptr);
+}
+
+/** run the loop until `done` says so, or `timeout` ms passed */
+template<typename F>
+static bool run_until(uv_loop_t *loop, uint64_t timeout, F done) {
+    uint64_t deadline = uv_now(loop) + timeout;
+    uv_timer_t t;
+    uv_timer_init(loop, &t);
+    uv_timer_start(&t, [](uv_timer_t *t) { uv_stop(t->loop); }, 10, 10);
+    bool ok;
+    while (!(ok = done()) && uv_now(loop) < deadline) {
+        uv_run(loop, UV_RUN_DEFAULT);
+    }
+    uv_close((uv_handle_t *) &t, nullptr);
+    uv_run(loop, UV_RUN_NOWAIT);
+    return ok;
+}
+
+static void close_taken(uv_loop_t *loop, uv_os_sock_t sock) {
+    auto h = (uv_tcp_t *) calloc(1, sizeof(uv_tcp_t));
+    uv_tcp_init(loop, h);
+    REQUIRE(uv_tcp_open(h, sock) == 0);
+    uv_close((uv_handle_t *) h, [](uv_handle_t *h) { free(h); });
+}
+
+TEST_CASE("warm pool", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+    dst_cache cache;
+    dst_cache_init(&cache, loop);
+    tcp_server_s srv = {};
+    tcp_server_start(loop, &srv);
+
+    warm_pool *pool = warm_pool_new(loop, &cache, "test", "127.0.0.1", srv.port, 2);
+    warm_pool_stats stats;
+    auto idle = [&]() {
+        warm_pool_get_stats(pool, &stats);
+        return stats.idle;
+    };
+    // connections held by the pool are not in use by a client
+    auto active = [&]() {
+        int n = 0;
+        dst_cache_foreach_addr(&cache, [](void *ctx, const char *, const char *, const dst_addr *a) {
+            *(int *) ctx += a->active;
+        }, &n);
+        return n;
+    };
+    REQUIRE(run_until(loop, 2000, [&] { return idle() == 2 && srv.accepted == 2; }));
+    CHECK(active() == 0);
+
+    uv_os_sock_t sock;
+    dst_addr *addr = nullptr;
+    char peer[80];
+    char expected[80];
+    snprintf(expected, sizeof(expected), "tcp:127.0.0.1:%s", srv.port);
+
+    SECTION("take and refill") {
+        srv.greeting = "hello";
+        for (int i = 0; i < 2; i++) {
+            REQUIRE(warm_pool_take(pool, &sock, &addr, peer, sizeof(peer)) == 0);
+            CHECK(std::string(peer) == expected);
+            CHECK(std::string(addr->name) == std::string("127.0.0.1:") + srv.port);
+            CHECK(active() == 1);
+            close_taken(loop, sock);
+            dst_addr_release(addr);
+            CHECK(active() == 0);
+        }
+        warm_pool_get_stats(pool, &stats);
+        CHECK(stats.hits == 2);
+        CHECK(run_until(loop, 2000, [&] { return idle() == 2 && srv.accepted == 4; }));
+
+        // refills the server greeted are not stale, the greeting stays in the socket for the bridge
+        REQUIRE(warm_pool_take(pool, &sock, &addr, peer, sizeof(peer)) == 0);
+        char buf[16] = {0};
+        CHECK(recv(sock, buf, sizeof(buf), MSG_PEEK) == 5);
+        CHECK(std::string(buf) == "hello");
+        close_taken(loop, sock);
+        dst_addr_release(addr);
+    }
+
+    SECTION("stale connections are replaced") {
+        // the server drops the idle connections, the pool notices and connects again
+        tcp_server_drop(&srv);
+        CHECK(run_until(loop, 2000, [&] { return idle() == 2 && srv.accepted == 4; }));
+    }
+
+    SECTION("stale connections are not handed out") {
+        tcp_server_drop(&srv);
+        uv_run(loop, UV_RUN_NOWAIT); // let the server close, but not the pool look
+        uv_sleep(100);
+        CHECK(warm_pool_take(pool, &sock, &addr, peer, sizeof(peer)) == -1);
+        warm_pool_get_stats(pool, &stats);
+        CHECK(stats.hits == 0);
+        CHECK(stats.misses == 1);
+        CHECK(run_until(loop, 2000, [&] { return idle() == 2; }));
+    }
+
+    SECTION("idle connections are recycled") {
+        warm_pool_set_max_idle(pool, 10);
+        CHECK(run_until(loop, 3000, [&] { return srv.accepted >= 4 && idle() == 2; }));
+    }
+
+    warm_pool_free(pool);
+    tcp_server_stop(&srv);
+    dst_cache_free(&cache);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+
+TEST_CASE("hosted service admission", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+    struct waited_s {
+        int called;
+        int admitted;
+    } waited = {0};
+    auto on_admitted = [](void *ctx, bool admitted) {
+        auto w = (waited_s *) ctx;
+        w->called++;
+        w->admitted += admitted;
+    };
+
+    hosted_service_limits limits = {0};
+    limits.max_conns = 2;
+    limits.queue_size = 1;
+    limits.queue_timeout = 50;
+    admission *adm = admission_new(loop, "test", &limits);
+
+    CHECK(admission_request(adm, on_admitted, &waited) == admission_admitted);
+    CHECK(admission_request(adm, on_admitted, &waited) == admission_admitted);
+    CHECK(admission_request(adm, on_admitted, &waited) == admission_queued);
+    CHECK(admission_request(adm, on_admitted, &waited) == admission_rejected);
+
+    // a closed connection admits the queued client
+    admission_connected(adm);
+    admission_release(adm, true);
+    CHECK(waited.called == 1);
+    CHECK(waited.admitted == 1);
+
+    // nothing frees up this time, the client gives up
+    CHECK(admission_request(adm, on_admitted, &waited) == admission_queued);
+    uv_run(loop, UV_RUN_DEFAULT);
+    CHECK(waited.called == 2);
+    CHECK(waited.admitted == 1);
+
+    admission_stats stats;
+    admission_get_stats(adm, &stats);
+    CHECK(stats.conns == 0);
+    CHECK(stats.pending == 2);
+    CHECK(stats.queued == 0);
+    CHECK(stats.admitted == 3);
+    CHECK(stats.rejected == 1);
+    CHECK(stats.timed_out == 1);
+
+    admission_free(adm);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+
+TEST_CASE("hosted latency histogram", "[hosting]") {
+    latency_histogram h = {0};
+    CHECK(latency_percentile(&h, 50) == 0);
+
+    for (int i = 0; i < 90; i++) latency_record(&h, 100);
+    for (int i = 0; i < 9; i++) latency_record(&h, 1000);
+    latency_record(&h, 20000);
+    CHECK(h.count == 100);
+    CHECK(h.sum == 9000 + 9000 + 20000);
+    CHECK(h.max == 20000);
+
+    // percentiles are bucket bounds, never above the largest sample
+    CHECK(latency_percentile(&h, 50) == 127);
+    CHECK(latency_percentile(&h, 90) == 127);
+    CHECK(latency_percentile(&h, 99) == 1023);
+    CHECK(latency_percentile(&h, 100) == 20000);
+
+    // very long samples all go to the last bucket
+    latency_record(&h, UINT64_C(1) << 40);
+    CHECK(h.buckets[LATENCY_BUCKETS - 1] == 1);
+    CHECK(latency_percentile(&h, 100) == UINT64_C(1) << 40);
+}
+
+/** stands in for the ziti connection of a relayed udp client. writes complete when the test says so */
+struct fake_udp_client_s {
+    struct pending_write {
+        ziti_write_cb cb;
+        void *ctx;
+    };
+    std::vector<std::string> received;
+    std::vector<pending_write> pending;
+
+    void complete_all() {
+        std::vector<pending_write> done;
+        done.swap(pending);
+        for (auto &w: done) {
+            w.cb((ziti_connection) this, 0, w.ctx);
+        }
+    }
+};
+
+static const udp_bridge_client_ops fake_udp_client_ops = {
+        // write
+        [](ziti_connection clt, uint8_t *data, size_t len, ziti_write_cb cb, void *ctx) -> int {
+            auto c = (fake_udp_client_s *) clt;
+            c->received.emplace_back((const char *) data, len);
+            c->pending.push_back({cb, ctx});
+            return 0;
+        },
+};
+
+TEST_CASE("udp relay", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+
+    // the server echoes every datagram back to its sender
+    struct server_s {
+        uv_udp_t udp;
+        char buf[1024];
+        std::vector<std::string> received;
+    } server;
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    uv_udp_init(loop, &server.udp);
+    server.udp.data = &server;
+    REQUIRE(uv_udp_bind(&server.udp, (struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    uv_udp_getsockname(&server.udp, (struct sockaddr *) &addr, &len);
+    uv_udp_recv_start(&server.udp, [](uv_handle_t *h, size_t, uv_buf_t *b) {
+        auto s = (server_s *) h->data;
+        *b = uv_buf_init(s->buf, sizeof(s->buf));
+    }, [](uv_udp_t *h, ssize_t nread, const uv_buf_t *b, const struct sockaddr *from, unsigned) {
+        if (nread > 0) {
+            ((server_s *) h->data)->received.emplace_back(b->base, nread);
+            uv_buf_t reply = uv_buf_init(b->base, nread);
+            uv_udp_try_send(h, &reply, 1, from);
+        }
+    });
+
+    // the client's own socket, read with recvmmsg() like the hosted ones
+    fake_udp_client_s clt;
+    uv_udp_t sock;
+    REQUIRE(uv_udp_init_ex(loop, &sock, AF_INET | UV_UDP_RECVMMSG) == 0);
+    REQUIRE(uv_udp_connect(&sock, (struct sockaddr *) &addr) == 0);
+
+    int errors = 0;
+    auto on_error = [](void *ctx, const char *err) { (*(int *) ctx)++; };
+    udp_relay *relay = udp_relay_new(loop, "test", 0, &fake_udp_client_ops);
+    CHECK_FALSE(udp_relay_is_shared(relay));
+    udp_bridge *b = udp_bridge_new(relay, (ziti_connection) &clt, &sock, (struct sockaddr *) &addr, on_error, &errors);
+    REQUIRE(b != nullptr);
+    sock.data = b;
+    REQUIRE(udp_bridge_start(b, [](uv_udp_t *h, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *,
+                                   unsigned flags) {
+        udp_bridge_recv((udp_bridge *) h->data, nread, buf, flags);
+    }) == 0);
+
+    auto send = [&](int count) {
+        for (int i = 0; i < count; i++) {
+            std::string msg = "dgram-" + std::to_string(i);
+            udp_bridge_send(b, (const uint8_t *) msg.data(), msg.size());
+        }
+    };
+
+    SECTION("datagrams keep their boundaries and order both ways") {
+        // more than one sendmmsg() batch
+        const int count = UDP_BRIDGE_SEND_BATCH * 2 + 3;
+        send(count);
+        REQUIRE(run_until(loop, 2000, [&] { return clt.received.size() == count; }));
+        REQUIRE(server.received.size() == count);
+        for (int i = 0; i < count; i++) {
+            CHECK(server.received[i] == "dgram-" + std::to_string(i));
+            CHECK(clt.received[i] == server.received[i]);
+        }
+        clt.complete_all();
+    }
+
+    SECTION("datagrams beyond the in-flight limit are dropped") {
+        send(UDP_BRIDGE_MAX_INFLIGHT + 10);
+        // client writes are not completed, so replies pile up against the limit as well
+        REQUIRE(run_until(loop, 2000, [&] { return clt.received.size() == UDP_BRIDGE_MAX_INFLIGHT; }));
+        run_until(loop, 100, [] { return false; });
+        CHECK(server.received.size() == UDP_BRIDGE_MAX_INFLIGHT);
+        CHECK(clt.received.size() == UDP_BRIDGE_MAX_INFLIGHT);
+
+        // room is made as the client's writes complete
+        clt.complete_all();
+        send(1);
+        CHECK(run_until(loop, 2000, [&] { return clt.received.size() == UDP_BRIDGE_MAX_INFLIGHT + 1; }));
+        clt.complete_all();
+    }
+    CHECK(errors == 0);
+
+    udp_bridge_free(b);
+    udp_relay_free(relay);
+    uv_close((uv_handle_t *) &sock, nullptr);
+    uv_close((uv_handle_t *) &server.udp, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+
+TEST_CASE("shared udp relay", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+
+    // the server counts what it gets and echoes it back, which the shared sockets drop
+    struct server_s {
+        uv_udp_t udp;
+        char buf[1024];
+        int received;
+    } server = {0};
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    uv_udp_init(loop, &server.udp);
+    server.udp.data = &server;
+    REQUIRE(uv_udp_bind(&server.udp, (struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    uv_udp_getsockname(&server.udp, (struct sockaddr *) &addr, &len);
+    uv_udp_recv_start(&server.udp, [](uv_handle_t *h, size_t, uv_buf_t *b) {
+        auto s = (server_s *) h->data;
+        *b = uv_buf_init(s->buf, sizeof(s->buf));
+    }, [](uv_udp_t *h, ssize_t nread, const uv_buf_t *b, const struct sockaddr *from, unsigned) {
+        if (nread > 0) {
+            ((server_s *) h->data)->received++;
+            uv_buf_t reply = uv_buf_init(b->base, nread);
+            uv_udp_try_send(h, &reply, 1, from);
+        }
+    });
+
+    int errors = 0;
+    auto on_error = [](void *ctx, const char *err) { (*(int *) ctx)++; };
+    udp_relay *relay = udp_relay_new(loop, "test", 2, &fake_udp_client_ops);
+    CHECK(udp_relay_is_shared(relay));
+    udp_bridge *clients[3];
+    for (auto &c: clients) {
+        c = udp_bridge_new(relay, nullptr, nullptr, (struct sockaddr *) &addr, on_error, &errors);
+        REQUIRE(c != nullptr);
+        for (int i = 0; i < 10; i++) {
+            udp_bridge_send(c, (const uint8_t *) "ping", 4);
+        }
+    }
+
+    uv_timer_t timer;
+    uv_timer_init(loop, &timer);
+    uv_timer_start(&timer, [](uv_timer_t *t) { uv_stop(t->loop); }, 200, 0);
+    uv_run(loop, UV_RUN_DEFAULT);
+    CHECK(server.received == 30);
+    CHECK(errors == 0);
+
+    for (auto c: clients) {
+        udp_bridge_free(c);
+    }
+    udp_relay_free(relay);
+    uv_close((uv_handle_t *) &timer, nullptr);
+    uv_close((uv_handle_t *) &server.udp, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+
+// windows refuses connects to a full backlog instead of letting them stall
+#ifndef _WIN32
+/** an address as dst_entry_select hands it out. the test keeps a reference to look at it afterwards */
+static dst_addr *race_addr(int port) {
+    auto a = (dst_addr *) calloc(1, sizeof(dst_addr));
+    uv_ip4_addr("127.0.0.1", port, (struct sockaddr_in *) &a->addr);
+    snprintf(a->name, sizeof(a->name), "127.0.0.1:%d", port);
+    a->active = 1;
+    a->refs = 2;
+    return a;
+}
+
+TEST_CASE("happy eyeballs race", "[hosting]") {
+    uv_loop_t *loop = uv_loop_new();
+    tcp_server_s good = {};
+    tcp_server_start(loop, &good);
+    tcp_server_s stalled = {};
+    stalled.stalled = true;
+    tcp_server_start(loop, &stalled);
+
+    struct result_s {
+        int calls;
+        int status;
+        uv_os_sock_t sock;
+        dst_addr *addr;
+    } r = {0, 0, -1, nullptr};
+    auto cb = [](void *ctx, int status, uv_os_sock_t sock, dst_addr *addr) {
+        auto r = (result_s *) ctx;
+        r->calls++;
+        r->status = status;
+        r->sock = sock;
+        r->addr = addr;
+    };
+
+    dst_addr *slow = race_addr(atoi(stalled.port));
+    dst_addr *fast = race_addr(atoi(good.port));
+
+    SECTION("second address wins when the first stalls") {
+        uint64_t start = uv_now(loop);
+        REQUIRE(he_race_start(loop, slow, fast, cb, &r) != nullptr);
+        REQUIRE(run_until(loop, 2000, [&] { return r.calls > 0 && good.accepted == 1; }));
+        CHECK(r.status == 0);
+        CHECK(r.addr == fast);
+        CHECK(uv_now(loop) - start >= HE_CONNECTION_ATTEMPT_DELAY);
+        // the stalled attempt was abandoned and its reference released
+        CHECK(slow->refs == 1);
+        CHECK(slow->active == 0);
+        CHECK(fast->refs == 2);
+        CHECK(fast->connects == 1);
+        close_taken(loop, r.sock);
+        dst_addr_release(r.addr);
+    }
+
+    SECTION("first address wins without trying the second") {
+        REQUIRE(he_race_start(loop, fast, slow, cb, &r) != nullptr);
+        REQUIRE(run_until(loop, 2000, [&] { return r.calls > 0; }));
+        CHECK(r.status == 0);
+        CHECK(r.addr == fast);
+        CHECK(slow->refs == 1);
+        CHECK(slow->connects == 0);
+        close_taken(loop, r.sock);
+        dst_addr_release(r.addr);
+    }
+
+    SECTION("cancel releases both addresses") {
+        he_race *race = he_race_start(loop, slow, slow, cb, &r);
+        slow->refs++;
+        slow->active++;
+        REQUIRE(race != nullptr);
+        // let the second attempt start too
+        run_until(loop, HE_CONNECTION_ATTEMPT_DELAY + 100, [] { return false; });
+        he_race_cancel(race);
+        uv_run(loop, UV_RUN_NOWAIT);
+        CHECK(r.calls == 0);
+        CHECK(slow->refs == 1);
+        CHECK(slow->active == 0);
+    }
+
+    SECTION("fails when both addresses fail") {
+        // nothing listens on the port once the good server is gone
+        tcp_server_stop(&good);
+        uv_run(loop, UV_RUN_NOWAIT);
+        dst_addr *refused = race_addr(atoi(good.port));
+        dst_addr *refused2 = race_addr(atoi(good.port));
+        REQUIRE(he_race_start(loop, refused, refused2, cb, &r) != nullptr);
+        REQUIRE(run_until(loop, 2000, [&] { return r.calls > 0; }));
+        CHECK(r.status == UV_ECONNREFUSED);
+        CHECK(r.addr == nullptr);
+        // the second attempt did not wait for the delay
+        CHECK(refused2->connects == 1);
+        CHECK(refused->failures == 1);
+        CHECK(refused2->failures == 1);
+        CHECK(refused->refs == 1);
+        CHECK(refused2->refs == 1);
+        free(refused);
+        free(refused2);
+    }
+
+    free(slow);
+    free(fast);
+    if (!uv_is_closing((uv_handle_t *) &good.listener)) {
+        tcp_server_stop(&good);
+    }
+    tcp_server_stop(&stalled);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
+#endif
+
+/** stands in for the ziti connection of a bridged client. writes complete when the test says so */
+struct fake_tcp_client_s {
+    struct pending_write {
+        size_t len;
+        ziti_write_cb cb;
+        void *ctx;
+    };
+    std::deque<pending_write> pending;
+    size_t pending_bytes;
+    int writes;
+    int close_writes;
+    int resumes;
+    size_t queue_at_resume;
+    uv_tcp_t *server;
+    int done;
+    const char *err;
+
+    void complete_one() {
+        pending_write w = pending.front();
+        pending.pop_front();
+        pending_bytes -= w.len;
+        w.cb((ziti_connection) this, (ssize_t) w.len, w.ctx);
+    }
+};
+
+static const tcp_bridge_client_ops fake_tcp_client_ops = {
+        // write
+        [](ziti_connection clt, uint8_t *data, size_t len, ziti_write_cb cb, void *ctx) -> int {
+            auto c = (fake_tcp_client_s *) clt;
+            c->pending.push_back({len, cb, ctx});
+            c->pending_bytes += len;
+            c->writes++;
+            return 0;
+        },
+        // close_write
+        [](ziti_connection clt) -> int {
+            ((fake_tcp_client_s *) clt)->close_writes++;
+            return 0;
+        },
+        // resume
+        [](ziti_connection clt) {
+            auto c = (fake_tcp_client_s *) clt;
+            c->resumes++;
+            c->queue_at_resume = uv_stream_get_write_queue_size((uv_stream_t *) c->server);
+        },
+};
+
+TEST_CASE("tcp bridge", "[hosting]") {
+    const int max_queued = 64 * 1024;
+    uv_loop_t *loop = uv_loop_new();
+
+    // the server side is a loopback connection that the test reads and writes directly
+    struct peer_s {
+        uv_tcp_t listener;
+        uv_tcp_t tcp;
+        bool accepted;
+        size_t received;
+        bool eof;
+        char buf[64 * 1024];
+    } peer = {};
+    struct sockaddr_in addr;
+    uv_ip4_addr("127.0.0.1", 0, &addr);
+    uv_tcp_init(loop, &peer.listener);
+    peer.listener.data = &peer;
+    REQUIRE(uv_tcp_bind(&peer.listener, (struct sockaddr *) &addr, 0) == 0);
+    int len = sizeof(addr);
+    uv_tcp_getsockname(&peer.listener, (struct sockaddr *) &addr, &len);
+    REQUIRE(uv_listen((uv_stream_t *) &peer.listener, 1, [](uv_stream_t *l, int status) {
+        auto p = (peer_s *) l->data;
+        uv_tcp_init(l->loop, &p->tcp);
+        p->tcp.data = p;
+        p->accepted = uv_accept(l, (uv_stream_t *) &p->tcp) == 0;
+    }) == 0);
+    auto peer_read = [](peer_s *p) {
+        uv_read_start((uv_stream_t *) &p->tcp, [](uv_handle_t *h, size_t, uv_buf_t *b) {
+            auto p = (peer_s *) h->data;
+            *b = uv_buf_init(p->buf, sizeof(p->buf));
+        }, [](uv_stream_t *s, ssize_t nread, const uv_buf_t *) {
+            auto p = (peer_s *) s->data;
+            if (nread > 0) p->received += nread;
+            if (nread == UV_EOF) p->eof = true;
+        });
+    };
+
+    fake_tcp_client_s clt = {};
+    uv_tcp_t server;
+    uv_tcp_init(loop, &server);
+    clt.server = &server;
+    uv_connect_t connect_req;
+    bool connected = false;
+    connect_req.data = &connected;
+    uv_tcp_connect(&connect_req, &server, (struct sockaddr *) &addr, [](uv_connect_t *r, int status) {
+        *(bool *) r->data = status == 0;
+    });
+    REQUIRE(run_until(loop, 2000, [&] { return connected && peer.accepted; }));
+
+    tcp_bridge_pool *pool = tcp_bridge_pool_new(loop, 16 * 1024, max_queued, &fake_tcp_client_ops);
+    tcp_bridge *b = tcp_bridge_new(pool, (ziti_connection) &clt, &server, [](void *ctx, const char *err) {
+        auto c = (fake_tcp_client_s *) ctx;
+        c->done++;
+        c->err = err;
+    }, &clt);
+    server.data = b;
+    REQUIRE(tcp_bridge_start(b, [](uv_handle_t *h, size_t, uv_buf_t *buf) {
+        tcp_bridge_alloc((tcp_bridge *) h->data, buf);
+    }, [](uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+        tcp_bridge_read((tcp_bridge *) s->data, nread, buf);
+    }) == 0);
+
+    tcp_bridge_stats stats;
+    SECTION("client is held back until the server catches up") {
+        static uint8_t chunk[16 * 1024];
+        size_t sent = 0;
+        // the peer does not read, so the server's write queue fills up once the socket buffers are full
+        for (int i = 0; i < 100000 && tcp_bridge_write(b, chunk, sizeof(chunk)) > 0; i++) {
+            sent += sizeof(chunk);
+        }
+        CHECK(uv_stream_get_write_queue_size((uv_stream_t *) &server) >= (size_t) max_queued);
+        CHECK(tcp_bridge_write(b, chunk, sizeof(chunk)) == 0);
+        tcp_bridge_get_stats(b, &stats);
+        CHECK(stats.server_stalls == 1);
+        CHECK(clt.resumes == 0);
+
+        // the client is asked for more once the queue is down to half
+        peer_read(&peer);
+        REQUIRE(run_until(loop, 2000, [&] { return clt.resumes > 0; }));
+        CHECK(clt.resumes == 1);
+        CHECK(clt.queue_at_resume <= (size_t) max_queued / 2);
+        CHECK(tcp_bridge_write(b, chunk, sizeof(chunk)) == sizeof(chunk));
+        sent += sizeof(chunk);
+        REQUIRE(run_until(loop, 2000, [&] { return peer.received == sent; }));
+        tcp_bridge_get_stats(b, &stats);
+        CHECK(stats.to_server == sent);
+    }
+
+    SECTION("reading the server pauses until the client catches up") {
+        std::vector<char> data(1024 * 1024, 'x');
+        uv_write_t write_req;
+        uv_buf_t buf = uv_buf_init(data.data(), (unsigned int) data.size());
+        uv_write(&write_req, (uv_stream_t *) &peer.tcp, &buf, 1, nullptr);
+
+        REQUIRE(run_until(loop, 2000, [&] { return clt.pending_bytes >= (size_t) max_queued; }));
+        int writes = clt.writes;
+        run_until(loop, 100, [] { return false; });
+        CHECK(clt.writes == writes);
+        tcp_bridge_get_stats(b, &stats);
+        CHECK(stats.client_stalls == 1);
+
+        // above half of the limit, reading stays paused
+        while (clt.pending_bytes - clt.pending.front().len > (size_t) max_queued / 2) {
+            clt.complete_one();
+        }
+        run_until(loop, 100, [] { return false; });
+        CHECK(clt.writes == writes);
+
+        clt.complete_one();
+        REQUIRE(run_until(loop, 2000, [&] { return clt.writes > writes; }));
+
+        REQUIRE(run_until(loop, 2000, [&] {
+            while (!clt.pending.empty()) {
+                clt.complete_one();
+            }
+            tcp_bridge_get_stats(b, &stats);
+            return stats.to_client == data.size();
+        }));
+        CHECK(stats.client_stalls >= 1);
+    }
+
+    SECTION("client closes first") {
+        peer_read(&peer);
+        CHECK(tcp_bridge_write(b, nullptr, ZITI_EOF) == 0);
+        REQUIRE(run_until(loop, 2000, [&] { return peer.eof; }));
+        CHECK(clt.done == 0);
+
+        uv_shutdown_t shutdown_req;
+        uv_shutdown(&shutdown_req, (uv_stream_t *) &peer.tcp, nullptr);
+        REQUIRE(run_until(loop, 2000, [&] { return clt.done > 0; }));
+        CHECK(clt.close_writes == 1);
+        CHECK(clt.err == nullptr);
+    }
+
+    SECTION("server closes first") {
+        peer_read(&peer);
+        uv_shutdown_t shutdown_req;
+        uv_shutdown(&shutdown_req, (uv_stream_t *) &peer.tcp, nullptr);
+        REQUIRE(run_until(loop, 2000, [&] { return clt.close_writes > 0; }));
+        CHECK(clt.done == 0);
+        CHECK(!peer.eof);
+
+        CHECK(tcp_bridge_write(b, nullptr, ZITI_EOF) == 0);
+        REQUIRE(run_until(loop, 2000, [&] { return clt.done > 0 && peer.eof; }));
+        CHECK(clt.close_writes == 1);
+        CHECK(clt.err == nullptr);
+    }
+
+    // writes that are still out fail once the bridge is gone
+    tcp_bridge_free(b);
+    while (!clt.pending.empty()) {
+        auto w = clt.pending.front();
+        clt.pending.pop_front();
+        w.cb((ziti_connection) &clt, -1, w.ctx);
+    }
+    tcp_bridge_pool_free(pool);
+    uv_close((uv_handle_t *) &server, nullptr);
+    uv_close((uv_handle_t *) &peer.tcp, nullptr);
+    uv_close((uv_handle_t *) &peer.listener, nullptr);
+    uv_run(loop, UV_RUN_DEFAULT);
+    uv_loop_delete(loop);
+}
@@ -0,0 +1,496 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // sendmmsg()
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <ziti/ziti_log.h>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/socket.h>
+#endif
+
+#include "udp_bridge.h"
+
+/** libuv reads one datagram of up to this size per recvmmsg() slot */
+#define UDP_DGRAM_MAX (64 * 1024)
+
+typedef struct udp_buf_s {
+    udp_bridge *bridge;
+    uv_udp_send_t req;
+    size_t len;
+    size_t cap;
+    STAILQ_ENTRY(udp_buf_s) _next;
+    uint8_t data[];
+} udp_buf;
+
+struct shared_sock_s {
+    udp_relay *relay;
+    struct sockaddr_storage dst;
+    int clients;
+    bool warned; // about a dropped reply
+    uv_udp_t udp;
+    LIST_ENTRY(shared_sock_s) _next;
+};
+
+struct udp_relay_s {
+    uv_loop_t *loop;
+    char *label;
+    int shared_sockets;
+    const udp_bridge_client_ops *ops;
+    LIST_HEAD(, shared_sock_s) sockets;
+    int refs; // owner, bridges and open shared sockets
+};
+
+struct udp_bridge_s {
+    udp_relay *relay;
+    ziti_connection clt;
+    uv_udp_t *server;
+    struct shared_sock_s *shared;
+    udp_bridge_error_cb err_cb;
+    void *ctx;
+
+    STAILQ_HEAD(, udp_buf_s) out; // datagrams waiting for the next flush
+    int queued;
+    int to_client;  // ziti writes in flight
+    int to_server;  // server writes in flight
+    bool dirty;     // on the flush list
+    bool closed;
+    LIST_ENTRY(udp_bridge_s) _next;
+};
+
+// buffers and the flush handle are shared by all relays, which run on the (single) tunneler loop
+static STAILQ_HEAD(, udp_buf_s) free_bufs = STAILQ_HEAD_INITIALIZER(free_bufs);
+static int n_free_bufs;
+static char *recv_slab;
+static bool recv_slab_busy;
+static LIST_HEAD(, udp_bridge_s) dirty_bridges = LIST_HEAD_INITIALIZER(dirty_bridges);
+static uv_idle_t *flusher; // open while there are relays
+static int n_relays;
+
+static udp_buf *buf_get(size_t len) {
+    udp_buf *ub = STAILQ_FIRST(&free_bufs);
+    if (len <= UDP_BRIDGE_BUF_SIZE && ub != NULL) {
+        STAILQ_REMOVE_HEAD(&free_bufs, _next);
+        n_free_bufs--;
+    } else {
+        size_t cap = len > UDP_BRIDGE_BUF_SIZE ? len : UDP_BRIDGE_BUF_SIZE;
+        ub = malloc(sizeof(udp_buf) + cap);
+        ub->cap = cap;
+    }
+    ub->len = len;
+    ub->req.data = ub;
+    return ub;
+}
+
+static void buf_put(udp_buf *ub) {
+    if (ub->cap == UDP_BRIDGE_BUF_SIZE && n_free_bufs < UDP_BRIDGE_POOL_SIZE) {
+        STAILQ_INSERT_HEAD(&free_bufs, ub, _next);
+        n_free_bufs++;
+    } else {
+        free(ub);
+    }
+}
+
+/** reads go to one slab that is reused for every read, unless a read is already using it */
+static void on_recv_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+    if (recv_slab_busy) {
+        buf->base = malloc(UDP_DGRAM_MAX);
+        buf->len = UDP_DGRAM_MAX;
+        return;
+    }
+    if (recv_slab == NULL) {
+        recv_slab = malloc(UDP_BRIDGE_RECV_BATCH * UDP_DGRAM_MAX);
+    }
+    recv_slab_busy = true;
+    buf->base = recv_slab;
+    buf->len = UDP_BRIDGE_RECV_BATCH * UDP_DGRAM_MAX;
+}
+
+/** datagrams of a recvmmsg() batch are delivered as chunks of the buffer, which is only done after the last */
+static void recv_done(const uv_buf_t *buf, unsigned flags) {
+    if (flags & UV_UDP_MMSG_CHUNK || buf->base == NULL) {
+        return;
+    }
+    if (buf->base == recv_slab) {
+        recv_slab_busy = false;
+    } else {
+        free(buf->base);
+    }
+}
+
+static void on_flusher_close(uv_handle_t *h) {
+    free(h);
+}
+
+static void relay_unref(udp_relay *relay) {
+    if (--relay->refs == 0) {
+        free(relay->label);
+        free(relay);
+        if (--n_relays == 0) {
+            uv_close((uv_handle_t *) flusher, on_flusher_close);
+            flusher = NULL;
+        }
+    }
+}
+
+static void bridge_release(udp_bridge *b) {
+    if (!b->closed || b->to_client > 0 || b->to_server > 0) {
+        return;
+    }
+    relay_unref(b->relay);
+    free(b);
+}
+
+static void drop_queued(udp_bridge *b) {
+    while (!STAILQ_EMPTY(&b->out)) {
+        udp_buf *ub = STAILQ_FIRST(&b->out);
+        STAILQ_REMOVE_HEAD(&b->out, _next);
+        buf_put(ub);
+    }
+    b->queued = 0;
+}
+
+static void bridge_failed(udp_bridge *b, const char *err) {
+    if (!b->closed) {
+        b->err_cb(b->ctx, err);
+    }
+}
+
+static void on_client_write(ziti_connection clt, ssize_t status, void *ctx) {
+    udp_buf *ub = ctx;
+    udp_bridge *b = ub->bridge;
+    buf_put(ub);
+    b->to_client--;
+    if (status < 0) {
+        bridge_failed(b, ziti_errorstr((int) status));
+    }
+    bridge_release(b);
+}
+
+static void relay_to_client(udp_bridge *b, const char *data, size_t len) {
+    if (b->to_client >= UDP_BRIDGE_MAX_INFLIGHT) {
+        ZITI_LOG(VERBOSE, "udp_relay[%s] client is behind, dropping %zu byte datagram", b->relay->label, len);
+        return;
+    }
+    udp_buf *ub = buf_get(len);
+    memcpy(ub->data, data, len);
+    ub->bridge = b;
+    b->to_client++;
+    int rc = b->relay->ops->write(b->clt, ub->data, len, on_client_write, ub);
+    if (rc != ZITI_OK) {
+        b->to_client--;
+        buf_put(ub);
+        bridge_failed(b, ziti_errorstr(rc));
+    }
+}
+
+static void on_server_write(uv_udp_send_t *req, int status) {
+    udp_buf *ub = req->data;
+    udp_bridge *b = ub->bridge;
+    buf_put(ub);
+    b->to_server--;
+    // a shared socket is not failed by one client's datagrams
+    if (status < 0 && status != UV_ECANCELED && b->shared == NULL) {
+        bridge_failed(b, uv_strerror(status));
+    }
+    bridge_release(b);
+}
+
+/** write what the socket takes right away, in as few calls as possible */
+static int send_now(udp_bridge *b, uv_udp_t *h) {
+#if defined(__linux__)
+    uv_os_fd_t fd;
+    // datagrams libuv still has queued must go out first
+    if (uv_udp_get_send_queue_count(h) != 0 || uv_fileno((uv_handle_t *) h, &fd) != 0) {
+        return 0;
+    }
+
+    struct mmsghdr msgs[UDP_BRIDGE_SEND_BATCH];
+    struct iovec iov[UDP_BRIDGE_SEND_BATCH];
+    while (!STAILQ_EMPTY(&b->out)) {
+        int n = 0;
+        udp_buf *ub;
+        STAILQ_FOREACH(ub, &b->out, _next) {
+            if (n == UDP_BRIDGE_SEND_BATCH) break;
+            iov[n].iov_base = ub->data;
+            iov[n].iov_len = ub->len;
+            memset(&msgs[n], 0, sizeof(msgs[n]));
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            n++;
+        }
+
+        int sent = sendmmsg(fd, msgs, n, 0);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ? 0 : uv_translate_sys_error(errno);
+        }
+        for (int i = 0; i < sent; i++) {
+            ub = STAILQ_FIRST(&b->out);
+            STAILQ_REMOVE_HEAD(&b->out, _next);
+            b->queued--;
+            buf_put(ub);
+        }
+        if (sent < n) {
+            return 0;
+        }
+    }
+#else
+    udp_buf *ub;
+    while ((ub = STAILQ_FIRST(&b->out)) != NULL) {
+        uv_buf_t buf = uv_buf_init((char *) ub->data, (unsigned int) ub->len);
+        int rc = uv_udp_try_send(h, &buf, 1, NULL);
+        if (rc == UV_EAGAIN) {
+            return 0;
+        }
+        if (rc < 0) {
+            return rc;
+        }
+        STAILQ_REMOVE_HEAD(&b->out, _next);
+        b->queued--;
+        buf_put(ub);
+    }
+#endif
+    return 0;
+}
+
+static void flush(udp_bridge *b) {
+    uv_udp_t *h = b->shared ? &b->shared->udp : b->server;
+    if (uv_is_closing((uv_handle_t *) h)) {
+        drop_queued(b);
+        return;
+    }
+
+    int rc = send_now(b, h);
+    if (rc != 0) {
+        drop_queued(b);
+        if (b->shared == NULL) {
+            bridge_failed(b, uv_strerror(rc));
+        }
+        return;
+    }
+
+    // the rest waits in libuv's queue until the socket is writable
+    udp_buf *ub;
+    while ((ub = STAILQ_FIRST(&b->out)) != NULL) {
+        STAILQ_REMOVE_HEAD(&b->out, _next);
+        b->queued--;
+        uv_buf_t buf = uv_buf_init((char *) ub->data, (unsigned int) ub->len);
+        ub->bridge = b;
+        b->to_server++;
+        rc = uv_udp_send(&ub->req, h, &buf, 1, NULL, on_server_write);
+        if (rc != 0) {
+            b->to_server--;
+            buf_put(ub);
+            drop_queued(b);
+            if (b->shared == NULL) {
+                bridge_failed(b, uv_strerror(rc));
+            }
+            return;
+        }
+    }
+}
+
+static void on_flush(uv_idle_t *idle) {
+    udp_bridge *b;
+    while ((b = LIST_FIRST(&dirty_bridges)) != NULL) {
+        LIST_REMOVE(b, _next);
+        b->dirty = false;
+        flush(b);
+    }
+    uv_idle_stop(idle);
+}
+
+static void on_shared_data(uv_udp_t *h, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *addr,
+                           unsigned flags) {
+    struct shared_sock_s *s = h->data;
+    if (nread > 0 && !s->warned) {
+        s->warned = true;
+        ZITI_LOG(WARN, "udp_relay[%s] server sent a reply to a one-way service, dropping it and any that follow",
+                 s->relay->label);
+    } else if (nread > 0) {
+        ZITI_LOG(VERBOSE, "udp_relay[%s] dropping %zd byte datagram received on shared socket",
+                 s->relay->label, nread);
+    }
+    recv_done(buf, flags);
+}
+
+static void on_shared_close(uv_handle_t *h) {
+    struct shared_sock_s *s = h->data;
+    relay_unref(s->relay);
+    free(s);
+}
+
+static bool same_addr(const struct sockaddr_storage *a, const struct sockaddr *b) {
+    if (a->ss_family != b->sa_family) {
+        return false;
+    }
+    size_t len = b->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    return memcmp(a, b, len) == 0;
+}
+
+/** a socket to `dst` with the fewest clients, opening another while there are fewer than configured */
+static struct shared_sock_s *shared_sock_get(udp_relay *relay, const struct sockaddr *dst) {
+    int n = 0;
+    struct shared_sock_s *s, *least = NULL;
+    LIST_FOREACH(s, &relay->sockets, _next) {
+        if (same_addr(&s->dst, dst)) {
+            n++;
+            if (least == NULL || s->clients < least->clients) {
+                least = s;
+            }
+        }
+    }
+    if (least != NULL && n >= relay->shared_sockets) {
+        return least;
+    }
+
+    s = calloc(1, sizeof(struct shared_sock_s));
+    s->relay = relay;
+    memcpy(&s->dst, dst, dst->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    uv_udp_init_ex(relay->loop, &s->udp, AF_UNSPEC | UV_UDP_RECVMMSG);
+    s->udp.data = s;
+    relay->refs++;
+
+    int rc = uv_udp_connect(&s->udp, dst);
+    if (rc == 0) {
+        rc = uv_udp_recv_start(&s->udp, on_recv_alloc, on_shared_data);
+    }
+    if (rc != 0) {
+        ZITI_LOG(ERROR, "udp_relay[%s] failed to open shared socket: %s", relay->label, uv_strerror(rc));
+        uv_close((uv_handle_t *) &s->udp, on_shared_close);
+        return least;
+    }
+    LIST_INSERT_HEAD(&relay->sockets, s, _next);
+    ZITI_LOG(DEBUG, "udp_relay[%s] opened shared socket %d of %d", relay->label, n + 1, relay->shared_sockets);
+    return s;
+}
+
+udp_relay *udp_relay_new(uv_loop_t *loop, const char *label, int one_way_sockets, const udp_bridge_client_ops *ops) {
+    udp_relay *relay = calloc(1, sizeof(udp_relay));
+    relay->loop = loop;
+    relay->label = strdup(label);
+    relay->shared_sockets = one_way_sockets > 0 ? one_way_sockets : 0;
+    relay->ops = ops;
+    if (relay->shared_sockets > 0) {
+        ZITI_LOG(WARN, "udp_relay[%s] is one-way: clients share %d socket(s) per server address and anything "
+                       "the server sends back is dropped", label, relay->shared_sockets);
+    }
+    LIST_INIT(&relay->sockets);
+    relay->refs = 1;
+
+    if (n_relays++ == 0) {
+        flusher = calloc(1, sizeof(uv_idle_t));
+        uv_idle_init(loop, flusher);
+        uv_unref((uv_handle_t *) flusher);
+    }
+    return relay;
+}
+
+void udp_relay_free(udp_relay *relay) {
+    if (relay != NULL) {
+        relay_unref(relay);
+    }
+}
+
+bool udp_relay_is_shared(const udp_relay *relay) {
+    return relay->shared_sockets > 0;
+}
+
+udp_bridge *udp_bridge_new(udp_relay *relay, ziti_connection clt, uv_udp_t *server, const struct sockaddr *dst,
+                           udp_bridge_error_cb err_cb, void *ctx) {
+    struct shared_sock_s *shared = NULL;
+    if (server == NULL) {
+        shared = shared_sock_get(relay, dst);
+        if (shared == NULL) {
+            return NULL;
+        }
+        shared->clients++;
+    }
+
+    udp_bridge *b = calloc(1, sizeof(udp_bridge));
+    b->relay = relay;
+    b->clt = clt;
+    b->server = server;
+    b->shared = shared;
+    b->err_cb = err_cb;
+    b->ctx = ctx;
+    STAILQ_INIT(&b->out);
+    relay->refs++;
+    return b;
+}
+
+int udp_bridge_start(udp_bridge *b, uv_udp_recv_cb recv_cb) {
+    if (b->shared != NULL) {
+        return 0;
+    }
+    return uv_udp_recv_start(b->server, on_recv_alloc, recv_cb);
+}
+
+void udp_bridge_recv(udp_bridge *b, ssize_t nread, const uv_buf_t *buf, unsigned flags) {
+    if (b != NULL && !b->closed) {
+        if (nread > 0) {
+            relay_to_client(b, buf->base, (size_t) nread);
+        } else if (nread < 0) {
+            bridge_failed(b, uv_strerror((int) nread));
+        }
+    }
+    recv_done(buf, flags);
+}
+
+void udp_bridge_send(udp_bridge *b, const uint8_t *data, size_t len) {
+    if (b->closed) {
+        return;
+    }
+    if (b->queued + b->to_server >= UDP_BRIDGE_MAX_INFLIGHT) {
+        ZITI_LOG(VERBOSE, "udp_relay[%s] server is behind, dropping %zu byte datagram", b->relay->label, len);
+        return;
+    }
+
+    udp_buf *ub = buf_get(len);
+    memcpy(ub->data, data, len);
+    STAILQ_INSERT_TAIL(&b->out, ub, _next);
+    b->queued++;
+    if (!b->dirty) {
+        b->dirty = true;
+        LIST_INSERT_HEAD(&dirty_bridges, b, _next);
+        uv_idle_start(flusher, on_flush);
+    }
+}
+
+void udp_bridge_free(udp_bridge *b) {
+    if (b == NULL) {
+        return;
+    }
+    if (b->dirty) {
+        LIST_REMOVE(b, _next);
+        b->dirty = false;
+    }
+    drop_queued(b);
+
+    struct shared_sock_s *s = b->shared;
+    if (s != NULL && --s->clients == 0) {
+        LIST_REMOVE(s, _next);
+        uv_close((uv_handle_t *) &s->udp, on_shared_close);
+    }
+    b->closed = true;
+    bridge_release(b);
+}
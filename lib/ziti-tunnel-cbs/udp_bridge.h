@@ -0,0 +1,96 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_UDP_BRIDGE_H
+#define ZITI_TUNNELER_SDK_UDP_BRIDGE_H
+
+#include <stdbool.h>
+#include <uv.h>
+#include <ziti/ziti.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** datagrams up to this size are copied into pooled buffers, larger ones get a buffer of their own */
+#define UDP_BRIDGE_BUF_SIZE 2048
+/** free pooled buffers kept for reuse */
+#define UDP_BRIDGE_POOL_SIZE 1024
+/** datagrams read from a server socket with one recvmmsg() where libuv supports it */
+#define UDP_BRIDGE_RECV_BATCH 16
+/** datagrams written to a server socket with one sendmmsg() (linux) */
+#define UDP_BRIDGE_SEND_BATCH 64
+/** datagrams a client may have on the way in each direction before more are dropped */
+#define UDP_BRIDGE_MAX_INFLIGHT 256
+
+/**
+ * datagram relay between the clients of a hosted udp service and its server.
+ * datagrams from clients are queued and written to the server once per loop iteration, in batches.
+ * each client normally gets a socket of its own. a relay for a one-way service shares sockets instead:
+ * clients of the same server address write through a few common sockets. datagrams that arrive on a shared
+ * socket cannot be told apart by client and are dropped, so only servers that do not reply (syslog, metrics)
+ * may be marked one-way.
+ */
+typedef struct udp_relay_s udp_relay;
+
+typedef struct udp_bridge_s udp_bridge;
+
+/** called when datagrams can no longer be relayed for a client. the owner should close the client */
+typedef void (*udp_bridge_error_cb)(void *ctx, const char *err);
+
+/** how datagrams are written to clients (ziti_write(), outside of tests) */
+typedef struct udp_bridge_client_ops_s {
+    int (*write)(ziti_connection clt, uint8_t *data, size_t len, ziti_write_cb cb, void *ctx);
+} udp_bridge_client_ops;
+
+/**
+ * `one_way_sockets` is how many sockets the clients of one server address share, for services whose server
+ * does not reply. 0 gives each client its own socket.
+ */
+udp_relay *udp_relay_new(uv_loop_t *loop, const char *label, int one_way_sockets, const udp_bridge_client_ops *ops);
+
+/** the relay is released when its last bridge and shared socket are gone */
+void udp_relay_free(udp_relay *relay);
+
+bool udp_relay_is_shared(const udp_relay *relay);
+
+/**
+ * relay datagrams between `clt` and the server at `dst`. `server` is the client's own socket, connected to `dst`,
+ * or NULL to use a socket shared with other clients. returns NULL if no shared socket could be opened.
+ */
+udp_bridge *udp_bridge_new(udp_relay *relay, ziti_connection clt, uv_udp_t *server, const struct sockaddr *dst,
+                           udp_bridge_error_cb err_cb, void *ctx);
+
+/**
+ * start reading the client's own socket with `recv_cb`, which passes what it reads to udp_bridge_recv().
+ * (the socket's data pointer belongs to its owner)
+ */
+int udp_bridge_start(udp_bridge *b, uv_udp_recv_cb recv_cb);
+
+/** relay a datagram the server sent on the client's own socket */
+void udp_bridge_recv(udp_bridge *b, ssize_t nread, const uv_buf_t *buf, unsigned flags);
+
+/** queue a datagram from the client for the server */
+void udp_bridge_send(udp_bridge *b, const uint8_t *data, size_t len);
+
+/** datagrams still queued are dropped. the bridge is released once no write is in flight */
+void udp_bridge_free(udp_bridge *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_UDP_BRIDGE_H
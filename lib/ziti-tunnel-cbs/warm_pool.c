@@ -0,0 +1,367 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <ziti/ziti_log.h>
+
+#if _WIN32
+#define sock_close(s) closesocket(s)
+#define sock_error() WSAGetLastError()
+#define SOCK_IN_PROGRESS(e) ((e) == WSAEWOULDBLOCK)
+#define SOCK_WOULD_BLOCK(e) ((e) == WSAEWOULDBLOCK)
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define sock_close(s) close(s)
+#define sock_error() errno
+#define SOCK_IN_PROGRESS(e) ((e) == EINPROGRESS)
+#define SOCK_WOULD_BLOCK(e) ((e) == EAGAIN || (e) == EWOULDBLOCK)
+#endif
+
+#include "warm_pool.h"
+
+#define INVALID_SOCK ((uv_os_sock_t) -1)
+
+struct warm_conn_s {
+    warm_pool *pool;
+    uv_poll_t poll;
+    uv_os_sock_t sock;
+    dst_addr *addr; // parked: holds the server address without counting as active
+    bool idle;
+    uint64_t since; // connect started, or became idle
+    char peer[80];
+    TAILQ_ENTRY(warm_conn_s) _next;
+};
+
+TAILQ_HEAD(warm_conn_list_s, warm_conn_s);
+
+struct warm_pool_s {
+    uv_loop_t *loop;
+    dst_cache *dst_cache;
+    char *label;
+    char *host;
+    char *port;
+    int size;
+    uint64_t max_idle;
+
+    struct warm_conn_list_s connecting;
+    struct warm_conn_list_s idle; // oldest first
+    int n_connecting;
+    int n_idle;
+
+    bool resolving;
+    uint64_t retry_at;
+    uv_timer_t timer;
+
+    uint64_t hits;
+    uint64_t misses;
+};
+
+static void replenish(warm_pool *pool);
+
+static int set_nonblocking(uv_os_sock_t s) {
+#if _WIN32
+    u_long on = 1;
+    return ioctlsocket(s, FIONBIO, &on) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(s, F_GETFL);
+    return flags < 0 ? -1 : fcntl(s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+/** check an idle connection without consuming data. returns false if the server closed it */
+static bool is_alive(uv_os_sock_t s) {
+    char c;
+    int rc = (int) recv(s, &c, 1, MSG_PEEK);
+    if (rc > 0) {
+        return true; // server spoke first, the data is left for the bridge
+    }
+    return rc < 0 && SOCK_WOULD_BLOCK(sock_error());
+}
+
+static void format_peer(uv_os_sock_t s, char *buf, size_t len) {
+    struct sockaddr_storage ss;
+    socklen_t ss_len = sizeof(ss);
+    char ip[INET6_ADDRSTRLEN] = "?";
+    int port = 0;
+    if (getpeername(s, (struct sockaddr *) &ss, &ss_len) == 0) {
+        if (ss.ss_family == AF_INET) {
+            struct sockaddr_in *in = (struct sockaddr_in *) &ss;
+            uv_ip4_name(in, ip, sizeof(ip));
+            port = ntohs(in->sin_port);
+        } else if (ss.ss_family == AF_INET6) {
+            struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &ss;
+            uv_ip6_name(in6, ip, sizeof(ip));
+            port = ntohs(in6->sin6_port);
+        }
+    }
+    snprintf(buf, len, "tcp:%s:%d", ip, port);
+}
+
+static void on_conn_close(uv_handle_t *h) {
+    struct warm_conn_s *conn = h->data;
+    if (conn->sock != INVALID_SOCK) {
+        sock_close(conn->sock);
+    }
+    dst_addr_drop(conn->addr);
+    free(conn);
+}
+
+/** remove from the pool and release the poll handle. the socket is closed unless it was taken */
+static void release_conn(struct warm_conn_s *conn) {
+    warm_pool *pool = conn->pool;
+    if (conn->idle) {
+        TAILQ_REMOVE(&pool->idle, conn, _next);
+        pool->n_idle--;
+    } else {
+        TAILQ_REMOVE(&pool->connecting, conn, _next);
+        pool->n_connecting--;
+    }
+    uv_poll_stop(&conn->poll);
+    uv_close((uv_handle_t *) &conn->poll, on_conn_close);
+}
+
+static void on_idle_event(uv_poll_t *p, int status, int events) {
+    struct warm_conn_s *conn = p->data;
+    warm_pool *pool = conn->pool;
+    if (status == 0 && is_alive(conn->sock)) {
+        // server sent data ahead of the client. it stays queued in the socket, stop watching
+        uv_poll_stop(p);
+        return;
+    }
+    ZITI_LOG(DEBUG, "warm_pool[%s] server closed idle connection to %s", pool->label, conn->peer);
+    release_conn(conn);
+    replenish(pool);
+}
+
+static void on_connect_event(uv_poll_t *p, int status, int events) {
+    struct warm_conn_s *conn = p->data;
+    warm_pool *pool = conn->pool;
+
+    // libuv reports a socket error as UV_EBADF, the socket knows what actually went wrong
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, (char *) &err, &err_len) != 0) {
+        err = uv_translate_sys_error(sock_error());
+    } else if (err != 0) {
+        err = uv_translate_sys_error(err);
+    } else if (status < 0) {
+        err = status;
+    }
+
+    dst_addr_report(conn->addr, err, uv_now(pool->loop));
+    if (err != 0) {
+        ZITI_LOG(WARN, "warm_pool[%s] connect to %s failed: %s", pool->label, conn->addr->name, uv_strerror(err));
+        pool->retry_at = uv_now(pool->loop) + WARM_POOL_RETRY_DELAY;
+        release_conn(conn);
+        return;
+    }
+
+    format_peer(conn->sock, conn->peer, sizeof(conn->peer));
+    TAILQ_REMOVE(&pool->connecting, conn, _next);
+    pool->n_connecting--;
+    conn->idle = true;
+    conn->since = uv_now(pool->loop);
+    TAILQ_INSERT_TAIL(&pool->idle, conn, _next);
+    pool->n_idle++;
+    ZITI_LOG(TRACE, "warm_pool[%s] connected to %s, %d idle", pool->label, conn->peer, pool->n_idle);
+
+    uv_poll_start(p, UV_READABLE | UV_DISCONNECT, on_idle_event);
+}
+
+static void start_connect(warm_pool *pool, dst_addr *addr) {
+    const struct sockaddr *sa = (const struct sockaddr *) &addr->addr;
+    socklen_t sa_len = sa->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+    uv_os_sock_t s = socket(sa->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCK) {
+        ZITI_LOG(WARN, "warm_pool[%s] socket() failed: %s", pool->label,
+                 uv_strerror(uv_translate_sys_error(sock_error())));
+        dst_addr_drop(addr);
+        return;
+    }
+    if (set_nonblocking(s) != 0 ||
+        (connect(s, sa, sa_len) != 0 && !SOCK_IN_PROGRESS(sock_error()))) {
+        int err = uv_translate_sys_error(sock_error());
+        ZITI_LOG(WARN, "warm_pool[%s] connect to %s failed: %s", pool->label, addr->name, uv_strerror(err));
+        sock_close(s);
+        dst_addr_report(addr, err, uv_now(pool->loop));
+        dst_addr_drop(addr);
+        pool->retry_at = uv_now(pool->loop) + WARM_POOL_RETRY_DELAY;
+        return;
+    }
+
+    struct warm_conn_s *conn = calloc(1, sizeof(*conn));
+    conn->pool = pool;
+    conn->sock = s;
+    conn->addr = addr;
+    conn->since = uv_now(pool->loop);
+    if (uv_poll_init_socket(pool->loop, &conn->poll, s) != 0) {
+        sock_close(s);
+        dst_addr_drop(addr);
+        free(conn);
+        return;
+    }
+    conn->poll.data = conn;
+    TAILQ_INSERT_TAIL(&pool->connecting, conn, _next);
+    pool->n_connecting++;
+    // completion (or failure) of a non-blocking connect is reported as writable
+    uv_poll_start(&conn->poll, UV_WRITABLE, on_connect_event);
+}
+
+static void on_resolved(void *ctx, int status, dst_entry *dst) {
+    warm_pool *pool = ctx;
+    pool->resolving = false;
+    if (status != 0) {
+        ZITI_LOG(WARN, "warm_pool[%s] failed to resolve %s: %s", pool->label, pool->host, uv_strerror(status));
+        pool->retry_at = uv_now(pool->loop) + WARM_POOL_RETRY_DELAY;
+        return;
+    }
+
+    // spread the pool over the server addresses
+    int need = pool->size - pool->n_idle - pool->n_connecting;
+    for (int i = 0; i < need; i++) {
+        dst_addr *addr = dst_entry_select(dst, dst_lb_round_robin, AF_UNSPEC, NULL, 0);
+        if (addr == NULL) break;
+        // only connections in use by clients count towards least-conn
+        dst_addr_park(addr);
+        start_connect(pool, addr);
+    }
+}
+
+static void replenish(warm_pool *pool) {
+    if (pool->resolving || pool->n_idle + pool->n_connecting >= pool->size ||
+        uv_now(pool->loop) < pool->retry_at) {
+        return;
+    }
+
+    struct addrinfo hints;
+    dst_cache_hints(&hints, pool->host, IPPROTO_TCP);
+    pool->resolving = true;
+    int rc = dst_cache_resolve(pool->dst_cache, pool->host, pool->port, &hints, on_resolved, pool);
+    if (rc != 0) {
+        pool->resolving = false;
+        pool->retry_at = uv_now(pool->loop) + WARM_POOL_RETRY_DELAY;
+    }
+}
+
+static void on_check_timer(uv_timer_t *t) {
+    warm_pool *pool = t->data;
+    uint64_t now = uv_now(pool->loop);
+
+    struct warm_conn_s *conn;
+    while ((conn = TAILQ_FIRST(&pool->idle)) != NULL && now - conn->since > pool->max_idle) {
+        ZITI_LOG(TRACE, "warm_pool[%s] recycling idle connection to %s", pool->label, conn->peer);
+        release_conn(conn);
+    }
+    while ((conn = TAILQ_FIRST(&pool->connecting)) != NULL && now - conn->since > WARM_POOL_CONNECT_TIMEOUT) {
+        ZITI_LOG(WARN, "warm_pool[%s] connect to %s timed out", pool->label, conn->addr->name);
+        dst_addr_report(conn->addr, UV_ETIMEDOUT, now);
+        pool->retry_at = now + WARM_POOL_RETRY_DELAY;
+        release_conn(conn);
+    }
+    replenish(pool);
+}
+
+warm_pool *warm_pool_new(uv_loop_t *loop, dst_cache *cache, const char *label,
+                         const char *host, const char *port, int size) {
+    warm_pool *pool = calloc(1, sizeof(warm_pool));
+    pool->loop = loop;
+    pool->dst_cache = cache;
+    pool->label = strdup(label);
+    pool->host = strdup(host);
+    pool->port = strdup(port);
+    pool->size = size;
+    pool->max_idle = WARM_POOL_MAX_IDLE;
+    TAILQ_INIT(&pool->connecting);
+    TAILQ_INIT(&pool->idle);
+
+    uv_timer_init(loop, &pool->timer);
+    pool->timer.data = pool;
+    uv_timer_start(&pool->timer, on_check_timer, WARM_POOL_CHECK_INTERVAL, WARM_POOL_CHECK_INTERVAL);
+    uv_unref((uv_handle_t *) &pool->timer);
+
+    replenish(pool);
+    return pool;
+}
+
+void warm_pool_set_max_idle(warm_pool *pool, uint64_t ms) {
+    pool->max_idle = ms;
+}
+
+static void on_pool_timer_close(uv_handle_t *h) {
+    warm_pool *pool = h->data;
+    free(pool->label);
+    free(pool->host);
+    free(pool->port);
+    free(pool);
+}
+
+void warm_pool_free(warm_pool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    if (pool->resolving) {
+        dst_cache_cancel(pool->dst_cache, pool);
+    }
+    while (!TAILQ_EMPTY(&pool->idle)) {
+        release_conn(TAILQ_FIRST(&pool->idle));
+    }
+    while (!TAILQ_EMPTY(&pool->connecting)) {
+        release_conn(TAILQ_FIRST(&pool->connecting));
+    }
+    uv_close((uv_handle_t *) &pool->timer, on_pool_timer_close);
+}
+
+int warm_pool_take(warm_pool *pool, uv_os_sock_t *sock, dst_addr **addr, char *peer, size_t peer_len) {
+    struct warm_conn_s *conn;
+    // newest first, it is the least likely to have been closed by the server
+    while ((conn = TAILQ_LAST(&pool->idle, warm_conn_list_s)) != NULL) {
+        if (!is_alive(conn->sock)) {
+            release_conn(conn);
+            continue;
+        }
+
+        *sock = conn->sock;
+        conn->sock = INVALID_SOCK;
+        *addr = conn->addr;
+        conn->addr = NULL;
+        dst_addr_unpark(*addr);
+        snprintf(peer, peer_len, "%s", conn->peer);
+        release_conn(conn);
+        pool->hits++;
+        replenish(pool);
+        return 0;
+    }
+
+    pool->misses++;
+    replenish(pool);
+    return -1;
+}
+
+void warm_pool_get_stats(const warm_pool *pool, warm_pool_stats *stats) {
+    stats->size = pool->size;
+    stats->idle = pool->n_idle;
+    stats->connecting = pool->n_connecting;
+    stats->hits = pool->hits;
+    stats->misses = pool->misses;
+}
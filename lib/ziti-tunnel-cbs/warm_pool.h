@@ -0,0 +1,74 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#ifndef ZITI_TUNNELER_SDK_WARM_POOL_H
+#define ZITI_TUNNELER_SDK_WARM_POOL_H
+
+#include <uv.h>
+#include "dst_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** how often idle connections are checked and the pool is topped up (ms) */
+#define WARM_POOL_CHECK_INTERVAL 1000
+/** idle connections are replaced after this long, before servers time them out, unless the pool says (ms) */
+#define WARM_POOL_MAX_IDLE 60000
+/** connects that take longer are abandoned (ms) */
+#define WARM_POOL_CONNECT_TIMEOUT 5000
+/** wait after a failed connect or lookup before trying again (ms) */
+#define WARM_POOL_RETRY_DELAY 2000
+
+/**
+ * TCP connections to a hosted service's server that are established before clients need them.
+ * idle connections are watched for the server closing them, and are replaced in the background
+ * when they are taken, lost, or get too old. data that a server sends before the client is bridged
+ * stays in the socket until it is read by the bridge.
+ */
+typedef struct warm_pool_s warm_pool;
+
+typedef struct warm_pool_stats_s {
+    int size;
+    int idle;
+    int connecting;
+    uint64_t hits;   // clients that got a connection from the pool
+    uint64_t misses; // clients that found the pool empty
+} warm_pool_stats;
+
+warm_pool *warm_pool_new(uv_loop_t *loop, dst_cache *cache, const char *label,
+                         const char *host, const char *port, int size);
+
+/** replace idle connections after `ms` instead of WARM_POOL_MAX_IDLE, for servers that time out sooner */
+void warm_pool_set_max_idle(warm_pool *pool, uint64_t ms);
+
+/** close all connections. the pool is released once its handles are closed */
+void warm_pool_free(warm_pool *pool);
+
+/**
+ * take an established connection. on success the caller owns `*sock` and the reference to the server
+ * address in `*addr` (counted as active, release with dst_addr_release), and `peer` is set to "tcp:<ip>:<port>" of the server. returns -1 if the pool has
+ * no connection ready.
+ */
+int warm_pool_take(warm_pool *pool, uv_os_sock_t *sock, dst_addr **addr, char *peer, size_t peer_len);
+
+void warm_pool_get_stats(const warm_pool *pool, warm_pool_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZITI_TUNNELER_SDK_WARM_POOL_H
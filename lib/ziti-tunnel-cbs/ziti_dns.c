@@ -14,21 +14,34 @@
  limitations under the License.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include <ziti/ziti_tunnel.h>
 #include <ziti/ziti_log.h>
 #include <ziti/ziti_dns.h>
 #include "ziti_instance.h"
 #include "dns_host.h"
+#include "dns_trie.h"
+#include "dns_cache.h"
+#include "dns_ip_pool.h"
+#include "dns_upstream.h"
 
-#define MAX_UPSTREAMS 5
 #define MAX_DNS_NAME 256
 #define MAX_IP_LENGTH 16
+// proxied answers of wildcard domains get 1/PROXY_CACHE_SHARE of the cache limit, upstream answers the rest
+#define PROXY_CACHE_SHARE 4
 
-#ifndef IN6ADDR_V4MAPPED
-#define IN6ADDR_V4MAPPED(v4) \
-	{{{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
-	    0x00, 0x00, 0xff, 0xff, v4[0], v4[1], v4[2], v4[3] }}}
-#endif
+// rewrite the state file when it holds this many records more than needed
+#define STATE_COMPACT_SLACK 1024
+// appended state records are flushed to the file this long (ms) after the first of them
+#define STATE_FLUSH_DELAY 1000
+
+// TTL of locally assigned A/AAAA answers (seconds). idle wildcard mappings are reclaimed after this long
+#define DNS_ENTRY_TTL 60
+
+// a proxied query is sent again on a new resolver connection if the first one fails
+#define PROXY_MAX_ATTEMPTS 2
 
 enum ns_q_type {
     NS_T_A = 1,
@@ -41,40 +54,93 @@ enum ns_q_type {
 typedef struct ziti_dns_client_s {
     io_ctx_t *io_ctx;
     bool is_tcp;
-    model_map active_reqs; // dns_reqs keyed by address of ID.
+    model_map active_reqs; // dns_reqs keyed by client's request ID
+
+    // tcp clients: length-prefixed queries may span reads, and several may arrive at once
+    uint8_t *in_buf;
+    size_t in_len;
+    size_t in_cap;
+    bool reading; // defer close while queries from in_buf are processed
+    bool eof; // client will not send more queries
+    bool failed;
+
+    // tcp clients: framed responses the tunneler did not accept yet, written when the client acks
+    uint8_t *out_buf;
+    size_t out_len;
+    size_t out_cap;
 } ziti_dns_client_t;
 
-struct dns_req {
+// question of a client query, parsed in place
+struct dns_query_s {
     uint16_t id;
-    size_t req_len;
-    uint8_t req[4096];
-    size_t resp_len;
-    uint8_t resp[4096];
+    bool recursive;
+    uint16_t type;
+    char name[MAX_DNS_NAME];
+    size_t section_len; // wire length of the question section
+    size_t udp_size; // largest response the client accepts
+    bool upstream_only; // not a single class IN question, only upstream servers can answer it
+};
 
-    dns_message msg;
+// request buffer sizes. a request object holds a query and a response buffer of its size class
+static const size_t dns_req_sizes[] = { 512, 1232, 4096 };
+#define DNS_REQ_CLASSES (sizeof(dns_req_sizes) / sizeof(dns_req_sizes[0]))
+#define DNS_REQ_POOL_MAX 32 // released objects kept per size class
+#define DNS_TCP_RESP_SIZE 4096 // size class of tcp queries, larger answers get a buffer of their own
+#define DNS_TCP_MSG_MAX 65535 // tcp messages carry a 2-byte length
+
+struct dns_req {
+    dns_upstream_query upstream; // first, see on_upstream_answer()
+    uint16_t id; // client's request ID
+    uint16_t xid; // unique ID for upstream and proxied queries
+    struct dns_query_s q;
 
-    struct in_addr addr;
+    // status and proxied answers. question is only populated for proxied requests
+    dns_message msg;
 
-    uint8_t *rp;
+    ip_addr_t addr; // local A/AAAA answer
 
     ziti_dns_client_t *clt;
+
+    // wildcard domain resolver connection the query is pending on
+    struct dns_domain_s *proxy_domain;
+    uint8_t proxy_attempts;
+
+    size_t size_class;
+    struct dns_req *next_free;
+
+    size_t req_len;
+    uint8_t *req;
+    size_t resp_size; // resp capacity, limited to what the client accepts
+    size_t resp_len;
+    uint8_t *resp;
+    uint8_t *resp_buf; // allocated resp, for tcp answers larger than the size class
+    uint8_t buf[];
 };
 
 static void* on_dns_client(const void *app_intercept_ctx, io_ctx_t *io);
 static int on_dns_close(void *dns_io_ctx);
+static int on_dns_close_write(void *dns_io_ctx);
 static ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packet, size_t len);
 static int query_upstream(struct dns_req *req);
-static void dns_upstream_alloc(uv_handle_t *h, size_t reqlen, uv_buf_t *b);
-static void on_upstream_packet(uv_udp_t *h, ssize_t rc, const uv_buf_t *buf, const struct sockaddr* addr, unsigned int flags);
 static void complete_dns_req(struct dns_req *req);
+static void on_dns_write_ack(void *dns_io_ctx, size_t len);
+static bool flush_tcp_resp(ziti_dns_client_t *clt);
 static void free_dns_req(struct dns_req *req);
 
+struct intercept_names_s {
+    model_map entries; // set[dns_entry_t]
+    model_map domains; // set[dns_domain_t]
+};
+
 typedef struct dns_domain_s {
     char name[MAX_DNS_NAME];
 
     model_map intercepts; // set[intercept]
+    model_map entries; // set[dns_entry_t] created for names matching this domain
 
     ziti_connection resolv_proxy;
+    bool proxy_wire; // hosting side of resolv_proxy accepts wire format queries
+    model_map pending; // map[xid -> dns_req] queries sent over resolv_proxy
 
 } dns_domain_t;
 
@@ -83,72 +149,120 @@ typedef struct dns_entry_s {
     char name[MAX_DNS_NAME];
     char ip[MAX_IP_LENGTH];
     ip_addr_t addr;
+    char ip6[IP6ADDR_STRLEN_MAX];
+    ip_addr_t addr6; // set when IPv6 range is configured
     dns_domain_t *domain;
 
     model_map intercepts;
 
+    // wildcard matches that are not intercepted by name can be reclaimed once idle
+    uint32_t conns;
+    uint64_t last_used;
+    bool reclaimable;
+    TAILQ_ENTRY(dns_entry_s) _lru;
+
 } dns_entry_t;
 
 struct ziti_dns_s {
 
     struct {
         uint32_t base;
-        uint32_t counter;
         uint32_t counter_mask;
         uint32_t capacity;
+        dns_ip_pool alloc; // host offsets in use
     } ip_pool;
 
+    // IPv6 addresses are assigned in parallel with the IPv4 pool: prefix + IPv4 host bits
+    struct {
+        bool enabled;
+        ip6_addr_t prefix;
+    } ip6_pool;
+
     // map[hostname -> dns_entry_t]
     model_map hostnames;
 
     // map[ip4_addr_t -> dns_entry_t]
     model_map ip_addresses;
 
+    // reclaimable entries, most recently used first
+    TAILQ_HEAD(dns_entry_lru_s, dns_entry_s) idle_entries;
+
+    // hostname -> address mappings kept across restarts
+    struct {
+        char *path;
+        FILE *file;
+        size_t records;
+        size_t compact_at; // after a failed rewrite, the next is not tried before there are this many records
+        uv_timer_t flush_timer;
+        model_map pinned; // map[hostname -> ip4] restored from file, not registered yet
+    } state;
+
     // map[domain -> dns_domain_t]
     model_map domains;
 
+    // map[intercept -> struct intercept_names_s], names registered by each intercept
+    model_map intercept_names;
+
+    // active wildcard domains indexed by reversed labels
+    dns_trie domain_trie;
+
     uv_loop_t *loop;
     tunneler_context tnlr;
 
-    model_map requests;
-    uv_udp_t upstream;
-    bool is_ipv4;
-    int num_dns_up;
-    struct sockaddr_in6 upstream_addr[MAX_UPSTREAMS];
+    model_map requests; // dns_reqs keyed by xid
+    uint32_t xid_state; // xorshift state for request IDs, seeded once
+    dns_upstream *upstream;
+
+    // responses from upstream servers
+    dns_cache cache;
+    // responses from hosting side resolvers of wildcard domains
+    dns_cache proxy_cache;
+
+    struct {
+        struct dns_req *free;
+        size_t count;
+    } req_pool[DNS_REQ_CLASSES];
 } ziti_dns;
 
-static uint32_t next_ipv4() {
-    uint32_t candidate;
-    uint32_t i = 0; // track how many candidates have been considered. should never exceed pool capacity.
+static size_t cache_limit = ZITI_DNS_DEFAULT_CACHE_LIMIT;
 
-    if (model_map_size(&ziti_dns.ip_addresses) == ziti_dns.ip_pool.capacity) {
-        ZITI_LOG(ERROR, "DNS ip pool exhausted (%u IPs). Try rerunning with larger DNS range.",
-                 ziti_dns.ip_pool.capacity);
-        return INADDR_NONE;
+static uint64_t now_ms(void) {
+    return uv_hrtime() / 1000000;
+}
+
+static bool ip_pool_offset(uint32_t ip4, uint32_t *offset) {
+    uint32_t host_ip = ntohl(ip4);
+    if ((host_ip & ~ziti_dns.ip_pool.counter_mask) != ziti_dns.ip_pool.base) {
+        return false;
     }
+    *offset = host_ip & ziti_dns.ip_pool.counter_mask;
+    return true;
+}
 
-    do {
-        candidate = htonl(ziti_dns.ip_pool.base | (ziti_dns.ip_pool.counter++ & ziti_dns.ip_pool.counter_mask));
-        i += 1;
-        if (ziti_dns.ip_pool.counter == ziti_dns.ip_pool.counter_mask) {
-            ziti_dns.ip_pool.counter = 1;
-        }
-    } while ((model_map_getl(&ziti_dns.ip_addresses, candidate) != NULL) && i < ziti_dns.ip_pool.capacity);
+static bool reclaim_idle_entry(void);
+static bool drop_pinned_addr(void);
+
+static uint32_t next_ipv4() {
+    uint32_t offset = dns_ip_pool_alloc(&ziti_dns.ip_pool.alloc);
+    if (offset == DNS_IP_POOL_NONE && (reclaim_idle_entry() || drop_pinned_addr())) {
+        offset = dns_ip_pool_alloc(&ziti_dns.ip_pool.alloc);
+    }
 
-    if (i == ziti_dns.ip_pool.capacity) {
-        ZITI_LOG(ERROR, "no IPs available after scanning entire pool");
+    if (offset == DNS_IP_POOL_NONE) {
+        ZITI_LOG(ERROR, "DNS ip pool exhausted (%u IPs). Try rerunning with larger DNS range.",
+                 ziti_dns.ip_pool.capacity);
         return INADDR_NONE;
     }
 
-    return candidate;
+    return htonl(ziti_dns.ip_pool.base | offset);
 }
 
 static int seed_dns(const char *dns_cidr) {
     uint32_t ip[4];
     uint32_t bits;
     int rc = sscanf(dns_cidr, "%d.%d.%d.%d/%d", &ip[0], &ip[1], &ip[2], &ip[3], &bits);
-    if (rc != 5 || ip[0] > 255 || ip[1] > 255 || ip[2] > 255 || ip[3] > 255 || bits > 32) {
-        ZITI_LOG(ERROR, "Invalid IP range specification: n.n.n.n/m format is expected");
+    if (rc != 5 || ip[0] > 255 || ip[1] > 255 || ip[2] > 255 || ip[3] > 255 || bits < 8 || bits > 30) {
+        ZITI_LOG(ERROR, "Invalid IP range specification: n.n.n.n/m format (8 <= m <= 30) is expected");
         return -1;
     }
     uint32_t mask = 0;
@@ -160,9 +274,18 @@ static int seed_dns(const char *dns_cidr) {
     ziti_dns.ip_pool.counter_mask = ~( (uint32_t)-1 << (32 - (uint32_t)bits));
     ziti_dns.ip_pool.base = mask & ~ziti_dns.ip_pool.counter_mask;
 
-    ziti_dns.ip_pool.counter = 1;
     ziti_dns.ip_pool.capacity = (1 << (32 - bits)) - 2; // subtract 2 for network and broadcast IPs
 
+    dns_ip_pool_free(&ziti_dns.ip_pool.alloc);
+    if (dns_ip_pool_init(&ziti_dns.ip_pool.alloc, ziti_dns.ip_pool.counter_mask + 1) != 0) {
+        ZITI_LOG(ERROR, "failed to allocate DNS ip pool");
+        return -1;
+    }
+    // network and broadcast IPs
+    dns_ip_pool_reserve(&ziti_dns.ip_pool.alloc, 0);
+    dns_ip_pool_reserve(&ziti_dns.ip_pool.alloc, ziti_dns.ip_pool.counter_mask);
+    TAILQ_INIT(&ziti_dns.idle_entries);
+
     union ip_bits {
         uint8_t b[4];
         uint32_t ip;
@@ -181,6 +304,12 @@ static int seed_dns(const char *dns_cidr) {
 int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_cidr) {
     ziti_dns.tnlr = tnlr;
     seed_dns(dns_cidr);
+    uv_random(NULL, NULL, &ziti_dns.xid_state, sizeof(ziti_dns.xid_state), 0, NULL);
+    if (ziti_dns.xid_state == 0) {
+        ziti_dns.xid_state = 0x9e3779b9; // xorshift never leaves zero
+    }
+    dns_cache_init(&ziti_dns.cache, cache_limit - cache_limit / PROXY_CACHE_SHARE);
+    dns_cache_init(&ziti_dns.proxy_cache, cache_limit / PROXY_CACHE_SHARE);
 
     intercept_ctx_t *dns_intercept = intercept_ctx_new(tnlr, "ziti:dns-resolver", &ziti_dns);
     ziti_address dns_zaddr, tun_zaddr;
@@ -188,8 +317,10 @@ int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_
     intercept_ctx_add_address(dns_intercept, &dns_zaddr);
     intercept_ctx_add_port_range(dns_intercept, 53, 53);
     intercept_ctx_add_protocol(dns_intercept, "udp");
-    intercept_ctx_override_cbs(dns_intercept, on_dns_client, on_dns_req, on_dns_close, on_dns_close);
+    intercept_ctx_add_protocol(dns_intercept, "tcp");
+    intercept_ctx_override_cbs(dns_intercept, on_dns_client, on_dns_req, on_dns_close, on_dns_close_write);
     ziti_tunneler_intercept(tnlr, dns_intercept);
+    ziti_tunneler_set_match_domains(tnlr, ziti_dns_match_intercept_domains);
 
     // reserve tun and dns ips by adding to ip_addresses with empty dns entries
     ziti_address_from_string(&tun_zaddr, dns_cidr); // assume tun ip is first in dns_cidr
@@ -197,100 +328,140 @@ int ziti_dns_setup(tunneler_context tnlr, const char *dns_addr, const char *dns_
     size_t n = sizeof(reserved) / sizeof(ziti_address *);
     for (int i = 0; i < n; i++) {
         struct in_addr *in4_p = (struct in_addr *) &reserved[i]->addr.cidr.ip;
-        model_map_setl(&ziti_dns.ip_addresses, in4_p->s_addr, calloc(1, sizeof(dns_entry_t)));
+        dns_entry_t *entry = calloc(1, sizeof(dns_entry_t));
+        ip_addr_set_ip4_u32(&entry->addr, in4_p->s_addr);
+        model_map_setl(&ziti_dns.ip_addresses, in4_p->s_addr, entry);
+        uint32_t offset;
+        if (ip_pool_offset(in4_p->s_addr, &offset)) {
+            dns_ip_pool_reserve(&ziti_dns.ip_pool.alloc, offset);
+        }
     }
     return 0;
 }
 
-#define CHECK_UV(op) do{ int rc = (op); if (rc < 0) {\
-ZITI_LOG(ERROR, "failed [" #op "]: %d(%s)", rc, uv_strerror(rc)); \
-return rc;} \
-}while(0)
+static void ipv6_from_ipv4(uint32_t ip4, ip_addr_t *addr6) {
+    const ip6_addr_t *prefix = &ziti_dns.ip6_pool.prefix;
+    uint32_t host = ntohl(ip4) & ziti_dns.ip_pool.counter_mask;
+    IP_ADDR6(addr6, prefix->addr[0], prefix->addr[1], prefix->addr[2], htonl(host));
+}
 
-int ziti_dns_set_upstream(uv_loop_t *l, tunnel_upstream_dns_array upstreams) {
-    if (!uv_is_active((const uv_handle_t *) &ziti_dns.upstream)) {
-        CHECK_UV(uv_udp_init(l, &ziti_dns.upstream));
-        int r = uv_udp_bind(&ziti_dns.upstream,
-                            (const struct sockaddr *) &(struct sockaddr_in6){
-                                    .sin6_family = AF_INET6,
-                                    .sin6_addr = in6addr_any,
-                            }, 0);
-        if (r != 0) {
-            ZITI_LOG(WARN, "failed to bind upstream socket to IPv6 address: %s", uv_strerror(r));
-            r = uv_udp_bind(&ziti_dns.upstream,
-                            (const struct sockaddr *) &(struct sockaddr_in){
-                                    .sin_family = AF_INET,
-                                    .sin_addr = INADDR_ANY,
-                            }, 0);
-            if (r != 0) {
-                ZITI_LOG(WARN, "failed to bind upstream socket to IPv4 address: %s", uv_strerror(r));
-                return r;
-            }
-            ziti_dns.is_ipv4 = true;
+int ziti_dns_set_ipv6_range(const char *ipv6_cidr) {
+    char addr_str[IP6ADDR_STRLEN_MAX];
+    unsigned int bits;
+    ip6_addr_t prefix;
+    if (sscanf(ipv6_cidr, "%45[0-9a-fA-F:]/%u", addr_str, &bits) != 2 || bits > 96 ||
+        !ip6addr_aton(addr_str, &prefix)) {
+        ZITI_LOG(ERROR, "Invalid IPv6 range specification[%s]: x:x::/n format (n <= 96) is expected", ipv6_cidr);
+        return -1;
+    }
+
+    // clear host bits
+    for (int i = 0; i < 4; i++) {
+        uint32_t word_bits = bits > 32 * i ? bits - 32 * i : 0;
+        uint32_t mask = word_bits >= 32 ? 0xFFFFFFFFU : word_bits == 0 ? 0 : ~(0xFFFFFFFFU >> word_bits);
+        prefix.addr[i] &= htonl(mask);
+    }
+    ziti_dns.ip6_pool.prefix = prefix;
+    ziti_dns.ip6_pool.enabled = true;
+
+    // assign addresses to existing (and reserved) entries
+    model_map_iter it = model_map_iterator(&ziti_dns.ip_addresses);
+    while (it != NULL) {
+        dns_entry_t *entry = model_map_it_value(it);
+        ipv6_from_ipv4(ip_2_ip4(&entry->addr)->addr, &entry->addr6);
+        ipaddr_ntoa_r(&entry->addr6, entry->ip6, sizeof(entry->ip6));
+        it = model_map_it_next(it);
+    }
+
+    ZITI_LOG(INFO, "DNS configured with IPv6 range %s/%u", ip6addr_ntoa(&prefix), bits);
+    return 0;
+}
+
+/** find the entry that an assigned IPv4 or IPv6 address belongs to */
+static dns_entry_t *entry_by_addr(const ip_addr_t *addr) {
+    if (IP_IS_V4(addr)) {
+        return model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(addr)->addr);
+    }
+
+    if (IP_IS_V6(addr) && ziti_dns.ip6_pool.enabled) {
+        const ip6_addr_t *a6 = ip_2_ip6(addr);
+        const ip6_addr_t *prefix = &ziti_dns.ip6_pool.prefix;
+        uint32_t host = ntohl(a6->addr[3]);
+        if (a6->addr[0] != prefix->addr[0] || a6->addr[1] != prefix->addr[1] || a6->addr[2] != prefix->addr[2] ||
+            (host & ~ziti_dns.ip_pool.counter_mask) != 0) {
+            return NULL;
         }
-        CHECK_UV(uv_udp_recv_start(&ziti_dns.upstream, dns_upstream_alloc, on_upstream_packet));
-        uv_unref((uv_handle_t *) &ziti_dns.upstream);
+        return model_map_getl(&ziti_dns.ip_addresses, htonl(ziti_dns.ip_pool.base | host));
     }
+    return NULL;
+}
 
-    union {
-        struct in_addr addr;
-        uint8_t a[4];
-    } ipv4;
+const ip_addr_t *ziti_dns_ipv6_addr(const ip_addr_t *addr) {
+    dns_entry_t *entry = ziti_dns.ip6_pool.enabled ? entry_by_addr(addr) : NULL;
+    return entry ? &entry->addr6 : NULL;
+}
 
-    int idx = 0;
-    for (int i = 0; upstreams[i] != NULL && idx < MAX_UPSTREAMS; i++) {
-        const tunnel_upstream_dns *dns = upstreams[i];
-        int port = dns->port != 0 ? (int)dns->port : 53;
-
-        if (ziti_dns.is_ipv4) {
-            if (uv_inet_pton(AF_INET, dns->host, &ipv4) == 0) {
-                ((struct sockaddr_in *) &ziti_dns.upstream_addr[idx])->sin_family = AF_INET;
-                ((struct sockaddr_in *) &ziti_dns.upstream_addr[idx])->sin_addr = ipv4.addr;
-                ((struct sockaddr_in *) &ziti_dns.upstream_addr[idx])->sin_port = htons(port);
-                idx++;
-            } else {
-                ZITI_LOG(WARN, "cannot set non-IPv4 upstream on IPv4 only socket");
-            }
-        } else {
-            // set IPv6 upstream address, mapping IPv4 target to IPv6 space (if needed)
-            ziti_dns.upstream_addr[idx].sin6_family = AF_INET6;
-            ziti_dns.upstream_addr[idx].sin6_port = htons(port);
-            if (uv_inet_pton(AF_INET6, dns->host, &ziti_dns.upstream_addr[idx].sin6_addr) != 0) {
-                if (uv_inet_pton(AF_INET, dns->host, &ipv4) == 0) {
-                    ziti_dns.upstream_addr[idx].sin6_addr = (struct in6_addr) IN6ADDR_V4MAPPED(ipv4.a);
-                } else {
-                    ZITI_LOG(WARN, "upstream address[%s] is not IP format", dns->host);
-                    char port_str[6];
-                    snprintf(port_str, sizeof(port_str), "%hu", port);
-                    uv_getaddrinfo_t req = {0};
-                    if(uv_getaddrinfo(l, &req, NULL, dns->host, port_str, NULL) == 0) {
-                        memcpy(&ziti_dns.upstream_addr[idx], req.addrinfo->ai_addr, req.addrinfo->ai_addrlen);
-                    }
-                }
-            }
-            idx++;
+int ziti_dns_set_upstream(uv_loop_t *l, tunnel_upstream_dns_array upstreams) {
+    if (ziti_dns.upstream == NULL) {
+        ziti_dns.upstream = dns_upstream_new(l, DNS_UPSTREAM_QUERY_TIMEOUT);
+        if (ziti_dns.upstream == NULL) {
+            return UV_EINVAL;
         }
-        ZITI_LOG(INFO, "DNS upstream[%d] is set to %s:%hu", idx, dns->host, port);
     }
-    ziti_dns.num_dns_up = idx;
+
+    dns_upstream_clear_servers(ziti_dns.upstream);
+    for (int i = 0; upstreams[i] != NULL; i++) {
+        const tunnel_upstream_dns *dns = upstreams[i];
+        dns_upstream_add_server(ziti_dns.upstream, dns->host, dns->port != 0 ? (uint16_t) dns->port : 53);
+    }
     return 0;
 }
 
+void ziti_dns_set_cache_limit(size_t limit) {
+    cache_limit = limit;
+    dns_cache_set_limit(&ziti_dns.cache, limit - limit / PROXY_CACHE_SHARE);
+    dns_cache_set_limit(&ziti_dns.proxy_cache, limit / PROXY_CACHE_SHARE);
+    ZITI_LOG(INFO, "DNS upstream cache limit is set to %zu bytes", limit);
+}
+
+void ziti_dns_get_cache_stats(ziti_dns_cache_stats *stats) {
+    dns_cache_stats s, p;
+    dns_cache_get_stats(&ziti_dns.cache, &s);
+    dns_cache_get_stats(&ziti_dns.proxy_cache, &p);
+    stats->hits = s.hits + p.hits;
+    stats->misses = s.misses + p.misses;
+    stats->entries = s.entries + p.entries;
+    stats->bytes = s.bytes + p.bytes;
+    stats->limit = s.limit + p.limit;
+}
+
 
 void* on_dns_client(const void *app_intercept_ctx, io_ctx_t *io) {
-    ZITI_LOG(TRACE, "new DNS client");
     ziti_dns_client_t *clt = calloc(1, sizeof(ziti_dns_client_t));
     io->ziti_io = clt;
     clt->io_ctx = io;
+    const char *intercepted = get_intercepted_address(io->tnlr_io);
+    clt->is_tcp = intercepted != NULL && strncmp(intercepted, "tcp:", 4) == 0;
+    ZITI_LOG(TRACE, "new DNS %s client", clt->is_tcp ? "tcp" : "udp");
     ziti_tunneler_set_idle_timeout(io, 5000); // 5 seconds
+    if (clt->is_tcp) {
+        ziti_tunneler_set_write_ack_cb(io, on_dns_write_ack);
+    }
     ziti_tunneler_dial_completed(io, true);
     return clt;
 }
 
+/** remove from the in-flight requests. a request that got no ID must not remove the one holding its xid */
+static void forget_dns_req(struct dns_req *req) {
+    if (model_map_get_key(&ziti_dns.requests, &req->xid, sizeof(req->xid)) == req) {
+        model_map_remove_key(&ziti_dns.requests, &req->xid, sizeof(req->xid));
+    }
+}
+
 static void remove_dns_req(void *p) {
     struct dns_req *req = p;
     if (req) {
-        model_map_remove_key(&ziti_dns.requests, &req->id, sizeof(req->id));
+        forget_dns_req(req);
         free_dns_req(req);
     }
 }
@@ -303,10 +474,46 @@ int on_dns_close(void *dns_io_ctx) {
     model_map_clear(&clt->active_reqs, remove_dns_req);
     ziti_tunneler_close(clt->io_ctx->tnlr_io);
     free(clt->io_ctx);
+    free(clt->in_buf);
+    free(clt->out_buf);
     free(dns_io_ctx);
     return 0;
 }
 
+/** tcp clients are closed after they stop sending and all of their queries are answered and sent, or on error */
+static void check_tcp_client(ziti_dns_client_t *clt) {
+    if (clt->reading) {
+        return;
+    }
+    if (clt->failed || (clt->eof && model_map_size(&clt->active_reqs) == 0 && clt->out_len == 0)) {
+        on_dns_close(clt);
+    }
+}
+
+/** the client acked some of the responses, send more of what is pending */
+static void on_dns_write_ack(void *dns_io_ctx, size_t len) {
+    ziti_dns_client_t *clt = dns_io_ctx;
+    if (clt->out_len == 0) {
+        return;
+    }
+    if (!flush_tcp_resp(clt)) {
+        ZITI_LOG(WARN, "failed to send responses to tcp client");
+        clt->failed = true;
+    }
+    check_tcp_client(clt);
+}
+
+int on_dns_close_write(void *dns_io_ctx) {
+    ziti_dns_client_t *clt = dns_io_ctx;
+    if (!clt->is_tcp) {
+        return on_dns_close(dns_io_ctx);
+    }
+    ZITI_LOG(TRACE, "DNS tcp client sent FIN, %zu queries pending", model_map_size(&clt->active_reqs));
+    clt->eof = true;
+    check_tcp_client(clt);
+    return 0;
+}
+
 static bool check_name(const char *name, char clean_name[MAX_DNS_NAME], bool *is_domain) {
     const char *hp = name;
     char *p = clean_name;
@@ -333,26 +540,318 @@ static bool check_name(const char *name, char clean_name[MAX_DNS_NAME], bool *is
     return success;
 }
 
+/**
+ * write the live mappings to a new file that replaces the state file. the old file is kept (and appended to)
+ * if that fails. returns true if the file was replaced.
+ */
+static bool state_rewrite(void) {
+    size_t path_len = strlen(ziti_dns.state.path) + sizeof(".tmp");
+    char *tmp_path = malloc(path_len);
+    snprintf(tmp_path, path_len, "%s.tmp", ziti_dns.state.path);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        ZITI_LOG(WARN, "failed to write DNS state file[%s]: %s", tmp_path, strerror(errno));
+        free(tmp_path);
+        ziti_dns.state.compact_at = ziti_dns.state.records + STATE_COMPACT_SLACK;
+        return false;
+    }
+
+    size_t records = 0;
+    const char *name;
+    dns_entry_t *entry;
+    MODEL_MAP_FOREACH(name, entry, &ziti_dns.hostnames) {
+        fprintf(f, "%s %s\n", entry->ip, name);
+        records++;
+    }
+    void *ip4;
+    MODEL_MAP_FOREACH(name, ip4, &ziti_dns.state.pinned) {
+        ip_addr_t addr = IPADDR4_INIT((uint32_t)(uintptr_t) ip4);
+        fprintf(f, "%s %s\n", ipaddr_ntoa(&addr), name);
+        records++;
+    }
+
+    bool ok = fflush(f) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (ok && ziti_dns.state.file) {
+        fclose(ziti_dns.state.file);
+        ziti_dns.state.file = NULL;
+    }
+#if _WIN32
+    // rename() does not replace existing files on windows
+    bool replaced = ok && MoveFileExA(tmp_path, ziti_dns.state.path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool replaced = ok && rename(tmp_path, ziti_dns.state.path) == 0;
+#endif
+    if (replaced) {
+        // everything appended so far is in the new file
+        ziti_dns.state.records = records;
+        ziti_dns.state.compact_at = 0;
+        uv_timer_stop(&ziti_dns.state.flush_timer);
+    } else {
+        ZITI_LOG(WARN, "failed to replace DNS state file[%s]: %s", ziti_dns.state.path, strerror(errno));
+        remove(tmp_path);
+        ziti_dns.state.compact_at = ziti_dns.state.records + STATE_COMPACT_SLACK;
+    }
+    free(tmp_path);
+
+    if (ziti_dns.state.file == NULL) {
+        ziti_dns.state.file = fopen(ziti_dns.state.path, "a");
+        if (ziti_dns.state.file == NULL) {
+            ZITI_LOG(WARN, "failed to open DNS state file[%s]: %s", ziti_dns.state.path, strerror(errno));
+        }
+    }
+    return replaced;
+}
+
+static void on_state_flush(uv_timer_t *t) {
+    if (ziti_dns.state.file && fflush(ziti_dns.state.file) != 0) {
+        ZITI_LOG(WARN, "failed to write DNS state file[%s]: %s", ziti_dns.state.path, strerror(errno));
+    }
+}
+
+static void state_append(const dns_entry_t *entry) {
+    if (ziti_dns.state.file == NULL) {
+        return;
+    }
+
+    size_t live = model_map_size(&ziti_dns.hostnames) + model_map_size(&ziti_dns.state.pinned);
+    if (ziti_dns.state.records > 2 * live + STATE_COMPACT_SLACK &&
+        ziti_dns.state.records >= ziti_dns.state.compact_at) {
+        if (state_rewrite()) {
+            return; // includes entry
+        }
+        if (ziti_dns.state.file == NULL) {
+            return;
+        }
+    }
+
+    fprintf(ziti_dns.state.file, "%s %s\n", entry->ip, entry->name);
+    ziti_dns.state.records++;
+    // mappings are often created in bursts (e.g. when services are loaded), flush them together
+    if (!uv_is_active((uv_handle_t *) &ziti_dns.state.flush_timer)) {
+        uv_timer_start(&ziti_dns.state.flush_timer, on_state_flush, STATE_FLUSH_DELAY, 0);
+    }
+}
+
+/** replay state file. later records replace earlier ones for the same name or address */
+static void state_load(FILE *f) {
+    model_map names = {0}; // map[ip4 -> name]
+    char line[MAX_IP_LENGTH + MAX_DNS_NAME + 2];
+    char ip_str[MAX_IP_LENGTH];
+    char name[MAX_DNS_NAME];
+    ip4_addr_t ip;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%15s %255s", ip_str, name) != 2 || !ip4addr_aton(ip_str, &ip)) {
+            continue;
+        }
+        void *prev_ip = model_map_remove(&ziti_dns.state.pinned, name);
+        if (prev_ip) {
+            free(model_map_removel(&names, (uintptr_t) prev_ip));
+        }
+        char *prev_name = model_map_removel(&names, ip.addr);
+        if (prev_name) {
+            model_map_remove(&ziti_dns.state.pinned, prev_name);
+            free(prev_name);
+        }
+        model_map_set(&ziti_dns.state.pinned, name, (void *)(uintptr_t) ip.addr);
+        model_map_setl(&names, ip.addr, strdup(name));
+    }
+    model_map_clear(&names, free);
+
+    // keep addresses for the restored names
+    model_map_iter it = model_map_iterator(&ziti_dns.state.pinned);
+    while (it != NULL) {
+        const char *host = model_map_it_key(it);
+        uint32_t ip4 = (uint32_t)(uintptr_t) model_map_it_value(it);
+        uint32_t offset;
+        if (model_map_get(&ziti_dns.hostnames, host) == NULL && ip_pool_offset(ip4, &offset) &&
+            dns_ip_pool_reserve(&ziti_dns.ip_pool.alloc, offset)) {
+            it = model_map_it_next(it);
+        } else {
+            it = model_map_it_remove(it);
+        }
+    }
+}
+
+static void on_state_timer_close(uv_handle_t *h) {
+    memset(h, 0, sizeof(uv_timer_t));
+}
+
+/** stop keeping state, writing out records that are still buffered */
+static void state_close(void) {
+    if (ziti_dns.state.file) {
+        if (fclose(ziti_dns.state.file) != 0) {
+            ZITI_LOG(WARN, "failed to write DNS state file[%s]: %s", ziti_dns.state.path, strerror(errno));
+        }
+        ziti_dns.state.file = NULL;
+    }
+    if (ziti_dns.state.flush_timer.loop != NULL && !uv_is_closing((uv_handle_t *) &ziti_dns.state.flush_timer)) {
+        uv_close((uv_handle_t *) &ziti_dns.state.flush_timer, on_state_timer_close);
+    }
+    free(ziti_dns.state.path);
+    ziti_dns.state.path = NULL;
+    ziti_dns.state.records = 0;
+    ziti_dns.state.compact_at = 0;
+    model_map_clear(&ziti_dns.state.pinned, NULL);
+}
+
+int ziti_dns_set_state_file(uv_loop_t *loop, const char *path) {
+    if (path == NULL) {
+        state_close();
+        return 0;
+    }
+
+    free(ziti_dns.state.path);
+    ziti_dns.state.path = strdup(path);
+    if (ziti_dns.state.flush_timer.loop == NULL) {
+        uv_timer_init(loop, &ziti_dns.state.flush_timer);
+        // records still buffered are written when the process exits
+        uv_unref((uv_handle_t *) &ziti_dns.state.flush_timer);
+    }
+
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        state_load(f);
+        fclose(f);
+        ZITI_LOG(INFO, "restored %zu DNS mappings from %s", model_map_size(&ziti_dns.state.pinned), path);
+    } else if (errno != ENOENT) {
+        ZITI_LOG(WARN, "failed to read DNS state file[%s]: %s", path, strerror(errno));
+    }
+
+    state_rewrite();
+    return ziti_dns.state.file ? 0 : -1;
+}
+
+/** use the address that `host` had before restart */
+static uint32_t claim_pinned_addr(const char *host) {
+    void *ip4 = model_map_remove(&ziti_dns.state.pinned, host);
+    return ip4 ? (uint32_t)(uintptr_t) ip4 : INADDR_NONE;
+}
+
+/** give up a restored address that was not claimed so far */
+static bool drop_pinned_addr(void) {
+    model_map_iter it = model_map_iterator(&ziti_dns.state.pinned);
+    if (it == NULL) {
+        return false;
+    }
+    uint32_t offset;
+    if (ip_pool_offset((uint32_t)(uintptr_t) model_map_it_value(it), &offset)) {
+        dns_ip_pool_release(&ziti_dns.ip_pool.alloc, offset);
+    }
+    ZITI_LOG(INFO, "releasing restored DNS mapping for %s", (const char *) model_map_it_key(it));
+    model_map_it_remove(it);
+    return true;
+}
+
 static dns_entry_t* new_ipv4_entry(const char *host) {
-    dns_entry_t *entry = calloc(1, sizeof(dns_entry_t));
-    strncpy(entry->name, host, sizeof(entry->name));
-    uint32_t next = next_ipv4();
+    uint32_t next = claim_pinned_addr(host);
+    bool restored = next != INADDR_NONE;
+    if (!restored) {
+        next = next_ipv4();
+    }
     if (next == INADDR_NONE) {
         return NULL;
     }
+    dns_entry_t *entry = calloc(1, sizeof(dns_entry_t));
+    strncpy(entry->name, host, sizeof(entry->name));
+    entry->last_used = now_ms();
 
     ip_addr_set_ip4_u32(&entry->addr, next);
     ipaddr_ntoa_r(&entry->addr, entry->ip, sizeof(entry->ip));
+    if (ziti_dns.ip6_pool.enabled) {
+        ipv6_from_ipv4(next, &entry->addr6);
+        ipaddr_ntoa_r(&entry->addr6, entry->ip6, sizeof(entry->ip6));
+    }
 
     model_map_set(&ziti_dns.hostnames, host, entry);
     model_map_setl(&ziti_dns.ip_addresses, ip_2_ip4(&entry->addr)->addr, entry);
-    ZITI_LOG(INFO, "registered DNS entry %s -> %s", host, entry->ip);
+    ZITI_LOG(INFO, "registered DNS entry %s -> %s%s%s", host, entry->ip,
+             ziti_dns.ip6_pool.enabled ? ", " : "", ziti_dns.ip6_pool.enabled ? entry->ip6 : "");
+    if (!restored) {
+        state_append(entry);
+    }
 
     return entry;
 }
 
+/** keep entry on the idle list iff it only exists because of a wildcard domain */
+static void update_reclaimable(dns_entry_t *entry) {
+    bool reclaimable = entry->domain != NULL && model_map_size(&entry->intercepts) == 0;
+    if (reclaimable && !entry->reclaimable) {
+        TAILQ_INSERT_HEAD(&ziti_dns.idle_entries, entry, _lru);
+    } else if (!reclaimable && entry->reclaimable) {
+        TAILQ_REMOVE(&ziti_dns.idle_entries, entry, _lru);
+    }
+    entry->reclaimable = reclaimable;
+}
+
+static void touch_entry(dns_entry_t *entry) {
+    entry->last_used = now_ms();
+    if (entry->reclaimable) {
+        TAILQ_REMOVE(&ziti_dns.idle_entries, entry, _lru);
+        TAILQ_INSERT_HEAD(&ziti_dns.idle_entries, entry, _lru);
+    }
+}
+
+/** remove entry from the lookup maps and return its address to the pool */
+static void release_entry(dns_entry_t *entry) {
+    if (entry->domain) {
+        model_map_remove_key(&entry->domain->entries, &entry, sizeof(entry));
+    }
+    if (entry->reclaimable) {
+        TAILQ_REMOVE(&ziti_dns.idle_entries, entry, _lru);
+        entry->reclaimable = false;
+    }
+    model_map_removel(&ziti_dns.ip_addresses, ip_2_ip4(&entry->addr)->addr);
+    uint32_t offset;
+    if (ip_pool_offset(ip_2_ip4(&entry->addr)->addr, &offset)) {
+        dns_ip_pool_release(&ziti_dns.ip_pool.alloc, offset);
+    }
+}
+
+/**
+ * free the least recently used wildcard mapping that has no connections and was not queried within its TTL.
+ * clients may still hold answers that are younger than the TTL, so those mappings are never reclaimed.
+ */
+static bool reclaim_idle_entry(void) {
+    uint64_t now = now_ms();
+    dns_entry_t *entry = TAILQ_LAST(&ziti_dns.idle_entries, dns_entry_lru_s);
+    while (entry != NULL) {
+        if (now - entry->last_used < DNS_ENTRY_TTL * 1000) {
+            break; // the rest of the list was used more recently
+        }
+        if (entry->conns == 0) {
+            ZITI_LOG(INFO, "reclaiming idle DNS mapping %s -> %s", entry->name, entry->ip);
+            model_map_remove(&ziti_dns.hostnames, entry->name);
+            release_entry(entry);
+            model_map_clear(&entry->intercepts, NULL);
+            free(entry);
+            return true;
+        }
+        entry = TAILQ_PREV(entry, dns_entry_lru_s, _lru);
+    }
+    return false;
+}
+
+void ziti_dns_conn_start(const ip_addr_t *addr) {
+    dns_entry_t *entry = entry_by_addr(addr);
+    if (entry && entry->name[0] != '\0') {
+        entry->conns++;
+        touch_entry(entry);
+    }
+}
+
+void ziti_dns_conn_end(const ip_addr_t *addr) {
+    dns_entry_t *entry = entry_by_addr(addr);
+    if (entry && entry->conns > 0) {
+        entry->conns--;
+        touch_entry(entry);
+    }
+}
+
 const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr) {
-     dns_entry_t *entry = model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(addr)->addr);
+     dns_entry_t *entry = entry_by_addr(addr);
      if (entry && entry->domain) {
          return entry->domain->name;
      }
@@ -361,20 +860,45 @@ const char *ziti_dns_reverse_lookup_domain(const ip_addr_t *addr) {
 
 const char *ziti_dns_reverse_lookup(const char *ip_addr) {
     ip_addr_t addr = {0};
-    ipaddr_aton(ip_addr, &addr);
-    dns_entry_t *entry = model_map_getl(&ziti_dns.ip_addresses, ip_2_ip4(&addr)->addr);
+    if (!ipaddr_aton(ip_addr, &addr)) {
+        return NULL;
+    }
+    dns_entry_t *entry = entry_by_addr(&addr);
 
     return entry ? entry->name : NULL;
 }
 
+/** find the most specific wildcard domain that matches hostname */
 static dns_domain_t* find_domain(const char *hostname) {
-    char *dot = strchr(hostname, '.');
-    dns_domain_t *domain = model_map_get(&ziti_dns.domains, hostname);
-    while (dot != NULL && domain == NULL) {
-        domain = model_map_get(&ziti_dns.domains, dot + 1);
-        dot = strchr(dot + 1, '.');
+    return dns_trie_match(&ziti_dns.domain_trie, hostname);
+}
+
+struct intercept_visit_s {
+    intercept_domain_visitor visit;
+    void *ctx;
+};
+
+static bool visit_domain_intercepts(void *value, void *ctx) {
+    dns_domain_t *domain = value;
+    struct intercept_visit_s *v = ctx;
+    const void *key;
+    void *intercept;
+    MODEL_MAP_FOREACH(key, intercept, &domain->intercepts) {
+        if (v->visit(intercept, v->ctx)) {
+            return true;
+        }
     }
-    return domain;
+    return false;
+}
+
+void ziti_dns_match_intercept_domains(const ip_addr_t *addr, intercept_domain_visitor visit, void *ctx) {
+    dns_entry_t *entry = entry_by_addr(addr);
+    if (entry == NULL || entry->domain == NULL) {
+        return;
+    }
+
+    struct intercept_visit_s v = { visit, ctx };
+    dns_trie_find_match(&ziti_dns.domain_trie, entry->name, visit_domain_intercepts, &v);
 }
 
 static dns_entry_t *ziti_dns_lookup(const char *hostname) {
@@ -395,6 +919,8 @@ static dns_entry_t *ziti_dns_lookup(const char *hostname) {
             entry = new_ipv4_entry(clean);
             if (entry) {
                 entry->domain = domain;
+                model_map_set_key(&domain->entries, &entry, sizeof(entry), entry);
+                update_reclaimable(entry);
             }
         }
     }
@@ -402,6 +928,7 @@ static dns_entry_t *ziti_dns_lookup(const char *hostname) {
     if (entry) {
         if (model_map_size(&entry->intercepts) > 0 ||
             (entry->domain && model_map_size(&entry->domain->intercepts) > 0)) {
+            touch_entry(entry);
             return entry;
         } else {
             return NULL; // inactive entry
@@ -411,38 +938,73 @@ static dns_entry_t *ziti_dns_lookup(const char *hostname) {
 }
 
 
+static struct intercept_names_s *intercept_names(void *intercept) {
+    struct intercept_names_s *names = model_map_get_key(&ziti_dns.intercept_names, &intercept, sizeof(intercept));
+    if (names == NULL) {
+        names = calloc(1, sizeof(*names));
+        model_map_set_key(&ziti_dns.intercept_names, &intercept, sizeof(intercept), names);
+    }
+    return names;
+}
+
+static void deactivate_entry(dns_entry_t *e) {
+    if (model_map_get(&ziti_dns.hostnames, e->name) != e) {
+        return;
+    }
+    model_map_remove(&ziti_dns.hostnames, e->name);
+    release_entry(e);
+    ZITI_LOG(DEBUG, "%zu active hostnames mapped to %zu IPs", model_map_size(&ziti_dns.hostnames), model_map_size(&ziti_dns.ip_addresses));
+    ZITI_LOG(INFO, "DNS mapping %s -> %s is now inactive", e->name, e->ip);
+}
+
 void ziti_dns_deregister_intercept(void *intercept) {
-    model_map_iter it = model_map_iterator(&ziti_dns.domains);
+    struct intercept_names_s *names = model_map_remove_key(&ziti_dns.intercept_names, &intercept, sizeof(intercept));
+    if (names == NULL) {
+        return;
+    }
+
+    dns_domain_t *domain;
+    model_map_iter it = model_map_iterator(&names->domains);
     while (it != NULL) {
-        dns_domain_t *domain = model_map_it_value(it);
+        domain = model_map_it_value(it);
         model_map_remove_key(&domain->intercepts, &intercept, sizeof(intercept));
         it = model_map_it_next(it);
     }
 
-    it = model_map_iterator(&ziti_dns.hostnames);
+    it = model_map_iterator(&names->entries);
     while (it != NULL) {
         dns_entry_t *e = model_map_it_value(it);
         model_map_remove_key(&e->intercepts, &intercept, sizeof(intercept));
         if (model_map_size(&e->intercepts) == 0 && (e->domain == NULL || model_map_size(&e->domain->intercepts) == 0)) {
-            it = model_map_it_remove(it);
-            model_map_removel(&ziti_dns.ip_addresses, ip_2_ip4(&e->addr)->addr);
-            ZITI_LOG(DEBUG, "%zu active hostnames mapped to %zu IPs", model_map_size(&ziti_dns.hostnames), model_map_size(&ziti_dns.ip_addresses));
-            ZITI_LOG(INFO, "DNS mapping %s -> %s is now inactive", e->name, e->ip);
+            deactivate_entry(e);
         } else {
-            it = model_map_it_next(it);
+            update_reclaimable(e);
         }
+        it = model_map_it_remove(it);
     }
 
-    it = model_map_iterator(&ziti_dns.domains);
+    it = model_map_iterator(&names->domains);
     while (it != NULL) {
-        dns_domain_t *domain = model_map_it_value(it);
+        domain = model_map_it_value(it);
         if (model_map_size(&domain->intercepts) == 0) {
-            it = model_map_it_remove(it);
+            // names that only resolved through this domain go with it
+            model_map_iter eit = model_map_iterator(&domain->entries);
+            while (eit != NULL) {
+                dns_entry_t *e = model_map_it_value(eit);
+                eit = model_map_it_remove(eit);
+                if (model_map_size(&e->intercepts) == 0) {
+                    e->domain = NULL;
+                    deactivate_entry(e);
+                }
+            }
+            model_map_remove(&ziti_dns.domains, domain->name + 2);
+            dns_trie_remove(&ziti_dns.domain_trie, domain->name + 2);
+            dns_cache_remove_domain(&ziti_dns.proxy_cache, domain->name + 2);
             ZITI_LOG(INFO, "wildcard domain[*%s] is now inactive", domain->name);
-        } else {
-            it = model_map_it_next(it);
         }
+        it = model_map_it_remove(it);
     }
+    free(names);
 }
 
 const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *intercept) {
@@ -466,8 +1028,10 @@ const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *inte
             domain = calloc(1, sizeof(dns_domain_t));
             strncpy(domain->name, clean, sizeof(domain->name));
             model_map_set(&ziti_dns.domains, clean + 2, domain);
+            dns_trie_set(&ziti_dns.domain_trie, clean + 2, domain);
         }
         model_map_set_key(&domain->intercepts, &intercept, sizeof(intercept), intercept);
+        model_map_set_key(&intercept_names(intercept)->domains, &domain, sizeof(domain), domain);
         return NULL;
     } else {
         dns_entry_t *entry = model_map_get(&ziti_dns.hostnames, clean);
@@ -476,6 +1040,8 @@ const ip_addr_t *ziti_dns_register_hostname(const ziti_address *addr, void *inte
         }
         if (entry) {
             model_map_set_key(&entry->intercepts, &intercept, sizeof(intercept), intercept);
+            model_map_set_key(&intercept_names(intercept)->entries, &entry, sizeof(entry), entry);
+            update_reclaimable(entry);
             return &entry->addr;
         } else {
             return NULL;
@@ -492,6 +1058,7 @@ static const char DNS_OPT[] = { 0x0, 0x0, 0x29, 0x10, 0x0, 0x0, 0x0, 0x0, 0x0, 0
 #define DNS_QR(p) ((p) + 12)
 #define DNS_RD(p) ((p)[2] & 0x1)
 
+#define DNS_SET_ID(p,id) do{ (p)[0] = (id) >> 8; (p)[1] = (id) & 0xff; } while(0)
 #define DNS_SET_RA(p) ((p)[3] = (p)[3] | 0x80)
 #define DNS_SET_TC(p) ((p)[2] = (p)[2] | 0x2)
 #define DNS_SET_CODE(p,c) ((p)[3] = (p)[3] | ((c) & 0xf))
@@ -534,21 +1101,42 @@ static void format_resp(struct dns_req *req) {
 
     // copy header from request
     memcpy(req->resp, req->req, DNS_HEADER_LEN); // DNS header
+    DNS_SET_ID(req->resp, req->id);
     DNS_SET_ANS(req->resp);
     DNS_SET_CODE(req->resp, req->msg.status);
-    bool recursion_avail = uv_is_active((const uv_handle_t *) &ziti_dns.upstream);
+    bool recursion_avail = ziti_dns.upstream != NULL && dns_upstream_server_count(ziti_dns.upstream) > 0;
     if (recursion_avail) {
         DNS_SET_RA(req->resp);
     }
 
-    size_t query_section_len = strlen(req->msg.question[0]->name) + 2 + 4;
-    memcpy(req->resp + DNS_HEADER_LEN, req->req + DNS_HEADER_LEN, query_section_len);
+    memcpy(req->resp + DNS_HEADER_LEN, req->req + DNS_HEADER_LEN, req->q.section_len);
 
-    uint8_t *rp = req->resp + DNS_HEADER_LEN + query_section_len;
-    uint8_t *resp_end = req->resp + sizeof(req->resp);
+    uint8_t *rp = req->resp + DNS_HEADER_LEN + req->q.section_len;
+    uint8_t *resp_end = req->resp + req->resp_size;
     bool truncated = false;
 
-    if (req->msg.status == DNS_NO_ERROR && req->msg.answer != NULL) {
+    if (req->msg.status == DNS_NO_ERROR && !ip_addr_isany_val(req->addr)) {
+        // local A/AAAA answer is written directly
+        bool is_v4 = IP_IS_V4_VAL(req->addr);
+        uint16_t rdlen = is_v4 ? sizeof(ip4_addr_t) : 4 * sizeof(uint32_t);
+        if (resp_end - rp < 12 + rdlen) {
+            DNS_SET_TC(req->resp);
+        } else {
+            *rp++ = 0xc0;
+            *rp++ = 0x0c;
+            SET_U16(rp, is_v4 ? NS_T_A : NS_T_AAAA);
+            SET_U16(rp, 1); // class IN
+            SET_U32(rp, DNS_ENTRY_TTL);
+            SET_U16(rp, rdlen);
+            if (is_v4) {
+                memcpy(rp, &ip_2_ip4(&req->addr)->addr, rdlen);
+            } else {
+                memcpy(rp, ip_2_ip6(&req->addr)->addr, rdlen);
+            }
+            rp += rdlen;
+            DNS_SET_ARS(req->resp, 1);
+        }
+    } else if (req->msg.status == DNS_NO_ERROR && req->msg.answer != NULL) {
         int ans_count = 0;
         for (int i = 0; req->msg.answer[i] != NULL; i++) {
             ans_count++;
@@ -563,25 +1151,13 @@ static void format_resp(struct dns_req *req) {
             *rp++ = 0xc0;
             *rp++ = 0x0c;
 
-            ZITI_LOG(INFO, "found record[%s] for query[%d:%s]", a->data,
-                     (int)req->msg.question[0]->type, req->msg.question[0]->name);
+            ZITI_LOG(INFO, "found record[%s] for query[%d:%s]", a->data, (int)req->q.type, req->q.name);
 
             SET_U16(rp, a->type);
             SET_U16(rp, 1); // class IN
             SET_U32(rp, a->ttl);
 
             switch (a->type) {
-                case NS_T_A: {
-                    if (resp_end - rp < (2 + sizeof(req->addr.s_addr))) {
-                        truncated = true;
-                        goto done;
-                    }
-                    SET_U16(rp, sizeof(req->addr.s_addr));
-                    memcpy(rp, &req->addr.s_addr, sizeof(req->addr.s_addr));
-                    rp += sizeof(req->addr.s_addr);
-                    break;
-                }
-
                 case NS_T_TXT: {
                     uint16_t txtlen = strlen(a->data);
                     uint16_t datalen = 1 + txtlen;
@@ -646,19 +1222,16 @@ static void format_resp(struct dns_req *req) {
 }
 
 static void process_host_req(struct dns_req *req) {
-    dns_entry_t *entry = ziti_dns_lookup(req->msg.question[0]->name);
+    dns_entry_t *entry = ziti_dns_lookup(req->q.name);
     if (entry) {
         req->msg.status = DNS_NO_ERROR;
 
-        if (req->msg.question[0]->type == NS_T_A) {
-            req->addr.s_addr = entry->addr.u_addr.ip4.addr;
-
-            dns_answer *a = calloc(1, sizeof(dns_answer));
-            a->ttl = 60;
-            a->type = NS_T_A;
-            a->data = strdup(entry->ip);
-            req->msg.answer = calloc(2, sizeof(dns_answer *));
-            req->msg.answer[0] = a;
+        if (req->q.type == NS_T_A) {
+            ip_addr_copy(req->addr, entry->addr);
+            ZITI_LOG(INFO, "found record[%s] for query[%d:%s]", entry->ip, (int)req->q.type, req->q.name);
+        } else if (req->q.type == NS_T_AAAA && ziti_dns.ip6_pool.enabled) {
+            ip_addr_copy(req->addr, entry->addr6);
+            ZITI_LOG(INFO, "found record[%s] for query[%d:%s]", entry->ip6, (int)req->q.type, req->q.name);
         }
 
         format_resp(req);
@@ -675,8 +1248,44 @@ static void process_host_req(struct dns_req *req) {
 
 static void proxy_domain_close_cb(ziti_connection c) {
     dns_domain_t *domain = ziti_conn_data(c);
-    if (domain) {
+    if (domain && domain->resolv_proxy == c) {
         domain->resolv_proxy = NULL;
+        domain->proxy_wire = false;
+    }
+}
+
+static bool send_proxy_req(struct dns_req *req, dns_domain_t *domain);
+static char *proxy_req_json(struct dns_req *req, size_t *jsonlen);
+
+/** drop the resolver connection. queries pending on it are sent again on a new connection, or fail */
+static void proxy_conn_failed(dns_domain_t *domain, ziti_connection conn) {
+    if (conn != domain->resolv_proxy) {
+        return; // already replaced
+    }
+    domain->resolv_proxy = NULL;
+    domain->proxy_wire = false;
+    ziti_close(conn, proxy_domain_close_cb);
+
+    model_map retry = {0};
+    model_map_iter it = model_map_iterator(&domain->pending);
+    while (it != NULL) {
+        struct dns_req *req = model_map_it_value(it);
+        model_map_set_key(&retry, &req->xid, sizeof(req->xid), req);
+        it = model_map_it_remove(it);
+    }
+
+    it = model_map_iterator(&retry);
+    while (it != NULL) {
+        struct dns_req *req = model_map_it_value(it);
+        it = model_map_it_remove(it);
+        req->proxy_domain = NULL;
+        if (req->proxy_attempts < PROXY_MAX_ATTEMPTS && send_proxy_req(req, domain)) {
+            ZITI_LOG(DEBUG, "resending proxy resolve req[%04x] on new connection", req->id);
+            continue;
+        }
+        req->msg.status = DNS_SERVFAIL;
+        format_resp(req);
+        complete_dns_req(req);
     }
 }
 
@@ -684,15 +1293,60 @@ static void on_proxy_connect(ziti_connection conn, int status) {
     dns_domain_t *domain = ziti_conn_data(conn);
     if (status == ZITI_OK) {
         ZITI_LOG(INFO, "proxy resolve connection established for domain[%s]", domain->name);
-        domain->resolv_proxy = conn;
     } else {
         ZITI_LOG(ERROR, "failed to establish proxy resolve connection for domain[%s]", domain->name);
-        ziti_close(conn, proxy_domain_close_cb);
+        proxy_conn_failed(domain, conn);
     }
 }
 
+/** respond with an upstream or proxied answer, truncated if it is more than the client takes */
+static void set_answer(struct dns_req *req, const uint8_t *answer, size_t len, dns_cache *cache) {
+    if (len > req->resp_size && req->clt && req->clt->is_tcp && len <= DNS_TCP_MSG_MAX) {
+        req->resp_buf = malloc(len);
+        req->resp = req->resp_buf;
+        req->resp_size = len;
+    }
+    if (len <= req->resp_size) {
+        req->resp_len = len;
+        memcpy(req->resp, answer, len);
+        dns_cache_store(cache, req->resp, req->resp_len, now_ms());
+    } else {
+        ZITI_LOG(DEBUG, "response[%04x] exceeds client's limit(%zu): truncating", req->id, req->resp_size);
+        req->resp_len = DNS_HEADER_LEN + req->q.section_len;
+        memcpy(req->resp, answer, req->resp_len);
+        DNS_SET_TC(req->resp);
+        memset(req->resp + 6, 0, 6); // no answer, authority, additional records
+    }
+    DNS_SET_ID(req->resp, req->id);
+}
+
+static void on_proxy_wire_resp(dns_domain_t *domain, const uint8_t *data, size_t len) {
+    if (len < DNS_HEADER_LEN) {
+        return;
+    }
+    uint16_t xid = DNS_ID(data);
+    struct dns_req *req = model_map_get_key(&domain->pending, &xid, sizeof(xid));
+    if (req == NULL) {
+        return;
+    }
+    if (len < DNS_HEADER_LEN + req->q.section_len ||
+        memcmp(data + DNS_HEADER_LEN, req->req + DNS_HEADER_LEN, req->q.section_len) != 0) {
+        ZITI_LOG(DEBUG, "dropping proxy resolve response[%04x]: question does not match query[%04x]", xid, req->id);
+        return;
+    }
+
+    model_map_remove_key(&domain->pending, &xid, sizeof(xid));
+    req->proxy_domain = NULL;
+    set_answer(req, data, len, &ziti_dns.proxy_cache);
+    complete_dns_req(req);
+}
+
 static ssize_t on_proxy_data(ziti_connection conn, const uint8_t* data, ssize_t status) {
-    if (status >= 0) {
+    dns_domain_t *domain = ziti_conn_data(conn);
+    if (status > 0 && data[0] != '{') {
+        // wire format response, see DNS_WIRE_HELLO
+        on_proxy_wire_resp(domain, data, status);
+    } else if (status >= 0) {
         ZITI_LOG(DEBUG, "proxy resolve: %.*s", (int)status, data);
         dns_message msg = {0};
         int rc = parse_dns_message(&msg, (const char *) data, status);
@@ -700,82 +1354,118 @@ static ssize_t on_proxy_data(ziti_connection conn, const uint8_t* data, ssize_t
             // the original DNS client's request won't be completed because we can't get the msg ID.
             return rc;
         }
+        if (msg.question == NULL && msg.comment && strcmp(msg.comment, DNS_FORMAT_WIRE) == 0) {
+            ZITI_LOG(DEBUG, "proxy resolve connection for domain[%s] accepts wire format", domain->name);
+            domain->proxy_wire = conn == domain->resolv_proxy;
+            free_dns_message(&msg);
+            return status;
+        }
+        // responses on a connection may come in any order
         uint16_t id = msg.id;
-        struct dns_req *req = model_map_get_key(&ziti_dns.requests, &id, sizeof(id));
+        struct dns_req *req = model_map_remove_key(&domain->pending, &id, sizeof(id));
         if (req) {
+            req->proxy_domain = NULL;
+            req->msg.status = msg.status;
             req->msg.answer = msg.answer;
             msg.answer = NULL;
             format_resp(req);
+            dns_cache_store(&ziti_dns.proxy_cache, req->resp, req->resp_len, now_ms());
             complete_dns_req(req);
         }
         free_dns_message(&msg);
     } else {
         ZITI_LOG(ERROR, "proxy resolve connection failed: %d(%s)", (int)status, ziti_errorstr(status));
-        ziti_close(conn, proxy_domain_close_cb);
+        proxy_conn_failed(domain, conn);
     }
     return status;
 }
 
-struct proxy_dns_req_wr_s {
-    struct dns_req *req;
-    char *json;
-};
-
-static void free_proxy_dns_wr(struct proxy_dns_req_wr_s *wr) {
-    if (wr->json) {
-        free(wr->json);
-        wr->json = NULL;
-    }
-    free(wr);
-}
-
 static void on_proxy_write(ziti_connection conn, ssize_t len, void *ctx) {
     ZITI_LOG(DEBUG, "proxy resolve write: %d", (int)len);
-    if (ctx) {
-        struct proxy_dns_req_wr_s *wr = ctx;
-        if (len < 0) {
-            ZITI_LOG(WARN, "proxy resolve write failed: %s/%zd", ziti_errorstr(len), len);
-            wr->req->msg.status = DNS_SERVFAIL;
-            format_resp(wr->req);
-            complete_dns_req(wr->req);
-            ziti_close(conn, proxy_domain_close_cb);
-        }
-        free_proxy_dns_wr(wr);
+    if (len < 0) {
+        ZITI_LOG(WARN, "proxy resolve write failed: %s/%zd", ziti_errorstr(len), len);
+        proxy_conn_failed(ziti_conn_data(conn), conn);
     }
+    free(ctx);
 }
 
-static void proxy_domain_req(struct dns_req *req, dns_domain_t *domain) {
+/** send query over the domain's resolver connection, connecting first if needed */
+static bool send_proxy_req(struct dns_req *req, dns_domain_t *domain) {
     if (domain->resolv_proxy == NULL) {
         // initiate connection to hosting endpoint for this domain
         model_map_iter it = model_map_iterator(&domain->intercepts);
-        void *intercept = model_map_it_value(it);
-        domain->resolv_proxy = intercept_resolve_connect(intercept, domain, on_proxy_connect, on_proxy_data);
+        void *intercept = it ? model_map_it_value(it) : NULL;
+        if (intercept) {
+            domain->resolv_proxy = intercept_resolve_connect(intercept, domain, on_proxy_connect, on_proxy_data);
+        }
     }
-    dns_question *q = req->msg.question[0];
     if (domain->resolv_proxy == NULL) {
-        req->msg.status = DNS_SERVFAIL;
-    } else if (q->type == NS_T_MX || q->type == NS_T_SRV || q->type == NS_T_TXT) {
-        size_t jsonlen;
-        struct proxy_dns_req_wr_s *wr = calloc(1, sizeof(struct proxy_dns_req_wr_s));
-        wr->req = req;
-        wr->json = dns_message_to_json(&req->msg, MODEL_JSON_COMPACT, &jsonlen);
-        if (wr->json) {
-            ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %s", req->id, wr->json);
-
-            // intercept_resolve_connect above can quick-fail if context does not have a valid API session
-            // in that case resolve_proxy connection will be in Closed state and write will fail.
-            // ziti_write will queue the message if the connection state is Connecting (as it will be the first time through)
-            int rc = ziti_write(domain->resolv_proxy, (uint8_t *) wr->json, jsonlen, on_proxy_write, wr);
-            if (rc == ZITI_OK) {
-                // completion with client will happen in on_proxy_write if write fails, or on_proxy_data when response arrives
-                return;
-            }
-            ZITI_LOG(WARN, "failed to write proxy resolve request[%04x]: %s", req->id, ziti_errorstr(rc));
-            ziti_close(domain->resolv_proxy, proxy_domain_close_cb);
-        } else {
-            req->msg.status = DNS_FORMERR;
+        return false;
+    }
+
+    uint8_t *buf;
+    size_t buf_len;
+    // a wire format query must not look like JSON, the few xids that would are sent as JSON
+    if (domain->proxy_wire && (req->xid >> 8) != '{') {
+        buf_len = req->req_len;
+        buf = malloc(buf_len);
+        memcpy(buf, req->req, buf_len);
+        DNS_SET_ID(buf, req->xid);
+        ZITI_LOG(DEBUG, "writing proxy resolve req[%04x] in wire format", req->id);
+    } else if ((buf = (uint8_t *) proxy_req_json(req, &buf_len)) == NULL) {
+        return false;
+    }
+
+    // intercept_resolve_connect above can quick-fail if context does not have a valid API session
+    // in that case resolve_proxy connection will be in Closed state and write will fail.
+    // ziti_write will queue the message if the connection state is Connecting (as it will be the first time through)
+    req->proxy_attempts++;
+    int rc = ziti_write(domain->resolv_proxy, buf, buf_len, on_proxy_write, buf);
+    if (rc != ZITI_OK) {
+        ZITI_LOG(WARN, "failed to write proxy resolve request[%04x]: %s", req->id, ziti_errorstr(rc));
+        free(buf);
+        proxy_conn_failed(domain, domain->resolv_proxy);
+        return false;
+    }
+
+    // completion with client will happen in on_proxy_data when response arrives, or when the connection fails
+    req->proxy_domain = domain;
+    model_map_set_key(&domain->pending, &req->xid, sizeof(req->xid), req);
+    return true;
+}
+
+static char *proxy_req_json(struct dns_req *req, size_t *jsonlen) {
+    if (req->msg.question == NULL) {
+        req->msg.id = req->xid;
+        req->msg.recursive = req->q.recursive;
+        req->msg.question = calloc(2, sizeof(dns_question *));
+        req->msg.question[0] = calloc(1, sizeof(dns_question));
+        req->msg.question[0]->name = strdup(req->q.name);
+        req->msg.question[0]->type = req->q.type;
+    }
+
+    char *json = dns_message_to_json(&req->msg, MODEL_JSON_COMPACT, jsonlen);
+    if (json) {
+        ZITI_LOG(DEBUG, "writing proxy resolve req[%04x]: %s", req->id, json);
+    }
+    return json;
+}
+
+static void proxy_domain_req(struct dns_req *req, dns_domain_t *domain) {
+    if (req->q.type == NS_T_MX || req->q.type == NS_T_SRV || req->q.type == NS_T_TXT) {
+        size_t cached = dns_cache_lookup(&ziti_dns.proxy_cache, req->req, req->req_len, now_ms(),
+                                         req->resp, req->resp_size);
+        if (cached > 0) {
+            ZITI_LOG(TRACE, "answering query[%04x] from proxy cache", req->id);
+            req->resp_len = cached;
+            complete_dns_req(req);
+            return;
+        }
+
+        if (send_proxy_req(req, domain)) {
+            return;
         }
-        free_proxy_dns_wr(wr);
+        req->msg.status = DNS_SERVFAIL;
     } else {
         req->msg.status = DNS_NOT_IMPL;
     }
@@ -784,52 +1474,193 @@ static void proxy_domain_req(struct dns_req *req, dns_domain_t *domain) {
     complete_dns_req(req);
 }
 
-ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packet, size_t q_len) {
-    ziti_dns_client_t *clt = (ziti_dns_client_t *)ziti_io_ctx;
-    const uint8_t *dns_packet = q_packet;
-    size_t dns_packet_len = q_len;
+#define DNS_XID_PROBES 64 // random IDs tried before a query is failed
 
-    uint16_t req_id = DNS_ID(dns_packet);
-    struct dns_req *req = model_map_get_key(&ziti_dns.requests, &req_id, sizeof(req_id));
+/**
+ * pick an ID that is not used by any in-flight request. IDs are random so upstream answers are hard to guess.
+ * returns false if no free ID was found within DNS_XID_PROBES tries.
+ */
+static bool next_xid(uint16_t *xid) {
+    for (int i = 0; i < DNS_XID_PROBES; i++) {
+        uint32_t x = ziti_dns.xid_state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        ziti_dns.xid_state = x;
+        *xid = (uint16_t) (x >> 16);
+        if (model_map_get_key(&ziti_dns.requests, xid, sizeof(*xid)) == NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static long skip_name(const uint8_t *p, size_t len, size_t off) {
+    while (off < len) {
+        if (p[off] == 0) return (long)off + 1;
+        if ((p[off] & 0xC0) == 0xC0) return off + 1 < len ? (long)off + 2 : -1;
+        if ((p[off] & 0xC0) != 0) return -1;
+        off += p[off] + 1;
+    }
+    return -1;
+}
+
+static int parse_query(struct dns_query_s *q, const uint8_t *p, size_t len) {
+    if (len < DNS_HEADER_LEN || !IS_QUERY(DNS_FLAGS(p))) {
+        return -1;
+    }
+    q->id = DNS_ID(p);
+    q->recursive = DNS_RD(p);
+    q->type = 0;
+    q->name[0] = 0;
+    int qdcount = DNS_QRS(p);
+    q->upstream_only = qdcount != 1;
+
+    size_t off = DNS_HEADER_LEN;
+    if (qdcount > 0) {
+        char *np = q->name;
+        while (off < len && p[off] != 0) {
+            uint8_t label_len = p[off];
+            if ((label_len & 0xC0) != 0 || off + 1 + label_len >= len ||
+                (size_t)(np - q->name) + label_len + 2 > MAX_DNS_NAME) {
+                return -1;
+            }
+            if (np != q->name) *np++ = '.';
+            memcpy(np, p + off + 1, label_len);
+            np += label_len;
+            off += 1 + label_len;
+        }
+        *np = 0;
+        if (off + 5 > len) {
+            return -1;
+        }
+        q->type = p[off + 1] << 8 | p[off + 2];
+        if ((p[off + 3] << 8 | p[off + 4]) != 1) { // e.g. CHAOS version.bind
+            q->upstream_only = true;
+        }
+        off += 5;
+    }
+    // any further questions are passed on as they are
+    for (int i = 1; i < qdcount; i++) {
+        long end = skip_name(p, len, off);
+        if (end < 0 || (size_t)end + 4 > len) {
+            return -1;
+        }
+        off = (size_t)end + 4;
+    }
+    q->section_len = off - DNS_HEADER_LEN;
+
+    // EDNS OPT record advertises client's UDP payload size
+    q->udp_size = 512;
+    int rrs = (p[6] << 8 | p[7]) + (p[8] << 8 | p[9]) + (p[10] << 8 | p[11]);
+    for (int i = 0; i < rrs; i++) {
+        long rr = skip_name(p, len, off);
+        if (rr < 0 || (size_t)rr + 10 > len) {
+            break;
+        }
+        uint16_t type = p[rr] << 8 | p[rr + 1];
+        if (type == 41) {
+            size_t udp_size = p[rr + 2] << 8 | p[rr + 3];
+            q->udp_size = udp_size < 512 ? 512 : udp_size > 4096 ? 4096 : udp_size;
+            break;
+        }
+        off = (size_t)rr + 10 + (p[rr + 8] << 8 | p[rr + 9]);
+    }
+    return 0;
+}
+
+static struct dns_req *new_dns_req(size_t req_len, size_t resp_size) {
+    size_t needed = req_len > resp_size ? req_len : resp_size;
+    size_t cls = 0;
+    while (cls < DNS_REQ_CLASSES && dns_req_sizes[cls] < needed) {
+        cls++;
+    }
+    if (cls == DNS_REQ_CLASSES) {
+        return NULL;
+    }
+
+    struct dns_req *req = ziti_dns.req_pool[cls].free;
+    if (req) {
+        ziti_dns.req_pool[cls].free = req->next_free;
+        ziti_dns.req_pool[cls].count--;
+    } else {
+        req = malloc(sizeof(struct dns_req) + 2 * dns_req_sizes[cls]);
+    }
+    memset(req, 0, sizeof(struct dns_req));
+    req->size_class = cls;
+    req->req = req->buf;
+    req->resp = req->buf + dns_req_sizes[cls];
+    req->resp_size = resp_size;
+    return req;
+}
+
+static void release_dns_req(struct dns_req *req) {
+    size_t cls = req->size_class;
+    if (ziti_dns.req_pool[cls].count < DNS_REQ_POOL_MAX) {
+        req->next_free = ziti_dns.req_pool[cls].free;
+        ziti_dns.req_pool[cls].free = req;
+        ziti_dns.req_pool[cls].count++;
+    } else {
+        free(req);
+    }
+}
+
+/** start processing one query. returns -1 if the query cannot be parsed */
+static int process_dns_query(ziti_dns_client_t *clt, const uint8_t *q_packet, size_t q_len) {
+    struct dns_query_s query;
+    if (parse_query(&query, q_packet, q_len) != 0) {
+        return -1;
+    }
+    if (clt->is_tcp) {
+        query.udp_size = DNS_TCP_RESP_SIZE;
+    }
+
+    struct dns_req *req = model_map_get_key(&clt->active_reqs, &query.id, sizeof(query.id));
     if (req != NULL) {
-        ZITI_LOG(TRACE, "duplicate dns req[%04x] from %s client", req_id, req->clt == ziti_io_ctx ? "same" : "another");
-        // just drop new request
-        ziti_tunneler_ack(write_ctx);
-        return (ssize_t)q_len;
+        ZITI_LOG(TRACE, "duplicate dns req[%04x] from same client", query.id);
+        // client retransmit, just drop new request
+        return 0;
     }
 
-    req = calloc(1, sizeof(struct dns_req));
+    req = new_dns_req(q_len, query.udp_size);
+    if (req == NULL) {
+        ZITI_LOG(WARN, "dropping DNS query[%04x]: too large (%zu bytes)", query.id, q_len);
+        return 0;
+    }
     req->clt = clt;
+    req->q = query;
+    req->id = query.id;
 
     req->req_len = q_len;
     memcpy(req->req, q_packet, q_len);
 
-    if (parse_dns_req(&req->msg, dns_packet, dns_packet_len) != 0) {
-        ZITI_LOG(ERROR, "failed to parse DNS message");
-        on_dns_close(clt);
-        free_dns_req(req);
-        ziti_tunneler_ack(write_ctx);
-        return (ssize_t)q_len;
-    }
-    req->id = req->msg.id;
-
     ZITI_LOG(TRACE, "received DNS query q_len=%zd id[%04x] recursive[%s] type[%d] name[%s]", q_len, req->id,
-             req->msg.recursive ? "true" : "false",
-             (int)req->msg.question[0]->type,
-             req->msg.question[0]->name);
+             req->q.recursive ? "true" : "false", (int)req->q.type, req->q.name);
 
     model_map_set_key(&req->clt->active_reqs, &req->id, sizeof(req->id), req);
-    model_map_set_key(&ziti_dns.requests, &req->id, sizeof(req->id), req);
+    if (!next_xid(&req->xid)) {
+        ZITI_LOG(WARN, "no free request ID for query[%04x], %zu queries in flight", req->id,
+                 model_map_size(&ziti_dns.requests));
+        req->msg.status = DNS_SERVFAIL;
+        format_resp(req);
+        complete_dns_req(req);
+        return 0;
+    }
+    model_map_set_key(&ziti_dns.requests, &req->xid, sizeof(req->xid), req);
 
     // route request
-    dns_question *q = req->msg.question[0];
-
-    if (q->type == NS_T_A || q->type == NS_T_AAAA) {
+    if (req->q.upstream_only) {
+        if (query_upstream(req) != DNS_NO_ERROR) {
+            req->msg.status = DNS_NOT_IMPL;
+            format_resp(req);
+            complete_dns_req(req);
+        }
+    } else if (req->q.type == NS_T_A || req->q.type == NS_T_AAAA) {
         process_host_req(req); // will send upstream if no local answer and req is recursive
     } else {
         // find domain requires normalized name
         char reqname[MAX_DNS_NAME];
-        check_name(q->name, reqname, NULL);
+        check_name(req->q.name, reqname, NULL);
         dns_domain_t *domain = find_domain(reqname);
         if (domain) {
             proxy_domain_req(req, domain);
@@ -842,62 +1673,147 @@ ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packe
             }
         }
     }
+    return 0;
+}
+
+/** process complete length-prefixed queries, keep the rest for the next read */
+static void on_dns_tcp_data(ziti_dns_client_t *clt, const uint8_t *data, size_t len) {
+    if (clt->in_len + len > clt->in_cap) {
+        size_t cap = clt->in_cap ? clt->in_cap : 512;
+        while (cap < clt->in_len + len) {
+            cap *= 2;
+        }
+        clt->in_buf = realloc(clt->in_buf, cap);
+        clt->in_cap = cap;
+    }
+    memcpy(clt->in_buf + clt->in_len, data, len);
+    clt->in_len += len;
+
+    clt->reading = true;
+    size_t off = 0;
+    while (!clt->failed && clt->in_len - off >= 2) {
+        size_t msg_len = clt->in_buf[off] << 8 | clt->in_buf[off + 1];
+        if (clt->in_len - off - 2 < msg_len) {
+            break;
+        }
+        if (process_dns_query(clt, clt->in_buf + off + 2, msg_len) != 0) {
+            ZITI_LOG(WARN, "failed to parse DNS message from tcp client");
+            clt->failed = true;
+        }
+        off += 2 + msg_len;
+    }
+    clt->in_len -= off;
+    memmove(clt->in_buf, clt->in_buf + off, clt->in_len);
+    clt->reading = false;
+
+    check_tcp_client(clt);
+}
+
+ssize_t on_dns_req(const void *ziti_io_ctx, void *write_ctx, const void *q_packet, size_t q_len) {
+    ziti_dns_client_t *clt = (ziti_dns_client_t *)ziti_io_ctx;
+
+    if (clt->is_tcp) {
+        on_dns_tcp_data(clt, q_packet, q_len);
+    } else if (process_dns_query(clt, q_packet, q_len) != 0) {
+        ZITI_LOG(ERROR, "failed to parse DNS message");
+        on_dns_close(clt);
+    }
 
     ziti_tunneler_ack(write_ctx);
     return (ssize_t)q_len;
 }
 
+static void on_upstream_answer(dns_upstream_query *q, int status, const uint8_t *answer, size_t len) {
+    struct dns_req *req = (struct dns_req *) q;
+    if (status != 0) {
+        req->msg.status = DNS_SERVFAIL;
+        format_resp(req);
+    } else {
+        set_answer(req, answer, len, &ziti_dns.cache);
+    }
+    complete_dns_req(req);
+}
+
 int query_upstream(struct dns_req *req) {
-    bool avail = uv_is_active((const uv_handle_t *) &ziti_dns.upstream);
     bool success = false;
-    if (avail && req->msg.recursive) {
-        uv_buf_t buf = uv_buf_init((char *) req->req, req->req_len);
-
-        for (int i = 0; i < ziti_dns.num_dns_up; i++) {
-            int rc = uv_udp_try_send(&ziti_dns.upstream, &buf, 1,
-                                     (struct sockaddr *) &ziti_dns.upstream_addr[i]);
-            if (rc > 0) {
-                success = true;
-            } else {
-                ZITI_LOG(WARN, "failed to query[%04x] upstream DNS server[%d]: %d(%s)",
-                         req->id, i, rc, uv_strerror(rc));
-            }
+    if (ziti_dns.upstream != NULL && req->q.recursive) {
+        size_t cached = dns_cache_lookup(&ziti_dns.cache, req->req, req->req_len, now_ms(),
+                                         req->resp, req->resp_size);
+        if (cached > 0) {
+            ZITI_LOG(TRACE, "answering query[%04x] from cache", req->id);
+            req->resp_len = cached;
+            complete_dns_req(req);
+            return DNS_NO_ERROR;
         }
+
+        // tcp clients get truncated answers in full, asking upstream over tcp as well
+        bool tcp_fallback = req->clt != NULL && req->clt->is_tcp;
+        DNS_SET_ID(req->req, req->xid);
+        success = dns_upstream_send(ziti_dns.upstream, &req->upstream, req->req, req->req_len, req->q.section_len,
+                                    req->xid, tcp_fallback, on_upstream_answer) == 0;
     }
     return success ? DNS_NO_ERROR : DNS_REFUSE;
 }
 
-static void dns_upstream_alloc(uv_handle_t *h, size_t reqlen, uv_buf_t *b) {
-    static char dns_buf[1024];
-    b->base = dns_buf;
-    b->len = sizeof(dns_buf);
+static void free_dns_req(struct dns_req *req) {
+    if (req->proxy_domain) {
+        model_map_remove_key(&req->proxy_domain->pending, &req->xid, sizeof(req->xid));
+    }
+    dns_upstream_cancel(&req->upstream);
+    free_dns_message(&req->msg);
+    free(req->resp_buf);
+    release_dns_req(req);
 }
 
-static void on_upstream_packet(uv_udp_t *h, ssize_t rc, const uv_buf_t *buf, const struct sockaddr* addr, unsigned int flags) {
-    if (rc > 0) {
-        uint16_t id = DNS_ID(buf->base);
-        struct dns_req *req = model_map_get_key(&ziti_dns.requests, &id, sizeof(id));
-        if (req != NULL) {
-            ZITI_LOG(TRACE, "upstream sent response to query[%04x] (rc=%zd)", id, rc);
-            if (rc <= sizeof(req->resp)) {
-                req->resp_len = rc;
-                memcpy(req->resp, buf->base, rc);
-            } else {
-                ZITI_LOG(WARN, "unexpected DNS response: too large");
-            }
-            complete_dns_req(req);
+/** write as much of the pending responses as the tunneler takes, the rest waits for the client to ack */
+static bool flush_tcp_resp(ziti_dns_client_t *clt) {
+    while (clt->out_len > 0) {
+        ssize_t n = ziti_tunneler_write(clt->io_ctx->tnlr_io, clt->out_buf, clt->out_len);
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            break;
         }
+        clt->out_len -= n;
+        memmove(clt->out_buf, clt->out_buf + n, clt->out_len);
     }
+    return true;
 }
 
-static void free_dns_req(struct dns_req *req) {
-    free_dns_message(&req->msg);
-    free(req);
+static bool write_tcp_resp(ziti_dns_client_t *clt, const uint8_t *resp, size_t len) {
+    if (len > DNS_TCP_MSG_MAX) {
+        return false;
+    }
+    // responses are queued whole, so a partial write does not break the framing of the following ones
+    if (clt->out_len + 2 + len > clt->out_cap) {
+        size_t cap = clt->out_cap ? clt->out_cap : 2 + DNS_TCP_RESP_SIZE;
+        while (cap < clt->out_len + 2 + len) {
+            cap *= 2;
+        }
+        clt->out_buf = realloc(clt->out_buf, cap);
+        clt->out_cap = cap;
+    }
+    uint8_t *frame = clt->out_buf + clt->out_len;
+    frame[0] = (len >> 8) & 0xff;
+    frame[1] = len & 0xff;
+    memcpy(frame + 2, resp, len);
+    clt->out_len += 2 + len;
+    return flush_tcp_resp(clt);
 }
 
 static void complete_dns_req(struct dns_req *req) {
-    model_map_remove_key(&ziti_dns.requests, &req->id, sizeof(req->id));
-    if (req->clt) {
+    forget_dns_req(req);
+    if (req->clt && req->clt->is_tcp) {
+        ziti_dns_client_t *clt = req->clt;
+        model_map_remove_key(&clt->active_reqs, &req->id, sizeof(req->id));
+        if (!write_tcp_resp(clt, req->resp, req->resp_len)) {
+            ZITI_LOG(WARN, "failed to send response[%04x] to tcp client", req->id);
+            clt->failed = true;
+        }
+        // connection stays open for more queries
+        check_tcp_client(clt);
+    } else if (req->clt) {
         ziti_tunneler_write(req->clt->io_ctx->tnlr_io, req->resp, req->resp_len);
         model_map_remove_key(&req->clt->active_reqs, &req->id, sizeof(req->id));
         // close client if there are no other pending requests
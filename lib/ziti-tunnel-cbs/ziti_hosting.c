@@ -23,24 +23,40 @@
 #endif
 
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <ziti/ziti_log.h>
 #include <memory.h>
 #include <ziti/ziti_tunnel_cbs.h>
 #include "ziti_hosting.h"
+#include "happy_eyeballs.h"
 #include "tlsuv/tlsuv.h"
 
 #if _WIN32
 #ifndef strcasecmp
 #define strcasecmp(a,b) stricmp(a,b)
 #endif
+#define sock_close(s) closesocket(s)
+#else
+#include <unistd.h>
+#define sock_close(s) close(s)
 #endif
 
 #define KEEPALIVE_DELAY 60
+/** server addresses tried for a client before its connection is given up */
+#define HOSTED_CONNECT_ATTEMPTS 3
 
 /********** hosting **********/
 static void on_bridge_close(uv_handle_t *handle);
 
+/** where a client is with its service's admission control */
+enum hosted_admission_e {
+    io_not_admitted,
+    io_queued,     // waiting for a slot
+    io_connecting, // holds a slot, connecting to the server
+    io_connected,  // holds a slot, connected to the server
+};
+
 struct hosted_io_ctx_s {
     struct hosted_service_ctx_s *service;
     ziti_connection client;
@@ -49,19 +65,86 @@ struct hosted_io_ctx_s {
     const char *computed_dst_protocol;
     const char *computed_dst_ip_or_hn;
     const char *computed_dst_port;
+    char dst_port[16];
     char resolved_dst[80];
+    struct addrinfo hints;
+    bool resolving; // waiting for service->dst_cache
+    dst_addr *dst_addr; // server address the connection is counted against
+    he_race *race;      // dual-stack connect in progress
+    udp_bridge *udp;    // relays datagrams of udp clients
+    tcp_bridge *tcp;    // moves data of tcp clients, unless the sdk does
+    struct sockaddr_storage tried[HOSTED_CONNECT_ATTEMPTS];
+    int attempts;
+    enum hosted_admission_e admission;
+    uint64_t accepted_at;     // uv_hrtime() when the client came in
+    uint64_t connect_started; // uv_hrtime() when connecting to the server started, 0 if it did not
+    bool connected;
+    bool got_first_byte;
     union {
         uv_tcp_t tcp;
         uv_udp_t udp;
     } server;
 };
 
+/** give up the client's place with the service's admission control, if it has one */
+static void hosted_io_leave_admission(hosted_io_context io) {
+    admission *adm = io->service->admission;
+    if (adm != NULL) {
+        switch (io->admission) {
+            case io_queued:
+                admission_cancel(adm, io);
+                break;
+            case io_connecting:
+                admission_release(adm, false);
+                break;
+            case io_connected:
+                admission_release(adm, true);
+                break;
+            default:
+                break;
+        }
+    }
+    io->admission = io_not_admitted;
+}
+
+static void free_hosted_service_ctx(struct hosted_service_ctx_s *hosted_ctx);
+
 static void hosted_io_context_free(hosted_io_context io) {
     if (io) {
+        struct hosted_service_ctx_s *service = io->service;
+        hosted_io_leave_admission(io);
+        if (io->connected) {
+            io->service->metrics.active--;
+        } else if (io->connect_started != 0) {
+            io->service->metrics.connect_failures++;
+        }
+        if (io->resolving) {
+            dst_cache_cancel(&io->service->dst_cache, io);
+        }
+        he_race_cancel(io->race);
+        io->race = NULL;
+        dst_addr_release(io->dst_addr);
+        io->dst_addr = NULL;
+        udp_bridge_free(io->udp);
+        io->udp = NULL;
+        if (io->tcp) {
+            tcp_bridge_stats stats;
+            tcp_bridge_get_stats(io->tcp, &stats);
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] to_server[%" PRIu64 " bytes, %" PRIu64
+                     " stalls, %" PRIu64 "ms] to_client[%" PRIu64 " bytes, %" PRIu64 " stalls, %" PRIu64 "ms]",
+                     io->service->service_name, io->client_identity, io->resolved_dst,
+                     stats.to_server, stats.server_stalls, stats.server_stall_ms,
+                     stats.to_client, stats.client_stalls, stats.client_stall_ms);
+            tcp_bridge_free(io->tcp);
+            io->tcp = NULL;
+        }
         if (io->app_data) {
             free_tunneler_app_data_ptr(io->app_data);
         }
         free(io);
+        if (--service->n_clients == 0 && service->retired) {
+            free_hosted_service_ctx(service);
+        }
     }
 }
 
@@ -87,10 +170,16 @@ static void ziti_conn_close_cb(ziti_connection zc) {
     } \
 } while(0)
 
+static LIST_HEAD(, hosted_service_ctx_s) hosted_services = LIST_HEAD_INITIALIZER(hosted_services);
+
 static void free_hosted_service_ctx(struct hosted_service_ctx_s *hosted_ctx) {
     if (hosted_ctx == NULL) {
         return;
     }
+    if (hosted_ctx->_next.le_prev != NULL) {
+        LIST_REMOVE(hosted_ctx, _next);
+        hosted_ctx->_next.le_prev = NULL;
+    }
     safe_free(hosted_ctx->service_name);
     switch (hosted_ctx->cfg_type) {
         case HOST_CFG_V1:
@@ -124,6 +213,37 @@ static void free_hosted_service_ctx(struct hosted_service_ctx_s *hosted_ctx) {
     }
 
     STAILQ_CLEAR(&hosted_ctx->allowed_source_addresses, safe_free);
+    warm_pool_free(hosted_ctx->warm_pool);
+    hosted_ctx->warm_pool = NULL;
+    admission_free(hosted_ctx->admission);
+    hosted_ctx->admission = NULL;
+    udp_relay_free(hosted_ctx->udp_relay);
+    hosted_ctx->udp_relay = NULL;
+    tcp_bridge_pool_free(hosted_ctx->tcp_bridge_pool);
+    hosted_ctx->tcp_bridge_pool = NULL;
+    dst_cache_free(&hosted_ctx->dst_cache);
+}
+
+/** stop hosting with a context, e.g. one that a config update replaced. it is freed once its last client is gone */
+static void retire_hosted_service_ctx(struct hosted_service_ctx_s *host_ctx) {
+    if (host_ctx->_next.le_prev != NULL) {
+        LIST_REMOVE(host_ctx, _next);
+        host_ctx->_next.le_prev = NULL;
+    }
+    host_ctx->retired = true;
+    if (host_ctx->listener) {
+        ziti_conn_set_data(host_ctx->listener, NULL);
+        ziti_close(host_ctx->listener, NULL);
+        host_ctx->listener = NULL;
+    }
+    warm_pool_free(host_ctx->warm_pool);
+    host_ctx->warm_pool = NULL;
+    if (host_ctx->n_clients == 0) {
+        free_hosted_service_ctx(host_ctx);
+    } else {
+        ZITI_LOG(DEBUG, "hosted_service[%s] previous config stays in use by %d clients",
+                 host_ctx->service_name, host_ctx->n_clients);
+    }
 }
 
 static void hosted_server_close_cb(uv_handle_t *handle) {
@@ -171,6 +291,62 @@ void *local_addr(uv_handle_t *h, struct sockaddr *name, int *len) {
     return name;
 }
 
+static void on_hosted_tcp_alloc(uv_handle_t *h, size_t suggested, uv_buf_t *buf) {
+    hosted_io_context io = h->data;
+    tcp_bridge_alloc(io->tcp, buf);
+}
+
+/** count data relayed from the server to the client */
+static void hosted_io_to_client(hosted_io_context io, ssize_t len) {
+    if (len <= 0) {
+        return;
+    }
+    io->service->metrics.bytes_to_client += len;
+    if (!io->got_first_byte) {
+        io->got_first_byte = true;
+        latency_record(&io->service->metrics.first_byte, (uv_hrtime() - io->accepted_at) / 1000);
+    }
+}
+
+static void on_hosted_tcp_read(uv_stream_t *s, ssize_t nread, const uv_buf_t *buf) {
+    hosted_io_context io = s->data;
+    hosted_io_to_client(io, nread);
+    tcp_bridge_read(io->tcp, nread, buf);
+}
+
+/** called by ziti sdk with the data of a tcp client that is bridged by the tunneler */
+static ssize_t on_hosted_tcp_client_data(ziti_connection clt, const uint8_t *data, ssize_t len) {
+    hosted_io_context io = ziti_conn_data(clt);
+    if (io == NULL || io->tcp == NULL) {
+        return len > 0 ? len : 0;
+    }
+    ssize_t taken = tcp_bridge_write(io->tcp, data, len);
+    if (taken > 0) {
+        io->service->metrics.bytes_to_server += taken;
+    }
+    return taken;
+}
+
+static void resume_hosted_tcp_client(ziti_connection clt) {
+    // setting the data callback makes the sdk deliver what it still holds
+    ziti_conn_set_data_cb(clt, on_hosted_tcp_client_data);
+}
+
+static const tcp_bridge_client_ops hosted_tcp_client_ops = {
+        .write = ziti_write,
+        .close_write = ziti_close_write,
+        .resume = resume_hosted_tcp_client,
+};
+
+static void on_hosted_tcp_bridge_done(void *ctx, const char *err) {
+    hosted_io_context io = ctx;
+    if (err) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] bridge failed: %s", io->service->service_name,
+                 io->client_identity, io->resolved_dst, err);
+    }
+    hosted_server_close(io);
+}
+
 /** called by ziti sdk when a client connection is established (or fails) */
 static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
     struct hosted_io_ctx_s *io_ctx = ziti_conn_data(clt);
@@ -181,7 +357,17 @@ static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
         return;
     }
 
-    if (err == ZITI_OK) {
+    if (err == ZITI_OK && io_ctx->tcp != NULL) {
+        int rc = tcp_bridge_start(io_ctx->tcp, on_hosted_tcp_alloc, on_hosted_tcp_read);
+        if (rc != 0) {
+            ZITI_LOG(ERROR, "failed to bridge client[%s] with hosted_service[%s]: %s",
+                     io_ctx->client_identity, io_ctx->service->service_name, uv_strerror(rc));
+            hosted_server_close(io_ctx);
+            return;
+        }
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] connected", io_ctx->service->service_name,
+                 io_ctx->client_identity, io_ctx->resolved_dst);
+    } else if (err == ZITI_OK) {
         int rc;
         uv_handle_t *server = (uv_handle_t *) &io_ctx->server.tcp;
         uv_os_fd_t fd;
@@ -215,8 +401,21 @@ static void on_hosted_client_connect_complete(ziti_connection clt, int err) {
     }
 }
 
+/** the client's slot now counts as a connection to the server */
+static void hosted_io_connected(hosted_io_context io) {
+    hosted_metrics *m = &io->service->metrics;
+    io->connected = true;
+    m->active++;
+    latency_record(&m->connect, (uv_hrtime() - io->connect_started) / 1000);
+
+    if (io->admission == io_connecting && io->service->admission != NULL) {
+        admission_connected(io->service->admission);
+        io->admission = io_connected;
+    }
+}
 
 static void complete_hosted_tcp_connection(hosted_io_context io_ctx) {
+    hosted_io_connected(io_ctx);
     ZITI_LOG(DEBUG, "hosted_service[%s], client[%s]: connected to server %s", io_ctx->service->service_name,
              io_ctx->client_identity, io_ctx->resolved_dst);
 
@@ -231,7 +430,75 @@ static void complete_hosted_tcp_connection(hosted_io_context io_ctx) {
                  io_ctx->service->service_name, io_ctx->client_identity);
     }
 
-    ziti_accept(io_ctx->client, on_hosted_client_connect_complete, NULL);
+    ziti_data_cb data_cb = NULL;
+    if (io_ctx->service->tcp_bridge_pool) {
+        io_ctx->tcp = tcp_bridge_new(io_ctx->service->tcp_bridge_pool, io_ctx->client, tcp,
+                                     on_hosted_tcp_bridge_done, io_ctx);
+        data_cb = on_hosted_tcp_client_data;
+    }
+    ziti_accept(io_ctx->client, on_hosted_client_connect_complete, data_cb);
+}
+
+static bool has_source_addr(const tunneler_app_data *app_data) {
+    return app_data && app_data->source_addr && app_data->source_addr[0] != '\0';
+}
+
+static void on_hosted_client_connect_resolved(void *ctx, int status, dst_entry *dst);
+static void on_hosted_client_admitted(void *ctx, bool admitted);
+static void connect_hosted_server(hosted_io_context io);
+
+/** look the server up again (usually answered by the cache) to connect to an address not tried yet */
+static void resolve_again(hosted_io_context io) {
+    io->resolving = true;
+    int uv_err = dst_cache_resolve(&io->service->dst_cache, io->computed_dst_ip_or_hn, io->computed_dst_port,
+                                   &io->hints, on_hosted_client_connect_resolved, io);
+    if (uv_err != 0) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: getaddrinfo(%s:%s:%s) failed: %s",
+                 io->service->service_name, io->client_identity, io->computed_dst_protocol,
+                 io->computed_dst_ip_or_hn, io->computed_dst_port, uv_strerror(uv_err));
+        io->resolving = false;
+        hosted_server_close(io);
+    }
+}
+
+/** the tcp handle was closed after a failed connect. start over with the next address of the server */
+static void on_failover_close(uv_handle_t *handle) {
+    hosted_io_context io = handle->data;
+    int uv_err = uv_tcp_init(io->service->loop, &io->server.tcp);
+    if (uv_err != 0) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s] failed to initialize underlay handle: %s",
+                 io->service->service_name, io->client_identity, uv_strerror(uv_err));
+        // the handle is already closed, finish the way hosted_server_close does
+        handle->data = io;
+        hosted_server_close_cb(handle);
+        return;
+    }
+    io->server.tcp.data = io;
+    resolve_again(io);
+}
+
+/**
+ * a tcp connect to the server failed. the address is charged with the failure, and unless the
+ * client is gone or the attempts are used up, the next address of the server is tried.
+ * a uv_tcp_t cannot connect again after a failure, so it is closed and initialized again first.
+ * connections bound to a client requested source address are not retried.
+ */
+static void on_server_connect_failed(hosted_io_context io, int err) {
+    dst_addr_report(io->dst_addr, err, uv_now(io->service->loop));
+    dst_addr_release(io->dst_addr);
+    io->dst_addr = NULL;
+
+    if (err != UV_ECANCELED && io->client != NULL && io->attempts < HOSTED_CONNECT_ATTEMPTS &&
+        !has_source_addr(io->app_data) && !uv_is_closing((uv_handle_t *) &io->server.tcp)) {
+        ZITI_LOG(WARN, "hosted_service[%s], client[%s]: connect to %s failed: %s, trying next address",
+                 io->service->service_name, io->client_identity, io->resolved_dst, uv_strerror(err));
+        uv_close((uv_handle_t *) &io->server.tcp, on_failover_close);
+        return;
+    }
+
+    ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: connect to %s failed: %s", io->service->service_name,
+             io->client_identity, io->resolved_dst, uv_strerror(err));
+    hosted_server_close(io);
 }
 
 /**
@@ -255,12 +522,11 @@ static void on_hosted_tcp_server_connect_complete(uv_connect_t *c, int status) {
     }
 
     if (status < 0) {
-        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: connect to %s failed: %s", io_ctx->service->service_name,
-                 io_ctx->client_identity, io_ctx->resolved_dst, uv_strerror(status));
-        hosted_server_close(io_ctx);
+        on_server_connect_failed(io_ctx, status);
         free(c);
         return;
     }
+    dst_addr_report(io_ctx->dst_addr, 0, uv_now(io_ctx->service->loop));
     complete_hosted_tcp_connection(io_ctx);
     free(c);
 }
@@ -510,7 +776,9 @@ static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *serv
     }
     io->computed_dst_protocol = dst_protocol;
     io->computed_dst_ip_or_hn = dst_ip_or_hn;
-    io->computed_dst_port = dst_port;
+    // the port from the config is in a shared buffer, keep a copy for lookups after failed connects
+    snprintf(io->dst_port, sizeof(io->dst_port), "%s", dst_port);
+    io->computed_dst_port = io->dst_port;
 
     int socktype, uv_err = -1;
     int protocol_number = get_protocol_id(dst_protocol);
@@ -521,7 +789,8 @@ static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *serv
             io->server.tcp.data = io;
             break;
         case IPPROTO_UDP:
-            uv_err = uv_udp_init(service_ctx->loop, &io->server.udp);
+            // read replies with recvmmsg() where libuv supports it
+            uv_err = uv_udp_init_ex(service_ctx->loop, &io->server.udp, AF_UNSPEC | UV_UDP_RECVMMSG);
             socktype = SOCK_DGRAM;
             io->server.udp.data = io;
             break;
@@ -540,7 +809,7 @@ static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *serv
     // uv handle has been initialized and must be closed before freeing `io` now.
 
     // if app_data includes source ip[:port], verify that it is allowed before attempting to bind
-    if (app_data && app_data->source_addr && app_data->source_addr[0] != '\0') {
+    if (has_source_addr(app_data)) {
         if (do_bind(io, app_data->source_addr, socktype) != 0) {
             hosted_server_close(io);
             return NULL;
@@ -550,12 +819,11 @@ static hosted_io_context hosted_io_context_new(struct hosted_service_ctx_s *serv
     // success. now set references to ziti connection and app_data so cleanup happens in ziti_conn_close_cb
     io->client = client;
     io->app_data = app_data;
+    service_ctx->n_clients++;
 
     return io;
 }
 
-static void on_hosted_client_connect_resolved(uv_getaddrinfo_t* req, int status, struct addrinfo* res);
-
 /** called by ziti sdk when a ziti endpoint (client) initiates connection to a hosted service
  * - compute dial address (from appdata if forwarding, or from dial address in config)
  * - if forwarding, validate address is allowed
@@ -590,7 +858,7 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
     }
 
     if (app_data != NULL && app_data->conn_type == TunnelConnectionTypes.resolver) {
-        accept_resolver_conn(clt, &service_ctx->addr_u.allowed_hostnames);
+        accept_resolver_conn(clt, service_ctx->loop, &service_ctx->addr_u.allowed_hostnames, app_data->dns_format);
         free_tunneler_app_data_ptr(app_data);
         return;
     }
@@ -636,14 +904,74 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
 
     ZITI_LOG(INFO, "hosted_service[%s] client[%s] dst_addr[%s:%s:%s]: incoming connection",
              service_ctx->service_name, io->client_identity, protocol, ip_or_hn, port);
+    service_ctx->metrics.connections++;
+    io->accepted_at = uv_hrtime();
 
-    struct addrinfo hints = {0};
-    hints.ai_protocol = protocol_number;
-    hints.ai_socktype = protocol_number == IPPROTO_UDP ? SOCK_DGRAM : SOCK_STREAM;
-    hints.ai_flags = AI_NUMERICSERV;
-    if (is_ip) hints.ai_flags |= AI_NUMERICHOST;
+    // same hints as the warm pool, so both share the destination's cache entry
+    dst_cache_hints(&io->hints, ip_or_hn, protocol_number);
     ziti_conn_set_data(clt, io);
 
+    switch (admission_request(service_ctx->admission, on_hosted_client_admitted, io)) {
+        case admission_admitted:
+            io->admission = io_connecting;
+            connect_hosted_server(io);
+            break;
+        case admission_queued:
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] waiting for a free connection slot",
+                     service_ctx->service_name, io->client_identity);
+            io->admission = io_queued;
+            break;
+        case admission_rejected:
+            ZITI_LOG(WARN, "hosted_service[%s] client[%s] rejected, service is at its connection limit",
+                     service_ctx->service_name, io->client_identity);
+            hosted_server_close(io);
+            break;
+    }
+}
+
+/** called when a queued client gets a connection slot, or waited too long for one */
+static void on_hosted_client_admitted(void *ctx, bool admitted) {
+    hosted_io_context io = ctx;
+    if (!admitted) {
+        ZITI_LOG(WARN, "hosted_service[%s] client[%s] no connection slot became free, dropping connection",
+                 io->service->service_name, io->client_identity);
+        io->admission = io_not_admitted;
+        hosted_server_close(io);
+        return;
+    }
+    io->admission = io_connecting;
+    connect_hosted_server(io);
+}
+
+/** connect an admitted client to the server: with a warm connection, through the proxy or to a resolved address */
+static void connect_hosted_server(hosted_io_context io) {
+    struct hosted_service_ctx_s *service_ctx = io->service;
+    int protocol_number = io->hints.ai_protocol;
+    const char *protocol = io->computed_dst_protocol;
+    const char *ip_or_hn = io->computed_dst_ip_or_hn;
+    const char *port = io->computed_dst_port;
+    io->connect_started = uv_hrtime();
+
+    // warm connections are not bound to a client requested source address
+    if (service_ctx->warm_pool && protocol_number == IPPROTO_TCP && !has_source_addr(io->app_data)) {
+        uv_os_sock_t sock;
+        if (warm_pool_take(service_ctx->warm_pool, &sock, &io->dst_addr, io->resolved_dst, sizeof(io->resolved_dst)) == 0) {
+            int uv_err = uv_tcp_open(&io->server.tcp, sock);
+            if (uv_err != 0) {
+                ZITI_LOG(ERROR, "hosted_service[%s] client[%s] uv_tcp_open failed: %s", service_ctx->service_name,
+                         io->client_identity, uv_strerror(uv_err));
+                // the handle did not take the socket. io->dst_addr is released with the io context
+                sock_close(sock);
+                hosted_server_close(io);
+                return;
+            }
+            ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] using pre-established connection to %s",
+                     service_ctx->service_name, io->client_identity, io->resolved_dst);
+            complete_hosted_tcp_connection(io);
+            return;
+        }
+    }
+
     if (service_ctx->proxy_connector) {
         if (protocol_number == IPPROTO_TCP) {
             ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] dst_addr[%s:%s:%s] connecting through proxy %s",
@@ -658,85 +986,222 @@ static void on_hosted_client_connect(ziti_connection serv, ziti_connection clt,
         return;
     }
 
-    uv_getaddrinfo_t *ai_req = calloc(1, sizeof(uv_getaddrinfo_t));
-    ai_req->data = io;
-    int s = uv_getaddrinfo(service_ctx->loop, ai_req, on_hosted_client_connect_resolved, ip_or_hn, port, &hints);
+    // completes right away if the destination was resolved recently
+    io->resolving = true;
+    int s = dst_cache_resolve(&service_ctx->dst_cache, ip_or_hn, io->computed_dst_port, &io->hints,
+                              on_hosted_client_connect_resolved, io);
     if (s != 0) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s]: getaddrinfo(%s:%s:%s) failed: %s",
                  service_ctx->service_name, io->client_identity, protocol, ip_or_hn, port, uv_strerror(s));
-        free(ai_req);
+        io->resolving = false;
         hosted_server_close(io);
         return;
     }
 }
 
-static void on_hosted_client_connect_resolved(uv_getaddrinfo_t* ai_req, int status, struct addrinfo* res) {
-    hosted_io_context io = ai_req->data;
+/** called by libuv with the datagrams a udp server sends to a client */
+static void on_hosted_udp_server_data(uv_udp_t *h, ssize_t nread, const uv_buf_t *buf, const struct sockaddr *addr,
+                                      unsigned flags) {
+    hosted_io_context io = h->data;
+    if (io != NULL) {
+        hosted_io_to_client(io, nread);
+    }
+    udp_bridge_recv(io ? io->udp : NULL, nread, buf, flags);
+}
+
+/** called by ziti sdk with the datagrams of a udp client */
+static ssize_t on_hosted_udp_client_data(ziti_connection clt, const uint8_t *data, ssize_t len) {
+    hosted_io_context io = ziti_conn_data(clt);
+    if (io == NULL || io->udp == NULL) {
+        return len;
+    }
+    if (len < 0) {
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] closed: %s", io->service->service_name,
+                 io->client_identity, ziti_errorstr((int) len));
+        hosted_server_close(io);
+        return 0;
+    }
+    io->service->metrics.bytes_to_server += len;
+    udp_bridge_send(io->udp, data, len);
+    return len;
+}
+
+static const udp_bridge_client_ops hosted_udp_client_ops = {
+        .write = ziti_write,
+};
+
+static void on_hosted_udp_error(void *ctx, const char *err) {
+    hosted_io_context io = ctx;
+    ZITI_LOG(ERROR, "hosted_service[%s] client[%s] server[%s] relay failed: %s", io->service->service_name,
+             io->client_identity, io->resolved_dst, err);
+    hosted_server_close(io);
+}
+
+/** called by ziti sdk when a udp client connection is established (or fails) */
+static void on_hosted_udp_client_connect_complete(ziti_connection clt, int err) {
+    hosted_io_context io = ziti_conn_data(clt);
     if (io == NULL) {
-        ZITI_LOG(ERROR, "null io");
-        if (status >= 0) uv_freeaddrinfo(res);
-        free(ai_req);
+        ZITI_LOG(WARN, "missing io_ctx");
+        ziti_close(clt, ziti_conn_close_cb);
         return;
     }
 
+    if (err != ZITI_OK) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s] failed to connect: %s", io->service->service_name,
+                 io->client_identity, ziti_errorstr(err));
+        hosted_server_close(io);
+        return;
+    }
+
+    int uv_err = udp_bridge_start(io->udp, on_hosted_udp_server_data);
+    if (uv_err != 0) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s] failed to read from server[%s]: %s",
+                 io->service->service_name, io->client_identity, io->resolved_dst, uv_strerror(uv_err));
+        hosted_server_close(io);
+        return;
+    }
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] server[%s] connected", io->service->service_name,
+             io->client_identity, io->resolved_dst);
+}
+
+/** relay a udp client over its own socket, or over one shared with other clients if the service is one-way */
+static void connect_hosted_udp(hosted_io_context io, dst_addr *addr) {
+    uv_udp_t *server = NULL;
+    // a client that asked for a source address needs its own socket
+    if (!udp_relay_is_shared(io->service->udp_relay) || has_source_addr(io->app_data)) {
+        int uv_err = uv_udp_connect(&io->server.udp, (struct sockaddr *) &addr->addr);
+        if (uv_err != 0) {
+            ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_udp_connect failed: %s",
+                     io->service->service_name, io->client_identity, uv_strerror(uv_err));
+            dst_addr_report(addr, uv_err, uv_now(io->service->loop));
+            hosted_server_close(io);
+            return;
+        }
+        server = &io->server.udp;
+    }
+
+    io->udp = udp_bridge_new(io->service->udp_relay, io->client, server, (struct sockaddr *) &addr->addr,
+                             on_hosted_udp_error, io);
+    if (io->udp == NULL) {
+        ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: no shared socket to %s",
+                 io->service->service_name, io->client_identity, io->resolved_dst);
+        hosted_server_close(io);
+        return;
+    }
+
+    hosted_io_connected(io);
+    if (ziti_accept(io->client, on_hosted_udp_client_connect_complete, on_hosted_udp_client_data) != ZITI_OK) {
+        ZITI_LOG(ERROR, "ziti_accept failed");
+        hosted_server_close(io);
+    }
+}
+
+/** called when a dual-stack connect is decided */
+static void on_hosted_race_done(void *ctx, int status, uv_os_sock_t sock, dst_addr *addr) {
+    hosted_io_context io = ctx;
+    io->race = NULL;
+
+    if (status != 0) {
+        if (io->attempts < HOSTED_CONNECT_ATTEMPTS) {
+            ZITI_LOG(WARN, "hosted_service[%s] client[%s] connect to %s:%s:%s failed: %s, trying next address",
+                     io->service->service_name, io->client_identity, io->computed_dst_protocol,
+                     io->computed_dst_ip_or_hn, io->computed_dst_port, uv_strerror(status));
+            resolve_again(io);
+        } else {
+            ZITI_LOG(ERROR, "hosted_service[%s] client[%s] connect to %s:%s:%s failed: %s",
+                     io->service->service_name, io->client_identity, io->computed_dst_protocol,
+                     io->computed_dst_ip_or_hn, io->computed_dst_port, uv_strerror(status));
+            hosted_server_close(io);
+        }
+        return;
+    }
+
+    io->dst_addr = addr;
+    snprintf(io->resolved_dst, sizeof(io->resolved_dst), "%s:%s", get_protocol_str(io->hints.ai_protocol), addr->name);
+    dst_cache_set_family(&io->service->dst_cache, io->computed_dst_ip_or_hn, io->computed_dst_port, &io->hints,
+                         addr->addr.ss_family);
+
+    int uv_err = uv_tcp_open(&io->server.tcp, sock);
+    if (uv_err != 0) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s] uv_tcp_open failed: %s", io->service->service_name,
+                 io->client_identity, uv_strerror(uv_err));
+        hosted_server_close(io);
+        return;
+    }
+    complete_hosted_tcp_connection(io);
+}
+
+static void on_hosted_client_connect_resolved(void *ctx, int status, dst_entry *dst) {
+    hosted_io_context io = ctx;
+    io->resolving = false;
+
     if (status < 0) {
         ZITI_LOG(ERROR, "hosted_service[%s] client[%s] getaddrinfo(%s:%s:%s) failed: %s", io->service->service_name,
                  io->client_identity, io->computed_dst_protocol, io->computed_dst_ip_or_hn, io->computed_dst_port,
                  uv_strerror(status));
-        free(ai_req);
         ZITI_LOG(DEBUG, "closing c[%p] io[%p]", io->client, ziti_conn_data(io->client));
         hosted_server_close(io);
         return;
     }
 
-    if (res->ai_next != NULL) {
-        ZITI_LOG(DEBUG, "hosted_service[%s], client[%s]: getaddrinfo(%s:%s:%s) returned multiple results; using first",
-                 io->service->service_name, io->client_identity, io->computed_dst_protocol,
-                 io->computed_dst_ip_or_hn, io->computed_dst_port);
+    // tcp connects race an address of each family if the server has both (RFC 8305), unless the client asked
+    // for a source address. addresses that already failed for this client are not tried again
+    bool race = io->hints.ai_protocol == IPPROTO_TCP && !has_source_addr(io->app_data) &&
+                io->attempts + 2 <= HOSTED_CONNECT_ATTEMPTS;
+    int family = race ? dst_entry_family(dst) : AF_UNSPEC;
+    dst_addr *addr = dst_entry_select(dst, io->service->lb_policy, family, io->tried, io->attempts);
+    dst_addr *second = NULL;
+    if (race) {
+        int other = family == AF_INET6 ? AF_INET : AF_INET6;
+        second = dst_entry_select(dst, io->service->lb_policy, other, io->tried, io->attempts);
+        if (addr == NULL) {
+            addr = second;
+            second = NULL;
+        }
     }
-
-    uv_getnameinfo_t ni_req = {0};
-    int uv_err = uv_getnameinfo(io->service->loop, &ni_req, NULL, res->ai_addr, NI_NUMERICHOST | NI_NUMERICSERV);
-    if (uv_err == 0) {
-        snprintf(io->resolved_dst, sizeof(io->resolved_dst), "%s:%s:%s",
-                 get_protocol_str(res->ai_protocol), ni_req.host, ni_req.service);
-    } else {
-        ZITI_LOG(WARN, "hosted_service[%s] client[%s] getnameinfo failed: %s", io->service->service_name,
-                 io->client_identity, uv_strerror(uv_err));
-        strncpy(io->resolved_dst, "<unknown>", sizeof(io->resolved_dst));
+    if (addr == NULL) {
+        ZITI_LOG(ERROR, "hosted_service[%s] client[%s] no address of %s:%s:%s left to try", io->service->service_name,
+                 io->client_identity, io->computed_dst_protocol, io->computed_dst_ip_or_hn, io->computed_dst_port);
+        hosted_server_close(io);
+        return;
+    }
+    io->tried[io->attempts++] = addr->addr;
+    snprintf(io->resolved_dst, sizeof(io->resolved_dst), "%s:%s", get_protocol_str(io->hints.ai_protocol), addr->name);
+
+    // the race owns both address references, io->dst_addr is set once it is decided
+    if (second != NULL) {
+        io->tried[io->attempts++] = second->addr;
+        ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s, then %s:%s",
+                 io->service->service_name, io->client_identity, io->resolved_dst,
+                 get_protocol_str(io->hints.ai_protocol), second->name);
+        he_race *r = he_race_start(io->service->loop, addr, second, on_hosted_race_done, io);
+        if (r != NULL) {
+            io->race = r;
+        }
+        return;
     }
 
-    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s",
-             io->service->service_name, io->client_identity, io->resolved_dst);
+    ZITI_LOG(DEBUG, "hosted_service[%s] client[%s] initiating connection to %s (active=%d)",
+             io->service->service_name, io->client_identity, io->resolved_dst, addr->active);
+    io->dst_addr = addr;
 
-    switch (res->ai_protocol) {
+    int uv_err;
+    switch (io->hints.ai_protocol) {
         case IPPROTO_TCP:
             {
                 uv_connect_t *c = malloc(sizeof(uv_connect_t));
-                uv_err = uv_tcp_connect(c, &io->server.tcp, res->ai_addr, on_hosted_tcp_server_connect_complete);
+                uv_err = uv_tcp_connect(c, &io->server.tcp, (struct sockaddr *) &addr->addr,
+                                        on_hosted_tcp_server_connect_complete);
                 if (uv_err != 0) {
-                    ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_tcp_connect failed: %s",
-                             io->service->service_name, io->client_identity, uv_strerror(uv_err));
-                    hosted_server_close(io);
                     free(c);
+                    on_server_connect_failed(io, uv_err);
                 }
             }
             break;
         case IPPROTO_UDP:
-            uv_err = uv_udp_connect(&io->server.udp, res->ai_addr);
-            if (uv_err != 0) {
-                ZITI_LOG(ERROR, "hosted_service[%s], client[%s]: uv_udp_connect failed: %s",
-                         io->service->service_name, io->client_identity, uv_strerror(uv_err));
-                hosted_server_close(io);
-            } else if (ziti_accept(io->client, on_hosted_client_connect_complete, NULL) != ZITI_OK) {
-                ZITI_LOG(ERROR, "ziti_accept failed");
-                hosted_server_close(io);
-            }
+            connect_hosted_udp(io, addr);
             break;
     }
-
-    uv_freeaddrinfo(res);
-    free(ai_req);
 }
 
 /** called by ziti SDK when a hosted service listener is ready */
@@ -751,7 +1216,8 @@ static void hosted_listen_cb(ziti_connection serv, int status) {
         ZITI_LOG(ERROR, "unable to host service %s: %s", host_ctx->service_name, ziti_errorstr(status));
         ziti_conn_set_data(serv, NULL);
         ziti_close(serv, NULL);
-        free_hosted_service_ctx(host_ctx);
+        host_ctx->listener = NULL;
+        retire_hosted_service_ctx(host_ctx);
     }
 }
 
@@ -787,6 +1253,189 @@ static void listen_opts_from_host_cfg_v1(ziti_listen_opts *opts, const ziti_host
     }
 }
 
+static model_map warm_pool_sizes; // map[service_name -> int]
+
+void ziti_sdk_c_set_warm_pool(const char *service_name, int size) {
+    if (size > 0) {
+        model_map_set(&warm_pool_sizes, service_name, (void *) (intptr_t) size);
+    } else {
+        model_map_remove(&warm_pool_sizes, service_name);
+    }
+}
+
+static model_map lb_policies; // map[service_name -> dst_lb_policy], round-robin if not set
+
+int ziti_sdk_c_set_lb_policy(const char *service_name, const char *policy) {
+    if (strcasecmp(policy, "round-robin") == 0) {
+        model_map_remove(&lb_policies, service_name);
+    } else if (strcasecmp(policy, "least-conn") == 0) {
+        model_map_set(&lb_policies, service_name, (void *) (intptr_t) dst_lb_least_conn);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static model_map udp_one_way_sockets; // map[service_name -> int]
+
+void ziti_sdk_c_set_udp_one_way(const char *service_name, int sockets) {
+    if (sockets > 0) {
+        ZITI_LOG(WARN, "hosted udp service[%s] is one-way, datagrams its server sends back will be dropped",
+                 service_name);
+        model_map_set(&udp_one_way_sockets, service_name, (void *) (intptr_t) sockets);
+    } else {
+        model_map_remove(&udp_one_way_sockets, service_name);
+    }
+}
+
+static model_map tcp_bridge_opts; // map[service_name -> hosted_tcp_bridge_opts]
+
+void ziti_sdk_c_set_tcp_bridge(const char *service_name, const hosted_tcp_bridge_opts *opts) {
+    hosted_tcp_bridge_opts *prev;
+    if (opts != NULL) {
+        hosted_tcp_bridge_opts *o = malloc(sizeof(hosted_tcp_bridge_opts));
+        *o = *opts;
+        prev = model_map_set(&tcp_bridge_opts, service_name, o);
+    } else {
+        prev = model_map_remove(&tcp_bridge_opts, service_name);
+    }
+    free(prev);
+}
+
+static model_map service_limits; // map[service_name -> hosted_service_limits]
+
+void ziti_sdk_c_set_service_limits(const char *service_name, const hosted_service_limits *limits) {
+    hosted_service_limits *prev;
+    if (limits != NULL) {
+        hosted_service_limits *l = malloc(sizeof(hosted_service_limits));
+        *l = *limits;
+        prev = model_map_set(&service_limits, service_name, l);
+    } else {
+        prev = model_map_remove(&service_limits, service_name);
+    }
+    free(prev);
+}
+
+struct hosted_backends_s {
+    const char *service_name;
+    uint64_t now;
+    tunnel_hosted_backend **list;
+    int count;
+    int cap;
+};
+
+static void add_hosted_backend(void *ctx, const char *host, const char *port, const dst_addr *addr) {
+    struct hosted_backends_s *b = ctx;
+    if (b->count + 1 >= b->cap) {
+        b->cap = b->cap ? b->cap * 2 : 16;
+        b->list = realloc(b->list, b->cap * sizeof(tunnel_hosted_backend *));
+    }
+
+    char dst[300];
+    snprintf(dst, sizeof(dst), "%s:%s", host, port);
+    tunnel_hosted_backend *be = calloc(1, sizeof(tunnel_hosted_backend));
+    be->service = strdup(b->service_name);
+    be->destination = strdup(dst);
+    be->address = strdup(addr->name);
+    be->active = addr->active;
+    be->connects = (model_number) addr->connects;
+    be->failures = (model_number) addr->failures;
+    be->down = addr->down_until > b->now;
+    b->list[b->count++] = be;
+    b->list[b->count] = NULL;
+}
+
+static tunnel_hosted_service *new_hosted_service_stats(const struct hosted_service_ctx_s *host_ctx) {
+    admission_stats stats;
+    admission_get_stats(host_ctx->admission, &stats);
+    tunnel_hosted_service *svc = calloc(1, sizeof(tunnel_hosted_service));
+    svc->service = strdup(host_ctx->service_name);
+    svc->active = stats.conns;
+    svc->pending = stats.pending;
+    svc->queued = stats.queued;
+    svc->admitted = (model_number) stats.admitted;
+    svc->rejected = (model_number) stats.rejected;
+    svc->timed_out = (model_number) stats.timed_out;
+    return svc;
+}
+
+void ziti_sdk_c_get_hosted_backends(tunnel_hosted_backends *backends) {
+    struct hosted_backends_s b = {0};
+    struct hosted_service_ctx_s *host_ctx;
+    int n_services = 0;
+    LIST_FOREACH(host_ctx, &hosted_services, _next) {
+        n_services++;
+    }
+    backends->services = calloc(n_services + 1, sizeof(tunnel_hosted_service *));
+    n_services = 0;
+    LIST_FOREACH(host_ctx, &hosted_services, _next) {
+        backends->services[n_services++] = new_hosted_service_stats(host_ctx);
+        b.service_name = host_ctx->service_name;
+        b.now = uv_now(host_ctx->loop);
+        dst_cache_foreach_addr(&host_ctx->dst_cache, add_hosted_backend, &b);
+    }
+    backends->backends = b.list ? b.list : calloc(1, sizeof(tunnel_hosted_backend *));
+}
+
+static tunnel_latency *new_latency(const latency_histogram *h) {
+    tunnel_latency *l = calloc(1, sizeof(tunnel_latency));
+    l->count = (model_number) h->count;
+    l->mean = h->count ? (model_number) (h->sum / h->count) : 0;
+    l->p50 = (model_number) latency_percentile(h, 50);
+    l->p90 = (model_number) latency_percentile(h, 90);
+    l->p99 = (model_number) latency_percentile(h, 99);
+    l->max = (model_number) h->max;
+    return l;
+}
+
+static tunnel_hosted_service_metrics *new_hosted_service_metrics(const struct hosted_service_ctx_s *host_ctx) {
+    const hosted_metrics *m = &host_ctx->metrics;
+    tunnel_hosted_service_metrics *svc = calloc(1, sizeof(tunnel_hosted_service_metrics));
+    svc->service = strdup(host_ctx->service_name);
+    svc->connections = (model_number) m->connections;
+    svc->active = (model_number) m->active;
+    svc->connect_failures = (model_number) m->connect_failures;
+    svc->bytes_to_server = (model_number) m->bytes_to_server;
+    svc->bytes_to_client = (model_number) m->bytes_to_client;
+    svc->connect_latency = new_latency(&m->connect);
+    svc->first_byte_latency = new_latency(&m->first_byte);
+    return svc;
+}
+
+void ziti_sdk_c_get_hosted_metrics(tunnel_hosted_metrics *metrics) {
+    struct hosted_service_ctx_s *host_ctx;
+    int n_services = 0;
+    LIST_FOREACH(host_ctx, &hosted_services, _next) {
+        n_services++;
+    }
+    metrics->services = calloc(n_services + 1, sizeof(tunnel_hosted_service_metrics *));
+    n_services = 0;
+    LIST_FOREACH(host_ctx, &hosted_services, _next) {
+        metrics->services[n_services++] = new_hosted_service_metrics(host_ctx);
+    }
+}
+
+static void start_warm_pool(struct hosted_service_ctx_s *host_ctx) {
+    int size = (int) (intptr_t) model_map_get(&warm_pool_sizes, host_ctx->service_name);
+    if (size <= 0) {
+        return;
+    }
+    if (host_ctx->forward_protocol || host_ctx->forward_address || host_ctx->forward_port ||
+        host_ctx->proxy_connector != NULL || host_ctx->addr_u.address == NULL || host_ctx->proto_u.protocol == NULL ||
+        get_protocol_id(host_ctx->proto_u.protocol) != IPPROTO_TCP) {
+        ZITI_LOG(WARN, "hosted_service[%s] warm connections need a fixed tcp server address, not enabled",
+                 host_ctx->service_name);
+        return;
+    }
+
+    char port[12];
+    snprintf(port, sizeof(port), "%d", host_ctx->port_u.port);
+    host_ctx->warm_pool = warm_pool_new(host_ctx->loop, &host_ctx->dst_cache, host_ctx->service_name,
+                                        host_ctx->addr_u.address, port, size);
+    ZITI_LOG(INFO, "hosted_service[%s] keeping %d connections to %s:%s ready", host_ctx->service_name, size,
+             host_ctx->addr_u.address, port);
+}
+
 /** called by the tunneler sdk when a hosted service becomes available */
 host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service_name, cfg_type_e cfg_type, const void *cfg) {
     if (service_name == NULL) {
@@ -794,10 +1443,34 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
         return NULL;
     }
 
+    struct hosted_service_ctx_s *prev;
+    LIST_FOREACH(prev, &hosted_services, _next) {
+        if (prev->ziti_ctx == ziti_ctx && strcmp(prev->service_name, service_name) == 0) {
+            ZITI_LOG(INFO, "hosted_service[%s] config was updated, replacing its listener", service_name);
+            retire_hosted_service_ctx(prev);
+            break;
+        }
+    }
+
     struct hosted_service_ctx_s *host_ctx = calloc(1, sizeof(struct hosted_service_ctx_s));
     host_ctx->service_name = strdup(service_name);
     host_ctx->ziti_ctx = ziti_ctx;
     host_ctx->loop = loop;
+    dst_cache_init(&host_ctx->dst_cache, loop);
+    host_ctx->lb_policy = (dst_lb_policy) (intptr_t) model_map_get(&lb_policies, service_name);
+    // without limits every client is admitted right away, the counters are still kept
+    hosted_service_limits no_limits = {0};
+    const hosted_service_limits *limits = model_map_get(&service_limits, service_name);
+    host_ctx->admission = admission_new(loop, service_name, limits ? limits : &no_limits);
+    host_ctx->udp_relay = udp_relay_new(loop, service_name,
+                                        (int) (intptr_t) model_map_get(&udp_one_way_sockets, service_name),
+                                        &hosted_udp_client_ops);
+    const hosted_tcp_bridge_opts *bridge_opts = model_map_get(&tcp_bridge_opts, service_name);
+    if (bridge_opts) {
+        host_ctx->tcp_bridge_pool = tcp_bridge_pool_new(loop, bridge_opts->read_size, bridge_opts->max_queued,
+                                                        &hosted_tcp_client_ops);
+    }
+    LIST_INSERT_HEAD(&hosted_services, host_ctx, _next);
     host_ctx->cfg_type = cfg_type;
     host_ctx->cfg = cfg;
 
@@ -878,6 +1551,7 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
                     ZITI_LOG(ERROR, "hosted_service[%s] specifies 'forwardPort' with zero-length 'allowedPortRanges'",
                              host_ctx->service_name);
                     free_hosted_service_ctx(host_ctx);
+                    return NULL;
                 }
             } else {
                 host_ctx->port_u.port = host_v1_cfg->port;
@@ -944,8 +1618,10 @@ host_ctx_t *ziti_sdk_c_host(void *ziti_ctx, uv_loop_t *loop, const char *service
     }
 
     snprintf(host_ctx->display_address, sizeof(host_ctx->display_address), "%s:%s:%s", display_proto, display_addr, display_port);
+    start_warm_pool(host_ctx);
     ziti_connection serv;
     ziti_conn_init(ziti_ctx, &serv, host_ctx);
+    host_ctx->listener = serv;
 
     char listen_identity[128];
     if (listen_opts_p != NULL) {
@@ -22,6 +22,12 @@
 #define ZITI_TUNNEL_SDK_C_ZITI_HOSTING_H
 #include <ziti/ziti_tunnel.h>
 #include "tlsuv/http.h"
+#include "dst_cache.h"
+#include "warm_pool.h"
+#include "admission.h"
+#include "udp_bridge.h"
+#include "tcp_bridge.h"
+#include "hosted_metrics.h"
 // allowed address is one of:
 // - ip subnet address
 // - DNS name or wildcard
@@ -61,6 +67,19 @@ struct hosted_service_ctx_s {
     address_list_t    allowed_source_addresses;
     const char *proxy_addr;
     tlsuv_connector_t *proxy_connector;
+    dst_cache dst_cache;
+    dst_lb_policy lb_policy;
+    warm_pool *warm_pool; // pre-established server connections, if enabled for the service
+    admission *admission;
+    udp_relay *udp_relay;
+    tcp_bridge_pool *tcp_bridge_pool; // NULL if tcp clients are bridged by the sdk
+    hosted_metrics metrics;
+
+    ziti_connection listener;
+    int n_clients; // client io contexts, which keep a replaced context alive
+    bool retired; // replaced by a newer config, freed with its last client
+
+    LIST_ENTRY(hosted_service_ctx_s) _next;
 };
 
 struct tunneled_service_s {
@@ -68,6 +87,6 @@ struct tunneled_service_s {
     host_ctx_t      *host;
 };
 
-void accept_resolver_conn(ziti_connection conn, allowed_hostnames_t *allowed);
+void accept_resolver_conn(ziti_connection conn, uv_loop_t *loop, allowed_hostnames_t *allowed, const char *format);
 
 #endif //ZITI_TUNNEL_SDK_C_ZITI_HOSTING_H
@@ -295,6 +295,7 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
     ziti_io_ctx->ziti_eof = false;
     ziti_io_ctx->tnlr_eof = false;
     ziti_io_ctx->pending_wbytes = 0;
+    ziti_io_ctx->dns_conn = false;
 
     ziti_context ziti_ctx = zi_ctx->ztx;
     if (ziti_conn_init(ziti_ctx, &ziti_io_ctx->ziti_conn, io) != ZITI_OK) {
@@ -347,6 +348,9 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
         dial_opts.identity = resolved_dial_identity;
     }
 
+    if (app_data.dst_hostname != NULL && ipaddr_aton(app_data.dst_ip, &ziti_io_ctx->dns_addr)) {
+        ziti_io_ctx->dns_conn = true;
+    }
     free_tunneler_app_data(&app_data);
     dial_opts.app_data_sz = (size_t) json_len;
     dial_opts.app_data = app_data_json;
@@ -358,6 +362,9 @@ void * ziti_sdk_c_dial(const void *intercept_ctx, struct io_ctx_s *io) {
         return NULL;
     }
 
+    if (ziti_io_ctx->dns_conn) {
+        ziti_dns_conn_start(&ziti_io_ctx->dns_addr);
+    }
     return ziti_io_ctx;
 }
 
@@ -427,27 +434,11 @@ ziti_intercept_t *new_ziti_intercept(ziti_context ztx, ziti_service *service, zi
 }
 
 // only do matching on based on wildcard domain here
-static const ziti_address *intercept_match_addr(ip_addr_t *addr, void *ctx) {
-    ziti_intercept_t *zi_ctx = ctx;
-    if (zi_ctx->cfg_desc->cfgtype == INTERCEPT_CFG_V1) {
-        ziti_intercept_cfg_v1 *cfg = &zi_ctx->cfg.intercept_v1;
-        const char *domain = ziti_dns_reverse_lookup_domain(addr);
-        if (domain) {
-            const ziti_address *zaddr;
-            MODEL_LIST_FOREACH(zaddr, cfg->addresses) {
-                if (zaddr->type != ziti_address_hostname) continue;
-                if (ziti_address_match_s(domain, zaddr) >= 0) {
-                    return zaddr;
-                }
-            }
-        }
-    }
-    return NULL;
-}
-
-static const ziti_address  *intercept_addr_from_cfg_addr(const ziti_address *cfg_addr, ziti_intercept_t *zi) {
-    static ziti_address dns_addr;
+static const ziti_address  *intercept_addr_from_cfg_addr(const ziti_address *cfg_addr, ziti_intercept_t *zi,
+                                                         const ziti_address **intercept_addr6) {
+    static ziti_address dns_addr, dns_addr6;
     const ziti_address *intercept_addr_p = NULL;
+    *intercept_addr6 = NULL;
 
     if (cfg_addr->type == ziti_address_cidr) {
         intercept_addr_p = cfg_addr;
@@ -456,6 +447,12 @@ static const ziti_address  *intercept_addr_from_cfg_addr(const ziti_address *cfg
         if (intercept_ip) {
             intercept_addr_p = &dns_addr;
             ziti_address_from_ip_addr(&dns_addr, intercept_ip);
+
+            const ip_addr_t *intercept_ip6 = ziti_dns_ipv6_addr(intercept_ip);
+            if (intercept_ip6) {
+                *intercept_addr6 = &dns_addr6;
+                ziti_address_from_ip_addr(&dns_addr6, intercept_ip6);
+            }
         }
     } else {
         ZITI_LOG(WARN, "unknown ziti_address type %d", cfg_addr->type);
@@ -466,15 +463,15 @@ static const ziti_address  *intercept_addr_from_cfg_addr(const ziti_address *cfg
 
 intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *zi_ctx) {
     intercept_ctx_t *i_ctx = intercept_ctx_new(tnlr_ctx, zi_ctx->service_name, zi_ctx);
-    intercept_ctx_set_match_addr(i_ctx, intercept_match_addr);
 
-    const ziti_address *intercept_addr;
+    const ziti_address *intercept_addr, *intercept_addr6;
     switch (zi_ctx->cfg_desc->cfgtype) {
         case CLIENT_CFG_V1:
             intercept_ctx_add_protocol(i_ctx, "udp");
             intercept_ctx_add_protocol(i_ctx, "tcp");
-            intercept_addr = intercept_addr_from_cfg_addr(&zi_ctx->cfg.client_v1.hostname, zi_ctx);
+            intercept_addr = intercept_addr_from_cfg_addr(&zi_ctx->cfg.client_v1.hostname, zi_ctx, &intercept_addr6);
             intercept_ctx_add_address(i_ctx, intercept_addr);
+            intercept_ctx_add_address(i_ctx, intercept_addr6);
             intercept_ctx_add_port_range(i_ctx, zi_ctx->cfg.client_v1.port, zi_ctx->cfg.client_v1.port);
             break;
         case INTERCEPT_CFG_V1:
@@ -486,8 +483,9 @@ intercept_ctx_t *new_intercept_ctx(tunneler_context tnlr_ctx, ziti_intercept_t *
             }
             ziti_address *addr;
             MODEL_LIST_FOREACH(addr, config->addresses) {
-                intercept_addr = intercept_addr_from_cfg_addr(addr, zi_ctx);
+                intercept_addr = intercept_addr_from_cfg_addr(addr, zi_ctx, &intercept_addr6);
                 intercept_ctx_add_address(i_ctx, intercept_addr);
+                intercept_ctx_add_address(i_ctx, intercept_addr6);
             }
             ziti_port_range *pr;
             MODEL_LIST_FOREACH(pr, config->port_ranges) {
@@ -602,7 +600,11 @@ static void ziti_conn_close_cb(ziti_connection zc) {
         return;
     }
     if (io->ziti_io) {
-        free(io->ziti_io);
+        ziti_io_context *zio = io->ziti_io;
+        if (zio->dns_conn) {
+            ziti_dns_conn_end(&zio->dns_addr);
+        }
+        free(zio);
         io->ziti_io = NULL;
     }
     ziti_tunneler_close(io->tnlr_io);
@@ -611,7 +613,8 @@ static void ziti_conn_close_cb(ziti_connection zc) {
     ZITI_LOG(VERBOSE, "nulled data for ziti_conn[%p]", zc);
 }
 
-#define RESOLVE_APP_DATA "{\"connType\":\"resolver\"}"
+// hosting side that predates wire format ignores dns_format and keeps using JSON
+#define RESOLVE_APP_DATA "{\"connType\":\"resolver\",\"dns_format\":\"wire\"}"
 ziti_connection intercept_resolve_connect(ziti_intercept_t *intercept, void *ctx, ziti_conn_cb conn_cb, ziti_data_cb data_cb) {
     ziti_connection conn;
     ziti_conn_init(intercept->ztx, &conn, ctx);
@@ -759,6 +759,26 @@ static int process_cmd(const tunnel_command *cmd, command_cb cb, void *ctx) {
             break;
         }
 
+        case TunnelCommand_GetHostedBackends: {
+            tunnel_hosted_backends backends = {0};
+            ziti_sdk_c_get_hosted_backends(&backends);
+            result.data = tunnel_hosted_backends_to_json(&backends, MODEL_JSON_COMPACT, NULL);
+            result.success = true;
+            result.code = IPC_SUCCESS;
+            free_tunnel_hosted_backends(&backends);
+            break;
+        }
+
+        case TunnelCommand_GetHostedMetrics: {
+            tunnel_hosted_metrics metrics = {0};
+            ziti_sdk_c_get_hosted_metrics(&metrics);
+            result.data = tunnel_hosted_metrics_to_json(&metrics, MODEL_JSON_COMPACT, NULL);
+            result.success = true;
+            result.code = IPC_SUCCESS;
+            free_tunnel_hosted_metrics(&metrics);
+            break;
+        }
+
         case TunnelCommand_ExternalAuth: {
             tunnel_identity_id id = {};
             if (cmd->data == NULL ||
@@ -994,6 +1014,7 @@ static void on_ziti_event(ziti_context ztx, const ziti_event_t *event) {
             };
 
             bool send_event = false;
+            ziti_tunneler_begin_intercepts(CMD_CTX.tunnel_ctx);
             if (event->service.removed != NULL) {
                 ev.removed_services = event->service.removed;
                 for (zs = event->service.removed; *zs != NULL; zs++) {
@@ -1028,7 +1049,7 @@ static void on_ziti_event(ziti_context ztx, const ziti_event_t *event) {
                 }
             }
 
-            ziti_tunnel_commit_routes(CMD_CTX.tunnel_ctx);
+            ziti_tunneler_commit_intercepts(CMD_CTX.tunnel_ctx);
             break;
         }
 
@@ -1444,6 +1465,14 @@ static void on_sigdump(uv_signal_t *sig, int signum) {
     ip_dump(&stats, (dump_writer) fprintf, dumpfile);
     free_tunnel_ip_stats(&stats);
 
+    ziti_dns_cache_stats dns_stats;
+    ziti_dns_get_cache_stats(&dns_stats);
+    uint64_t lookups = dns_stats.hits + dns_stats.misses;
+    CHECK(cleanup, fprintf(dumpfile, "\n=================\nDNS Cache:\n"
+                                     "entries: %zu, bytes: %zu/%zu, hits: %" PRIu64 ", misses: %" PRIu64 " (%.1f%% hit rate)\n",
+                           dns_stats.entries, dns_stats.bytes, dns_stats.limit, dns_stats.hits, dns_stats.misses,
+                           lookups ? 100.0 * (double) dns_stats.hits / (double) lookups : 0.0));
+
     CHECK(cleanup, fflush(dumpfile));
     cleanup:
     fclose(dumpfile);
@@ -23,4 +23,10 @@ IMPL_MODEL(tunnel_tun_ip_v4, TUNNEL_TUN_IP_V4)
 IMPL_MODEL(tunnel_add_identity, TUNNEL_ADD_IDENTITY)
 IMPL_MODEL(tunnel_ext_auth, TUNNEL_EXT_AUTH)
 IMPL_MODEL(tunnel_upstream_dns, TUNNEL_UPSTREAM_DNS)
-IMPL_MODEL(tunnel_enroll, TNL_ENROLL)
\ No newline at end of file
+IMPL_MODEL(tunnel_enroll, TNL_ENROLL)
+IMPL_MODEL(tunnel_hosted_backend, TNL_HOSTED_BACKEND)
+IMPL_MODEL(tunnel_hosted_service, TNL_HOSTED_SERVICE)
+IMPL_MODEL(tunnel_hosted_backends, TNL_HOSTED_BACKENDS)
+IMPL_MODEL(tunnel_latency, TNL_LATENCY)
+IMPL_MODEL(tunnel_hosted_service_metrics, TNL_HOSTED_SERVICE_METRICS)
+IMPL_MODEL(tunnel_hosted_metrics, TNL_HOSTED_METRICS)
\ No newline at end of file
@@ -100,12 +100,23 @@ typedef void * (*ziti_sdk_dial_cb)(const void *app_intercept_ctx, io_ctx_t *io);
 typedef int (*ziti_sdk_close_cb)(void *ziti_io_ctx);
 typedef ssize_t (*ziti_sdk_write_cb)(const void *ziti_io_ctx, void *write_ctx, const void *data, size_t len);
 typedef host_ctx_t * (*ziti_sdk_host_cb)(void *ziti_ctx, uv_loop_t *loop, const char *service_name, cfg_type_e cfg_type, const void *cfg);
+/** called when `len` bytes written to the client with ziti_tunneler_write were acknowledged */
+typedef void (*ziti_sdk_write_ack_cb)(void *ziti_io_ctx, size_t len);
 
 /** data needed to intercept packets and dial the associated ziti service */
 typedef struct intercept_ctx_s  intercept_ctx_t;
 typedef const ziti_address * (*intercept_match_addr_fn)(ip_addr_t *addr, void *app_intercept_ctx);
 
+/** called for each intercept found by an intercept_match_domains_fn. returning true ends the walk */
+typedef bool (*intercept_domain_visitor)(void *app_intercept_ctx, void *ctx);
+/**
+ * call `visit` with the app_intercept_ctx of each intercept whose wildcard domains cover the hostname that `addr`
+ * was assigned to. lets the tunneler find wildcard matches with one index lookup instead of asking every intercept.
+ */
+typedef void (*intercept_match_domains_fn)(const ip_addr_t *addr, intercept_domain_visitor visit, void *ctx);
+
 extern intercept_ctx_t* intercept_ctx_new(tunneler_context tnlr_ctx, const char *app_id, void *app_intercept_ctx);
+/** match addresses that are not indexed by the tunneler's intercept_match_domains_fn, see ziti_tunneler_set_match_domains */
 extern void intercept_ctx_set_match_addr(intercept_ctx_t *intercept, intercept_match_addr_fn pred);
 extern void intercept_ctx_add_protocol(intercept_ctx_t *ctx, const char *protocol);
 /** parse address string as hostname|ip|cidr and add result to list of intercepted addresses */
@@ -120,6 +131,7 @@ struct io_ctx_s {
     ziti_sdk_write_cb     write_fn;
     ziti_sdk_close_cb     close_write_fn;
     ziti_sdk_close_cb     close_fn;
+    ziti_sdk_write_ack_cb write_ack_fn; // optional, see ziti_tunneler_set_write_ack_cb
 };
 
 struct io_ctx_list_entry_s {
@@ -172,14 +184,30 @@ extern void ziti_tunneler_shutdown(tunneler_context tnlr_ctx);
 
 extern int ziti_tunneler_intercept(tunneler_context tnlr_ctx, intercept_ctx_t *i_ctx);
 
+/**
+ * start a batch of intercept changes. until the matching `ziti_tunneler_commit_intercepts`,
+ * `ziti_tunneler_intercept` and `ziti_tunneler_stop_intercepting` only record their route changes.
+ * batches may be nested; only the outermost commit takes effect.
+ */
+extern void ziti_tunneler_begin_intercepts(tunneler_context tnlr_ctx);
+
+/** apply the net route changes of the current batch to the netif driver and commit them once */
+extern void ziti_tunneler_commit_intercepts(tunneler_context tnlr_ctx);
+
 extern host_ctx_t * ziti_tunneler_host(tunneler_context tnlr_ctx, const void *ziti_ctx, const char *service_name, cfg_type_e cfg_type, void *cfg);
 
 extern void ziti_tunneler_stop_intercepting(tunneler_context tnlr_ctx, void *zi_ctx);
 
 extern intercept_ctx_t * ziti_tunnel_find_intercept(tunneler_context tnlr_ctx, void *zi_ctx);
 
+/** find intercepts by wildcard domain with `fn` */
+extern void ziti_tunneler_set_match_domains(tunneler_context tnlr_ctx, intercept_match_domains_fn fn);
+
 extern void ziti_tunneler_set_idle_timeout(struct io_ctx_s *io_context, unsigned int timeout);
 
+/** get told when the client acknowledges written data (tcp only), e.g. to write what ziti_tunneler_write did not accept */
+extern void ziti_tunneler_set_write_ack_cb(struct io_ctx_s *io_context, ziti_sdk_write_ack_cb cb);
+
 extern void ziti_tunneler_dial_completed(struct io_ctx_s *io_context, bool ok);
 
 extern ssize_t ziti_tunneler_write(tunneler_io_context tnlr_io_ctx, const void *data, size_t len);
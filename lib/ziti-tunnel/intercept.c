@@ -153,6 +153,61 @@ struct addr_match {
     intercept_ctx_t *intercept;
 };
 
+/** keep `curr` unless `best` has a smaller address range, or a smaller port range */
+static void pick_match(struct addr_match *best, const struct addr_match *curr) {
+    if (best->intercept == NULL ||
+        (curr->addr_score <= best->addr_score && curr->pr_score <= best->pr_score)) {
+        *best = *curr;
+    }
+}
+
+struct domain_match_s {
+    tunneler_context tnlr_ctx;
+    const char *protocol;
+    uint16_t port;
+    struct addr_match best;
+};
+
+static bool on_domain_match(void *app_intercept_ctx, void *ctx) {
+    struct domain_match_s *m = ctx;
+    intercept_ctx_t *intercept = model_map_get_key(&m->tnlr_ctx->intercepts_by_ctx, &app_intercept_ctx,
+                                                   sizeof(app_intercept_ctx));
+    if (intercept == NULL || !protocol_match(m->protocol, &intercept->protocols)) {
+        return false;
+    }
+
+    struct addr_match curr = { 0 };
+    curr.intercept = intercept;
+    curr.addr_score = 1; // leave room for a matching plain ziti_address_hostname to win
+    curr.pr = port_match(m->port, &intercept->port_ranges);
+    if (curr.pr == NULL) {
+        return false;
+    }
+    curr.pr_score = curr.pr->high - curr.pr->low;
+    pick_match(&m->best, &curr);
+    return false;
+}
+
+struct domain_probe_s {
+    const void *app_intercept_ctx;
+    bool found;
+};
+
+static bool on_domain_probe(void *app_intercept_ctx, void *ctx) {
+    struct domain_probe_s *probe = ctx;
+    probe->found = app_intercept_ctx == probe->app_intercept_ctx;
+    return probe->found;
+}
+
+bool intercept_matches_domain(const intercept_ctx_t *intercept, const ip_addr_t *addr) {
+    if (intercept->tnlr_ctx == NULL || intercept->tnlr_ctx->match_domains == NULL) {
+        return false;
+    }
+    struct domain_probe_s probe = { intercept->app_intercept_ctx, false };
+    intercept->tnlr_ctx->match_domains(addr, on_domain_probe, &probe);
+    return probe.found;
+}
+
 /** return the intercept context with the smallest address range for a packet based on its destination ip:port */
 intercept_ctx_t * lookup_intercept_by_address(tunneler_context tnlr_ctx, const char *protocol, ip_addr_t *dst_addr, uint16_t dst_port) {
     if (tnlr_ctx == NULL) {
@@ -160,16 +215,15 @@ intercept_ctx_t * lookup_intercept_by_address(tunneler_context tnlr_ctx, const c
         return NULL;
     }
 
-    char key[3+1+IPADDR_STRLEN_MAX+1+6+1]; // [proto]:[ip]:[port]
-    snprintf(key, sizeof(key), "%s:%s:%d", protocol, ipaddr_ntoa(dst_addr), dst_port);
-    intercept_ctx_t *intercept = model_map_get(&tnlr_ctx->intercepts_cache, key);
-    if (intercept != NULL) {
+    intercept_ctx_t *intercept;
+    if (intercept_cache_get(&tnlr_ctx->intercepts_cache, protocol, dst_addr, dst_port, &intercept)) {
         return intercept;
     }
 
     ziti_address za;
     ziti_address_from_ip_addr(&za, dst_addr);
-    struct addr_match curr, best = { 0 };
+    struct domain_match_s m = { .tnlr_ctx = tnlr_ctx, .protocol = protocol, .port = dst_port };
+    struct addr_match curr;
 
     LIST_FOREACH(intercept, &tnlr_ctx->intercepts, entries) {
         if (!protocol_match(protocol, &intercept->protocols)) continue;
@@ -185,10 +239,10 @@ intercept_ctx_t * lookup_intercept_by_address(tunneler_context tnlr_ctx, const c
                 curr.addr_score = 0;
             }
         } else if (intercept->match_addr) {
-            // check for wildcard domain match
+            // application specific match for addresses that are not in the wildcard domain index
             curr.addr = intercept->match_addr(dst_addr, intercept->app_intercept_ctx);
             if (curr.addr) {
-                curr.addr_score = 1; // leave room for a matching plain ziti_address_hostname to win
+                curr.addr_score = 1; // same as a wildcard domain match
             }
         }
         if (curr.addr_score < 0) continue;
@@ -197,27 +251,18 @@ intercept_ctx_t * lookup_intercept_by_address(tunneler_context tnlr_ctx, const c
         curr.pr_score = (curr.pr != NULL) ? curr.pr->high - curr.pr->low : -1;
         if (curr.pr_score < 0) continue;
 
-        if (best.intercept == NULL) {
-            // first match
-            best = curr;
-            continue;
-        }
-
-        if (curr.addr_score > best.addr_score) {
-            // current address score is inferior to best match so far
-            continue;
-        }
-
-        if (curr.pr_score > best.pr_score) {
-            // current port matches, but matching range is larger than best matching range.
-            continue;
-        }
+        pick_match(&m.best, &curr);
+    }
 
-        best = curr;
+    // wildcard domain matches come straight from the index
+    if (tnlr_ctx->match_domains) {
+        tnlr_ctx->match_domains(dst_addr, on_domain_match, &m);
     }
 
-    model_map_set(&tnlr_ctx->intercepts_cache, key, best.intercept);
-    return best.intercept;
+    if (tnlr_ctx->intercept_batch == 0) {
+        intercept_cache_put(&tnlr_ctx->intercepts_cache, protocol, dst_addr, dst_port, m.best.intercept);
+    }
+    return m.best.intercept;
 }
 
 void free_intercept(intercept_ctx_t *intercept) {
@@ -0,0 +1,211 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+/**
+ * bounded cache of intercept lookups keyed by [proto]:[ip]:[port].
+ *
+ * the cache is a fixed number of small sets. a key hashes to exactly one set, and
+ * entries within a set are evicted with the CLOCK (second chance) algorithm. negative
+ * results are cached too, so a port scan can churn the cache but never grow it.
+ */
+
+#include <string.h>
+
+#include "ziti_tunnel_priv.h"
+
+#define CACHE_SETS 256 /* must be a power of 2 */
+#define CACHE_WAYS 4
+
+static const char *cache_protos[] = { NULL, "tcp", "udp" };
+#define num_cache_protos (sizeof(cache_protos)/sizeof(cache_protos[0]))
+
+struct intercept_cache_slot_s {
+    ip_addr_t addr;
+    uint16_t port;
+    uint8_t proto;      // index into cache_protos. 0 means the slot is empty
+    uint8_t referenced;
+    intercept_ctx_t *intercept;
+};
+
+struct intercept_cache_set_s {
+    struct intercept_cache_slot_s ways[CACHE_WAYS];
+    unsigned int hand;
+};
+
+static uint8_t proto_id(const char *protocol) {
+    for (uint8_t i = 1; i < num_cache_protos; i++) {
+        if (strcmp(cache_protos[i], protocol) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static uint32_t hash_key(uint8_t proto, const ip_addr_t *addr, uint16_t port) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+#define HASH_BYTE(b) do { h ^= (uint8_t)(b); h *= 16777619u; } while(0)
+    HASH_BYTE(proto);
+    HASH_BYTE(port & 0xff);
+    HASH_BYTE(port >> 8);
+    if (IP_IS_V4(addr)) {
+        uint32_t a = ip4_addr_get_u32(ip_2_ip4(addr));
+        for (int i = 0; i < 4; i++) HASH_BYTE(a >> (i * 8));
+    } else {
+        const ip6_addr_t *a6 = ip_2_ip6(addr);
+        for (int w = 0; w < 4; w++) {
+            for (int i = 0; i < 4; i++) HASH_BYTE(a6->addr[w] >> (i * 8));
+        }
+    }
+#undef HASH_BYTE
+    return h;
+}
+
+static bool slot_match(const struct intercept_cache_slot_s *s, uint8_t proto, const ip_addr_t *addr, uint16_t port) {
+    return s->proto == proto && s->port == port && ip_addr_cmp(&s->addr, addr);
+}
+
+static struct intercept_cache_set_s *cache_set(struct intercept_cache_s *cache, uint8_t proto, const ip_addr_t *addr, uint16_t port) {
+    if (cache->sets == NULL) {
+        return NULL;
+    }
+    return &cache->sets[hash_key(proto, addr, port) & (CACHE_SETS - 1)];
+}
+
+/** returns true if the lookup is cached. `*intercept` is set to the cached result, which may be NULL */
+bool intercept_cache_get(struct intercept_cache_s *cache, const char *protocol, const ip_addr_t *addr, uint16_t port,
+                         intercept_ctx_t **intercept) {
+    uint8_t proto = proto_id(protocol);
+    if (proto == 0) return false;
+
+    struct intercept_cache_set_s *set = cache_set(cache, proto, addr, port);
+    if (set == NULL) return false;
+
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        struct intercept_cache_slot_s *s = &set->ways[i];
+        if (slot_match(s, proto, addr, port)) {
+            s->referenced = 1;
+            *intercept = s->intercept;
+            return true;
+        }
+    }
+    return false;
+}
+
+void intercept_cache_put(struct intercept_cache_s *cache, const char *protocol, const ip_addr_t *addr, uint16_t port,
+                         intercept_ctx_t *intercept) {
+    uint8_t proto = proto_id(protocol);
+    if (proto == 0) return;
+
+    if (cache->sets == NULL) {
+        cache->sets = calloc(CACHE_SETS, sizeof(struct intercept_cache_set_s));
+        if (cache->sets == NULL) {
+            TNL_LOG(WARN, "failed to allocate intercept cache");
+            return;
+        }
+    }
+
+    struct intercept_cache_set_s *set = cache_set(cache, proto, addr, port);
+    struct intercept_cache_slot_s *victim = NULL;
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        struct intercept_cache_slot_s *s = &set->ways[i];
+        if (slot_match(s, proto, addr, port)) {
+            victim = s;
+            break;
+        }
+        if (victim == NULL && s->proto == 0) {
+            victim = s;
+        }
+    }
+
+    // all ways are in use. give each referenced entry a second chance
+    while (victim == NULL) {
+        struct intercept_cache_slot_s *s = &set->ways[set->hand];
+        set->hand = (set->hand + 1) % CACHE_WAYS;
+        if (s->referenced) {
+            s->referenced = 0;
+        } else {
+            victim = s;
+        }
+    }
+
+    ip_addr_copy(victim->addr, *addr);
+    victim->port = port;
+    victim->proto = proto;
+    victim->referenced = 1;
+    victim->intercept = intercept;
+}
+
+/** would `intercept` be a candidate for the lookup cached in this slot? */
+static bool intercept_matches_slot(const intercept_ctx_t *intercept, struct intercept_cache_slot_s *s) {
+    if (!protocol_match(cache_protos[s->proto], &intercept->protocols)) return false;
+    if (port_match(s->port, &intercept->port_ranges) == NULL) return false;
+
+    ziti_address za;
+    ziti_address_from_ip_addr(&za, &s->addr);
+    if (address_match(&za, &intercept->addresses) != NULL) return true;
+
+    if (intercept_matches_domain(intercept, &s->addr)) return true;
+
+    // application specific match for addresses that are not in the wildcard domain index
+    return intercept->match_addr && intercept->match_addr(&s->addr, intercept->app_intercept_ctx) != NULL;
+}
+
+/**
+ * invalidate cached lookups that are affected by a new intercept. only entries that the
+ * new intercept matches can change, whether they are currently cached as hits or misses.
+ */
+void intercept_cache_invalidate_added(struct intercept_cache_s *cache, const intercept_ctx_t *intercept) {
+    if (cache->sets == NULL) return;
+
+    int count = 0;
+    for (int i = 0; i < CACHE_SETS; i++) {
+        for (int w = 0; w < CACHE_WAYS; w++) {
+            struct intercept_cache_slot_s *s = &cache->sets[i].ways[w];
+            if (s->proto != 0 && intercept_matches_slot(intercept, s)) {
+                memset(s, 0, sizeof(*s));
+                count++;
+            }
+        }
+    }
+    TNL_LOG(VERBOSE, "invalidated %d cached lookups for service[%s]", count, intercept->service_name);
+}
+
+/**
+ * invalidate cached lookups that resolved to an intercept that is being removed. lookups
+ * that resolved to other intercepts (or to nothing) are unaffected by the removal.
+ */
+void intercept_cache_invalidate_removed(struct intercept_cache_s *cache, const intercept_ctx_t *intercept) {
+    if (cache->sets == NULL) return;
+
+    int count = 0;
+    for (int i = 0; i < CACHE_SETS; i++) {
+        for (int w = 0; w < CACHE_WAYS; w++) {
+            struct intercept_cache_slot_s *s = &cache->sets[i].ways[w];
+            if (s->proto != 0 && s->intercept == intercept) {
+                memset(s, 0, sizeof(*s));
+                count++;
+            }
+        }
+    }
+    TNL_LOG(VERBOSE, "invalidated %d cached lookups for service[%s]", count, intercept->service_name);
+}
+
+void intercept_cache_clear(struct intercept_cache_s *cache) {
+    if (cache->sets != NULL) {
+        memset(cache->sets, 0, CACHE_SETS * sizeof(struct intercept_cache_set_s));
+    }
+}
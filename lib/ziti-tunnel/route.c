@@ -17,13 +17,321 @@
 #include "ziti_tunnel_priv.h"
 #include <string.h>
 
-struct route_count {
-    char *route;
-    int count;
-    LIST_ENTRY(route_count) _next;
+/*
+ * intercept addresses are reference counted by their string form. the routes that are
+ * actually programmed through the netif driver are planned from the set of referenced
+ * addresses: prefixes that are nested inside another referenced prefix are dropped, and
+ * sibling prefixes that together cover their parent are merged into the parent. only the
+ * difference between the planned set and the installed set is pushed to the driver.
+ *
+ * referenced prefixes are kept in a binary trie per address family. a single reference
+ * change only affects the nodes on the path to its prefix, so unbatched changes re-plan
+ * the subtree below the shallowest routed node on that path. batched changes are planned
+ * from the whole trie when they are flushed.
+ */
+
+// map<route -> int* reference count>
+static model_map route_counts;
+
+// routes that are currently programmed through the netif driver. map<route -> route>
+static model_map installed_routes;
+
+static bool defer_updates = false;
+static bool plan_dirty = false;
+
+struct rt_node {
+    struct rt_node *child[2];
+    char *route;  // referenced route string for this exact prefix, if any
+    int refs;     // number of referenced routes with this exact prefix
+    bool covered; // this prefix is routed in full
 };
 
-static LIST_HEAD(routes, route_count) route_counts = LIST_HEAD_INITIALIZER(&route_counts);
+static struct rt_node rt_root_v4;
+static struct rt_node rt_root_v6;
+
+/** prefix bits in host order. ipv4 prefixes use a[0] only */
+struct rt_prefix {
+    uint32_t a[4];
+    int bits;
+};
+
+static bool parse_prefix(const char *route, bool *is_v6, struct rt_prefix *p) {
+    char addr_str[MAX_ROUTE_LEN + 32];
+    const char *slash = strchr(route, '/');
+    size_t addr_len = slash ? (size_t) (slash - route) : strlen(route);
+    if (addr_len >= sizeof(addr_str)) {
+        return false;
+    }
+    memcpy(addr_str, route, addr_len);
+    addr_str[addr_len] = '\0';
+
+    ip_addr_t ip;
+    if (!ipaddr_aton(addr_str, &ip)) {
+        return false;
+    }
+
+    memset(p, 0, sizeof(*p));
+    int max_bits;
+    if (IP_IS_V4(&ip)) {
+        *is_v6 = false;
+        max_bits = 32;
+        p->a[0] = lwip_ntohl(ip4_addr_get_u32(ip_2_ip4(&ip)));
+    } else {
+        *is_v6 = true;
+        max_bits = 128;
+        for (int i = 0; i < 4; i++) {
+            p->a[i] = lwip_ntohl(ip_2_ip6(&ip)->addr[i]);
+        }
+    }
+
+    p->bits = max_bits;
+    if (slash) {
+        char *end;
+        long bits = strtol(slash + 1, &end, 10);
+        if (*end != '\0' || bits < 0 || bits > max_bits) {
+            return false;
+        }
+        p->bits = (int) bits;
+    }
+    return true;
+}
+
+static int prefix_bit(const struct rt_prefix *p, int i) {
+    return (int) ((p->a[i / 32] >> (31 - i % 32)) & 1);
+}
+
+/** a prefix is routed in full if it is referenced, or if both of its halves are. never summarize up to a default route */
+static bool node_covered(const struct rt_node *n, int depth) {
+    return n->refs > 0 ||
+           (depth > 0 && n->child[0] && n->child[0]->covered && n->child[1] && n->child[1]->covered);
+}
+
+/** add the shallowest routed prefixes below n to the plan */
+static void trie_emit(const struct rt_node *n, struct rt_prefix *p, int depth, bool is_v6, model_map *plan) {
+    if (n == NULL) return;
+    if (n->covered) {
+        if (n->route) {
+            model_map_set(plan, n->route, n->route);
+            return;
+        }
+        char route[IPADDR_STRLEN_MAX + 5];
+        ip_addr_t ip;
+        if (is_v6) {
+            IP_ADDR6(&ip, lwip_htonl(p->a[0]), lwip_htonl(p->a[1]), lwip_htonl(p->a[2]), lwip_htonl(p->a[3]));
+        } else {
+            IP_ADDR4(&ip, (p->a[0] >> 24) & 0xff, (p->a[0] >> 16) & 0xff, (p->a[0] >> 8) & 0xff, p->a[0] & 0xff);
+        }
+        char ip_str[IPADDR_STRLEN_MAX];
+        ipaddr_ntoa_r(&ip, ip_str, sizeof(ip_str));
+        snprintf(route, sizeof(route), "%s/%d", ip_str, depth);
+        model_map_set(plan, route, "");
+        return;
+    }
+
+    for (int b = 0; b < 2; b++) {
+        if (n->child[b] == NULL) continue;
+        uint32_t bit = 1u << (31 - depth % 32);
+        if (b) p->a[depth / 32] |= bit;
+        trie_emit(n->child[b], p, depth + 1, is_v6, plan);
+        p->a[depth / 32] &= ~bit;
+    }
+}
+
+/** compute the minimal set of routes that covers all referenced addresses */
+static void plan_routes(model_map *plan) {
+    const char *route;
+    int *count;
+    MODEL_MAP_FOREACH(route, count, &route_counts) {
+        struct rt_prefix p;
+        bool is_v6;
+        if (!parse_prefix(route, &is_v6, &p)) {
+            // not an ip prefix. pass it through as is
+            model_map_set(plan, route, (void *) route);
+        }
+    }
+
+    struct rt_prefix p = { 0 };
+    trie_emit(&rt_root_v4, &p, 0, false, plan);
+    memset(&p, 0, sizeof(p));
+    trie_emit(&rt_root_v6, &p, 0, true, plan);
+}
+
+/** push routes that are in `after` but not in `before` to the driver, and remove those that are only in `before` */
+static int apply_route_delta(netif_driver tun, model_map *before, model_map *after) {
+    int changed = 0;
+    const char *route;
+    void *v;
+    // add new routes before removing old ones, so that traffic is never left without a route
+    MODEL_MAP_FOREACH(route, v, after) {
+        if (model_map_get(before, route) == NULL && model_map_get(&installed_routes, route) == NULL) {
+            char *r = strdup(route);
+            model_map_set(&installed_routes, r, r);
+            tun->add_route(tun->handle, r);
+            changed++;
+        }
+    }
+
+    MODEL_MAP_FOREACH(route, v, before) {
+        if (model_map_get(after, route) != NULL) {
+            continue;
+        }
+        char *r = model_map_remove(&installed_routes, route);
+        if (r != NULL) {
+            tun->delete_route(tun->handle, r);
+            free(r);
+            changed++;
+        }
+    }
+    return changed;
+}
+
+/** bring the installed routes in line with the referenced routes. returns the number of driver updates */
+static int apply_route_plan(netif_driver tun) {
+    plan_dirty = false;
+    model_map plan = { 0 };
+    plan_routes(&plan);
+
+    // everything that is installed but not planned goes away
+    model_map installed = { 0 };
+    const char *route;
+    void *v;
+    MODEL_MAP_FOREACH(route, v, &installed_routes) {
+        model_map_set(&installed, route, v);
+    }
+    int changed = apply_route_delta(tun, &installed, &plan);
+
+    model_map_clear(&installed, NULL);
+    model_map_clear(&plan, NULL);
+    TNL_LOG(DEBUG, "%zd route(s) cover %zd intercepted address(es). %d route update(s)",
+            model_map_size(&installed_routes), model_map_size(&route_counts), changed);
+    return changed;
+}
+
+/**
+ * apply one reference change of an ip prefix to the trie. if `incremental` is set, only the routes
+ * below the shallowest node on the prefix' path that is routed before or after the change are
+ * re-planned, and the difference is pushed to the driver.
+ */
+static void update_prefix(netif_driver tun, const char *route, bool is_v6, const struct rt_prefix *p, int delta,
+                          bool incremental) {
+    struct rt_node *path[129];
+    bool was_covered[129];
+    struct rt_node *n = is_v6 ? &rt_root_v6 : &rt_root_v4;
+    for (int i = 0; ; i++) {
+        path[i] = n;
+        was_covered[i] = n->covered;
+        if (i == p->bits) break;
+        int b = prefix_bit(p, i);
+        if (n->child[b] == NULL) {
+            n->child[b] = calloc(1, sizeof(struct rt_node));
+        }
+        n = n->child[b];
+    }
+
+    char *old_route = n->route;
+    if (delta > 0) {
+        n->refs++;
+        if (n->route == NULL) {
+            n->route = strdup(route);
+        }
+    } else {
+        n->refs--;
+        if (n->route && strcmp(n->route, route) == 0) {
+            // another route string may still reference this prefix. it is planned in canonical form from now on
+            n->route = NULL;
+        }
+    }
+
+    for (int i = p->bits; i >= 0; i--) {
+        path[i]->covered = node_covered(path[i], i);
+    }
+
+    if (incremental) {
+        int top = 0;
+        while (top < p->bits && !was_covered[top] && !path[top]->covered) top++;
+
+        struct rt_prefix sub = *p;
+        for (int i = top; i < 128; i++) {
+            sub.a[i / 32] &= ~(1u << (31 - i % 32));
+        }
+
+        // plan the subtree as it was before the change, then as it is now
+        bool is_covered[129];
+        char *new_route = n->route;
+        for (int i = top; i <= p->bits; i++) {
+            is_covered[i] = path[i]->covered;
+            path[i]->covered = was_covered[i];
+        }
+        n->route = old_route;
+        model_map before = { 0 };
+        trie_emit(path[top], &sub, top, is_v6, &before);
+
+        for (int i = top; i <= p->bits; i++) {
+            path[i]->covered = is_covered[i];
+        }
+        n->route = new_route;
+        model_map after = { 0 };
+        trie_emit(path[top], &sub, top, is_v6, &after);
+
+        int changed = apply_route_delta(tun, &before, &after);
+        model_map_clear(&before, NULL);
+        model_map_clear(&after, NULL);
+        TNL_LOG(DEBUG, "%zd route(s) cover %zd intercepted address(es). %d route update(s)",
+                model_map_size(&installed_routes), model_map_size(&route_counts), changed);
+    }
+
+    if (old_route != n->route) {
+        free(old_route);
+    }
+
+    // drop nodes that no longer lead to a referenced prefix
+    for (int i = p->bits; i > 0 && path[i]->refs == 0 && path[i]->child[0] == NULL && path[i]->child[1] == NULL; i--) {
+        path[i - 1]->child[prefix_bit(p, i - 1)] = NULL;
+        free(path[i]);
+    }
+}
+
+static int update_route(netif_driver tun, const char *route, int delta) {
+    int *count = model_map_get(&route_counts, route);
+    if (count == NULL) {
+        if (delta < 0) {
+            return 0;
+        }
+        count = calloc(1, sizeof(int));
+        model_map_set(&route_counts, route, count);
+    }
+    *count += delta;
+
+    if (*count <= 0) {
+        free(model_map_remove(&route_counts, route));
+    } else if (*count != delta) {
+        // route was already referenced, so the plan does not change
+        return 0;
+    }
+
+    // a pending batch is planned in full once it is no longer deferred
+    bool incremental = !defer_updates && !plan_dirty;
+    struct rt_prefix p;
+    bool is_v6;
+    if (parse_prefix(route, &is_v6, &p)) {
+        update_prefix(tun, route, is_v6, &p, delta, incremental);
+    } else if (incremental) {
+        // not an ip prefix. it is routed as is
+        model_map none = { 0 };
+        model_map one = { 0 };
+        model_map_set(&one, route, (void *) route);
+        apply_route_delta(tun, delta > 0 ? &none : &one, delta > 0 ? &one : &none);
+        model_map_clear(&one, NULL);
+    }
+
+    if (!incremental) {
+        plan_dirty = true;
+        if (!defer_updates) {
+            apply_route_plan(tun);
+        }
+    }
+    return 0;
+}
 
 // macOS ip4: NEIPv4Settings.includedRoutes+=<IP> NEIPv4Settings.subnetMasks+=<IP>
 // macOS ip6: NEIPv6Settings.includedRoutes+=<IP> NEIPv6Settings.networkPrefixLengths+=<PREFIX_LEN>
@@ -31,25 +339,11 @@ static LIST_HEAD(routes, route_count) route_counts = LIST_HEAD_INITIALIZER(&rout
 // linux: ip route add 1.2.3.4/20 dev tun0
 // wireguard-windows: mask + IP (https://git.zx2c4.com/wireguard-windows/tree/tunnel/winipcfg/luid.go)
 int add_route(netif_driver tun, address_t *dest) {
-    //char dest_cidr[128];
     if (tun == NULL) {
         return 1;
     }
 
-    struct route_count *r;
-    LIST_FOREACH(r, &route_counts, _next){
-        if (strcmp(r->route, dest->str) == 0) break;
-    }
-    if (r != NULL) {
-        r->count += 1;
-    } else {
-        r = malloc(sizeof(struct route_count));
-        r->route = strdup(dest->str);
-        r->count = 1;
-        LIST_INSERT_HEAD(&route_counts, r, _next);
-        return tun->add_route(tun->handle, dest->str);
-    }
-    return 0;
+    return update_route(tun, dest->str, 1);
 }
 
 /**
@@ -57,26 +351,28 @@ int add_route(netif_driver tun, address_t *dest) {
  * account for subnet routes too.
  */
 int delete_route(netif_driver tun, address_t *dest) {
-    //char dest_cidr[128];
     if (tun == NULL) {
         return 1;
     }
 
-    struct route_count *r;
-    LIST_FOREACH(r, &route_counts, _next){
-        if (strcmp(r->route, dest->str) == 0) break;
-    }
-    if (r != NULL) {
-        r->count -= 1;
-        if (r->count == 0) {
-            LIST_REMOVE(r, _next);
-            free(r->route);
-            free(r);
-            tun->delete_route(tun->handle, dest->str);
-        }
-    }
+    return update_route(tun, dest->str, -1);
+}
 
-    return 0;
+/** hold back netif driver updates until flush_route_updates is called */
+void defer_route_updates(void) {
+    defer_updates = true;
+}
+
+/**
+ * push the net effect of all route changes since defer_route_updates to the netif driver.
+ * returns the number of route updates that were pushed to the driver.
+ */
+int flush_route_updates(netif_driver tun) {
+    defer_updates = false;
+    if (tun == NULL || !plan_dirty) {
+        return 0;
+    }
+    return apply_route_plan(tun);
 }
 
 int prefix_to_ipv4_subnet(int prefix_len, char *subnet, size_t subnet_sz) {
@@ -23,6 +23,19 @@ extern "C" {
 /** make valid json from a plain string and parse it as a ziti_address */
 #define ZA_INIT_STR(za, s) (( parse_ziti_address((za), "\"" s "\"", strlen("\"" s "\"")) ), (za))
 
+static intercept_ctx_t *const NOT_CACHED = (intercept_ctx_t *) -1;
+
+/** returns the cached lookup result, or NOT_CACHED if the lookup is not in the cache */
+static intercept_ctx_t *cached_intercept(struct tunneler_ctx_s *tctx, const char *proto, const char *ip_str, uint16_t port) {
+    ip_addr_t ip;
+    ipaddr_aton(ip_str, &ip);
+    intercept_ctx_t *intercept;
+    if (!intercept_cache_get(&tctx->intercepts_cache, proto, &ip, port, &intercept)) {
+        return NOT_CACHED;
+    }
+    return intercept;
+}
+
 TEST_CASE("address_match", "[address]") {
     struct tunneler_ctx_s tctx = { };
     ziti_address za;
@@ -82,14 +95,125 @@ TEST_CASE("address_match", "[address]") {
     REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, 83) == intercept_s3);
 
     // verify the intercept cache is populated
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:127.0.0.1:80") == nullptr);
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:192.168.0.88:80") == intercept_s1);
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:192.168.0.10:80") == intercept_s2);
-    REQUIRE(model_map_get(&tctx.intercepts_cache, "tcp:192.168.0.10:81") == intercept_s3);
+    REQUIRE(cached_intercept(&tctx, "tcp", "127.0.0.1", 80) == nullptr);
+    REQUIRE(cached_intercept(&tctx, "tcp", "192.168.0.88", 80) == intercept_s1);
+    REQUIRE(cached_intercept(&tctx, "tcp", "192.168.0.10", 80) == intercept_s2);
+    REQUIRE(cached_intercept(&tctx, "tcp", "192.168.0.10", 81) == intercept_s3);
+    REQUIRE(cached_intercept(&tctx, "udp", "192.168.0.10", 81) == NOT_CACHED);
+
+    // removing s2 only drops the lookups that resolved to s2
+    intercept_cache_invalidate_removed(&tctx.intercepts_cache, intercept_s2);
+    REQUIRE(cached_intercept(&tctx, "tcp", "192.168.0.10", 80) == NOT_CACHED);
+    REQUIRE(cached_intercept(&tctx, "tcp", "192.168.0.88", 80) == intercept_s1);
+    REQUIRE(cached_intercept(&tctx, "tcp", "127.0.0.1", 80) == nullptr);
+
+    // adding an intercept drops the lookups (including misses) that it matches
+    intercept_ctx_t *intercept_s5 = intercept_ctx_new(&tctx, "s5", nullptr);
+    LIST_INSERT_HEAD(&tctx.intercepts, intercept_s5, entries);
+    intercept_ctx_add_address(intercept_s5, ZA_INIT_STR(&za, "127.0.0.0/8"));
+    intercept_ctx_add_protocol(intercept_s5, "tcp");
+    intercept_ctx_add_port_range(intercept_s5, 1, 1024);
+    intercept_cache_invalidate_added(&tctx.intercepts_cache, intercept_s5);
+    REQUIRE(cached_intercept(&tctx, "tcp", "127.0.0.1", 80) == NOT_CACHED);
+    REQUIRE(cached_intercept(&tctx, "tcp", "192.168.0.88", 80) == intercept_s1);
+    REQUIRE(cached_intercept(&tctx, "tcp", "192.168.0.10", 81) == intercept_s3);
+
+    IP_ADDR4(&ip, 127, 0, 0, 1);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, 80) == intercept_s5);
 
     // todo hostname and wildcard dns matching
 }
 
+// stands in for the application's wildcard domain index: 10.1.0.0/16 are names under the wildcard domains
+static void *wildcard_intercepts[2];
+static int wildcard_lookups;
+
+static void test_match_domains(const ip_addr_t *addr, intercept_domain_visitor visit, void *ctx) {
+    wildcard_lookups++;
+    if (!IP_IS_V4(addr) || (ntohl(ip_2_ip4(addr)->addr) >> 16) != 0x0a01) {
+        return;
+    }
+    for (void *app_ctx : wildcard_intercepts) {
+        if (app_ctx && visit(app_ctx, ctx)) return;
+    }
+}
+
+TEST_CASE("wildcard_domain_match", "[address]") {
+    struct tunneler_ctx_s tctx = { };
+    ziti_address za;
+    ip_addr_t ip;
+    LIST_INIT(&tctx.intercepts);
+    tctx.match_domains = test_match_domains;
+    wildcard_lookups = 0;
+
+    int app_w1, app_w2, app_c;
+    auto add = [&](const char *name, void *app_ctx, uint16_t low, uint16_t high) -> intercept_ctx_t * {
+        intercept_ctx_t *i = intercept_ctx_new(&tctx, name, app_ctx);
+        LIST_INSERT_HEAD(&tctx.intercepts, i, entries);
+        model_map_set_key(&tctx.intercepts_by_ctx, &i->app_intercept_ctx, sizeof(i->app_intercept_ctx), i);
+        intercept_ctx_add_protocol(i, "tcp");
+        intercept_ctx_add_port_range(i, low, high);
+        return i;
+    };
+
+    intercept_ctx_t *w1 = add("w1", &app_w1, 1, 1024);
+    intercept_ctx_t *w2 = add("w2", &app_w2, 443, 443);
+    intercept_ctx_t *c = add("c", &app_c, 443, 443);
+    intercept_ctx_add_address(c, ZA_INIT_STR(&za, "10.1.2.0/24"));
+    // the wildcard intercepts have no addresses or match_addr of their own, the index finds them
+    wildcard_intercepts[0] = &app_w1;
+    wildcard_intercepts[1] = &app_w2;
+
+    IP_ADDR4(&ip, 10, 1, 0, 5);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, 22) == w1);
+    // smaller port range wins among wildcard matches
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, 443) == w2);
+    REQUIRE(lookup_intercept_by_address(&tctx, "udp", &ip, 443) == nullptr);
+    // a name is a smaller address range than a /24
+    IP_ADDR4(&ip, 10, 1, 2, 5);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, 443) == w2);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, 81) == w1);
+    // addresses outside the wildcard names
+    IP_ADDR4(&ip, 10, 2, 0, 5);
+    REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, 22) == nullptr);
+    REQUIRE(wildcard_lookups == 6);
+
+    // adding a wildcard intercept drops cached lookups it now matches, through the index
+    REQUIRE(cached_intercept(&tctx, "tcp", "10.1.0.5", 22) == w1);
+    REQUIRE(cached_intercept(&tctx, "tcp", "10.2.0.5", 22) == nullptr);
+    intercept_cache_invalidate_added(&tctx.intercepts_cache, w2);
+    REQUIRE(cached_intercept(&tctx, "tcp", "10.1.0.5", 443) == NOT_CACHED);
+    REQUIRE(cached_intercept(&tctx, "tcp", "10.1.0.5", 22) == w1);
+    intercept_cache_invalidate_added(&tctx.intercepts_cache, w1);
+    REQUIRE(cached_intercept(&tctx, "tcp", "10.1.0.5", 22) == NOT_CACHED);
+    REQUIRE(cached_intercept(&tctx, "tcp", "10.2.0.5", 22) == nullptr);
+
+    wildcard_intercepts[0] = wildcard_intercepts[1] = nullptr;
+}
+
+TEST_CASE("intercept_cache_bounded", "[address]") {
+    struct tunneler_ctx_s tctx = { };
+    ip_addr_t ip;
+    LIST_INIT(&tctx.intercepts);
+
+    // a port scan caches a miss for every probe, but the cache must not grow without bound
+    IP_ADDR4(&ip, 10, 1, 2, 3);
+    for (uint16_t port = 1; port < 10000; port++) {
+        REQUIRE(lookup_intercept_by_address(&tctx, "tcp", &ip, port) == nullptr);
+    }
+
+    int cached = 0;
+    for (uint16_t port = 1; port < 10000; port++) {
+        if (cached_intercept(&tctx, "tcp", "10.1.2.3", port) != NOT_CACHED) {
+            cached++;
+        }
+    }
+    REQUIRE(cached > 0);
+    REQUIRE(cached <= 1024);
+    // the most recent lookup is always retained
+    REQUIRE(cached_intercept(&tctx, "tcp", "10.1.2.3", 9999) == nullptr);
+}
+
 TEST_CASE("address_conversion", "[address]") {
     const char *ip6_str = "2768:8631:c02:ffc9::1308";
     ip_addr_t ip6;
@@ -0,0 +1,208 @@
+/*
+ Copyright 2026 NetFoundry Inc.
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "catch2/catch.hpp"
+#include <set>
+#include <string>
+
+extern "C" {
+#include "ziti/ziti_tunnel.h"
+#include "ziti_tunnel_priv.h"
+}
+
+struct netif_handle_s {
+    int added;
+    int deleted;
+    std::set<std::string> routes;
+};
+
+static int test_add_route(netif_handle dev, const char *dest) {
+    dev->added++;
+    dev->routes.insert(dest);
+    return 0;
+}
+
+static int test_delete_route(netif_handle dev, const char *dest) {
+    dev->deleted++;
+    dev->routes.erase(dest);
+    return 0;
+}
+
+static address_t *test_address(address_t *a, const char *str) {
+    memset(a, 0, sizeof(*a));
+    snprintf(a->str, sizeof(a->str), "%s", str);
+    return a;
+}
+
+TEST_CASE("route_refcount", "[route]") {
+    struct netif_handle_s h = { };
+    netif_driver_t driver = { };
+    driver.handle = &h;
+    driver.add_route = test_add_route;
+    driver.delete_route = test_delete_route;
+    address_t a;
+
+    add_route(&driver, test_address(&a, "10.10.0.1"));
+    add_route(&driver, test_address(&a, "10.10.0.1"));
+    REQUIRE(h.added == 1);
+
+    delete_route(&driver, test_address(&a, "10.10.0.1"));
+    REQUIRE(h.deleted == 0);
+    delete_route(&driver, test_address(&a, "10.10.0.1"));
+    REQUIRE(h.deleted == 1);
+
+    // unknown routes are ignored
+    delete_route(&driver, test_address(&a, "10.10.0.1"));
+    REQUIRE(h.deleted == 1);
+}
+
+TEST_CASE("route_batch", "[route]") {
+    struct netif_handle_s h = { };
+    netif_driver_t driver = { };
+    driver.handle = &h;
+    driver.add_route = test_add_route;
+    driver.delete_route = test_delete_route;
+    address_t a;
+
+    defer_route_updates();
+    add_route(&driver, test_address(&a, "10.20.0.1"));
+    add_route(&driver, test_address(&a, "10.20.0.1"));
+    add_route(&driver, test_address(&a, "10.20.0.2"));
+    // added and removed within the batch, so the driver never sees it
+    add_route(&driver, test_address(&a, "10.20.0.3"));
+    delete_route(&driver, test_address(&a, "10.20.0.3"));
+    REQUIRE(h.added == 0);
+
+    REQUIRE(flush_route_updates(&driver) == 2);
+    REQUIRE(h.added == 2);
+    REQUIRE(h.deleted == 0);
+
+    defer_route_updates();
+    delete_route(&driver, test_address(&a, "10.20.0.1"));
+    delete_route(&driver, test_address(&a, "10.20.0.2"));
+    // removed and added back within the batch, so the installed route stays put
+    delete_route(&driver, test_address(&a, "10.20.0.1"));
+    add_route(&driver, test_address(&a, "10.20.0.1"));
+    REQUIRE(flush_route_updates(&driver) == 1);
+    REQUIRE(h.added == 2);
+    REQUIRE(h.deleted == 1);
+
+    delete_route(&driver, test_address(&a, "10.20.0.1"));
+    REQUIRE(h.deleted == 2);
+}
+
+TEST_CASE("route_aggregation", "[route]") {
+    struct netif_handle_s h = { };
+    netif_driver_t driver = { };
+    driver.handle = &h;
+    driver.add_route = test_add_route;
+    driver.delete_route = test_delete_route;
+    address_t a;
+
+    defer_route_updates();
+    add_route(&driver, test_address(&a, "10.30.0.0/16"));
+    add_route(&driver, test_address(&a, "10.30.1.1"));
+    add_route(&driver, test_address(&a, "10.40.0.0/17"));
+    add_route(&driver, test_address(&a, "10.40.128.0/17"));
+    add_route(&driver, test_address(&a, "10.32.0.2"));
+    add_route(&driver, test_address(&a, "10.32.0.3"));
+    flush_route_updates(&driver);
+
+    // nested routes are dropped and sibling routes are merged
+    REQUIRE(h.routes == std::set<std::string>{ "10.30.0.0/16", "10.40.0.0/16", "10.32.0.2/31" });
+
+    // removing the covering route exposes the nested one
+    delete_route(&driver, test_address(&a, "10.30.0.0/16"));
+    REQUIRE(h.routes == std::set<std::string>{ "10.30.1.1", "10.40.0.0/16", "10.32.0.2/31" });
+
+    // splitting a merged route
+    delete_route(&driver, test_address(&a, "10.40.128.0/17"));
+    delete_route(&driver, test_address(&a, "10.32.0.3"));
+    REQUIRE(h.routes == std::set<std::string>{ "10.30.1.1", "10.40.0.0/17", "10.32.0.2" });
+
+    delete_route(&driver, test_address(&a, "10.30.1.1"));
+    delete_route(&driver, test_address(&a, "10.40.0.0/17"));
+    delete_route(&driver, test_address(&a, "10.32.0.2"));
+    REQUIRE(h.routes.empty());
+}
+
+TEST_CASE("route_incremental", "[route]") {
+    struct netif_handle_s h = { };
+    netif_driver_t driver = { };
+    driver.handle = &h;
+    driver.add_route = test_add_route;
+    driver.delete_route = test_delete_route;
+    address_t a;
+
+    // unbatched changes only touch the routes of the affected prefix
+    char addr[32];
+    for (int i = 0; i < 64; i += 2) {
+        snprintf(addr, sizeof(addr), "10.50.%d.1", i);
+        add_route(&driver, test_address(&a, addr));
+    }
+    REQUIRE(h.added == 32);
+    REQUIRE(h.deleted == 0);
+
+    // merging two siblings replaces both with their parent
+    add_route(&driver, test_address(&a, "10.50.0.0"));
+    REQUIRE(h.added == 33);
+    REQUIRE(h.deleted == 1);
+    REQUIRE(h.routes.count("10.50.0.0/31") == 1);
+    REQUIRE(h.routes.count("10.50.0.1") == 0);
+
+    // referencing the merged prefix itself does not change anything
+    add_route(&driver, test_address(&a, "10.50.0.0/31"));
+    REQUIRE(h.added == 33);
+    REQUIRE(h.deleted == 1);
+    delete_route(&driver, test_address(&a, "10.50.0.0"));
+    REQUIRE(h.added == 33);
+    REQUIRE(h.deleted == 1);
+
+    // a covering prefix replaces everything below it, and exposes it again when it goes away
+    add_route(&driver, test_address(&a, "10.50.0.0/16"));
+    REQUIRE(h.routes == std::set<std::string>{ "10.50.0.0/16" });
+    delete_route(&driver, test_address(&a, "10.50.0.0/16"));
+    REQUIRE(h.routes.size() == 32);
+    REQUIRE(h.routes.count("10.50.0.0/31") == 1);
+    REQUIRE(h.routes.count("10.50.62.1") == 1);
+
+    // incremental updates leave the same routes as a full plan would
+    for (int i = 0; i < 64; i += 3) {
+        snprintf(addr, sizeof(addr), "10.50.%d.0/24", i);
+        add_route(&driver, test_address(&a, addr));
+    }
+    for (int i = 0; i < 64; i += 4) {
+        snprintf(addr, sizeof(addr), "10.50.%d.1", i);
+        delete_route(&driver, test_address(&a, addr));
+    }
+    defer_route_updates();
+    add_route(&driver, test_address(&a, "10.60.0.1"));
+    delete_route(&driver, test_address(&a, "10.60.0.1"));
+    REQUIRE(flush_route_updates(&driver) == 0);
+
+    for (int i = 0; i < 64; i += 3) {
+        snprintf(addr, sizeof(addr), "10.50.%d.0/24", i);
+        delete_route(&driver, test_address(&a, addr));
+    }
+    for (int i = 0; i < 64; i += 2) {
+        if (i % 4 == 0) continue;
+        snprintf(addr, sizeof(addr), "10.50.%d.1", i);
+        delete_route(&driver, test_address(&a, addr));
+    }
+    delete_route(&driver, test_address(&a, "10.50.0.0/31"));
+    REQUIRE(h.routes.empty());
+    REQUIRE(h.added == h.deleted);
+}
@@ -172,6 +172,15 @@ static err_t on_tcp_client_data(void *io_ctx, struct tcp_pcb *pcb, struct pbuf *
     return ERR_OK;
 }
 
+/** called by lwip when the client acknowledged data, which frees space in the send buffer */
+static err_t on_tcp_client_sent(void *io_ctx, struct tcp_pcb *pcb, u16_t len) {
+    struct io_ctx_s *io = io_ctx;
+    if (io != NULL && io->write_ack_fn != NULL && io->ziti_io != NULL) {
+        io->write_ack_fn(io->ziti_io, len);
+    }
+    return ERR_OK;
+}
+
 /** called by lwip when an error has occurred on a tcp connection.
  * the corresponding pcb is not valid by the time this fn is called. */
 static void on_tcp_client_err(void *io_ctx, err_t err) {
@@ -251,6 +260,7 @@ int tunneler_tcp_close(struct tcp_pcb *pcb) {
     LOG_STATE(DEBUG, "closing", pcb);
     tcp_arg(pcb, NULL);
     tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
     tcp_err(pcb, NULL);
     if (pcb->state == CLOSED) {
         return 0;
@@ -432,7 +442,9 @@ u8_t recv_tcp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
     io->close_fn = intercept_ctx->close_fn ? intercept_ctx->close_fn : tnlr_ctx->opts.ziti_close;
 
     tcp_err(npcb, on_tcp_client_err);
+    tcp_sent(npcb, on_tcp_client_sent);
     tcp_arg(npcb, io);
+    intercept_ctx_add_conn(intercept_ctx, io);
 
     TNL_LOG(DEBUG, "intercepted address[%s] client[%s] service[%s]", io->tnlr_io->intercepted, io->tnlr_io->client,
             intercept_ctx->service_name);
@@ -450,27 +462,6 @@ done:
     return 1;
 }
 
-struct io_ctx_list_s *tunneler_tcp_active(const void *zi_ctx) {
-    struct io_ctx_list_s *l = calloc(1, sizeof(struct io_ctx_list_s));
-    SLIST_INIT(l);
-
-    for (struct tcp_pcb *tpcb = tcp_active_pcbs; tpcb != NULL; tpcb = tpcb->next) {
-        struct io_ctx_s *io = tpcb->callback_arg;
-        if (io != NULL) {
-            tunneler_io_context tnlr_io = io->tnlr_io;
-            if (tnlr_io != NULL) {
-                if (io->ziti_ctx == zi_ctx) {
-                    struct io_ctx_list_entry_s *n = calloc(1, sizeof(struct io_ctx_list_entry_s));
-                    n->io = io;
-                    SLIST_INSERT_HEAD(l, n, entries);
-                }
-            }
-        }
-    }
-
-    return l;
-}
-
 void tunneler_tcp_get_conn(tunnel_ip_conn *conn, struct tcp_pcb *pcb) {
     if (!conn || !pcb) return;
     conn->protocol = strdup("tcp");
@@ -231,6 +231,7 @@ u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_
             intercept_ctx->service_name);
 
     udp_recv(npcb, on_udp_client_data, io);
+    intercept_ctx_add_conn(intercept_ctx, io);
 
     void *ziti_io_ctx = zdial(intercept_ctx->app_intercept_ctx, io);
     if (ziti_io_ctx == NULL) {
@@ -263,29 +264,6 @@ ssize_t tunneler_udp_write(struct udp_pcb *pcb, const void *data, size_t len) {
     return len;
 }
 
-struct io_ctx_list_s *tunneler_udp_active(const void *zi_ctx) {
-    struct io_ctx_list_s *l = calloc(1, sizeof(struct io_ctx_list_s));
-    SLIST_INIT(l);
-
-    for (struct udp_pcb *pcb = udp_pcbs; pcb != NULL; pcb = pcb->next) {
-        if (pcb->recv == on_udp_client_data) { // recv_arg contains io_context after dial completes.
-            struct io_ctx_s *io = pcb->recv_arg;
-            if (io != NULL) {
-                tunneler_io_context tnlr_io = io->tnlr_io;
-                if (tnlr_io != NULL) {
-                    if (io->ziti_ctx == zi_ctx) {
-                        struct io_ctx_list_entry_s *n = calloc(1, sizeof(struct io_ctx_list_entry_s));
-                        n->io = io;
-                        SLIST_INSERT_HEAD(l, n, entries);
-                    }
-                }
-            }
-        }
-    }
-
-    return l;
-}
-
 void tunneler_udp_get_conn(tunnel_ip_conn *conn, struct udp_pcb *pcb) {
     if (!conn || !pcb) return;
     conn->protocol = strdup("udp");
@@ -26,8 +26,6 @@ extern void tunneler_udp_dial_completed(struct io_ctx_s *io, bool ok);
 extern u8_t recv_udp(void *tnlr_ctx_arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr);
 extern void tunneler_udp_ack(struct write_ctx_s *write_ctx);
 extern int tunneler_udp_close(struct udp_pcb *pcb);
-/** return list of io contexts for active connections to the given service. caller must free the returned pointer */
-extern struct io_ctx_list_s *tunneler_udp_active(const void *zi_ctx);
 
 extern void tunneler_udp_get_conn(tunnel_ip_conn *conn, struct udp_pcb *pcb);
 
@@ -87,7 +87,7 @@ tunneler_context ziti_tunneler_init(tunneler_sdk_options *opts, uv_loop_t *loop)
     }
 
     LIST_INIT(&ctx->intercepts);
-    ctx->intercepts_cache.impl = NULL;
+    ctx->intercepts_cache.sets = NULL;
 
     run_packet_loop(loop, ctx);
 
@@ -157,16 +157,18 @@ void ziti_tunneler_exclude_route(tunneler_context tnlr_ctx, const char *dst) {
 }
 
 
-static void tunneler_kill_active(const void *ztx);
+static void tunneler_kill_active(intercept_ctx_t *intercept);
 
 void ziti_tunneler_shutdown(tunneler_context tnlr_ctx) {
     TNL_LOG(DEBUG, "tnlr_ctx %p", tnlr_ctx);
 
     while (!LIST_EMPTY(&tnlr_ctx->intercepts)) {
         intercept_ctx_t *i = LIST_FIRST(&tnlr_ctx->intercepts);
-        tunneler_kill_active(i->app_intercept_ctx);
+        tunneler_kill_active(i);
         LIST_REMOVE(i, entries);
     }
+    model_map_clear(&tnlr_ctx->intercepts_by_ctx, NULL);
+    intercept_cache_clear(&tnlr_ctx->intercepts_cache);
 }
 
 /** called by tunneler application when data has been successfully written to ziti */
@@ -196,6 +198,10 @@ void free_tunneler_io_context(tunneler_io_context *tnlr_io_ctx_p) {
 
     if (*tnlr_io_ctx_p != NULL) {
         tunneler_io_context io = *tnlr_io_ctx_p;
+        if (io->intercept != NULL) {
+            LIST_REMOVE(io, intercept_conns);
+            io->intercept = NULL;
+        }
         if (io->service_name != NULL) free((char*)io->service_name);
         free(io);
         *tnlr_io_ctx_p = NULL;
@@ -205,6 +211,11 @@ void free_tunneler_io_context(tunneler_io_context *tnlr_io_ctx_p) {
 void ziti_tunneler_set_idle_timeout(struct io_ctx_s *io_context, unsigned int timeout) {
     io_context->tnlr_io->idle_timeout = timeout;
 }
+
+void ziti_tunneler_set_write_ack_cb(struct io_ctx_s *io_context, ziti_sdk_write_ack_cb cb) {
+    io_context->write_ack_fn = cb;
+}
+
 /**
  * called by tunneler application when a service dial has completed
  * - let the client know that we have a connection (e.g. send SYN/ACK)
@@ -245,6 +256,7 @@ intercept_ctx_t* intercept_ctx_new(tunneler_context tnlr_ctx, const char *app_id
     STAILQ_INIT(&ictx->protocols);
     STAILQ_INIT(&ictx->addresses);
     STAILQ_INIT(&ictx->port_ranges);
+    LIST_INIT(&ictx->active_conns);
 
     return ictx;
 }
@@ -253,6 +265,11 @@ void intercept_ctx_set_match_addr(intercept_ctx_t *intercept, intercept_match_ad
     intercept->match_addr = pred;
 }
 
+void ziti_tunneler_set_match_domains(tunneler_context tnlr_ctx, intercept_match_domains_fn fn) {
+    tnlr_ctx->match_domains = fn;
+    intercept_cache_clear(&tnlr_ctx->intercepts_cache);
+}
+
 void intercept_ctx_add_protocol(intercept_ctx_t *ctx, const char *protocol) {
     protocol_t *proto = calloc(1, sizeof(protocol_t));
     proto->protocol = strdup(protocol);
@@ -307,18 +324,19 @@ int ziti_tunneler_intercept(tunneler_context tnlr_ctx, intercept_ctx_t *i_ctx) {
         return -1;
     }
 
-    model_map_clear(&tnlr_ctx->intercepts_cache, NULL);
     address_t *address;
-    STAILQ_FOREACH(address, &i_ctx->addresses, entries) {
-        protocol_t *proto;
-        STAILQ_FOREACH(proto, &i_ctx->protocols, entries) {
-            port_range_t *pr;
-            STAILQ_FOREACH(pr, &i_ctx->port_ranges, entries) {
-                // todo find conflicts with services
-                // intercept_ctx_t *match;
-                // match = lookup_intercept_by_address(tnlr_ctx, proto->protocol, &address->ip, pr->low, pr->high);
-                TNL_LOG(DEBUG, "intercepting address[%s:%s:%s] service[%s]",
-                        proto->protocol, address->str, pr->str, i_ctx->service_name);
+    if (tunnel_log_level >= DEBUG) {
+        STAILQ_FOREACH(address, &i_ctx->addresses, entries) {
+            protocol_t *proto;
+            STAILQ_FOREACH(proto, &i_ctx->protocols, entries) {
+                port_range_t *pr;
+                STAILQ_FOREACH(pr, &i_ctx->port_ranges, entries) {
+                    // todo find conflicts with services
+                    // intercept_ctx_t *match;
+                    // match = lookup_intercept_by_address(tnlr_ctx, proto->protocol, &address->ip, pr->low, pr->high);
+                    TNL_LOG(DEBUG, "intercepting address[%s:%s:%s] service[%s]",
+                            proto->protocol, address->str, pr->str, i_ctx->service_name);
+                }
             }
         }
     }
@@ -328,54 +346,65 @@ int ziti_tunneler_intercept(tunneler_context tnlr_ctx, intercept_ctx_t *i_ctx) {
     }
 
     LIST_INSERT_HEAD(&tnlr_ctx->intercepts, (struct intercept_ctx_s *)i_ctx, entries);
+    model_map_set_key(&tnlr_ctx->intercepts_by_ctx, &i_ctx->app_intercept_ctx, sizeof(i_ctx->app_intercept_ctx), i_ctx);
+    if (tnlr_ctx->intercept_batch == 0) {
+        intercept_cache_invalidate_added(&tnlr_ctx->intercepts_cache, i_ctx);
+    }
 
     return 0;
 }
 
-static void tunneler_kill_active(const void *zi_ctx) {
-    struct io_ctx_list_s *l;
-    ziti_sdk_close_cb zclose;
+void ziti_tunneler_begin_intercepts(tunneler_context tnlr_ctx) {
+    if (tnlr_ctx->intercept_batch++ == 0) {
+        TNL_LOG(DEBUG, "starting intercept batch");
+        defer_route_updates();
+    }
+}
 
-    l = tunneler_tcp_active(zi_ctx);
-    while (!SLIST_EMPTY(l)) {
-        struct io_ctx_list_entry_s *n = SLIST_FIRST(l);
-        TNL_LOG(DEBUG, "service_ctx[%p] client[%s] killing active connection", zi_ctx, n->io->tnlr_io->client);
-        // close the ziti connection, which also closes the underlay
-        zclose = n->io->close_fn;
-        if (zclose) zclose(n->io->ziti_io);
-        SLIST_REMOVE_HEAD(l, entries);
-        free(n);
-    }
-    free(l);
-
-    // todo be selective about protocols when merging newer config types
-    l = tunneler_udp_active(zi_ctx);
-    while (!SLIST_EMPTY(l)) {
-        struct io_ctx_list_entry_s *n = SLIST_FIRST(l);
-        TNL_LOG(DEBUG, "service[%p] client[%s] killing active connection", zi_ctx, n->io->tnlr_io->client);
+void ziti_tunneler_commit_intercepts(tunneler_context tnlr_ctx) {
+    if (tnlr_ctx->intercept_batch == 0) {
+        TNL_LOG(WARN, "no intercept batch in progress");
+        return;
+    }
+    if (--tnlr_ctx->intercept_batch > 0) {
+        return;
+    }
+
+    // cached lookups were not maintained while the batch was open
+    intercept_cache_clear(&tnlr_ctx->intercepts_cache);
+
+    int changed = flush_route_updates(tnlr_ctx->opts.netif_driver);
+    TNL_LOG(DEBUG, "committed intercept batch: %d route(s) changed", changed);
+    ziti_tunnel_commit_routes(tnlr_ctx);
+}
+
+static void tunneler_kill_active(intercept_ctx_t *intercept) {
+    struct tunneler_io_ctx_s *tnlr_io;
+    while ((tnlr_io = LIST_FIRST(&intercept->active_conns)) != NULL) {
+        // detach first, since the close may complete (and free the connection) synchronously
+        LIST_REMOVE(tnlr_io, intercept_conns);
+        tnlr_io->intercept = NULL;
+
+        struct io_ctx_s *io = tnlr_io->io;
+        TNL_LOG(DEBUG, "service[%s] client[%s] killing active connection", intercept->service_name, tnlr_io->client);
         // close the ziti connection, which also closes the underlay
-        zclose = n->io->close_fn;
-        if (zclose) zclose(n->io->ziti_io);
-        SLIST_REMOVE_HEAD(l, entries);
-        free(n);
+        if (io->close_fn) io->close_fn(io->ziti_io);
     }
-    free(l);
+}
+
+void intercept_ctx_add_conn(intercept_ctx_t *intercept, struct io_ctx_s *io) {
+    io->tnlr_io->io = io;
+    io->tnlr_io->intercept = intercept;
+    LIST_INSERT_HEAD(&intercept->active_conns, io->tnlr_io, intercept_conns);
 }
 
 intercept_ctx_t * ziti_tunnel_find_intercept(tunneler_context tnlr_ctx, void *zi_ctx) {
-    struct intercept_ctx_s *intercept;
     if (tnlr_ctx == NULL) {
         TNL_LOG(WARN, "null tnlr_ctx");
         return NULL;
     }
 
-    LIST_FOREACH(intercept, &tnlr_ctx->intercepts, entries) {
-        if (intercept->app_intercept_ctx == zi_ctx) {
-            return intercept;
-        }
-    }
-
-    return NULL;
+    return model_map_get_key(&tnlr_ctx->intercepts_by_ctx, &zi_ctx, sizeof(zi_ctx));
 }
 
 
@@ -383,14 +412,17 @@ intercept_ctx_t * ziti_tunnel_find_intercept(tunneler_context tnlr_ctx, void *zi
 // when called due to conflict we want to mark as disabled
 void ziti_tunneler_stop_intercepting(tunneler_context tnlr_ctx, void *zi_ctx) {
     TNL_LOG(DEBUG, "removing intercept for service_ctx[%p]", zi_ctx);
-    model_map_clear(&tnlr_ctx->intercepts_cache, NULL);
     struct intercept_ctx_s *intercept = ziti_tunnel_find_intercept(tnlr_ctx, zi_ctx);
 
     if (intercept != NULL) {
         TNL_LOG(DEBUG, "removing routes for service[%s] service_ctx[%p]", intercept->service_name, zi_ctx);
-        tunneler_kill_active(zi_ctx);
+        tunneler_kill_active(intercept);
 
         LIST_REMOVE(intercept, entries);
+        model_map_remove_key(&tnlr_ctx->intercepts_by_ctx, &zi_ctx, sizeof(zi_ctx));
+        // drop cached lookups even while a batch is open, since the intercept is freed below
+        // and the cache is only cleared when the batch is committed
+        intercept_cache_invalidate_removed(&tnlr_ctx->intercepts_cache, intercept);
 
         struct address_s *address;
         STAILQ_FOREACH(address, &intercept->addresses, entries) {
@@ -399,10 +431,6 @@ void ziti_tunneler_stop_intercepting(tunneler_context tnlr_ctx, void *zi_ctx) {
 
         free_intercept(intercept);
     }
-
-
-    tunneler_kill_active(zi_ctx);
-
 }
 
 /** called by tunneler application when data is read from a ziti connection */
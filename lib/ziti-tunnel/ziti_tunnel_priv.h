@@ -112,8 +112,26 @@ struct intercept_ctx_s {
     LIST_ENTRY(intercept_ctx_s) entries;
 
     intercept_match_addr_fn match_addr;
+
+    LIST_HEAD(tunneler_io_list_s, tunneler_io_ctx_s) active_conns; // live connections to this intercept
+};
+
+/** bounded [proto]:[ip]:[port] -> intercept_ctx lookup cache. zero-initialized is empty */
+struct intercept_cache_s {
+    struct intercept_cache_set_s *sets;
 };
 
+extern bool intercept_cache_get(struct intercept_cache_s *cache, const char *protocol, const ip_addr_t *addr,
+                                uint16_t port, intercept_ctx_t **intercept);
+extern void intercept_cache_put(struct intercept_cache_s *cache, const char *protocol, const ip_addr_t *addr,
+                                uint16_t port, intercept_ctx_t *intercept);
+extern void intercept_cache_invalidate_added(struct intercept_cache_s *cache, const intercept_ctx_t *intercept);
+extern void intercept_cache_invalidate_removed(struct intercept_cache_s *cache, const intercept_ctx_t *intercept);
+extern void intercept_cache_clear(struct intercept_cache_s *cache);
+
+/** does `intercept` match `addr` through one of its wildcard domains? */
+extern bool intercept_matches_domain(const intercept_ctx_t *intercept, const ip_addr_t *addr);
+
 struct excluded_route_s {
     char route[MAX_ROUTE_LEN];
 };
@@ -128,7 +146,10 @@ typedef struct tunneler_ctx_s {
     uv_poll_t netif_poll_req;
     uv_timer_t lwip_timer_req;
     LIST_HEAD(intercept_ctx_list_s, intercept_ctx_s) intercepts;
-    model_map intercepts_cache; // cached intercept_ctx lookup keyed by [proto]:[ip]:[port]
+    struct intercept_cache_s intercepts_cache; // cached intercept_ctx lookup keyed by [proto]:[ip]:[port]
+    model_map intercepts_by_ctx; // intercept_ctx keyed by app_intercept_ctx
+    int intercept_batch; // nesting depth of ziti_tunneler_begin_intercepts
+    intercept_match_domains_fn match_domains; // wildcard domain index of the application, if any
 } *tunneler_context;
 
 /** return the intercept context for a packet based on its destination ip:port */
@@ -152,8 +173,15 @@ struct tunneler_io_ctx_s {
     };
     uv_timer_t *conn_timer;
     uint32_t idle_timeout;
+
+    struct io_ctx_s *io;
+    intercept_ctx_t *intercept; // NULL once detached from the intercept
+    LIST_ENTRY(tunneler_io_ctx_s) intercept_conns;
 };
 
+/** register a new connection with the intercept that it was created for */
+extern void intercept_ctx_add_conn(intercept_ctx_t *intercept, struct io_ctx_s *io);
+
 extern void check_tnlr_timer(tunneler_context tnlr_ctx);
 extern void free_tunneler_io_context(tunneler_io_context *tnlr_io_ctx_p);
 
@@ -176,6 +204,10 @@ extern int add_route(netif_driver tun, address_t *dest);
 
 extern int delete_route(netif_driver tun, address_t *dest);
 
+extern void defer_route_updates(void);
+
+extern int flush_route_updates(netif_driver tun);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,6 +18,7 @@
 #define ZITI_TUNNEL_SDK_C_EVENTS_H
 
 #include "ziti/ziti.h"
+#include "ziti/ziti_tunnel_cbs.h"
 #include "model/dtos.h"
 
 #ifdef __cplusplus
@@ -55,7 +56,8 @@ XX(RecoveryCodes, model_string, array, RecoveryCodes, __VA_ARGS__)
 
 #define TUNNEL_METRICS_EVENT(XX, ...) \
 STATUS_EVENT(XX, __VA_ARGS__) \
-XX(Identities, tunnel_identity, array, Identities, __VA_ARGS__)
+XX(Identities, tunnel_identity, array, Identities, __VA_ARGS__) \
+XX(HostedServices, tunnel_hosted_service_metrics, array, HostedServices, __VA_ARGS__)
 
 #define TUNNEL_NOTIFICATION_MESSAGE(XX, ...) \
 XX(IdentityName, model_string, none, IdentityName, __VA_ARGS__) \
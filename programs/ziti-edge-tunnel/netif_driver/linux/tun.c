@@ -492,3 +492,13 @@ netif_driver tun_open(uv_loop_t *loop, uint32_t tun_ip, uint32_t dns_ip, const c
 
     return driver;
 }
+
+int tun_add_ipv6(netif_handle tun, const char *tun_ip6, const char *ipv6_cidr) {
+    const char *bits = strchr(ipv6_cidr, '/');
+    int rc = run_command("ip -6 addr add %s%s dev %s nodad", tun_ip6, bits ? bits : "/128", tun->name);
+    if (rc == 0) {
+        // the address implies a prefix route, make sure it exists in case the address was already present
+        run_command("ip -6 route replace %s dev %s", ipv6_cidr, tun->name);
+    }
+    return rc;
+}
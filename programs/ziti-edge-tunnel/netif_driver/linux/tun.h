@@ -30,4 +30,7 @@ struct netif_handle_s {
 
 extern netif_driver tun_open(struct uv_loop_s *loop, uint32_t tun_ip, uint32_t dns_ip, const char *cidr, char *error, size_t error_len);
 
+/** assign IPv6 address to the tun device and route `ipv6_cidr` through it */
+extern int tun_add_ipv6(netif_handle tun, const char *tun_ip6, const char *ipv6_cidr);
+
 #endif //ZITI_TUNNELER_SDK_TUN_H
@@ -14,7 +14,10 @@
  limitations under the License.
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -135,6 +138,9 @@ static char *configured_cidr = NULL;
 static char *configured_log_level = NULL;
 static char *configured_proxy = NULL;
 static char *config_dir = NULL;
+static size_t dns_cache_size = ZITI_DNS_DEFAULT_CACHE_LIMIT;
+static char *configured_ipv6_cidr = NULL;
+static char *dns_state_file = NULL;
 
 static uv_pipe_t cmd_server;
 static uv_pipe_t event_server;
@@ -1065,6 +1071,15 @@ static void broadcast_metrics(uv_timer_t *timer) {
 
     if (active_identities)
     {
+        // hosted services live on this loop, their counters are read directly
+        tunnel_hosted_metrics hosted = {0};
+        ziti_sdk_c_get_hosted_metrics(&hosted);
+        if (hosted.services[0] != NULL) {
+            metrics_event.HostedServices = hosted.services;
+            hosted.services = NULL;
+        }
+        free_tunnel_hosted_metrics(&hosted);
+
         // do not display the metrics events in the logs as this event will get called every 5 seconds
         send_events_message(&metrics_event, (to_json_fn) tunnel_metrics_event_to_json, false);
     }
@@ -1579,6 +1594,21 @@ static int run_tunnel(uv_loop_t *ziti_loop, uint32_t tun_ip, uint32_t dns_ip, co
 
     ip_addr_t dns_ip4 = IPADDR4_INIT(dns_ip);
     ziti_dns_setup(tunneler, ipaddr_ntoa(&dns_ip4), ip_range);
+    ziti_dns_set_cache_limit(dns_cache_size);
+    if (dns_state_file) {
+        ziti_dns_set_state_file(ziti_loop, dns_state_file);
+    }
+    if (configured_ipv6_cidr && ziti_dns_set_ipv6_range(configured_ipv6_cidr) == 0) {
+#if __linux__
+        ip_addr_t tun_ip4 = IPADDR4_INIT(tun_ip);
+        const ip_addr_t *tun_ip6 = ziti_dns_ipv6_addr(&tun_ip4);
+        if (tun_ip6) {
+            tun_add_ipv6(tun->handle, ipaddr_ntoa(tun_ip6), configured_ipv6_cidr);
+        }
+#else
+        ZITI_LOG(INFO, "IPv6 range is not assigned to the tun interface on this platform, only host routes are added");
+#endif
+    }
     if (dns_upstream) {
         tunnel_upstream_dns upstream = {
                 .host = dns_upstream
@@ -1782,6 +1812,9 @@ static tunneler_context initialize_tunneler(netif_driver tun, uv_loop_t* ziti_lo
 #include <commandline.h>
 #include <getopt.h>
 
+#define to_str(x) str(x)
+#define str(x) #x
+
 #define CHECK_COMMAND_ERRORS(errors) \
     do { \
         if (errors > 0) { \
@@ -1817,6 +1850,14 @@ static struct option run_options[] = {
         { "refresh", required_argument, NULL, 'r'},
         { "dns-ip-range", required_argument, NULL, 'd'},
         { "dns-upstream", required_argument, NULL, 'u'},
+        { "dns-cache-size", required_argument, NULL, 'C'},
+        { "dns-ipv6-range", required_argument, NULL, '6'},
+        { "dns-state", required_argument, NULL, 'S'},
+        { "warm-pool", required_argument, NULL, 'W'},
+        { "lb-policy", required_argument, NULL, 'B'},
+        { "conn-limit", required_argument, NULL, 'L'},
+        { "udp-one-way", required_argument, NULL, 'U'},
+        { "tcp-bridge", required_argument, NULL, 'T'},
         { "proxy", required_argument, NULL, 'x' },
 };
 
@@ -1825,6 +1866,11 @@ static struct option run_host_options[] = {
         { "identity-dir", required_argument, NULL, 'I'},
         { "verbose", required_argument, NULL, 'v'},
         { "refresh", required_argument, NULL, 'r'},
+        { "warm-pool", required_argument, NULL, 'W'},
+        { "lb-policy", required_argument, NULL, 'B'},
+        { "conn-limit", required_argument, NULL, 'L'},
+        { "udp-one-way", required_argument, NULL, 'U'},
+        { "tcp-bridge", required_argument, NULL, 'T'},
         { "proxy", required_argument, NULL, 'x' },
 };
 
@@ -1879,12 +1925,152 @@ static int init_proxy_connector(const char *url) {
     return 0;
 }
 
+/** parse <bytes> */
+static int set_dns_cache_size_opt(const char *arg) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long size = strtoull(arg, &end, 10);
+    if (end == arg || *end != '\0' || arg[0] == '-' || errno == ERANGE || size > SIZE_MAX) {
+        fprintf(stderr, "invalid dns-cache-size '%s', expected <bytes>\n", arg);
+        return 1;
+    }
+    dns_cache_size = (size_t) size;
+    return 0;
+}
+
+/** parse <service>:<count> */
+static int set_warm_pool_opt(const char *arg) {
+    const char *sep = strrchr(arg, ':');
+    char *end = NULL;
+    long size = sep ? strtol(sep + 1, &end, 10) : -1;
+    if (sep == NULL || sep == arg || end == sep + 1 || *end != '\0' || size < 0) {
+        fprintf(stderr, "invalid warm-pool '%s', expected <service>:<count>\n", arg);
+        return 1;
+    }
+    char service[256];
+    snprintf(service, sizeof(service), "%.*s", (int) (sep - arg), arg);
+    ziti_sdk_c_set_warm_pool(service, (int) size);
+    return 0;
+}
+
+/** parse <service>:<policy> */
+static int set_lb_policy_opt(const char *arg) {
+    const char *sep = strrchr(arg, ':');
+    char service[256];
+    if (sep == NULL || sep == arg) {
+        fprintf(stderr, "invalid lb-policy '%s', expected <service>:<policy>\n", arg);
+        return 1;
+    }
+    snprintf(service, sizeof(service), "%.*s", (int) (sep - arg), arg);
+    if (ziti_sdk_c_set_lb_policy(service, sep + 1) != 0) {
+        fprintf(stderr, "invalid lb-policy '%s', expected round-robin or least-conn\n", sep + 1);
+        return 1;
+    }
+    return 0;
+}
+
+/** parse <service>:<sockets> */
+static int set_udp_one_way_opt(const char *arg) {
+    const char *sep = strrchr(arg, ':');
+    char *end = NULL;
+    long sockets = sep ? strtol(sep + 1, &end, 10) : -1;
+    if (sep == NULL || sep == arg || end == sep + 1 || *end != '\0' || sockets < 0) {
+        fprintf(stderr, "invalid udp-one-way '%s', expected <service>:<sockets>\n", arg);
+        return 1;
+    }
+    char service[256];
+    snprintf(service, sizeof(service), "%.*s", (int) (sep - arg), arg);
+    ziti_sdk_c_set_udp_one_way(service, (int) sockets);
+    return 0;
+}
+
+struct int_setting_s {
+    const char *name;
+    size_t offset;
+};
+
+/** parse <name>=N[,<name>=N...] into the int fields of `settings`. returns the part that is not valid, or NULL */
+static const char *parse_int_settings(const char *p, const struct int_setting_s *names, size_t n_names,
+                                      void *settings) {
+    while (*p != '\0') {
+        const char *eq = strchr(p, '=');
+        size_t name_len = eq ? (size_t) (eq - p) : 0;
+        int *field = NULL;
+        for (size_t i = 0; eq != NULL && i < n_names; i++) {
+            if (strlen(names[i].name) == name_len && strncmp(names[i].name, p, name_len) == 0) {
+                field = (int *) ((char *) settings + names[i].offset);
+            }
+        }
+        char *end = NULL;
+        long val = field ? strtol(eq + 1, &end, 10) : -1;
+        if (field == NULL || end == eq + 1 || (*end != ',' && *end != '\0') || val < 0 || val > INT_MAX) {
+            return p;
+        }
+        *field = (int) val;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return NULL;
+}
+
+/** parse <service>:<limit>=N[,<limit>=N...] */
+static int set_conn_limit_opt(const char *arg) {
+    static const struct int_setting_s limit_names[] = {
+            { "conns", offsetof(hosted_service_limits, max_conns) },
+            { "pending", offsetof(hosted_service_limits, max_pending) },
+            { "rate", offsetof(hosted_service_limits, rate) },
+            { "burst", offsetof(hosted_service_limits, burst) },
+            { "queue", offsetof(hosted_service_limits, queue_size) },
+            { "queue-timeout", offsetof(hosted_service_limits, queue_timeout) },
+    };
+
+    const char *sep = strrchr(arg, ':');
+    if (sep == NULL || sep == arg || sep[1] == '\0') {
+        fprintf(stderr, "invalid conn-limit '%s', expected <service>:<limit>=N[,<limit>=N...]\n", arg);
+        return 1;
+    }
+
+    hosted_service_limits limits = {0};
+    const char *bad = parse_int_settings(sep + 1, limit_names, sizeof(limit_names) / sizeof(limit_names[0]), &limits);
+    if (bad != NULL) {
+        fprintf(stderr, "invalid conn-limit '%s', expected conns, pending, rate, burst, queue or queue-timeout"
+                        " with a count\n", bad);
+        return 1;
+    }
+
+    char service[256];
+    snprintf(service, sizeof(service), "%.*s", (int) (sep - arg), arg);
+    ziti_sdk_c_set_service_limits(service, &limits);
+    return 0;
+}
+
+/** parse <service>[:<setting>=N[,<setting>=N...]] */
+static int set_tcp_bridge_opt(const char *arg) {
+    static const struct int_setting_s setting_names[] = {
+            { "read", offsetof(hosted_tcp_bridge_opts, read_size) },
+            { "queue", offsetof(hosted_tcp_bridge_opts, max_queued) },
+    };
+
+    const char *sep = strrchr(arg, ':');
+    size_t service_len = sep ? (size_t) (sep - arg) : strlen(arg);
+    hosted_tcp_bridge_opts opts = {0};
+    const char *bad = sep ? parse_int_settings(sep + 1, setting_names, 2, &opts) : NULL;
+    if (service_len == 0 || bad != NULL) {
+        fprintf(stderr, "invalid tcp-bridge '%s', expected <service>[:read=<bytes>,queue=<bytes>]\n", arg);
+        return 1;
+    }
+
+    char service[256];
+    snprintf(service, sizeof(service), "%.*s", (int) service_len, arg);
+    ziti_sdk_c_set_tcp_bridge(service, &opts);
+    return 0;
+}
+
 static int run_opts(int argc, char *argv[]) {
     int c, option_index, errors = 0;
     optind = 0;
     bool identity_provided = false;
 
-    while ((c = getopt_long(argc, argv, "i:I:v:r:d:u:x:",
+    while ((c = getopt_long(argc, argv, "i:I:v:r:d:u:C:6:S:W:B:L:U:T:x:",
                             run_options, &option_index)) != -1) {
         switch (c) {
             case 'i': {
@@ -1912,6 +2098,30 @@ static int run_opts(int argc, char *argv[]) {
             case 'u':
                 dns_upstream = optarg;
                 break;
+            case 'C':
+                errors += set_dns_cache_size_opt(optarg);
+                break;
+            case '6':
+                configured_ipv6_cidr = optarg;
+                break;
+            case 'S':
+                dns_state_file = optarg;
+                break;
+            case 'W':
+                errors += set_warm_pool_opt(optarg);
+                break;
+            case 'B':
+                errors += set_lb_policy_opt(optarg);
+                break;
+            case 'L':
+                errors += set_conn_limit_opt(optarg);
+                break;
+            case 'U':
+                errors += set_udp_one_way_opt(optarg);
+                break;
+            case 'T':
+                errors += set_tcp_bridge_opt(optarg);
+                break;
             case 'x':
                 configured_proxy = optarg;
                 break;
@@ -1936,7 +2146,7 @@ static int run_host_opts(int argc, char *argv[]) {
     optind = 0;
     bool identity_provided = false;
 
-    while ((c = getopt_long(argc, argv, "i:I:v:r:x:",
+    while ((c = getopt_long(argc, argv, "i:I:v:r:W:B:L:U:T:x:",
                             run_host_options, &option_index)) != -1) {
         switch (c) {
             case 'i': {
@@ -1958,6 +2168,21 @@ static int run_host_opts(int argc, char *argv[]) {
                 ziti_set_refresh_interval(interval);
                 break;
             }
+            case 'W':
+                errors += set_warm_pool_opt(optarg);
+                break;
+            case 'B':
+                errors += set_lb_policy_opt(optarg);
+                break;
+            case 'L':
+                errors += set_conn_limit_opt(optarg);
+                break;
+            case 'U':
+                errors += set_udp_one_way_opt(optarg);
+                break;
+            case 'T':
+                errors += set_tcp_bridge_opt(optarg);
+                break;
             case 'x':
                 configured_proxy = optarg;
                 break;
@@ -2999,6 +3224,22 @@ static int get_status_opts(int argc, char *argv[]) {
     return optind;
 }
 
+static int get_hosted_backends_opts(int argc, char *argv[]) {
+    optind = 0;
+
+    cmd.command = TunnelCommand_GetHostedBackends;
+
+    return optind;
+}
+
+static int get_hosted_metrics_opts(int argc, char *argv[]) {
+    optind = 0;
+
+    cmd.command = TunnelCommand_GetHostedMetrics;
+
+    return optind;
+}
+
 static int delete_identity_opts(int argc, char *argv[]) {
     tunnel_identity_id id = {
             .identifier = get_identity_opt(argc, argv),
@@ -3063,6 +3304,25 @@ static CommandLine enroll_cmd = make_command("enroll", "enroll Ziti identity",
         "\t-c|--cert\tcertificate for enrollment\n"
         "\t-n|--name\tidentity name\n",
         parse_enroll_opts, enroll);
+
+// options of hosted services, shared by run and run-host
+#define HOSTING_OPTS_HELP \
+        "\t-W|--warm-pool <service>:<count>\tkeep <count> connections to the server of" \
+        " hosted tcp <service> established ahead of clients (may be repeated)\n" \
+        "\t-B|--lb-policy <service>:<policy>\tspread connections of hosted <service> over" \
+        " the addresses of its server with round-robin (default) or least-conn (may be repeated)\n" \
+        "\t-L|--conn-limit <service>:<limit>=N[,...]\tlimit the clients of hosted" \
+        " <service>: conns (connected or connecting at once), pending (connecting at" \
+        " once), rate (new per second), burst, queue (clients waiting for a slot," \
+        " 0 rejects right away) and queue-timeout (ms, default 2000) (may be repeated)\n" \
+        "\t-U|--udp-one-way <service>:<sockets>\thosted udp <service> never replies:" \
+        " relay its clients through <sockets> sockets per server address and drop" \
+        " anything the server sends back (may be repeated)\n" \
+        "\t-T|--tcp-bridge <service>[:read=<bytes>,queue=<bytes>]\tmove the data of" \
+        " hosted tcp <service> with the tunneler's bridge, reading up to <bytes> from" \
+        " the server at once (default 16384) and holding back a side when <bytes> are" \
+        " queued toward the other (default 262144) (may be repeated)\n"
+
 static CommandLine run_cmd = make_command("run", "run Ziti tunnel (required superuser access)",
                                           "-i <id.file> [-r N] [-v N] [-d|--dns-ip-range N.N.N.N/n]",
                                           "\t-i|--identity <identity>\trun with provided identity file (required)\n"
@@ -3072,16 +3332,26 @@ static CommandLine run_cmd = make_command("run", "run Ziti tunnel (required supe
                                           "\t-v|--verbose N\tset log level, higher level -- more verbose (default 3)\n"
                                           "\t-r|--refresh N\tset service polling interval in seconds (default 10)\n"
                                           "\t-d|--dns-ip-range <ip range>\tspecify CIDR block in which service DNS names"
-                                          " are assigned in N.N.N.N/n format (default " DEFAULT_DNS_CIDR ")\n",
+                                          " are assigned in N.N.N.N/n format (default " DEFAULT_DNS_CIDR ")\n"
+                                          "\t-C|--dns-cache-size <bytes>\tmemory limit for caching upstream and proxied DNS responses,"
+                                          " 0 disables caching (default " to_str(ZITI_DNS_DEFAULT_CACHE_LIMIT) ")\n"
+                                          "\t-6|--dns-ipv6-range <ipv6 range>\talso assign IPv6 addresses (AAAA records) to"
+                                          " service DNS names from CIDR block in x:x::/n format, n <= 96 (e.g. fd00:5a17::/96)\n"
+                                          "\t-S|--dns-state <file>\tkeep service DNS name to IP mappings in <file> so names"
+                                          " resolve to the same IPs after restart\n"
+                                          HOSTING_OPTS_HELP,
         run_opts, run);
 static CommandLine run_host_cmd = make_command("run-host", "run Ziti tunnel to host services",
-                                          "-i <id.file> [-r N] [-v N]",
+                                          "-i <id.file> [-r N] [-v N] [-W <service>:<count>] [-B <service>:<policy>]"
+                                          " [-L <service>:<limit>=N[,...]] [-U <service>:<sockets>]"
+                                          " [-T <service>[:read=<bytes>,queue=<bytes>]]",
                                           "\t-i|--identity <identity>\trun with provided identity file (required)\n"
                                           "\t-I|--identity-dir <dir>\tload identities from provided directory\n"
                                           "\t-x|--proxy type://[username[:password]@]hostname_or_ip:port\tproxy to use when"
                                           " connecting to OpenZiti controller and edge routers"
                                           "\t-v|--verbose N\tset log level, higher level -- more verbose (default 3)\n"
-                                          "\t-r|--refresh N\tset service polling interval in seconds (default 10)\n",
+                                          "\t-r|--refresh N\tset service polling interval in seconds (default 10)\n"
+                                          HOSTING_OPTS_HELP,
                                           run_host_opts, run);
 static CommandLine dump_cmd = make_command("dump", "dump the identities information", "[-i <identity>] [-p <dir>]",
                                            "\t-i|--identity\tdump identity info\n"
@@ -3111,6 +3381,10 @@ static CommandLine get_mfa_codes_cmd = make_command("get_mfa_codes", "Get MFA co
                                                          "\t-i|--identity\tidentity info for fetching mfa codes\n"
                                                          "\t-c|--authcode\tauth code to authenticate the request for fetching mfa codes\n", get_mfa_codes_opts, send_message_to_tunnel_fn);
 static CommandLine get_status_cmd = make_command("tunnel_status", "Get Tunnel Status", "", "", get_status_opts, send_message_to_tunnel_fn);
+static CommandLine hosted_backends_cmd = make_command("hosted_backends", "Get connection counts of hosted service server addresses",
+                                                     "", "", get_hosted_backends_opts, send_message_to_tunnel_fn);
+static CommandLine hosted_metrics_cmd = make_command("hosted_metrics", "Get traffic counters and latencies of hosted services",
+                                                    "", "", get_hosted_metrics_opts, send_message_to_tunnel_fn);
 static CommandLine delete_id_cmd = make_command("delete", "delete the identities information", "[-i <identity>]",
                                                  "\t-i|--identity\tidentity info that needs to be deleted\n", delete_identity_opts, send_message_to_tunnel_fn);
 static CommandLine add_id_cmd = make_command("add", "enroll and load the identity", "-j <jwt_content> -i <identity_name>",
@@ -3157,6 +3431,8 @@ static CommandLine *main_cmds[] = {
         &get_mfa_codes_cmd,
         &ext_auth_login,
         &get_status_cmd,
+        &hosted_backends_cmd,
+        &hosted_metrics_cmd,
         &delete_id_cmd,
         &add_id_cmd,
         &set_log_level_cmd,